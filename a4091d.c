@@ -42,6 +42,9 @@ typedef struct device *device_t;
 #include "siopvar.h"
 #include "attach.h"
 #include "ndkcompat.h"
+#include "ramlog.h"
+#include "iotrace.h"
+#include "bootlog.h"
 
 #define ADDR8(x)      (volatile uint8_t *)(x)
 #define ADDR32(x)     (volatile uint32_t *)(x)
@@ -87,6 +90,9 @@ usage(void)
            "It does not work on any other driver.\n"
            "Usage:  a4091d [<unit>]\n"
            "        a4091d -c   -- show 68040 special registers\n"
+           "        a4091d -l <unit> -- show the driver RAM log\n"
+           "        a4091d -t <file> <unit> -- capture an I/O trace to file\n"
+           "        a4091d --boot <unit> -- show the boot timeline\n"
            "        a4091d -p <periph address>\n"
            "        a4091d -x <xs address>\n");
 }
@@ -1680,6 +1686,337 @@ show_periph(struct scsipi_periph *periph)
     Permit();
 }
 
+/*
+ * Format one RAM log record the way the driver's printf() would have.
+ * Each conversion is handed to printf() separately, with the argument
+ * taken from the record.
+ */
+static void
+ramlog_print_record(const uint32_t *rec)
+{
+    const char     *fmt   = (const char *) rec[1];
+    uint32_t        nargs = RAMLOG_REC_NARGS(rec[0]);
+    const uint32_t *arg   = &rec[2];
+    const char     *strs  = (const char *) &rec[2 + nargs];
+    uint32_t        used  = 0;
+    char            spec[32];
+    size_t          len;
+    int             llong;
+    int             ch;
+
+    for (;;) {
+        while ((ch = *fmt++) != '%') {
+            if (ch == '\0')
+                return;
+            putchar(ch);
+        }
+        spec[0] = '%';
+        len = 1;
+        llong = 0;
+        for (;;) {
+            ch = *fmt++;
+            if (len >= sizeof (spec) - 16)
+                return;     /* Not a sensible format */
+            if (ch == '*' || (ch == '.' && *fmt == '*')) {
+                if (ch == '.') {
+                    fmt++;
+                    spec[len++] = '.';
+                }
+                if (used >= nargs)
+                    return;
+                len += sprintf(spec + len, "%d", (int) arg[used++]);
+                continue;
+            }
+            if (ch == 'l' && *fmt == 'l') {
+                fmt++;
+                llong = 1;
+                spec[len++] = 'l';
+                spec[len++] = 'l';
+                continue;
+            }
+            if (ch == 't' || ch == 'z')
+                ch = 'l';   /* Both are 32 bits */
+            if (ch == '#' || ch == ' ' || ch == '-' || ch == '+' ||
+                ch == '.' || ch == 'l' || ((unsigned)ch - '0' <= 9)) {
+                spec[len++] = ch;
+                continue;
+            }
+            break;
+        }
+        spec[len++] = ch;
+        spec[len] = '\0';
+        switch (ch) {
+            case '\0':
+                return;
+            case 'c':
+            case 'd':
+            case 'o':
+            case 'u':
+            case 'p':
+            case 'X':
+            case 'x':
+                if (used + llong >= nargs)
+                    return;
+                if (llong) {
+                    printf(spec, ((uint64_t) arg[used] << 32) | arg[used + 1]);
+                    used += 2;
+                } else if (ch == 'p') {
+                    printf(spec, (void *) arg[used++]);
+                } else {
+                    printf(spec, arg[used++]);
+                }
+                break;
+            case 's':
+                if (used >= nargs)
+                    return;
+                if (arg[used] == RAMLOG_NULLSTR)
+                    printf(spec, "(null)");
+                else
+                    printf(spec, strs + arg[used]);
+                used++;
+                break;
+            default:
+                putchar(ch);
+                break;
+        }
+    }
+}
+
+/*
+ * Print the records in ring[start..end). Where the first record boundary
+ * is not known (the part of the ring left over from the previous pass),
+ * skip ahead to the next word which looks like a record tag.
+ */
+static void
+ramlog_print_range(const uint32_t *ring, uint32_t start, uint32_t end,
+                   int resync)
+{
+    uint32_t pos = start;
+    uint32_t w;
+    uint32_t len;
+
+    while (pos < end) {
+        w = ring[pos];
+        len = RAMLOG_REC_LEN(w);
+        if ((w & RAMLOG_TAGMASK) != RAMLOG_TAG || len == 0 ||
+            pos + len > end ||
+            (len >= 2 && ring[pos + 1] != 0 &&
+             len < 2 + RAMLOG_REC_NARGS(w))) {
+            if (!resync)
+                break;      /* Record still being written */
+            pos++;
+            continue;
+        }
+        if (len >= 2 && ring[pos + 1] != 0)
+            ramlog_print_record(&ring[pos]);
+        pos += len;
+        if (is_user_abort())
+            break;
+    }
+}
+
+static void
+show_ramlog(struct ramlog *rl)
+{
+    uint32_t *ring;
+    uint32_t  head;
+    uint32_t  pos;
+
+    if (rl == NULL) {
+        printf("Driver was not built with DEBUG_RAMLOG\n");
+        return;
+    }
+    if (rl->rl_magic != RAMLOG_MAGIC) {
+        printf("RAM log is empty\n");
+        return;
+    }
+    if (rl->rl_words != RAMLOG_WORDS) {
+        printf("RAM log size %u does not match this tool (%u)\n",
+               (uint) rl->rl_words, RAMLOG_WORDS);
+        return;
+    }
+    ring = AllocMem(sizeof (rl->rl_ring), MEMF_PUBLIC);
+    if (ring == NULL) {
+        printf("No memory for RAM log copy\n");
+        return;
+    }
+
+    Forbid();
+    head = rl->rl_head;
+    CopyMem(rl->rl_ring, ring, sizeof (rl->rl_ring));
+    Permit();
+
+    pos = head & (RAMLOG_WORDS - 1);
+    if (head >= RAMLOG_WORDS)
+        ramlog_print_range(ring, pos, RAMLOG_WORDS, 1);
+    ramlog_print_range(ring, 0, pos, 0);
+
+    FreeMem(ring, sizeof (rl->rl_ring));
+}
+
+static uint32_t
+boot_ms(const struct bootlog *bl, uint32_t ticks)
+{
+    return (ticks / (bl->bl_freq / 1000));
+}
+
+/*
+ * Print the boot milestones in ms from the earliest one, followed by
+ * what each target cost during the boot.
+ */
+static void
+show_bootlog(struct bootlog *bl)
+{
+    static const char * const names[BL_COUNT] = {
+        "Relocation start", "Relocation done", "Romtag init",
+        "Handler started", "NVRAM load", "NVRAM done", "Channel ready",
+        "Mount start", "Mount done", "Boot menu", "Boot menu done",
+    };
+    struct bootlog snap;
+    uint32_t first = 0;
+    uint32_t prev;
+    uint32_t ticks;
+    int      have_first = 0;
+    uint     id;
+    uint     t;
+
+    if (bl == NULL) {
+        printf("Driver was not built with ENABLE_BOOTLOG\n");
+        return;
+    }
+    if (bl->bl_magic != BOOTLOG_MAGIC) {
+        printf("No boot timeline (driver was not started from ROM)\n");
+        return;
+    }
+    if (bl->bl_freq < 1000) {
+        printf("Boot timeline has no E-clock frequency\n");
+        return;
+    }
+
+    Forbid();
+    CopyMem(bl, &snap, sizeof (snap));
+    Permit();
+
+    for (id = 0; id < BL_COUNT; id++) {
+        if ((snap.bl_seen & BIT(id)) == 0)
+            continue;
+        if (!have_first || (int32_t) (snap.bl_stamp[id] - first) < 0)
+            first = snap.bl_stamp[id];
+        have_first = 1;
+    }
+    for (t = 0; t < BOOTLOG_TARGETS; t++) {
+        if (snap.bl_target[t].bt_probes != 0 &&
+            (int32_t) (snap.bl_target[t].bt_probe - first) < 0)
+            first = snap.bl_target[t].bt_probe;
+    }
+
+    printf("Milestone              ms   +ms\n");
+    prev = first;
+    for (id = 0; id < BL_COUNT; id++) {
+        if ((snap.bl_seen & BIT(id)) == 0)
+            continue;
+        printf("%-18s %6u %5u\n", names[id],
+               (uint) boot_ms(&snap, snap.bl_stamp[id] - first),
+               (uint) boot_ms(&snap, snap.bl_stamp[id] - prev));
+        prev = snap.bl_stamp[id];
+    }
+    if (snap.bl_open)
+        printf("(still recording)\n");
+
+    printf("\nTarget  Start  Probe  LUNs  Spin-up\n");
+    for (t = 0; t < BOOTLOG_TARGETS; t++) {
+        struct bootlog_target *bt = &snap.bl_target[t];
+
+        if (bt->bt_probes == 0 && bt->bt_spin == 0)
+            continue;
+        printf("%6u %6u %6u %5u  ", t,
+               (uint) boot_ms(&snap, bt->bt_probe - first),
+               (uint) boot_ms(&snap, bt->bt_probe_ticks),
+               bt->bt_attached);
+        if (bt->bt_spin == 0) {
+            printf("-\n");
+        } else if (bt->bt_ready == 0) {
+            printf("not ready\n");
+        } else {
+            ticks = bt->bt_ready - bt->bt_spin;
+            printf("%u ms\n", (uint) boot_ms(&snap, ticks));
+        }
+    }
+}
+
+/*
+ * Copy I/O trace records from the driver's ring to a file until ^C.
+ * The file should be on RAM: or on another controller, so writing it
+ * does not add to the trace.
+ */
+static void
+capture_iotrace(struct iotrace *it, const char *filename)
+{
+    struct iotrace_file hdr;
+    struct iotrace_rec  rec;
+    FILE               *fp;
+    uint32_t            tail;
+    uint32_t            head;
+    uint32_t            now;
+    uint32_t            last = 0;
+
+    if (it == NULL) {
+        printf("Driver was not built with ENABLE_IOTRACE\n");
+        return;
+    }
+    if (it->it_magic != IOTRACE_MAGIC) {
+        printf("Driver I/O trace ring is not valid\n");
+        return;
+    }
+    fp = fopen(filename, "wb");
+    if (fp == NULL) {
+        printf("Failed to open %s\n", filename);
+        return;
+    }
+
+    memset(&hdr, 0, sizeof (hdr));
+    hdr.itf_magic   = IOTRACE_MAGIC;
+    hdr.itf_version = IOTRACE_VERSION;
+    hdr.itf_recsize = sizeof (rec);
+    hdr.itf_freq    = it->it_freq;
+    fwrite(&hdr, sizeof (hdr), 1, fp);  /* Rewritten with counts at end */
+
+    printf("Capturing I/O to %s; press ^C to stop\n", filename);
+    tail = it->it_head;
+    it->it_active = 1;
+    while (!is_user_abort()) {
+        head = it->it_head;
+        if (head - tail > IOTRACE_RECS) {
+            hdr.itf_lost += head - tail - IOTRACE_RECS;
+            tail = head - IOTRACE_RECS;
+        }
+        for (; tail != head; tail++) {
+            rec = it->it_ring[tail & (IOTRACE_RECS - 1)];
+            if (it->it_head - tail > IOTRACE_RECS) {
+                hdr.itf_lost++;     /* Overwritten while being copied */
+                continue;
+            }
+            now = rec.it_time;
+            rec.it_time = (hdr.itf_count == 0) ? 0 : now - last;
+            last = now;
+            if (fwrite(&rec, sizeof (rec), 1, fp) != 1) {
+                printf("Write to %s failed\n", filename);
+                goto stop;
+            }
+            hdr.itf_count++;
+        }
+        Delay(1);
+    }
+stop:
+    it->it_active = 0;
+
+    fseek(fp, 0, SEEK_SET);
+    fwrite(&hdr, sizeof (hdr), 1, fp);
+    fclose(fp);
+    printf("%u records captured, %u lost\n",
+           (uint) hdr.itf_count, (uint) hdr.itf_lost);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -1688,6 +2025,9 @@ main(int argc, char *argv[])
     unsigned int pos = 0;
     int rc = 0;
     int open_and_wait = 0;
+    int show_log = 0;
+    int show_boot = 0;
+    char *trace_file = NULL;
     struct IOExtTD     *tio;
     struct MsgPort     *mp;
     struct IOStdReq    *ior;
@@ -1696,7 +2036,9 @@ main(int argc, char *argv[])
     char   *devname = DEVICE_NAME;
 
     for (arg = 1; arg < argc; arg++) {
-        if (*argv[arg] == '-') {
+        if (strcmp(argv[arg], "--boot") == 0) {
+            show_boot++;
+        } else if (*argv[arg] == '-') {
             char *ptr = argv[arg];
             while (*(++ptr) != '\0') {
                 switch (*ptr) {
@@ -1728,6 +2070,16 @@ main(int argc, char *argv[])
                         }
                         print_xs(xs, 1);
                         exit(0);
+                    case 'l':
+                        show_log++;
+                        break;
+                    case 't':
+                        if (++arg >= argc) {
+                            printf("-%c requires an argument\n", *ptr);
+                            exit(1);
+                        }
+                        trace_file = argv[arg];
+                        break;
                     case 'w':
                         open_and_wait++;
                         break;
@@ -1789,6 +2141,19 @@ main(int argc, char *argv[])
     }
 
     ior = &tio->iotd_Req;
+    if (show_log || show_boot || (trace_file != NULL)) {
+        periph = (void *) ior->io_Unit;
+        asave = periph->periph_channel->chan_adapter->adapt_asave;
+        if (show_log)
+            show_ramlog((asave != NULL) ? asave->as_ramlog : NULL);
+        if (show_boot)
+            show_bootlog((asave != NULL) ? asave->as_bootlog : NULL);
+        if (trace_file != NULL)
+            capture_iotrace((asave != NULL) ? asave->as_iotrace : NULL,
+                            trace_file);
+        goto done;
+    }
+
     struct MsgPort *rp = ior->io_Message.mn_ReplyPort;
     struct Library *dp = &ior->io_Device->dd_Library;
     printf("IORequest\n");
@@ -1952,6 +2317,8 @@ main(int argc, char *argv[])
         show_interrupt(4, asave->as_isr);
         printf("  as_exiting=%x\n", asave->as_exiting);
         printf("  as_device_private=%p\n", asave->as_device_private);
+        printf("  as_ramlog=%p\n", asave->as_ramlog);
+        printf("  as_iotrace=%p\n", asave->as_iotrace);
         struct siop_softc *sc = asave->as_device_private;
 //      printf("    sc_siop_si=%p\n", sc->sc_siop_si);
 #if defined(ARCH_710)
@@ -2016,6 +2383,15 @@ main(int argc, char *argv[])
 #endif
         printf("    sc_nosync=%x sc_nodisconnect=%x\n",
                sc->sc_nosync, sc->sc_nodisconnect);
+        printf("    sc_dmode=%02x (burst %u%s)", sc->sc_dmode,
+               SIOP_BURST_LEN(sc->sc_dmode >> 6),
+               (asave->dma_burst != 0) ? ", calibrated" : "");
+        for (pos = 0; pos < ARRAY_SIZE(sc->sc_burst_kbs); pos++) {
+            if (sc->sc_burst_kbs[pos] != 0)
+                printf(" %u=%luKB/s", SIOP_BURST_LEN(pos),
+                       sc->sc_burst_kbs[pos]);
+        }
+        printf("\n");
         for (pos = 0; pos < ARRAY_SIZE(sc->sc_sync); pos++) {
 #if defined(ARCH_710)
             printf("    sc_sync[%d] state=%u sxfer=%u sbcl=%u\n",
@@ -2043,6 +2419,7 @@ main(int argc, char *argv[])
         }
     }
 
+done:
     CloseDevice((struct IORequest *) tio);
 
 open_fail:
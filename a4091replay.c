@@ -0,0 +1,460 @@
+//
+// Copyright 2026 Stefan Reinauer
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+
+/*
+ * a4091replay
+ * -----------
+ * Plays back an I/O trace captured with "a4091d -t" against a unit and
+ * reports throughput and latency percentiles. Requests are issued at
+ * their recorded inter-arrival times (or back to back with -f), with up
+ * to -q requests outstanding. Writes are replayed as reads unless -w is
+ * given. The loopback unit (ENABLE_LOOPBACK) is a good target for
+ * measuring the driver alone.
+ */
+const char *version = "\0$VER: a4091replay 1.0 ("AMIGA_DATE") \xa9 Stefan Reinauer";
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/param.h>
+#include <exec/types.h>
+#include <exec/io.h>
+#include <exec/memory.h>
+#include <devices/trackdisk.h>
+#include <devices/timer.h>
+#include <clib/exec_protos.h>
+#include <clib/alib_protos.h>
+#include <clib/timer_protos.h>
+#include <proto/exec.h>
+#include <proto/dos.h>
+#include <inline/timer.h>
+
+#include "nsd.h"
+#include "cmdhandler.h"
+#include "iotrace.h"
+
+#define ARRAY_SIZE(x) ((sizeof (x) / sizeof ((x)[0])))
+#define BIT(x)        (1 << (x))
+
+#define STR(s) #s
+#define XSTR(s) STR(s)
+#define DEVICE_NAME XSTR(DEVNAME) ".device"
+
+#define REPLAY_MAX_QUEUE  32
+#define REPLAY_MAX_UNITS  16
+
+extern BOOL __check_abort_enabled;  // 0 = Disable gcc clib2 ^C break handling
+
+struct Device *TimerBase;
+
+typedef struct {
+    struct IOExtTD *io;
+    uint64_t        start;          /* E-clock when sent */
+    uint32_t        index;          /* Record being replayed */
+    uint8_t         busy;
+} slot_t;
+
+typedef struct {
+    uint8_t         target;
+    uint8_t         lun;
+    struct IOExtTD *io;             /* Opened request, cloned into slots */
+} unit_t;
+
+static slot_t   slots[REPLAY_MAX_QUEUE];
+static unit_t   units[REPLAY_MAX_UNITS];
+static uint     nunits;
+static uint32_t *latency;           /* E-clock ticks, per record */
+static uint     nerrors;
+
+static void
+usage(void)
+{
+    printf("Usage:  a4091replay [options] <trace file>\n"
+           "        -d <device>  device to replay to (default "
+                                 DEVICE_NAME ")\n"
+           "        -u <unit>    send every request to this unit\n"
+           "        -q <depth>   requests outstanding (default 4, max %d)\n"
+           "        -f           ignore recorded times, replay back to back\n"
+           "        -w           really write (default: writes become reads)\n",
+           REPLAY_MAX_QUEUE);
+}
+
+static uint64_t
+eclock_now(void)
+{
+    struct EClockVal ev;
+
+    ReadEClock(&ev);
+    return (((uint64_t) ev.ev_hi << 32) | ev.ev_lo);
+}
+
+/* Returns 1 for reads, 2 for writes and 0 for anything without data */
+static int
+data_direction(uint cmd)
+{
+    switch (cmd) {
+        case CMD_READ:
+        case ETD_READ:
+        case TD_READ64:
+        case NSCMD_TD_READ64:
+        case NSCMD_ETD_READ64:
+        case NSCMD_TD_READV64:
+            return (1);
+        case CMD_WRITE:
+        case ETD_WRITE:
+        case TD_FORMAT:
+        case ETD_FORMAT:
+        case TD_WRITE64:
+        case TD_FORMAT64:
+        case NSCMD_TD_WRITE64:
+        case NSCMD_TD_FORMAT64:
+        case NSCMD_ETD_WRITE64:
+        case NSCMD_ETD_FORMAT64:
+        case NSCMD_TD_WRITEV64:
+            return (2);
+        default:
+            return (0);
+    }
+}
+
+static unit_t *
+get_unit(const char *devname, int fixed_unit, const struct iotrace_rec *rec,
+         struct MsgPort *mp)
+{
+    unit_t *u;
+    uint    i;
+    ULONG   unitno;
+
+    for (i = 0; i < nunits; i++) {
+        u = &units[i];
+        if (fixed_unit >= 0 ||
+            (u->target == rec->it_target && u->lun == rec->it_lun))
+            return (u);
+    }
+    if (nunits >= ARRAY_SIZE(units))
+        return (NULL);
+
+    u = &units[nunits];
+    unitno = (fixed_unit >= 0) ? (ULONG) fixed_unit :
+             (ULONG) rec->it_target + rec->it_lun * 10;
+    u->io = (struct IOExtTD *) CreateExtIO(mp, sizeof (struct IOExtTD));
+    if (u->io == NULL)
+        return (NULL);
+    if (OpenDevice(devname, unitno, (struct IORequest *) u->io, 0)) {
+        printf("Open %s unit %lu failed\n", devname, unitno);
+        DeleteExtIO((struct IORequest *) u->io);
+        return (NULL);
+    }
+    u->target = rec->it_target;
+    u->lun    = rec->it_lun;
+    nunits++;
+    return (u);
+}
+
+static void
+reap(slot_t *s)
+{
+    if (s->io->iotd_Req.io_Error != 0)
+        nerrors++;
+    latency[s->index] = eclock_now() - s->start;
+    s->busy = 0;
+}
+
+/* Account for a replied request and return its slot */
+static slot_t *
+reap_msg(struct IORequest *ior)
+{
+    uint i;
+
+    for (i = 0; i < ARRAY_SIZE(slots); i++) {
+        if (slots[i].busy && (struct IORequest *) slots[i].io == ior) {
+            reap(&slots[i]);
+            return (&slots[i]);
+        }
+    }
+    return (NULL);
+}
+
+/* Wait for one request to finish and return its slot */
+static slot_t *
+wait_slot(struct MsgPort *mp)
+{
+    WaitPort(mp);
+    return (reap_msg((struct IORequest *) GetMsg(mp)));
+}
+
+/* Wait until the E-clock reaches due, completing requests meanwhile */
+static void
+wait_until(uint64_t due, struct timerequest *tr, struct MsgPort *mp)
+{
+    ULONG tmask = BIT(tr->tr_node.io_Message.mn_ReplyPort->mp_SigBit);
+    ULONG mmask = BIT(mp->mp_SigBit);
+    struct IORequest *ior;
+
+    if (eclock_now() >= due)
+        return;
+
+    tr->tr_node.io_Command = TR_ADDREQUEST;
+    tr->tr_time.tv_secs  = due >> 32;   /* ev_hi */
+    tr->tr_time.tv_micro = (ULONG) due; /* ev_lo */
+    SendIO(&tr->tr_node);
+    for (;;) {
+        while ((ior = (struct IORequest *) GetMsg(mp)) != NULL)
+            (void) reap_msg(ior);
+        if (CheckIO(&tr->tr_node))
+            break;
+        Wait(tmask | mmask);
+    }
+    WaitIO(&tr->tr_node);
+}
+
+static int
+cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *) a;
+    uint32_t y = *(const uint32_t *) b;
+    return ((x > y) - (x < y));
+}
+
+static uint32_t
+ticks_to_usec(uint64_t ticks, uint32_t freq)
+{
+    return ((uint32_t) (ticks * 1000000 / freq));
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char         *devname = DEVICE_NAME;
+    const char         *filename = NULL;
+    int                 fixed_unit = -1;
+    uint                depth = 4;
+    int                 fast = 0;
+    int                 writes = 0;
+    int                 arg;
+    int                 rc = 1;
+    FILE               *fp;
+    struct iotrace_file hdr;
+    struct iotrace_rec *recs = NULL;
+    struct MsgPort     *mp = NULL;
+    struct MsgPort     *tp = NULL;
+    struct timerequest *tr = NULL;
+    void               *buf = NULL;
+    ULONG               buflen = 0;
+    uint32_t            freq;
+    uint32_t            i;
+    uint32_t            nlat = 0;
+    uint64_t            start;
+    uint64_t            due;
+    uint64_t            elapsed;
+    uint64_t            bytes = 0;
+    uint64_t            ticks;
+    uint                skipped = 0;
+
+    for (arg = 1; arg < argc; arg++) {
+        if (*argv[arg] == '-') {
+            char opt = argv[arg][1];
+            if (opt == 'f') {
+                fast = 1;
+            } else if (opt == 'w') {
+                writes = 1;
+            } else if ((opt == 'd' || opt == 'u' || opt == 'q') &&
+                       (arg + 1 < argc)) {
+                arg++;
+                if (opt == 'd')
+                    devname = argv[arg];
+                else if (opt == 'u')
+                    fixed_unit = atoi(argv[arg]);
+                else
+                    depth = atoi(argv[arg]);
+            } else {
+                usage();
+                exit(1);
+            }
+        } else {
+            filename = argv[arg];
+        }
+    }
+    if (filename == NULL || depth == 0 || depth > REPLAY_MAX_QUEUE) {
+        usage();
+        exit(1);
+    }
+
+    fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        printf("Failed to open %s\n", filename);
+        exit(1);
+    }
+    if ((fread(&hdr, sizeof (hdr), 1, fp) != 1) ||
+        (hdr.itf_magic != IOTRACE_MAGIC) ||
+        (hdr.itf_version != IOTRACE_VERSION) ||
+        (hdr.itf_recsize != sizeof (struct iotrace_rec)) ||
+        (hdr.itf_freq == 0)) {
+        printf("%s is not an I/O trace\n", filename);
+        fclose(fp);
+        exit(1);
+    }
+    recs = malloc(hdr.itf_count * sizeof (*recs) + 1);
+    latency = malloc(hdr.itf_count * sizeof (*latency) + 1);
+    if (recs == NULL || latency == NULL) {
+        printf("No memory for %u records\n", (uint) hdr.itf_count);
+        fclose(fp);
+        goto fail;
+    }
+    if (fread(recs, sizeof (*recs), hdr.itf_count, fp) != hdr.itf_count) {
+        printf("%s is truncated\n", filename);
+        fclose(fp);
+        goto fail;
+    }
+    fclose(fp);
+
+    for (i = 0; i < hdr.itf_count; i++)
+        if (data_direction(recs[i].it_command) && recs[i].it_length > buflen)
+            buflen = recs[i].it_length;
+    buf = AllocMem(buflen + 1, MEMF_PUBLIC | MEMF_CLEAR);
+
+    __check_abort_enabled = 0;
+    mp = CreatePort(NULL, 0);
+    tp = CreatePort(NULL, 0);
+    if (mp == NULL || tp == NULL || buf == NULL) {
+        printf("Out of memory\n");
+        goto fail;
+    }
+    tr = (struct timerequest *) CreateExtIO(tp, sizeof (*tr));
+    if (tr == NULL ||
+        OpenDevice(TIMERNAME, UNIT_WAITECLOCK, &tr->tr_node, 0) != 0) {
+        printf("Failed to open " TIMERNAME "\n");
+        if (tr != NULL)
+            DeleteExtIO(&tr->tr_node);
+        tr = NULL;
+        goto fail;
+    }
+    TimerBase = tr->tr_node.io_Device;
+    {
+        struct EClockVal ev;
+        freq = ReadEClock(&ev);
+    }
+    for (i = 0; i < depth; i++) {
+        slots[i].io = (struct IOExtTD *) CreateExtIO(mp, sizeof (struct IOExtTD));
+        if (slots[i].io == NULL) {
+            printf("Out of memory\n");
+            goto fail;
+        }
+    }
+
+    printf("Replaying %u records from %s%s%s\n", (uint) hdr.itf_count,
+           filename, fast ? ", back to back" : "",
+           writes ? ", with writes" : "");
+    start = eclock_now();
+    due = start;
+    for (i = 0; i < hdr.itf_count; i++) {
+        const struct iotrace_rec *rec = &recs[i];
+        int       dir = data_direction(rec->it_command);
+        uint64_t  offset = rec->it_block << 9;
+        unit_t   *u;
+        slot_t   *s = NULL;
+        uint      j;
+
+        /* Recorded times are in the capturing machine's E-clock */
+        due += (uint64_t) rec->it_time * freq / hdr.itf_freq;
+        if (dir == 0 || rec->it_length == 0) {
+            skipped++;
+            continue;
+        }
+        if (SetSignal(0, 0) & SIGBREAKF_CTRL_C) {
+            printf("^C abort\n");
+            break;
+        }
+        u = get_unit(devname, fixed_unit, rec, mp);
+        if (u == NULL)
+            break;
+        if (!fast)
+            wait_until(due, tr, mp);
+        for (j = 0; j < depth; j++)
+            if (!slots[j].busy) {
+                s = &slots[j];
+                break;
+            }
+        while (s == NULL)
+            s = wait_slot(mp);
+
+        s->io->iotd_Req.io_Device  = u->io->iotd_Req.io_Device;
+        s->io->iotd_Req.io_Unit    = u->io->iotd_Req.io_Unit;
+        s->io->iotd_Req.io_Command = (dir == 2 && writes) ? TD_WRITE64 :
+                                                            TD_READ64;
+        s->io->iotd_Req.io_Flags   = 0;
+        s->io->iotd_Req.io_Data    = buf;
+        s->io->iotd_Req.io_Length  = rec->it_length;
+        s->io->iotd_Req.io_Offset  = (ULONG) offset;
+        s->io->iotd_Req.io_Actual  = (ULONG) (offset >> 32);
+        s->index = nlat++;
+        s->busy  = 1;
+        s->start = eclock_now();
+        SendIO((struct IORequest *) s->io);
+        bytes += rec->it_length;
+    }
+    for (i = 0; i < depth; i++)
+        if (slots[i].busy) {
+            WaitIO((struct IORequest *) slots[i].io);
+            reap(&slots[i]);
+        }
+    elapsed = eclock_now() - start;
+    if (elapsed == 0)
+        elapsed = 1;
+
+    printf("%u requests, %u skipped, %u errors\n",
+           (uint) nlat, skipped, nerrors);
+    if (nlat != 0) {
+        uint32_t usec = ticks_to_usec(elapsed, freq);
+        printf("Elapsed %u ms, %u IOPS, %u KB/s\n", (uint) (usec / 1000),
+               (uint) ((uint64_t) nlat * freq / elapsed),
+               (uint) (bytes * freq / elapsed / 1024));
+
+        qsort(latency, nlat, sizeof (*latency), cmp_u32);
+        printf("Latency usec: p50 %u  p90 %u  p99 %u  p99.9 %u  max %u\n",
+               (uint) ticks_to_usec(latency[nlat * 50 / 100], freq),
+               (uint) ticks_to_usec(latency[nlat * 90 / 100], freq),
+               (uint) ticks_to_usec(latency[nlat * 99 / 100], freq),
+               (uint) ticks_to_usec(latency[nlat * 999 / 1000], freq),
+               (uint) ticks_to_usec(latency[nlat - 1], freq));
+        ticks = 0;
+        for (i = 0; i < nlat; i++)
+            ticks += latency[i];
+        printf("Latency usec: mean %u\n",
+               (uint) ticks_to_usec(ticks / nlat, freq));
+    }
+    rc = 0;
+
+fail:
+    for (i = 0; i < ARRAY_SIZE(slots); i++)
+        if (slots[i].io != NULL)
+            DeleteExtIO((struct IORequest *) slots[i].io);
+    for (i = 0; i < nunits; i++) {
+        CloseDevice((struct IORequest *) units[i].io);
+        DeleteExtIO((struct IORequest *) units[i].io);
+    }
+    if (tr != NULL) {
+        CloseDevice(&tr->tr_node);
+        DeleteExtIO(&tr->tr_node);
+    }
+    if (tp != NULL)
+        DeletePort(tp);
+    if (mp != NULL)
+        DeletePort(mp);
+    if (buf != NULL)
+        FreeMem(buf, buflen + 1);
+    free(recs);
+    free(latency);
+    exit(rc);
+}
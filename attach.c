@@ -53,6 +53,7 @@
 #include "util/a4092flash/flash.h"
 #include "util/a4092flash/nvram_flash.h"
 #include "mfg.h"
+#include "bootlog.h"
 
 /*
  * NewMinList
@@ -82,7 +83,8 @@ struct ExpansionBase *ExpansionBase;
  * This is the actual interrupt handler. It checks whether the interrupt
  * register of the SCSI chip indicates there is something to do, and if
  * so also captures the SCSI Status 0 and DMA Status, and then wakes the
- * service task to go process them.
+ * service task to go process them. With ENABLE_QUICK_COMPLETION, a
+ * normal command completion is handled right here instead.
  */
 __attribute__((noinline))
 static int
@@ -110,10 +112,20 @@ irq_handler_core(a4091_save_t *save)
      * captured in ISTAT are not missed. See DMA Status (DSTAT) register
      * documentation.
      */
-    sc->sc_istat |= istat;
     reg = *ADDR32((uintptr_t) &rp->siop_sstat2);
-    sc->sc_sstat0 = reg >> 8;
-    sc->sc_dstat  = reg;
+#ifdef ENABLE_QUICK_COMPLETION
+    /*
+     * Good status completions are finished here and the next command is
+     * started without waiting for the service task. It is still woken
+     * to arm timeouts and reply the finished requests.
+     */
+    if (!siop_quick_complete(sc, istat, (uint8_t) reg))
+#endif
+    {
+        sc->sc_istat |= istat;
+        sc->sc_sstat0 = reg >> 8;
+        sc->sc_dstat  = reg;
+    }
 #if defined(ARCH_720) || defined(ARCH_770)
     sc->sc_sist = rp->siop_sist;
 #endif
@@ -643,10 +655,19 @@ init_chan(device_t self, UBYTE *boardnum)
     dip_switches = get_dip_switches();
     printf("DIP switches = %02x\n", dip_switches);
 
+#ifdef ENABLE_BOOTLOG
+    bootlog_mark(BL_NVRAM);
+#endif
     Load_BattMem();
 #if defined(FLASH_PARALLEL) || defined(FLASH_SPI)
     mfg_read();
 #endif
+#ifdef ENABLE_TOPOCACHE
+    topo_load();
+#endif
+#ifdef ENABLE_BOOTLOG
+    bootlog_mark(BL_NVRAM_DONE);
+#endif
 
     sc->sc_dev = self;
     sc->sc_siopp = (siop_regmap_p)((char *)dev_base + HW_OFFSET_REGISTERS);
@@ -825,11 +846,86 @@ scsipi_alloc_periph(int flags)
 void
 scsipi_free_periph(struct scsipi_periph *periph)
 {
+    sd_geom_invalidate(periph);
     FreeMem(periph, sizeof (*periph));
 }
 
 int scsi_probe_device(struct scsipi_channel *chan, int target, int lun, struct scsipi_periph *periph, int *failed);
 
+/* Room for 32 LUN entries */
+#define REPORT_LUNS_BUFSIZE (sizeof (struct scsi_report_luns_header) + \
+                             32 * sizeof (struct scsi_report_luns_lun))
+
+/*
+ * report_luns
+ * -----------
+ * Ask an SPC-2 or later device for its list of LUNs, so that attach()
+ * can refuse LUNs which don't exist without probing each one of them.
+ * Older devices, or devices which fail the command, keep being probed
+ * one LUN at a time.
+ */
+static void
+report_luns(struct scsipi_periph *periph)
+{
+    struct scsi_report_luns cmd;
+    struct scsi_report_luns_header *hdr;
+    struct scsi_report_luns_lun *lp;
+    int      target = periph->periph_target;
+    uint32_t len;
+    uint     lun;
+    uint8_t  map;
+
+    if (periph->periph_version < 4)
+        return;
+
+    hdr = AllocMem(REPORT_LUNS_BUFSIZE,
+                   (asave->need_chip_ram_dma ? MEMF_CHIP : 0) |
+                   MEMF_PUBLIC | MEMF_CLEAR);
+    if (hdr == NULL)
+        return;
+
+    memset(&cmd, 0, sizeof (cmd));
+    cmd.opcode = SCSI_REPORT_LUNS;
+    cmd.selectreport = SELECTREPORT_NORMAL;
+    _lto4b(REPORT_LUNS_BUFSIZE, cmd.alloclen);
+
+    if (scsipi_command(periph, (void *) &cmd, sizeof (cmd), (void *) hdr,
+                       REPORT_LUNS_BUFSIZE, 0, 3000, NULL,
+                       XS_CTL_DATA_IN | XS_CTL_SILENT) != 0)
+        goto out;
+
+    /* A truncated list might hide some of LUNs 0-7 */
+    len = _4btol(hdr->length);
+    if (len > REPORT_LUNS_BUFSIZE - sizeof (*hdr))
+        goto out;
+
+    map = BIT(0);
+    for (lp = (void *) (hdr + 1); len >= sizeof (*lp);
+         len -= sizeof (*lp), lp++) {
+        switch (lp->lun[0] & REPORTLUNS_ADDR_MASK) {
+            case REPORTLUNS_ADDR_PERIPH:
+                if (lp->lun[0] != 0)  // Behind another bus
+                    continue;
+                lun = lp->lun[1];
+                break;
+            case REPORTLUNS_ADDR_FLAT:
+                lun = ((lp->lun[0] & ~REPORTLUNS_ADDR_MASK) << 8) | lp->lun[1];
+                break;
+            default:
+                continue;
+        }
+        if (lun < 8)
+            map |= BIT(lun);
+    }
+
+    asave->as_lun_map[target] = map;
+    asave->as_lun_map_valid |= BIT(target);
+    printf("  Target %d: REPORT LUNS map %02x\n", target, map);
+
+out:
+    FreeMem(hdr, REPORT_LUNS_BUFSIZE);
+}
+
 int
 attach(device_t self, uint scsi_target, struct scsipi_periph **periph_p,
        uint flags)
@@ -851,6 +947,16 @@ attach(device_t self, uint scsi_target, struct scsipi_periph **periph_p,
     if (target == chan->chan_id)
         return (ERROR_SELF_UNIT);
 
+    /*
+     * Refuse LUNs which LUN 0 did not report, without touching the bus.
+     * Attaching LUN 0 refreshes the list.
+     */
+    if (lun == 0)
+        asave->as_lun_map_valid &= ~BIT(target);
+    else if ((asave->as_lun_map_valid & BIT(target)) &&
+             ((asave->as_lun_map[target] & BIT(lun)) == 0))
+        return (ERROR_BAD_UNIT);
+
     periph = scsipi_alloc_periph(0);
     *periph_p = periph;
     if (periph == NULL)
@@ -869,6 +975,15 @@ attach(device_t self, uint scsi_target, struct scsipi_periph **periph_p,
     periph->periph_changeint = NULL;
     NewMinList(&periph->periph_changeintlist);
 
+#ifdef ENABLE_TOPOCACHE
+    if (topo_attach(periph) == 0) {
+        scsipi_insert_periph(chan, periph);
+        if ((lun == 0) && (get_lun_count() > 1))
+            report_luns(periph);
+        return (0);
+    }
+#endif
+
     rc = scsi_probe_device(chan, target, lun, periph, &failed);
     printf("scsi_probe_device(%d.%d) cont=%d failed=%d\n",
            target, lun, rc, failed);
@@ -883,6 +998,9 @@ attach(device_t self, uint scsi_target, struct scsipi_periph **periph_p,
 
     scsipi_insert_periph(chan, periph);
 
+    if ((lun == 0) && (get_lun_count() > 1))
+        report_luns(periph);
+
     /* Check if device supports disconnect/reconnect */
     if (asave->allow_disc) {
         struct {
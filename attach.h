@@ -17,6 +17,7 @@
 #if defined(FLASH_PARALLEL) || defined(FLASH_SPI)
 #include "util/a4092flash/nvram_flash.h"
 #endif
+#include "topocache.h"
 
 struct scsipi_periph;
 struct sio_softc;
@@ -28,6 +29,9 @@ struct MsgPort;
 struct timerequest;
 struct callout;
 struct ConfigDev;
+struct ramlog;
+struct iotrace;
+struct bootlog;
 struct Library;
 
 typedef struct {
@@ -43,13 +47,23 @@ typedef struct {
     struct timerequest   *as_timerio;
     struct callout      **as_callout_head;
     struct ConfigDev     *as_cd;
+    uint32_t              as_ticks;       // Seconds since handler start
     /* scripts copy (for Zorro II systems) */
     void                 *as_scripts_copy;
     uint32_t              as_scripts_copy_size;
+    /* Deferred printf() records, NULL unless built with DEBUG_RAMLOG */
+    struct ramlog        *as_ramlog;
+    /* BeginIO trace ring, NULL unless built with ENABLE_IOTRACE */
+    struct iotrace       *as_iotrace;
+    /* Boot timeline, NULL unless built with ENABLE_BOOTLOG */
+    struct bootlog       *as_bootlog;
 #ifdef ENABLE_QUICKINTS
     /* quick interrupt support */
     ULONG                 quick_vec_num;
 #endif
+    /* REPORT LUNS inventory, one bit per LUN 0-7 for each target */
+    uint16_t              as_lun_map_valid;
+    uint8_t               as_lun_map[16];
     /* Keep byte-sized state after the hot longword fields. */
     int8_t                as_timer_running;
     uint8_t               as_irq_signal;
@@ -62,6 +76,7 @@ typedef struct {
     uint8_t              cdrom_boot;
     uint8_t              ignore_last;
     uint8_t              allow_disc;
+    uint8_t              dma_burst;     /* Calibrated DMODE BL + 1, 0 = none */
 #ifdef ENABLE_QUICKINTS
     uint8_t               quick_int;
 #endif
@@ -78,6 +93,16 @@ typedef struct {
     uint8_t          menu_color_g;
     uint8_t          menu_color_b;
     char             mfg_serial[16];     /* e.g. "A4092-00000001" */
+#ifdef ENABLE_TOPOCACHE
+    /* Cached bus topology (see topocache.c) */
+    struct {
+        struct topo_header hdr;
+        struct topo_entry  ent[TOPO_MAX_ENTRIES];
+        struct topo_entry  pend;         /* Unit currently being probed */
+        uint8_t            dirty;        /* Needs to be written to flash */
+        uint8_t            blocked;      /* OEM data occupies the sector */
+    } topo;
+#endif
 #endif
 } a4091_save_t;
 
@@ -45,6 +45,7 @@ int Load_BattMem(void)
         asave->quick_int   = (osf & BIT(2)) ? 1 : 0;
 #endif
         asave->allow_disc  = (osf & BIT(3)) ? 1 : 0;
+        asave->dma_burst   = (osf >> 4) & 7;
         /* Default Amiga blue — mfg_read() overrides if mfg data is valid */
         asave->menu_color_r = 6;
         asave->menu_color_g = 8;
@@ -61,6 +62,7 @@ int Load_BattMem(void)
         asave->quick_int   = 0;
 #endif
         asave->allow_disc  = 0;
+        asave->dma_burst   = 0;
         /* Default Amiga blue */
         asave->menu_color_r = 6;
         asave->menu_color_g = 8;
@@ -80,7 +82,8 @@ int Load_BattMem(void)
 #else
     UBYTE cdrom_boot = 0,
           ignore_last = 0,
-          allow_disc = 0;
+          allow_disc = 0,
+          dma_burst = 0;
 #ifdef ENABLE_QUICKINTS
     UBYTE quick_int = 0;
 #endif
@@ -95,6 +98,7 @@ int Load_BattMem(void)
         asave->quick_int   = 0;
 #endif
         asave->allow_disc  = 0;
+        asave->dma_burst   = 0;
         return 0;
     }
 
@@ -114,6 +118,9 @@ int Load_BattMem(void)
     ReadBattMem(&allow_disc,
                 BATTMEM_A4091_ALLOW_DISC_ADDR,
                 BATTMEM_A4091_ALLOW_DISC_LEN);
+    ReadBattMem(&dma_burst,
+                BATTMEM_A4091_DMA_BURST_ADDR,
+                BATTMEM_A4091_DMA_BURST_LEN);
 
     // CDROM_BOOT defaults to on, hence invert it
     asave->cdrom_boot = !cdrom_boot;
@@ -122,6 +129,7 @@ int Load_BattMem(void)
     asave->quick_int = quick_int;
 #endif
     asave->allow_disc = allow_disc;
+    asave->dma_burst = dma_burst;
     printf("  cdrom_boot: %s\n", asave->cdrom_boot?"on":"off");
     printf("  ignore_last: %s\n", asave->ignore_last?"on":"off");
 #ifdef ENABLE_QUICKINTS
@@ -145,6 +153,7 @@ int Save_BattMem(void)
     if (asave->quick_int)   osf |= BIT(2);
 #endif
     if (asave->allow_disc)  osf |= BIT(3);
+    osf |= (asave->dma_burst & 7) << 4;
     asave->nvram.nv.settings.os_flags = osf;
     asave->nvram.os_dirty = 1;
     printf("Staging settings to NVRAM cache\n");
@@ -158,7 +167,8 @@ int Save_BattMem(void)
 #else
     UBYTE cdrom_boot = !asave->cdrom_boot,
           ignore_last = asave->ignore_last,
-          allow_disc = asave->allow_disc;
+          allow_disc = asave->allow_disc,
+          dma_burst = asave->dma_burst;
 #ifdef ENABLE_QUICKINTS
     UBYTE quick_int = asave->quick_int;
 #endif
@@ -188,6 +198,9 @@ int Save_BattMem(void)
     WriteBattMem(&allow_disc,
                  BATTMEM_A4091_ALLOW_DISC_ADDR,
                  BATTMEM_A4091_ALLOW_DISC_LEN);
+    WriteBattMem(&dma_burst,
+                 BATTMEM_A4091_DMA_BURST_ADDR,
+                 BATTMEM_A4091_DMA_BURST_LEN);
 
     ReleaseBattSemaphore();
 
@@ -33,6 +33,8 @@ int Nvram_CommitDirty(void);
 #define BATTMEM_A4091_QUICK_INT_LEN    1
 #define BATTMEM_A4091_ALLOW_DISC_ADDR  75
 #define BATTMEM_A4091_ALLOW_DISC_LEN   1
+#define BATTMEM_A4091_DMA_BURST_ADDR  76  /* DMODE BL + 1, 0 = none */
+#define BATTMEM_A4091_DMA_BURST_LEN    3
 
 #endif
 #endif
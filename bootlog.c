@@ -0,0 +1,225 @@
+//
+// Copyright 2026 Stefan Reinauer
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+
+#ifdef DEBUG_DEVICE
+#define USE_SERIAL_OUTPUT
+#endif
+#include "port.h"
+#include "printf.h"
+#include <string.h>
+#include <exec/io.h>
+#include <devices/timer.h>
+#include <clib/timer_protos.h>
+#include <inline/timer.h>
+
+#include "device.h"
+#include "scsi_all.h"
+#include "scsi_spc.h"
+#include "scsipiconf.h"
+#include "sys_queue.h"
+#include "attach.h"
+#include "bootlog.h"
+
+#ifdef ENABLE_BOOTLOG
+
+/* Filled in by DiagEntry in rom.S, see the romtag in device.c */
+extern uint32_t boot_stamp[3];
+
+struct bootlog bootlog;
+static struct timerequest bl_tr;
+
+#define CIAB_TODHI  ((volatile uint8_t *) 0xbfda00)
+#define CIAB_TODMID ((volatile uint8_t *) 0xbfd900)
+#define CIAB_TODLOW ((volatile uint8_t *) 0xbfd800)
+
+/*
+ * read_tod
+ * --------
+ * Read the CIA-B time of day counter. Reading the high byte latches
+ * the counter until the low byte has been read.
+ */
+static uint32_t
+read_tod(void)
+{
+    uint32_t tod;
+
+    tod  = *CIAB_TODHI << 16;
+    tod |= *CIAB_TODMID << 8;
+    tod |= *CIAB_TODLOW;
+    return (tod);
+}
+
+/*
+ * tod_to_eclock
+ * -------------
+ * Convert a number of video lines to E-clock ticks. The line rate
+ * follows from the E-clock: 15625 Hz on PAL machines, 15734 Hz on NTSC.
+ */
+static uint32_t
+tod_to_eclock(uint32_t lines, uint32_t freq)
+{
+    uint32_t rate = (freq < 712000) ? 15625 : 15734;
+
+    lines &= 0xffffff;
+    return ((lines / rate) * freq +
+            (lines % rate) * (freq / 100) / rate * 100);
+}
+
+static void
+stamp(uint id, uint32_t when)
+{
+    bootlog.bl_stamp[id] = when;
+    bootlog.bl_seen |= BIT(id);
+}
+
+uint32_t
+bootlog_now(void)
+{
+    struct Device *TimerBase = bootlog.bl_timerbase;
+    struct EClockVal ev;
+
+    if (TimerBase == NULL)
+        return (0);
+    (void) ReadEClock(&ev);
+    return (ev.ev_lo);
+}
+
+/*
+ * bootlog_init
+ * ------------
+ * Called from the romtag init when the driver starts from ROM. The
+ * relocation stamps are back-dated from a paired TOD / E-clock reading.
+ * timer.device stays open until bootlog_free().
+ */
+void
+bootlog_init(void)
+{
+    struct Device   *TimerBase;
+    struct EClockVal ev;
+    uint32_t         tod;
+
+    if (OpenDevice(TIMERNAME, UNIT_MICROHZ, &bl_tr.tr_node, 0) != 0)
+        return;
+    TimerBase = bl_tr.tr_node.io_Device;
+
+    Disable();
+    tod = read_tod();
+    bootlog.bl_freq = ReadEClock(&ev);
+    Enable();
+
+    bootlog.bl_timerbase = TimerBase;
+    bootlog.bl_magic = BOOTLOG_MAGIC;
+    bootlog.bl_open = 1;
+    stamp(BL_INIT, ev.ev_lo);
+
+    if (boot_stamp[0] == BOOTLOG_STAMP) {
+        stamp(BL_RELOC, ev.ev_lo -
+              tod_to_eclock(tod - boot_stamp[1], bootlog.bl_freq));
+        stamp(BL_RELOC_DONE, ev.ev_lo -
+              tod_to_eclock(tod - boot_stamp[2], bootlog.bl_freq));
+    }
+}
+
+void
+bootlog_mark(uint id)
+{
+    if (bootlog.bl_open)
+        stamp(id, bootlog_now());
+}
+
+/*
+ * bootlog_attach
+ * --------------
+ * Account one CMD_ATTACH, which started at E-clock start, to its target.
+ */
+void
+bootlog_attach(uint32_t unit, uint32_t start, int failed)
+{
+    struct bootlog_target *bt;
+    int target;
+    int lun;
+
+    if (bootlog.bl_open == 0)
+        return;
+    decode_unit_number(unit, &target, &lun);
+    if (target >= BOOTLOG_TARGETS)
+        return;
+
+    bt = &bootlog.bl_target[target];
+    if (bt->bt_probes++ == 0)
+        bt->bt_probe = start;
+    bt->bt_probe_ticks += bootlog_now() - start;
+    if (failed == 0)
+        bt->bt_attached++;
+}
+
+/*
+ * bootlog_xfer
+ * ------------
+ * Called for every completed xfer. A target is spinning up from its
+ * first "not ready, becoming ready" class sense until the next command
+ * which completes without error.
+ */
+void
+bootlog_xfer(struct scsipi_xfer *xs)
+{
+    struct scsi_sense_data *sense = &xs->sense.scsi_sense;
+    struct bootlog_target  *bt;
+    uint target = xs->xs_periph->periph_target;
+
+    if (bootlog.bl_open == 0 || target >= BOOTLOG_TARGETS)
+        return;
+
+    bt = &bootlog.bl_target[target];
+    if (xs->error == XS_SENSE) {
+        if (bt->bt_spin == 0 &&
+            SSD_SENSE_KEY(sense->flags) == SKEY_NOT_READY &&
+            sense->asc == 0x04 && sense->ascq != 0x03)
+            bt->bt_spin = bootlog_now();
+    } else if (xs->error == XS_NOERROR) {
+        if (bt->bt_spin != 0 && bt->bt_ready == 0)
+            bt->bt_ready = bootlog_now();
+    }
+}
+
+void
+bootlog_close(void)
+{
+    bootlog.bl_open = 0;
+}
+
+/*
+ * bootlog_free
+ * ------------
+ * Closes timer.device when the driver is expunged. Called by the command
+ * handler as it shuts down, after its last bootlog_now().
+ */
+void
+bootlog_free(void)
+{
+    bootlog.bl_open = 0;
+    if (bootlog.bl_timerbase == NULL)
+        return;
+    bootlog.bl_timerbase = NULL;
+    CloseDevice(&bl_tr.tr_node);
+}
+
+uint32_t
+bootlog_ms(uint32_t ticks)
+{
+    if (bootlog.bl_freq < 1000)
+        return (0);
+    return (ticks / (bootlog.bl_freq / 1000));
+}
+
+#endif /* ENABLE_BOOTLOG */
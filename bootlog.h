@@ -0,0 +1,88 @@
+//
+// Copyright 2026 Stefan Reinauer
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+
+#ifndef _BOOTLOG_H
+#define _BOOTLOG_H
+
+#include <stdint.h>
+
+/*
+ * Boot timeline (ENABLE_BOOTLOG)
+ *
+ * When the driver starts from ROM, it stamps each boot milestone with
+ * the low 32 bits of the E-clock, and keeps per-target probe and spin-up
+ * times. Recording stops once the boot menu has run. "a4091d --boot" and
+ * the boot menu debug page find the log through as_bootlog.
+ *
+ * Relocation happens in DiagEntry, before timer.device exists. rom.S
+ * reads the CIA-B time of day counter (one tick per video line) around
+ * _relocate and leaves both readings in boot_stamp[], the first longword
+ * after the driver's romtag. It only does so if boot_stamp[0] still holds
+ * BOOTLOG_EMPTY. bootlog_init() converts them to E-clock time.
+ */
+#define BOOTLOG_MAGIC    0x424c4f47      /* "BLOG" */
+#define BOOTLOG_STAMP    0x52454c4f      /* "RELO", boot_stamp[0] */
+#define BOOTLOG_EMPTY    0x2d2d2d2d      /* "----", slot not filled in */
+#define BOOTLOG_TARGETS  16
+
+/* Milestones, in boot order */
+#define BL_RELOC         0   /* DiagEntry starts _relocate */
+#define BL_RELOC_DONE    1
+#define BL_INIT          2   /* Romtag init() */
+#define BL_HANDLER       3   /* Command handler task running */
+#define BL_NVRAM         4   /* Load_BattMem, mfg_read, topo_load */
+#define BL_NVRAM_DONE    5
+#define BL_CHAN_DONE     6   /* init_chan returned */
+#define BL_MOUNT         7   /* MountDrive */
+#define BL_MOUNT_DONE    8
+#define BL_MENU          9   /* boot_menu */
+#define BL_MENU_DONE     10
+#define BL_COUNT         11
+
+struct bootlog_target {
+    uint32_t bt_probe;          /* E-clock at first attach, 0 if never */
+    uint32_t bt_probe_ticks;    /* Total time in attach(), all LUNs */
+    uint32_t bt_spin;           /* E-clock at first NOT READY, 0 if none */
+    uint32_t bt_ready;          /* E-clock at next good command after it */
+    uint8_t  bt_attached;       /* LUNs attached */
+    uint8_t  bt_probes;         /* attach() calls */
+    uint8_t  bt_reserved[2];
+};
+
+struct bootlog {
+    uint32_t bl_magic;          /* BOOTLOG_MAGIC */
+    uint32_t bl_freq;           /* E-clock ticks per second */
+    uint16_t bl_seen;           /* Bit per milestone which was stamped */
+    uint8_t  bl_open;           /* Still recording */
+    uint8_t  bl_reserved;
+    void    *bl_timerbase;      /* timer.device, for ReadEClock() */
+    uint32_t bl_stamp[BL_COUNT];
+    struct bootlog_target bl_target[BOOTLOG_TARGETS];
+};
+
+#ifdef ENABLE_BOOTLOG
+struct scsipi_xfer;
+
+extern struct bootlog bootlog;
+
+void bootlog_init(void);
+void bootlog_mark(uint id);
+void bootlog_attach(uint32_t unit, uint32_t start, int failed);
+void bootlog_xfer(struct scsipi_xfer *xs);
+uint32_t bootlog_now(void);
+void bootlog_close(void);
+void bootlog_free(void);
+uint32_t bootlog_ms(uint32_t ticks);
+#endif
+
+#endif /* _BOOTLOG_H */
@@ -56,6 +56,7 @@
 #include "version.h"
 #include "mounter.h" // for Port/IOReq wrappers
 #include "a4091.h"
+#include "bootlog.h"
 
 #if defined(FLASH_PARALLEL) || defined(FLASH_SPI)
 #include "util/a4092flash/mfg_flash.h"
@@ -1026,6 +1027,68 @@ static void disks_page(void)
     scan_disks();
 }
 
+#ifdef ENABLE_BOOTLOG
+static void boot_time_row(int row, const char *label, uint32_t ticks)
+{
+    struct RastPort *rp = &screen->RastPort;
+    char buf[12];
+    UWORD y = 64 + row * 9;
+    int len;
+
+    SetAPen(rp, 2);
+    Move(rp, 110, y);
+    Text(rp, label, strlen(label));
+    itoa(bootlog_ms(ticks), buf, 10);
+    len = strlen(buf);
+    SetAPen(rp, 1);
+    Move(rp, 222 - len * 8, y);
+    Text(rp, buf, len);
+}
+
+/* Boot timeline summary in the free left half of the debug page */
+static void boot_times(void)
+{
+    struct bootlog *bl = asave->as_bootlog;
+    uint32_t probe = 0;
+    uint32_t spin = 0;
+    uint32_t first;
+    int row = 1;
+    int t;
+
+    if (bl == NULL || bl->bl_magic != BOOTLOG_MAGIC)
+        return;
+
+#define SEEN(a, b) ((bl->bl_seen & (BIT(a) | BIT(b))) == (BIT(a) | BIT(b)))
+#define SPAN(a, b) (bl->bl_stamp[b] - bl->bl_stamp[a])
+    for (t = 0; t < BOOTLOG_TARGETS; t++) {
+        struct bootlog_target *bt = &bl->bl_target[t];
+        probe += bt->bt_probe_ticks;
+        if (bt->bt_spin != 0 && bt->bt_ready != 0 &&
+            bt->bt_ready - bt->bt_spin > spin)
+            spin = bt->bt_ready - bt->bt_spin;
+    }
+    first = (bl->bl_seen & BIT(BL_RELOC)) ? bl->bl_stamp[BL_RELOC] :
+                                            bl->bl_stamp[BL_INIT];
+
+    SetAPen(&screen->RastPort, 1);
+    Print("Boot time (ms)", 110, 64, FALSE);
+    if (SEEN(BL_RELOC, BL_RELOC_DONE))
+        boot_time_row(row++, "Reloc", SPAN(BL_RELOC, BL_RELOC_DONE));
+    if (SEEN(BL_NVRAM, BL_NVRAM_DONE))
+        boot_time_row(row++, "NVRAM", SPAN(BL_NVRAM, BL_NVRAM_DONE));
+    if (SEEN(BL_INIT, BL_CHAN_DONE))
+        boot_time_row(row++, "Init", SPAN(BL_INIT, BL_CHAN_DONE));
+    boot_time_row(row++, "Probe", probe);
+    boot_time_row(row++, "Spin-up", spin);
+    if (SEEN(BL_MOUNT, BL_MOUNT_DONE))
+        boot_time_row(row++, "Mount", SPAN(BL_MOUNT, BL_MOUNT_DONE));
+    if (bl->bl_seen & BIT(BL_MENU))
+        boot_time_row(row++, "Total", bl->bl_stamp[BL_MENU] - first);
+#undef SEEN
+#undef SPAN
+}
+#endif
+
 static void debug_page(void)
 {
     struct NewGadget ng;
@@ -1087,6 +1150,9 @@ static void debug_page(void)
                                     GTBB_Recessed,  TRUE,
                                     GTBB_FrameType, BBFT_RIDGE,
                                     TAG_DONE);
+#ifdef ENABLE_BOOTLOG
+    boot_times();
+#endif
 
     page_footer();
 }
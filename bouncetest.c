@@ -0,0 +1,113 @@
+//
+// Copyright 2026 Stefan Reinauer
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+
+/*
+ * Host test for the 53C710 head/tail bounce bytes (siopbounce.h).
+ * A read into a misaligned buffer is "DMAed" the way siop_build_chain()
+ * lays it out, then completed the way siop_scsidone() does.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include "scsipiconf.h"
+#include "siopbounce.h"
+
+static int failures;
+
+#define CHECK(cond, ...) do {                       \
+        if (!(cond)) {                              \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+            printf(__VA_ARGS__);                    \
+            printf("\n");                           \
+            failures++;                             \
+        }                                           \
+    } while (0)
+
+/*
+ * Read len bytes of disk into buf + misalign, completing with error.
+ * Returns nonzero if the caller's buffer matches the disk data.
+ */
+static int
+bounced_read(int misalign, int len, int error)
+{
+    unsigned char disk[512];
+    unsigned char mem[512 + 8];
+    unsigned char bounce[16];
+    unsigned char *buf = mem + misalign;
+    unsigned char hlen;
+    unsigned char tlen;
+    int i;
+
+    for (i = 0; i < len; i++)
+        disk[i] = (unsigned char) (i * 7 + 3);
+    memset(mem, 0xee, sizeof (mem));
+    memset(bounce, 0x55, sizeof (bounce));
+
+    if (siop_bounce_split(buf, len, &hlen, &tlen)) {
+        /* Chain: bounce head, aligned middle, bounce tail */
+        memcpy(bounce, disk, hlen);
+        memcpy(buf + hlen, disk + hlen, len - hlen - tlen);
+        memcpy(bounce + 4, disk + len - tlen, tlen);
+        CHECK((((unsigned long) (buf + hlen)) & 3) == 0,
+              "middle of %d+%d not aligned", misalign, len);
+        CHECK(((len - hlen - tlen) & 3) == 0,
+              "middle of %d+%d not whole longwords", misalign, len);
+        if (siop_bounce_wanted(error))
+            siop_bounce_finish(bounce, buf, hlen, buf + len - tlen, tlen);
+    } else {
+        memcpy(buf, disk, len);
+    }
+    return (memcmp(buf, disk, len) == 0);
+}
+
+int
+main(void)
+{
+    struct scsi_sense_data sense;
+    int misalign;
+    int len;
+
+    /* Good reads of every alignment and length */
+    for (misalign = 0; misalign < 4; misalign++)
+        for (len = 1; len <= 80; len++)
+            CHECK(bounced_read(misalign, len, XS_NOERROR),
+                  "good read %d+%d", misalign, len);
+
+    /*
+     * CHECK CONDITION with RECOVERED ERROR: the data is valid and the
+     * request later completes as a success, so the head and tail bytes
+     * must have been handed over.
+     */
+    memset(&sense, 0, sizeof (sense));
+    sense.response_code = SSD_RCODE_CURRENT;
+    sense.flags = SKEY_RECOVERED_ERROR;
+    CHECK(SSD_SENSE_KEY(sense.flags) == SKEY_RECOVERED_ERROR, "sense key");
+    for (misalign = 1; misalign < 4; misalign++) {
+        CHECK(bounced_read(misalign, 511, XS_SENSE),
+              "recovered error (XS_SENSE) %d+511", misalign);
+        CHECK(bounced_read(misalign, 511, XS_BUSY),
+              "recovered error (XS_BUSY) %d+511", misalign);
+    }
+
+    /* No data phase: nothing to copy */
+    CHECK(!siop_bounce_wanted(XS_SELTIMEOUT), "selection timeout copied");
+    CHECK(!siop_bounce_wanted(XS_RESET), "bus reset copied");
+
+    if (failures != 0) {
+        printf("%d failures\n", failures);
+        return (1);
+    }
+    printf("bounce tests passed\n");
+    return (0);
+}
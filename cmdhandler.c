@@ -47,6 +47,9 @@
 #include "nsd.h"
 #include "ndkcompat.h"
 #include "version.h"
+#include "ramlog.h"
+#include "bootlog.h"
+#include "iotrace.h"
 
 #ifndef DEBUG_CMDHANDLER
 #undef DEBUG_CMD
@@ -70,6 +73,10 @@ typedef struct {
     struct SignalSemaphore started;   // Command handler has started
 } start_msg_t;
 
+static void expire_idle_units(int expired_only);
+
+/* Set by flush_idle_units(), which may not wait for the handler */
+static volatile uint8_t idle_flush;
 
 static void
 irq_poll(uint got_int, struct siop_softc *sc)
@@ -200,6 +207,78 @@ cmd_complete(void *ior, int8_t rc)
     ReplyMsg(&ioreq->io_Message);
 }
 
+/*
+ * abort_io
+ * --------
+ * AbortIO() entry, called in the context of the requesting task.
+ * A request which is still waiting at the handler's message port is
+ * replied with IOERR_ABORTED right away. Requests the handler task
+ * already took are marked with IOF_ABORTREQ, and the handler is woken
+ * to cancel them at the next opportunity (see cancel_aborted()).
+ */
+int
+abort_io(struct IORequest *ior)
+{
+    struct scsipi_channel *chan;
+    struct Node           *node;
+    int                    rc = IOERR_NOCMD;
+
+    Forbid();
+    if (ior->io_Message.mn_Node.ln_Type == NT_MESSAGE) {
+        for (node = myPort->mp_MsgList.lh_Head; node->ln_Succ != NULL;
+             node = node->ln_Succ) {
+            if (node == &ior->io_Message.mn_Node) {
+                Remove(node);
+                ior->io_Error = IOERR_ABORTED;
+                ReplyMsg(&ior->io_Message);
+                Permit();
+                return (0);
+            }
+        }
+
+        ior->io_Flags |= IOF_ABORTREQ;
+        if (asave != NULL) {
+            chan = &asave->as_device_private->sc_channel;
+            chan->chan_abort_pending = 1;
+            if (chan->chan_task != NULL)
+                Signal(chan->chan_task, chan->chan_sig_mask);
+        }
+        rc = 0;
+    }
+    Permit();
+    return (rc);
+}
+
+/*
+ * cancel_aborted
+ * --------------
+ * Handler side of AbortIO(). Replies marked requests which are waiting
+ * for the bounce buffer, and takes their xfers off the scsipi channel
+ * queue if they have not been handed to the SCSI chip yet. Commands
+ * which are already running on the bus finish normally; a split
+ * transfer is not continued past its current piece.
+ */
+static void
+cancel_aborted(struct scsipi_channel *chan)
+{
+    struct IORequest *ior;
+    struct IORequest *next;
+
+    chan->chan_abort_pending = 0;
+
+    for (ior = (struct IORequest *) chan->chan_stalled_queue.mlh_Head;
+         (next = (struct IORequest *) ior->io_Message.mn_Node.ln_Succ) != NULL;
+         ior = next) {
+        if (ior->io_Flags & IOF_ABORTREQ) {
+            Remove(&ior->io_Message.mn_Node);
+            ior->io_Error = IOERR_ABORTED;
+            ReplyMsg(&ior->io_Message);
+        }
+    }
+
+    scsipi_abort_queued(chan);
+}
+
 #ifndef AddHeadMinList
 void
 AddHeadMinList(struct MinList *list, struct MinNode *node)
@@ -281,9 +360,36 @@ static const UWORD nsd_supported_cmds[] = {
     TD_PROTSTATUS, TD_CHANGENUM, TD_CHANGESTATE,
     NSCMD_DEVICEQUERY,
     NSCMD_TD_READ64, NSCMD_TD_WRITE64, NSCMD_TD_SEEK64, NSCMD_TD_FORMAT64,
+    NSCMD_TD_READV64, NSCMD_TD_WRITEV64, NSCMD_HD_SCSICMDV,
     TAG_END
 };
 
+/*
+ * cmd_handler_term
+ * ----------------
+ * Release everything the command handler owns. Returns in Forbid(), so
+ * the handler task ends before anything else can run.
+ */
+static void
+cmd_handler_term(void)
+{
+    deinit_chan(NULL);
+#ifdef ENABLE_IOTRACE
+    iotrace_free();
+#endif
+#ifdef ENABLE_BOOTLOG
+    bootlog_free();
+#endif
+    close_timer();
+    asave->as_isr = NULL;
+    FreeMem(asave->as_device_private, sizeof (*asave->as_device_private));
+    FreeMem(asave, sizeof (*asave));
+    asave = NULL;
+    Forbid();
+    DeletePort(myPort);
+    myPort = NULL;
+}
+
 static int
 cmd_do_iorequest(struct IORequest * ior)
 {
@@ -403,6 +509,18 @@ CMD_WRITE_continue:
             }
             break;
 
+        case NSCMD_HD_SCSICMDV:  // Batch of SCSI Direct commands
+            PRINTF_CMD("NSCMD_HD_SCSICMDV %d n=%"PRIu32"\n",
+                    ((struct scsipi_periph *) ior->io_Unit)->periph_lun * 10 +
+                    ((struct scsipi_periph *) ior->io_Unit)->periph_target,
+                    iotd->iotd_Req.io_Length / sizeof (struct SCSICmd));
+            rc = sd_scsidirect_batch(iotd->iotd_Req.io_Unit, ior);
+            if (rc != 0) {
+                iotd->iotd_Req.io_Error = rc;
+                ReplyMsg(&ior->io_Message);
+            }
+            break;
+
         case NSCMD_TD_READ64:
             printf("NSCMD_");
             // fallthrough
@@ -457,6 +575,34 @@ CMD_WRITE_continue:
             iotd->iotd_Req.io_Actual = 0;
             goto CMD_WRITE_continue;
 
+        case NSCMD_TD_READV64:
+        case NSCMD_TD_WRITEV64:
+            PRINTF_CMD("NSCMD_TD_%sV64 %d %"PRIx32":%"PRIx32" %"PRIx32"\n",
+                   (cmd == NSCMD_TD_READV64) ? "READ" : "WRITE",
+                   ((struct scsipi_periph *) ior->io_Unit)->periph_lun * 10 +
+                   ((struct scsipi_periph *) ior->io_Unit)->periph_target,
+                   iotd->iotd_Req.io_Actual, iotd->iotd_Req.io_Offset,
+                   iotd->iotd_Req.io_Length);
+            if (iotd->iotd_Req.io_Length == 0)
+                goto io_done;
+            blkshift = ((struct scsipi_periph *) ior->io_Unit)->periph_blkshift;
+
+            blkno_high = iotd->iotd_Req.io_Actual >> blkshift;
+            blkno_low = iotd->iotd_Req.io_Actual << (32 - blkshift);
+            blkno_low |= (iotd->iotd_Req.io_Offset >> blkshift);
+            blkno = ((uint64_t)blkno_high << 32) | blkno_low;
+            iotd->iotd_Req.io_Actual = 0;
+
+            rc = sd_readwritev(iotd->iotd_Req.io_Unit, blkno,
+                               (cmd == NSCMD_TD_READV64) ? B_READ : B_WRITE,
+                               iotd->iotd_Req.io_Data,
+                               iotd->iotd_Req.io_Length, ior);
+            if (rc != 0) {
+                iotd->iotd_Req.io_Error = rc;
+                ReplyMsg(&ior->io_Message);
+            }
+            break;
+
 #ifdef ENABLE_SEEK
         case NSCMD_TD_SEEK64:
         case TD_SEEK64:
@@ -602,7 +748,10 @@ CMD_SEEK_continue:
             break;
         }
 
-        case CMD_ATTACH:  // Attach (open) a new SCSI device
+        case CMD_ATTACH: {  // Attach (open) a new SCSI device
+#ifdef ENABLE_BOOTLOG
+            uint32_t start = bootlog_now();
+#endif
             PRINTF_CMD("CMD_ATTACH %"PRIu32"\n", iotd->iotd_Req.io_Offset);
 
             rc = attach(NULL, iotd->iotd_Req.io_Offset,
@@ -612,10 +761,17 @@ CMD_SEEK_continue:
                 ior->io_Error = rc;
             } else if ((iotd->iotd_Req.io_Length & TDF_DEBUG_OPEN) == 0) {
                 (void) sd_blocksize((struct scsipi_periph *) ior->io_Unit);
+#ifdef ENABLE_TOPOCACHE
+                topo_update((struct scsipi_periph *) ior->io_Unit);
+#endif
             }
+#ifdef ENABLE_BOOTLOG
+            bootlog_attach(iotd->iotd_Req.io_Offset, start, rc);
+#endif
 
             ReplyMsg(&ior->io_Message);
             break;
+        }
 
         case CMD_DETACH:  // Detach (close) a SCSI device
             PRINTF_CMD("CMD_DETACH %d\n",
@@ -628,15 +784,7 @@ CMD_SEEK_continue:
 
         case CMD_TERM:
             PRINTF_CMD("CMD_TERM\n");
-            deinit_chan(NULL);
-            close_timer();
-            asave->as_isr = NULL;
-            FreeMem(asave->as_device_private, sizeof (*asave->as_device_private));
-            FreeMem(asave, sizeof (*asave));
-            asave = NULL;
-            Forbid();
-            DeletePort(myPort);
-            myPort = NULL;
+            cmd_handler_term();
             ReplyMsg(&ior->io_Message);
             return (1);
 
@@ -708,6 +856,7 @@ irq_and_timer_handler(void)
 
     if (mask & timer_mask) {
         WaitIO(&asave->as_timerio->tr_node);
+        asave->as_ticks++;
         callout_run_timeouts();
         sd_testunitready_walk(chan);
         restart_timer();
@@ -762,6 +911,13 @@ cmd_handler(void)
         msg->io_Error = ERROR_NO_MEMORY;
         goto fail_allocmem;
     }
+#ifdef DEBUG_RAMLOG
+    asave->as_ramlog = &ramlog;
+#endif
+#ifdef ENABLE_BOOTLOG
+    asave->as_bootlog = &bootlog;
+    bootlog_mark(BL_HANDLER);
+#endif
     /*
      * Check if driver is loaded in Zorro II memory space. If so, DMA buffers
      * must be allocated in Chip RAM since the A4091/A4092 (Zorro III) cannot
@@ -798,6 +954,12 @@ fail_msgport:
         return;
     }
 
+#ifdef ENABLE_BOOTLOG
+    bootlog_mark(BL_CHAN_DONE);
+#endif
+#ifdef ENABLE_IOTRACE
+    iotrace_init();
+#endif
     ReleaseSemaphore(&msg->started);
     restart_timer();
 
@@ -830,14 +992,37 @@ fail_msgport:
         /* Process timer events */
         if (mask & timer_mask) {
             WaitIO(&asave->as_timerio->tr_node);
+            asave->as_ticks++;
             callout_run_timeouts();
             sd_testunitready_walk(chan);
+            expire_idle_units(TRUE);
             restart_timer();
         }
 
+        if (idle_flush) {
+            idle_flush = 0;
+            expire_idle_units(FALSE);
+            if (drv_expunge_deferred()) {
+                cmd_handler_term();
+                drv_free();
+                return;  // Exit handler, still in Forbid()
+            }
+        }
+
         if (mask & chan->chan_sig_mask) {
+            if (chan->chan_abort_pending)
+                cancel_aborted(chan);
+
             /* Process continuation or stalled queue */
-            if (chan->chan_continue_iotd != NULL) {
+            if ((chan->chan_continue_iotd != NULL) &&
+                (((struct IORequest *) chan->chan_continue_iotd)->io_Flags &
+                 IOF_ABORTREQ)) {
+                /* Aborted split transfer: io_Actual has what was done */
+                struct IORequest *aior = chan->chan_continue_iotd;
+                chan->chan_continue_iotd = NULL;
+                aior->io_Error = IOERR_ABORTED;
+                ReplyMsg(&aior->io_Message);
+            } else if (chan->chan_continue_iotd != NULL) {
                 struct IOExtTD *iotd = chan->chan_continue_iotd;
                 struct scsipi_periph *periph = (struct scsipi_periph *) iotd->iotd_Req.io_Unit;
                 uint64_t blkno = chan->chan_current_blkno;
@@ -950,20 +1135,145 @@ struct unit_list {
     struct scsipi_periph *periph;
     uint                  scsi_target;
     uint                  count;
+    /* State when the last opener closed the unit */
+    uint32_t              idle_since;   // asave->as_ticks
+    uint32_t              reset_count;  // chan_reset_count
+    uint                  changenum;    // periph_changenum
 };
 unit_list_t *unit_list = NULL;
 
+/*
+ * Closed units stay attached for this many seconds, so that tools which
+ * open and close a unit repeatedly don't pay for an attach every time.
+ */
+#define UNIT_IDLE_EXPIRE 10
+
+/*
+ * unit_is_stale
+ * -------------
+ * Returns non-zero if a closed unit saw a bus reset or media change
+ * since it was closed, and must be attached from scratch.
+ */
+static int
+unit_is_stale(const unit_list_t *cur)
+{
+    const struct scsipi_periph *periph = cur->periph;
+
+    return ((periph->periph_changenum != cur->changenum) ||
+            (periph->periph_channel->chan_reset_count != cur->reset_count));
+}
+
+/*
+ * unit_unlink
+ * -----------
+ * Removes the first closed unit matching the criteria from the unit list.
+ * The caller is responsible for detaching the periph and freeing the
+ * list entry. Units are only ever unlinked in Forbid() state, as the
+ * list is shared between the command handler and Open()/Close().
+ */
+static unit_list_t *
+unit_unlink(int expired_only)
+{
+    unit_list_t *parent = NULL;
+    unit_list_t *cur;
+
+    Forbid();
+    for (cur = unit_list; cur != NULL; parent = cur, cur = cur->next) {
+        if (cur->count != 0)
+            continue;
+        if (expired_only && !unit_is_stale(cur) &&
+            (asave->as_ticks - cur->idle_since < UNIT_IDLE_EXPIRE))
+            continue;
+        if (parent == NULL)
+            unit_list = cur->next;
+        else
+            parent->next = cur->next;
+        break;
+    }
+    Permit();
+    return (cur);
+}
+
+/*
+ * expire_idle_units
+ * -----------------
+ * Called by the command handler once a second to detach closed units
+ * which expired or became stale, and to detach all closed units when
+ * flush_idle_units() asked for it.
+ */
+static void
+expire_idle_units(int expired_only)
+{
+    unit_list_t *cur;
+
+    while ((cur = unit_unlink(expired_only)) != NULL) {
+        detach(cur->periph);
+        FreeMem(cur, sizeof (*cur));
+    }
+}
+
+static void
+detach_unit(struct scsipi_periph *periph)
+{
+    struct IOStdReq ior;
+
+    ior.io_Message.mn_ReplyPort = CreateMsgPort();
+    ior.io_Command = CMD_DETACH;
+    ior.io_Unit = (struct Unit *) periph;
+
+    PutMsg(myPort, &ior.io_Message);
+    WaitPort(ior.io_Message.mn_ReplyPort);
+    DeleteMsgPort(ior.io_Message.mn_ReplyPort);
+}
+
+/*
+ * flush_idle_units
+ * ----------------
+ * Asks the command handler to detach all closed units, so that a later
+ * expunge can succeed. Called from Expunge, which may run under Forbid()
+ * in a low memory AllocMem() of any task, the handler included, so this
+ * only signals the handler and never waits for it.
+ */
+void
+flush_idle_units(void)
+{
+    if (myPort == NULL)
+        return;
+    idle_flush = 1;
+    Signal(myPort->mp_SigTask, BIT(myPort->mp_SigBit));
+}
+
 int
 open_unit(uint scsi_target, void **io_Unit, uint flags)
 {
+    unit_list_t *parent = NULL;
     unit_list_t *cur;
-    for (cur = unit_list; cur != NULL; cur = cur->next) {
+
+    Forbid();
+    for (cur = unit_list; cur != NULL; parent = cur, cur = cur->next) {
         if (cur->scsi_target == scsi_target) {
+            if ((cur->count == 0) && unit_is_stale(cur)) {
+                /* Closed unit is no longer valid; attach it again */
+                if (parent == NULL)
+                    unit_list = cur->next;
+                else
+                    parent->next = cur->next;
+                break;
+            }
             cur->count++;
+            cur->periph->periph_flags |= PERIPH_OPEN;
+            Permit();
             *io_Unit = cur->periph;
             return (0);
         }
     }
+    Permit();
+
+    if (cur != NULL) {
+        detach_unit(cur->periph);
+        FreeMem(cur, sizeof (*cur));
+    }
+
     if (flags & TDF_DEBUG_OPEN)
         return (ERROR_BAD_UNIT);  // This flag only grabs already open device
 
@@ -993,8 +1303,11 @@ open_unit(uint scsi_target, void **io_Unit, uint flags)
     cur->count = 1;
     cur->periph = (struct scsipi_periph *) ior.io_Unit;
     cur->scsi_target = scsi_target;
+    Forbid();
+    cur->periph->periph_flags |= PERIPH_OPEN;
     cur->next = unit_list;
     unit_list = cur;
+    Permit();
     return (0);
 }
 
@@ -1002,31 +1315,25 @@ void
 close_unit(void *io_Unit)
 {
     struct scsipi_periph *periph = io_Unit;
-    unit_list_t *parent = NULL;
     unit_list_t *cur;
-    for (cur = unit_list; cur != NULL; parent = cur, cur = cur->next) {
-        if (cur->periph == periph) {
-            if (--cur->count > 0)
-                return;  // Peripheral is still open
 
-            /* Remove device from list */
-            if (parent == NULL)
-                unit_list = cur->next;
-            else
-                parent->next = cur->next;
-            FreeMem(cur, sizeof (*cur));
-
-            /* Detach (close) peripheral */
-            struct IOStdReq ior;
-            ior.io_Message.mn_ReplyPort = CreateMsgPort();
-            ior.io_Command = CMD_DETACH;
-            ior.io_Unit = (struct Unit *) periph;
-
-            PutMsg(myPort, &ior.io_Message);
-            WaitPort(ior.io_Message.mn_ReplyPort);
-            DeleteMsgPort(ior.io_Message.mn_ReplyPort);
+    Forbid();
+    for (cur = unit_list; cur != NULL; cur = cur->next) {
+        if (cur->periph == periph) {
+            if (--cur->count == 0) {
+                /*
+                 * Keep the peripheral attached; the command handler
+                 * detaches it once it has been idle long enough.
+                 */
+                periph->periph_flags &= ~PERIPH_OPEN;
+                cur->idle_since  = asave->as_ticks;
+                cur->reset_count = periph->periph_channel->chan_reset_count;
+                cur->changenum   = periph->periph_changenum;
+            }
+            Permit();
             return;
         }
     }
+    Permit();
     printf("Could not find unit %p to close\n", periph);
 }
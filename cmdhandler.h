@@ -16,10 +16,12 @@
 
 int open_unit(uint scsi_target, void **io_Unit, uint flags);
 void close_unit(void *io_Unit);
+void flush_idle_units(void);
 
 int start_cmd_handler(uint *boardnum);
 void stop_cmd_handler(void);
 void cmd_complete(void *ior, int8_t rc);
+int abort_io(struct IORequest *ior);
 
 void td_addchangeint(struct IORequest *ior);
 void td_remchangeint(struct IORequest *ior);
@@ -39,6 +39,8 @@
 #include "bootmenu.h"
 #include "romfile.h"
 #include "attach.h"
+#include "iotrace.h"
+#include "bootlog.h"
 
 #ifdef DEBUG
 #include <clib/debug_protos.h>
@@ -53,6 +55,7 @@ struct ExecBase *SysBase __attribute__((aligned(4)));
 struct MsgPort *myPort __attribute__((aligned(4)));
 
 static BPTR saved_seg_list;
+static struct Library *saved_dev;
 
 /*
  * -----------------------------------------------------------
@@ -91,7 +94,20 @@ asm("romtag:                                \n"
     "       dc.l    _device_name            \n"
     "       dc.l    _device_id_string       \n"
     "       dc.l    _init                   \n"
-    "endcode:                               \n");
+    "endcode:                               \n"
+#ifdef ENABLE_BOOTLOG
+    /*
+     * DiagEntry in rom.S stores a tag and the CIA-B TOD before and
+     * after relocating the driver here, right behind the romtag.
+     * It checks for BOOTLOG_EMPTY first, since the ROM may have been
+     * built with another driver (romtool -D).
+     */
+    "       .balign 4                       \n"
+    "       .globl  _boot_stamp             \n"
+    "_boot_stamp:                           \n"
+    "       dc.l    "XSTR(BOOTLOG_EMPTY)",0,0 \n"
+#endif
+    );
 
 static const char device_name[]      = DEVICE_NAME;
 char real_device_name[17];
@@ -162,6 +178,7 @@ init_device(BPTR seg_list asm("a0"), struct Library *dev asm("d0"))
 
     /* save pointer to our loaded code (the SegList) */
     saved_seg_list = seg_list;
+    saved_dev = dev;
 
     get_device_name();
     dev->lib_Node.ln_Type = NT_DEVICE;
@@ -203,6 +220,14 @@ drv_expunge(struct Library *dev asm("a6"))
 {
     ObtainSemaphore(&entry_sem);
 
+    /*
+     * Closed units kept attached for a quick reopen must go. The handler
+     * detaches them on its own and then finishes the expunge itself, see
+     * drv_expunge_deferred().
+     */
+    if (dev->lib_OpenCnt == 0)
+        flush_idle_units();
+
     if ((dev->lib_OpenCnt != 0) || periph_still_attached()) {
         printf("expunge() device still open\n");
         dev->lib_Flags |= LIBF_DELEXP;  // Indicate I'll expunge myself later
@@ -224,6 +249,60 @@ drv_expunge(struct Library *dev asm("a6"))
     return (seg_list);
 }
 
+/*
+ * drv_expunge_deferred
+ * --------------------
+ * Called by the command handler after it detached the idle units which
+ * made drv_expunge() refuse. exec does not call Expunge again, and with
+ * no opener left no Close will come to do it, so the expunge finishes
+ * here. Returns nonzero with the device already off the device list; the
+ * handler then shuts down and calls drv_free() as its last action.
+ */
+int
+drv_expunge_deferred(void)
+{
+    struct Library *dev = saved_dev;
+    int gone = 0;
+
+    ObtainSemaphore(&entry_sem);
+    Forbid();
+    if ((dev->lib_Flags & LIBF_DELEXP) && (dev->lib_OpenCnt == 0) &&
+        !periph_still_attached()) {
+        printf("expunge() %s from handler\n", device_id_string);
+        Remove(&dev->lib_Node);
+        gone = 1;
+    }
+    Permit();
+    ReleaseSemaphore(&entry_sem);
+    return (gone);
+}
+
+/*
+ * drv_free
+ * --------
+ * Frees the device and unloads the driver once drv_expunge_deferred()
+ * removed it. Called by the command handler under Forbid() right before
+ * it ends. The handler runs from the segment being unloaded; FreeMem()
+ * only touches the first bytes of each hunk and nothing can reuse the
+ * memory until the task is gone and Forbid() is broken.
+ */
+void
+drv_free(void)
+{
+    struct Library *dev = saved_dev;
+    struct DosLibrary *DOSBase;
+
+    FreeMem((char *)dev - dev->lib_NegSize,
+            dev->lib_NegSize + dev->lib_PosSize);
+    if (saved_seg_list == 0)
+        return;  // Started from ROM
+    DOSBase = (struct DosLibrary *)OpenLibrary("dos.library", 36);
+    if (DOSBase == NULL)
+        return;
+    UnLoadSeg(saved_seg_list);
+    CloseLibrary(&DOSBase->dl_lib);
+}
+
 /*
  * drv_open
  * --------
@@ -304,6 +383,10 @@ drv_begin_io(struct Library *dev asm("a6"), struct IORequest *ior asm("a1"))
 {
     (void)dev;
 
+#ifdef ENABLE_IOTRACE
+    iotrace_record(ior);
+#endif
+
     /* These commands are forced to always execute in immediate mode */
     switch (ior->io_Command) {
         case TD_REMCHANGEINT:
@@ -336,7 +419,7 @@ drv_begin_io(struct Library *dev asm("a6"), struct IORequest *ior asm("a1"))
     }
 
     /* All other commands must be pushed to the driver task */
-    ior->io_Flags &= ~IOF_QUICK;
+    ior->io_Flags &= ~(IOF_QUICK | IOF_ABORTREQ);
     PutMsg(myPort, &ior->io_Message);
 }
 
@@ -345,11 +428,10 @@ static ULONG __used __saveds
 drv_abort_io(struct Library *dev asm("a6"), struct IORequest *ior asm("a1"))
 {
     (void)dev;
-    (void)ior;
 
     printf("abort_io(%d)\n", ior->io_Command);
 
-    return (IOERR_NOCMD);
+    return (abort_io(ior));
 }
 
 static const ULONG device_vectors[] =
@@ -440,7 +522,13 @@ static int mount_drives(struct ConfigDev *cd, struct Library *dev)
 	ms.ignoreLast = asave->ignore_last;
 	ms.hostId = hostid;
 
+#ifdef ENABLE_BOOTLOG
+	bootlog_mark(BL_MOUNT);
+#endif
 	ret = MountDrive(&ms);
+#ifdef ENABLE_BOOTLOG
+	bootlog_mark(BL_MOUNT_DONE);
+#endif
 
 	printf("ret = %x\nunitNum = { ", ret);
 	for (i=0; i<max_targets; i++)
@@ -460,6 +548,10 @@ init(BPTR seg_list asm("a0"), struct Library *dev asm("d0"))
 
     if (seg_list == 0)
         romboot = TRUE;
+#ifdef ENABLE_BOOTLOG
+    if (romboot)
+        bootlog_init();
+#endif
 
     struct Library *mydev = MakeLibrary((ULONG *)&device_vectors, NULL,
             (APTR)init_device, sizeof(struct Library), seg_list);
@@ -470,7 +562,17 @@ init(BPTR seg_list asm("a0"), struct Library *dev asm("d0"))
 
         if (romboot) {
             mount_drives(asave->as_cd, dev);
+#ifdef ENABLE_TOPOCACHE
+            topo_commit();
+#endif
+#ifdef ENABLE_BOOTLOG
+            bootlog_mark(BL_MENU);
+#endif
             boot_menu();
+#ifdef ENABLE_BOOTLOG
+            bootlog_mark(BL_MENU_DONE);
+            bootlog_close();
+#endif
         }
     }
 
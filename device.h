@@ -35,6 +35,9 @@
 
 #define TDF_DEBUG_OPEN    (1<<7)  // Open unit in debug mode (no I/O)
 
+#define IOB_ABORTREQ      7       // io_Flags: AbortIO() was called
+#define IOF_ABORTREQ      (1<<IOB_ABORTREQ)
+
 #define HD_WIDESCSI       8       // Wide SCSI detection bit
 
 /*
@@ -76,4 +79,7 @@
 extern struct MsgPort *myPort;
 extern char real_device_name[];
 
+int drv_expunge_deferred(void);
+void drv_free(void);
+
 #endif /* _DEVICE_H */
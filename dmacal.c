@@ -0,0 +1,208 @@
+//
+// Copyright 2026 Stefan Reinauer
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+
+#ifdef DEBUG_ATTACH
+#define USE_SERIAL_OUTPUT
+#endif
+#include "port.h"
+#include "printf.h"
+#include <string.h>
+#include <sys/param.h>
+#include <exec/memory.h>
+
+#include "device.h"
+#include "scsi_all.h"
+#include "scsipi_all.h"
+#include "scsipiconf.h"
+#include "sys_queue.h"
+#include "siopreg.h"
+#include "siopvar.h"
+#include "attach.h"
+#include "battmem.h"
+#include "dmacal.h"
+
+#ifdef ENABLE_DMA_CALIBRATION
+
+#define CAL_LEN       (32 << 10)    /* Bytes per SCRIPTS memory move */
+#define CAL_PASSES    16            /* Moves timed per burst length */
+#define CAL_INTCODE   0xff40        /* DSPS of the terminating INT */
+#define CAL_WAIT      1000000       /* ISTAT polls before giving up */
+
+/*
+ * dma_burst_load
+ * --------------
+ * Apply a burst length saved by an earlier calibration. Called before
+ * the first chip reset so that reset programs the calibrated DMODE.
+ */
+void
+dma_burst_load(struct siop_softc *sc)
+{
+    if (asave->dma_burst == 0)
+        return;
+
+    sc->sc_dmode = (sc->sc_dmode & ~SIOP_DMODE_BL_MASK) |
+                   ((asave->dma_burst - 1) << 6);
+    printf("DMA burst %u (saved)\n", SIOP_BURST_LEN(asave->dma_burst - 1));
+}
+
+/*
+ * cal_run
+ * -------
+ * Start the memory move script and poll for its completion with chip
+ * interrupts masked. Returns 0 on success, 1 if the script stopped for
+ * any other reason, and -1 if it had to be aborted.
+ */
+static int
+cal_run(siop_regmap_p rp, uint32_t *script)
+{
+    uint8_t dstat;
+    int     count;
+
+    rp->siop_dsp = kvtop(script);
+    for (count = 0; count < CAL_WAIT; count++)
+        if (rp->siop_istat & (SIOP_ISTAT_SIP | SIOP_ISTAT_DIP))
+            break;
+    if (count == CAL_WAIT) {
+        rp->siop_istat |= SIOP_ISTAT_ABRT;
+        return (-1);
+    }
+#if defined(ARCH_710)
+    /* DSTAT and SSTAT0 must be read together, see irq_handler_core() */
+    dstat = *ADDR32((uintptr_t) &rp->siop_sstat2);
+#else
+    dstat = rp->siop_dstat;
+#endif
+    if ((dstat & ~SIOP_DSTAT_DFE) != SIOP_DSTAT_SIR ||
+        rp->siop_dsps != CAL_INTCODE)
+        return (1);
+    return (0);
+}
+
+/*
+ * dma_burst_calibrate
+ * -------------------
+ * If no burst length was saved, time SCRIPTS memory-to-memory moves at
+ * every DMODE burst length and keep the fastest one which copied the
+ * data intact. The result is saved to NVRAM (A4092) or BattMem so that
+ * later boots skip the measurement. Per-length results are left in
+ * sc_burst_kbs[] for a4091d.
+ *
+ * Returns non-zero if the chip had to be aborted and must be reset.
+ */
+int
+dma_burst_calibrate(struct siop_softc *sc)
+{
+    siop_regmap_p rp = sc->sc_siopp;
+    uint8_t  *buf;
+    uint32_t *src;
+    uint32_t *dst;
+    uint32_t *script;
+    void     *eclock;
+    uint32_t  freq;
+    uint32_t  start;
+    uint32_t  ticks;
+    uint      bl;
+    uint      pass;
+    uint      i;
+    int       best = -1;
+    int       aborted = 0;
+    int       rc = 0;
+
+    if (asave->dma_burst != 0)
+        return (0);
+
+    buf = AllocMem(CAL_LEN * 2 + 32, MEMF_PUBLIC);
+    if (buf == NULL)
+        return (0);
+    if (is_zorro_ii_address(buf, CAL_LEN * 2 + 32) ||
+        (eclock = eclock_open()) == NULL) {
+        FreeMem(buf, CAL_LEN * 2 + 32);
+        return (0);
+    }
+
+    src = (uint32_t *) buf;
+    dst = (uint32_t *) (buf + CAL_LEN);
+    script = (uint32_t *) (buf + CAL_LEN * 2);
+    for (i = 0; i < CAL_LEN / 4; i++)
+        src[i] = 0xa5c30f00 ^ (i * 0x01010101);
+    script[0] = 0xc0000000 | CAL_LEN;   /* Memory move */
+    script[1] = kvtop(src);
+    script[2] = kvtop(dst);
+    script[3] = 0x98080000;             /* Interrupt */
+    script[4] = CAL_INTCODE;
+    CacheClearE(buf, CAL_LEN * 2 + 32, CACRF_ClearD);
+
+    /* Keep irq_handler_core() away from the chip while polling */
+    sc->sc_flags |= SIOP_INTSOFF;
+    rp->siop_sien = 0;
+    rp->siop_dien = 0;
+
+    for (bl = 0; bl < ARRAY_SIZE(sc->sc_burst_kbs); bl++) {
+        sc->sc_burst_kbs[bl] = 0;
+        rp->siop_dmode = (sc->sc_dmode & ~SIOP_DMODE_BL_MASK) | (bl << 6);
+
+        memset(dst, 0, CAL_LEN);
+        CacheClearE(dst, CAL_LEN, CACRF_ClearD);
+
+        start = eclock_read(eclock, &freq);
+        for (pass = 0; pass < CAL_PASSES; pass++)
+            if ((rc = cal_run(rp, script)) != 0)
+                break;
+        ticks = eclock_read(eclock, NULL) - start;
+
+        if (rc != 0) {
+            printf("DMA burst %u failed\n", SIOP_BURST_LEN(bl));
+            if (rc < 0) {
+                aborted = 1;
+                break;
+            }
+            continue;
+        }
+        CacheClearE(dst, CAL_LEN, CACRF_ClearD);
+        if (memcmp(src, dst, CAL_LEN) != 0) {
+            printf("DMA burst %u miscompare\n", SIOP_BURST_LEN(bl));
+            continue;
+        }
+        if (ticks == 0)
+            ticks = 1;
+        /* Each move reads and writes CAL_LEN bytes; fits 32 bits */
+        sc->sc_burst_kbs[bl] = CAL_PASSES * (CAL_LEN * 2 / 1024) *
+                               freq / ticks;
+        printf("DMA burst %u: %lu KB/s\n", SIOP_BURST_LEN(bl),
+               sc->sc_burst_kbs[bl]);
+        if (best < 0 || sc->sc_burst_kbs[bl] > sc->sc_burst_kbs[best])
+            best = bl;
+    }
+
+    eclock_close(eclock);
+    FreeMem(buf, CAL_LEN * 2 + 32);
+
+    if (best >= 0) {
+        sc->sc_dmode = (sc->sc_dmode & ~SIOP_DMODE_BL_MASK) | (best << 6);
+        asave->dma_burst = best + 1;
+        Save_BattMem();
+#if defined(FLASH_PARALLEL) || defined(FLASH_SPI)
+        Nvram_CommitDirty();
+#endif
+    }
+    rp->siop_dmode = sc->sc_dmode;
+
+    sc->sc_flags &= ~SIOP_INTSOFF;
+    if (!aborted) {
+        rp->siop_sien = sc->sc_sien;
+        rp->siop_dien = sc->sc_dien;
+    }
+    return (aborted);
+}
+
+#endif /* ENABLE_DMA_CALIBRATION */
@@ -0,0 +1,11 @@
+#ifndef DMACAL_H
+#define DMACAL_H
+
+#ifdef ENABLE_DMA_CALIBRATION
+struct siop_softc;
+
+void dma_burst_load(struct siop_softc *sc);
+int  dma_burst_calibrate(struct siop_softc *sc);
+#endif
+
+#endif /* DMACAL_H */
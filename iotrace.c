@@ -0,0 +1,127 @@
+//
+// Copyright 2026 Stefan Reinauer
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+
+#ifdef DEBUG_CMDHANDLER
+#define USE_SERIAL_OUTPUT
+#endif
+#include "port.h"
+#include "printf.h"
+#include <string.h>
+#include <exec/memory.h>
+#include <exec/io.h>
+#include <devices/trackdisk.h>
+
+#include "device.h"
+#include "scsi_all.h"
+#include "scsipiconf.h"
+#include "sys_queue.h"
+#include "attach.h"
+#include "nsd.h"
+#include "cmdhandler.h"
+#include "iotrace.h"
+
+#ifdef ENABLE_IOTRACE
+
+/*
+ * iotrace_init
+ * ------------
+ * Allocate the I/O trace ring. Capture stays off until a tool sets
+ * it_active. A failure here only means there is no trace.
+ */
+void
+iotrace_init(void)
+{
+    struct iotrace *it;
+    uint32_t        freq;
+
+    it = AllocMem(sizeof (*it), MEMF_CLEAR | MEMF_PUBLIC);
+    if (it == NULL)
+        return;
+    it->it_timer = eclock_open();
+    if (it->it_timer == NULL) {
+        FreeMem(it, sizeof (*it));
+        return;
+    }
+    (void) eclock_read(it->it_timer, &freq);
+    it->it_freq  = freq;
+    it->it_magic = IOTRACE_MAGIC;
+    asave->as_iotrace = it;
+}
+
+/*
+ * iotrace_record
+ * --------------
+ * Called from BeginIO, in the context of the requesting task. Each
+ * record is written with interrupts disabled, so a reader which sees
+ * it_head advance past a record sees all of it.
+ */
+void
+iotrace_record(struct IORequest *ior)
+{
+    struct IOStdReq      *io = (struct IOStdReq *) ior;
+    struct scsipi_periph *periph = (struct scsipi_periph *) io->io_Unit;
+    struct iotrace       *it;
+    struct iotrace_rec   *rec;
+    uint64_t              offset = io->io_Offset;
+    uint32_t              now;
+
+    if (asave == NULL || (it = asave->as_iotrace) == NULL ||
+        it->it_active == 0 || periph == NULL)
+        return;
+
+    switch (io->io_Command) {
+        case TD_READ64:
+        case TD_WRITE64:
+        case TD_SEEK64:
+        case TD_FORMAT64:
+        case NSCMD_TD_READ64:
+        case NSCMD_TD_WRITE64:
+        case NSCMD_TD_SEEK64:
+        case NSCMD_TD_FORMAT64:
+        case NSCMD_TD_READV64:
+        case NSCMD_TD_WRITEV64:
+        case NSCMD_ETD_READ64:
+        case NSCMD_ETD_WRITE64:
+        case NSCMD_ETD_SEEK64:
+        case NSCMD_ETD_FORMAT64:
+            offset |= (uint64_t) io->io_Actual << 32;
+            break;
+    }
+
+    now = eclock_read(it->it_timer, NULL);
+
+    Disable();
+    rec = &it->it_ring[it->it_head & (IOTRACE_RECS - 1)];
+    rec->it_time    = now;
+    rec->it_command = io->io_Command;
+    rec->it_target  = periph->periph_target;
+    rec->it_lun     = periph->periph_lun;
+    rec->it_block   = offset >> 9;
+    rec->it_length  = io->io_Length;
+    it->it_head++;
+    Enable();
+}
+
+void
+iotrace_free(void)
+{
+    struct iotrace *it = asave->as_iotrace;
+
+    if (it == NULL)
+        return;
+    asave->as_iotrace = NULL;
+    eclock_close(it->it_timer);
+    FreeMem(it, sizeof (*it));
+}
+
+#endif /* ENABLE_IOTRACE */
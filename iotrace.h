@@ -0,0 +1,72 @@
+//
+// Copyright 2026 Stefan Reinauer
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+
+#ifndef _IOTRACE_H
+#define _IOTRACE_H
+
+#include <stdint.h>
+
+/*
+ * I/O trace (ENABLE_IOTRACE)
+ *
+ * While capture is active, the driver's BeginIO stores one record per
+ * IORequest in a ring reached through as_iotrace. "a4091d -t" drains
+ * the ring to a trace file, which a4091replay plays back against a unit.
+ *
+ * In the ring, it_time holds the low 32 bits of the E-clock when the
+ * request arrived. In a trace file it holds the E-clock ticks since the
+ * previous record instead.
+ */
+#define IOTRACE_MAGIC    0x494f5452      /* "IOTR" */
+#define IOTRACE_VERSION  2
+#define IOTRACE_RECS     1024            /* Ring size, must be a power of 2 */
+
+struct iotrace_rec {
+    uint32_t it_time;           /* E-clock at BeginIO (delta in files) */
+    uint16_t it_command;        /* io_Command */
+    uint8_t  it_target;
+    uint8_t  it_lun;
+    uint64_t it_block;          /* Byte offset / 512 */
+    uint32_t it_length;         /* io_Length in bytes */
+};
+
+/* Driver side ring */
+struct iotrace {
+    uint32_t           it_magic;         /* IOTRACE_MAGIC */
+    uint32_t           it_freq;          /* E-clock ticks per second */
+    volatile uint32_t  it_head;          /* Records ever written */
+    volatile uint8_t   it_active;        /* Set by the capture tool */
+    uint8_t            it_reserved[3];
+    void              *it_timer;         /* eclock_open() handle */
+    struct iotrace_rec it_ring[IOTRACE_RECS];
+};
+
+/* Trace file header, followed by itf_count records */
+struct iotrace_file {
+    uint32_t itf_magic;         /* IOTRACE_MAGIC */
+    uint16_t itf_version;       /* IOTRACE_VERSION */
+    uint16_t itf_recsize;       /* sizeof (struct iotrace_rec) */
+    uint32_t itf_freq;          /* E-clock ticks per second */
+    uint32_t itf_count;         /* Records in the file */
+    uint32_t itf_lost;          /* Records overwritten before capture */
+};
+
+#ifdef ENABLE_IOTRACE
+struct IORequest;
+
+void iotrace_init(void);
+void iotrace_record(struct IORequest *ior);
+void iotrace_free(void);
+#endif
+
+#endif /* _IOTRACE_H */
@@ -0,0 +1,301 @@
+//
+// Copyright 2026 Stefan Reinauer
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+
+#ifdef DEBUG_SIOP
+#define USE_SERIAL_OUTPUT
+#endif
+#include "port.h"
+#include "printf.h"
+#include <string.h>
+#include <sys/param.h>
+#include <exec/memory.h>
+
+#include "device.h"
+#include "scsi_all.h"
+#include "scsi_disk.h"
+#include "scsi_spc.h"
+#include "scsipi_all.h"
+#include "scsipi_disk.h"
+#include "scsipiconf.h"
+#include "sys_queue.h"
+#include "attach.h"
+#include "nsd.h"
+#include "loopback.h"
+
+#ifdef ENABLE_LOOPBACK
+
+#define LB_BLKSIZE  512
+#define LB_SIZE     ((ULONG) LOOPBACK_BLOCKS * LB_BLKSIZE)
+
+static uint8_t *lb_store;
+static TAILQ_HEAD(, scsipi_xfer) lb_done;
+
+/*
+ * lb_sense
+ * --------
+ * Fail the xfer with CHECK CONDITION and fill in its sense data, the
+ * same as an adapter which fetched the sense data on its own would.
+ */
+static void
+lb_sense(struct scsipi_xfer *xs, uint key, uint asc)
+{
+    struct scsi_sense_data *sense = &xs->sense.scsi_sense;
+
+    memset(sense, 0, sizeof (*sense));
+    sense->response_code = SSD_RCODE_CURRENT;
+    sense->flags = key;
+    sense->extra_len = 10;
+    sense->asc = asc;
+    xs->status = SCSI_CHECK;
+    xs->error = XS_SENSE;
+}
+
+/*
+ * lb_copy
+ * -------
+ * Move data between the caller's buffer (flat or vectored) and buf.
+ * Returns the number of bytes moved.
+ */
+static ULONG
+lb_copy(struct scsipi_xfer *xs, uint8_t *buf, ULONG len)
+{
+    const struct NSIOVec *iov = xs->xs_iov;
+    int    iovcnt = xs->xs_iovcnt;
+    int    to_dev = (xs->xs_control & XS_CTL_DATA_OUT);
+    ULONG  done = 0;
+    ULONG  count;
+    APTR   addr;
+
+    if (len > (ULONG) xs->datalen)
+        len = xs->datalen;
+    if (iov == NULL) {
+        addr = xs->data;
+        count = len;
+        iovcnt = 1;
+    }
+    while (done < len && iovcnt-- > 0) {
+        if (iov != NULL) {
+            addr = iov->iov_Base;
+            count = iov->iov_Len;
+            iov++;
+        }
+        if (count > len - done)
+            count = len - done;
+        if (to_dev)
+            CopyMem(addr, buf + done, count);
+        else
+            CopyMem(buf + done, addr, count);
+        done += count;
+    }
+    return (done);
+}
+
+/*
+ * lb_reply
+ * --------
+ * Return a small data-in reply, truncated to the allocation length.
+ */
+static void
+lb_reply(struct scsipi_xfer *xs, uint8_t *buf, ULONG len)
+{
+    xs->resid = xs->datalen - lb_copy(xs, buf, len);
+}
+
+/*
+ * lb_rw
+ * -----
+ * READ or WRITE of len blocks at lba against the RAM store.
+ */
+static void
+lb_rw(struct scsipi_xfer *xs, uint64_t lba, ULONG len)
+{
+    ULONG bytes;
+
+    if (lba > LOOPBACK_BLOCKS || len > LOOPBACK_BLOCKS - lba) {
+        lb_sense(xs, SKEY_ILLEGAL_REQUEST, 0x21);  /* LBA out of range */
+        return;
+    }
+    bytes = len * LB_BLKSIZE;
+    xs->resid = xs->datalen - lb_copy(xs, lb_store + lba * LB_BLKSIZE, bytes);
+}
+
+static void
+lb_execute(struct scsipi_xfer *xs)
+{
+    const uint8_t *cdb = (const uint8_t *) xs->cmd;
+    uint8_t        buf[36];
+
+    xs->status = SCSI_OK;
+    xs->error = XS_NOERROR;
+    xs->resid = xs->datalen;
+
+    if (xs->xs_periph->periph_lun != 0) {
+        if (cdb[0] == INQUIRY) {
+            memset(buf, 0, sizeof (buf));
+            buf[0] = SID_QUAL_LU_NOT_SUPP | T_NODEVICE;
+            lb_reply(xs, buf, sizeof (buf));
+        } else {
+            lb_sense(xs, SKEY_ILLEGAL_REQUEST, 0x25);  /* LUN not supported */
+        }
+        return;
+    }
+
+    switch (cdb[0]) {
+        case SCSI_TEST_UNIT_READY:
+        case START_STOP:
+        case SCSI_PREVENT_ALLOW_MEDIUM_REMOVAL:
+        case SCSI_SYNCHRONIZE_CACHE_10:
+        case SCSI_SYNCHRONIZE_CACHE_16:
+        case SCSI_SEEK_6_COMMAND:
+        case SCSI_SEEK_10_COMMAND:
+            break;
+        case INQUIRY: {
+            struct scsipi_inquiry_data *inq = (void *) buf;
+
+            memset(buf, 0, sizeof (buf));
+            inq->device = T_DIRECT;
+            inq->version = 2;
+            inq->response_format = SID_FORMAT_ISO;
+            inq->additional_length = sizeof (buf) - 5;
+            memcpy(inq->vendor, "A4091   ", sizeof (inq->vendor));
+            memcpy(inq->product, "RAM loopback    ", sizeof (inq->product));
+            memcpy(inq->revision, "1.0 ", sizeof (inq->revision));
+            lb_reply(xs, buf, sizeof (buf));
+            break;
+        }
+        case SCSI_REQUEST_SENSE:
+            memset(buf, 0, 18);
+            buf[0] = SSD_RCODE_CURRENT;
+            buf[7] = 10;
+            lb_reply(xs, buf, 18);
+            break;
+        case SCSI_MODE_SENSE_6:
+            /* Header and an all-zero page: not write protected */
+            memset(buf, 0, sizeof (buf));
+            buf[0] = sizeof (buf) - 1;
+            buf[4] = cdb[2] & SMS_PAGE_MASK;
+            buf[5] = sizeof (buf) - 6;
+            lb_reply(xs, buf, MIN(sizeof (buf), cdb[4]));
+            break;
+        case READ_CAPACITY_10:
+            _lto4b(LOOPBACK_BLOCKS - 1, buf);
+            _lto4b(LB_BLKSIZE, buf + 4);
+            lb_reply(xs, buf, 8);
+            break;
+        case SERVICE_ACTION_IN:
+            if ((cdb[1] & 0x1f) != SRC16_READ_CAPACITY) {
+                lb_sense(xs, SKEY_ILLEGAL_REQUEST, 0x24);
+                break;
+            }
+            memset(buf, 0, 32);
+            _lto8b(LOOPBACK_BLOCKS - 1, buf);
+            _lto4b(LB_BLKSIZE, buf + 8);
+            lb_reply(xs, buf, MIN(32, _4btol(cdb + 10)));
+            break;
+        case SCSI_READ_6_COMMAND:
+        case SCSI_WRITE_6_COMMAND:
+            lb_rw(xs, _3btol(cdb + 1) & 0x1fffff, cdb[4] ? cdb[4] : 256);
+            break;
+        case READ_10:
+        case WRITE_10:
+            lb_rw(xs, _4btol(cdb + 2), _2btol(cdb + 7));
+            break;
+        case READ_12:
+        case WRITE_12:
+            lb_rw(xs, _4btol(cdb + 2), _4btol(cdb + 6));
+            break;
+        case READ_16:
+        case WRITE_16:
+            lb_rw(xs, _8btol(cdb + 2), _4btol(cdb + 10));
+            break;
+        default:
+            lb_sense(xs, SKEY_ILLEGAL_REQUEST, 0x20);  /* Invalid opcode */
+            break;
+    }
+}
+
+/*
+ * loopback_request
+ * ----------------
+ * Run an xfer addressed to the loopback target without touching the
+ * chip. Returns 0 if the xfer is for some other target.
+ *
+ * The command is carried out right away, but completion is deferred to
+ * the next pass of the interrupt handler, so a request takes the same
+ * path through the handler task as one which went out on the bus.
+ * Polled xfers are completed before returning.
+ */
+int
+loopback_request(struct scsipi_xfer *xs)
+{
+    if (xs->xs_periph->periph_target != LOOPBACK_TARGET)
+        return (0);
+
+    if (lb_done.tqh_last == NULL)
+        TAILQ_INIT(&lb_done);
+
+    if (lb_store == NULL) {
+        lb_store = AllocMem(LB_SIZE, MEMF_PUBLIC | MEMF_CLEAR);
+        if (lb_store == NULL)
+            printf("loopback: no memory for %lu bytes\n", LB_SIZE);
+    }
+    if (lb_store == NULL) {
+        xs->status = SCSI_OK;
+        xs->error = XS_SELTIMEOUT;
+    } else {
+        lb_execute(xs);
+    }
+
+    if (xs->xs_control & XS_CTL_POLL) {
+        scsipi_done(xs);
+        return (1);
+    }
+    TAILQ_INSERT_TAIL(&lb_done, xs, channel_q);
+    Signal(asave->as_svc_task, BIT(asave->as_irq_signal));
+    return (1);
+}
+
+/*
+ * loopback_finish
+ * ---------------
+ * Complete the xfers run since the last call. Called from the interrupt
+ * handler. Xfers which are started by these completions are left for
+ * the next pass.
+ */
+void
+loopback_finish(void)
+{
+    struct scsipi_xfer *xs;
+    struct scsipi_xfer *next;
+
+    if (lb_done.tqh_first == NULL)
+        return;
+
+    xs = lb_done.tqh_first;
+    TAILQ_INIT(&lb_done);
+    for (; xs != NULL; xs = next) {
+        next = xs->channel_q.tqe_next;
+        scsipi_done(xs);
+    }
+}
+
+void
+loopback_free(void)
+{
+    if (lb_store != NULL) {
+        FreeMem(lb_store, LB_SIZE);
+        lb_store = NULL;
+    }
+}
+
+#endif /* ENABLE_LOOPBACK */
@@ -0,0 +1,23 @@
+#ifndef LOOPBACK_H
+#define LOOPBACK_H
+
+#ifdef ENABLE_LOOPBACK
+/*
+ * The loopback unit answers for one SCSI target from a RAM disk instead
+ * of the bus. It shadows any real device with the same ID.
+ */
+#ifndef LOOPBACK_TARGET
+#define LOOPBACK_TARGET   6
+#endif
+#ifndef LOOPBACK_BLOCKS
+#define LOOPBACK_BLOCKS   2048          /* 512-byte blocks (1 MB) */
+#endif
+
+struct scsipi_xfer;
+
+int  loopback_request(struct scsipi_xfer *xs);
+void loopback_finish(void);
+void loopback_free(void);
+#endif
+
+#endif /* LOOPBACK_H */
@@ -26,6 +26,43 @@
 #define NSCMD_ETD_SEEK64    0xE002
 #define NSCMD_ETD_FORMAT64  0xE003
 
+/*
+ * Vectored (scatter/gather) I/O - A4091 driver extension
+ *
+ * Like NSCMD_TD_READ64 / NSCMD_TD_WRITE64, io_Offset and io_Actual hold
+ * the 64-bit byte offset and io_Length the number of bytes to transfer.
+ * io_Data points to an array of struct NSIOVec, which is consumed in
+ * order until io_Length bytes have been described. The whole LBA range
+ * is transferred with a single SCSI command. On completion io_Actual
+ * holds the number of bytes transferred.
+ */
+#define NSCMD_TD_READV64    0xC0A0
+#define NSCMD_TD_WRITEV64   0xC0A1
+
+#define NSIOV_MAX           32  // Maximum number of descriptors per request
+
+struct NSIOVec
+{
+    APTR    iov_Base;               /* start of this buffer         */
+    ULONG   iov_Len;                /* length of this buffer        */
+};
+
+/*
+ * Batched SCSI direct - A4091 driver extension
+ *
+ * io_Data points to an array of struct SCSICmd and io_Length is the
+ * size of that array in bytes. The commands are run in order and the
+ * request is replied once, with io_Actual holding the number of entries
+ * which were run. Each entry reports its own scsi_Status, scsi_Actual
+ * and sense data, and io_Error holds the first failure. Set
+ * SCSICMDVF_STOPONERROR in io_Offset to end the batch at the first
+ * entry which fails, for example with CHECK CONDITION.
+ */
+#define NSCMD_HD_SCSICMDV   0xC0A2
+
+#define SCSICMDV_MAX            64      // Maximum number of SCSICmd entries
+#define SCSICMDVF_STOPONERROR   (1<<0)  // io_Offset: stop at first failure
+
 #define NSDEVTYPE_TRACKDISK 5   // Trackdisk-like block storage device
 
 #define DRIVE_NEWSTYLE          0x4E535459L /* NSTY */
@@ -26,6 +26,8 @@
 #include <clib/exec_protos.h>
 #include <clib/intuition_protos.h>
 #include <devices/timer.h>
+#include <clib/timer_protos.h>
+#include <inline/timer.h>
 #include <intuition/intuition.h>
 #include <inline/intuition.h>
 #include <exec/io.h>
@@ -152,6 +154,49 @@ delay(int usecs)
     delete_timer(tr);
 }
 
+/*
+ * eclock_open
+ * -----------
+ * Opens timer.device so that the E-clock can be read with eclock_read().
+ * This is meant for short benchmarks such as the DMA burst calibration.
+ */
+void *
+eclock_open(void)
+{
+    return (create_timer(UNIT_ECLOCK));
+}
+
+/*
+ * eclock_read
+ * -----------
+ * Returns the low 32 bits of the E-clock counter. The E-clock frequency
+ * is stored in *freq if freq is not NULL.
+ */
+uint32_t
+eclock_read(void *handle, uint32_t *freq)
+{
+    struct timerequest *tr = handle;
+    struct Device *TimerBase = tr->tr_node.io_Device;
+    struct EClockVal ev;
+    ULONG f;
+
+    f = ReadEClock(&ev);
+    if (freq != NULL)
+        *freq = f;
+    return (ev.ev_lo);
+}
+
+/*
+ * eclock_close
+ * ------------
+ * Closes timer.device and frees a handle from eclock_open().
+ */
+void
+eclock_close(void *handle)
+{
+    delete_timer(handle);
+}
+
 const char *
 device_xname(void *ptr)
 {
@@ -81,6 +81,9 @@ bsd_splx(int ilevel)
 #define kvtop(x) ((uint32_t)(x))
 
 void delay(int usecs);
+void *eclock_open(void);
+uint32_t eclock_read(void *handle, uint32_t *freq);
+void eclock_close(void *handle);
 
 #define __UNVOLATILE(x) ((void *)(unsigned long)(volatile void *)(x))
 #define __UNCONST(a) ((void *)(intptr_t)(a))
@@ -51,6 +51,7 @@
 #undef putchar
 #undef vfprintf
 #include <exec/execbase.h>
+#include "ramlog.h"
 
 #include <string.h>
 #include <stdarg.h>
@@ -159,6 +160,169 @@ udiv64_32(uint32_t *remainder, uint64_t value, uint32_t base)
     return quotient;
 }
 
+#ifdef DEBUG_RAMLOG
+struct ramlog ramlog;
+
+#ifdef USE_SERIAL_OUTPUT
+/**
+ * ramlog_reserve() claims space for one record in the RAM log ring.
+ *
+ * The head is advanced with CAS, so a printf() from an interrupt which
+ * arrives in the middle of this just takes the next record. A record
+ * which would run past the end of the ring is preceded by a padding
+ * record up to the end.
+ *
+ * @param [in]  nwords - Length of the record in longwords.
+ *
+ * @return      Index of the first longword of the record in rl_ring[].
+ */
+static uint32_t
+ramlog_reserve(uint32_t nwords)
+{
+    uint32_t old = ramlog.rl_head;
+    uint32_t cur;
+    uint32_t pos;
+    uint32_t pad;
+
+    do {
+        cur = old;
+        pos = cur & (RAMLOG_WORDS - 1);
+        pad = (pos + nwords > RAMLOG_WORDS) ? RAMLOG_WORDS - pos : 0;
+        __asm__ volatile("cas.l %0,%2,%1"
+                         : "+d" (old), "+m" (ramlog.rl_head)
+                         : "d" (cur + pad + nwords)
+                         : "cc", "memory");
+    } while (old != cur);
+
+    if (pad != 0) {
+        if (pad > 1)
+            ramlog.rl_ring[pos + 1] = 0;
+        ramlog.rl_ring[pos] = RAMLOG_TAG | pad;
+        pos = 0;
+    }
+    ramlog.rl_ring[pos] = 0;
+    return (pos);
+}
+
+/**
+ * ramlog_vprintf() stores a format string and its arguments as one record
+ *                  in the RAM log ring.  The format string is walked the
+ *                  same way as kdoprnt() does, only to learn the size of
+ *                  each argument; nothing is formatted here.
+ *
+ * @param [in]  fmt - A printf() format string which stays valid for the
+ *                    life of the driver.
+ * @param [in]  ap  - A pointer to a variable list of arguments.
+ *
+ * @return      Zero.
+ */
+static int
+ramlog_vprintf(const char *fmt, va_list ap)
+{
+    uint32_t   rec[2 + RAMLOG_MAXARGS];
+    char       str[RAMLOG_MAXSTR];
+    const char *start = fmt;
+    uint32_t   nargs = 0;
+    uint32_t   slen = 0;
+    uint32_t   nwords;
+    uint32_t   pos;
+    uint32_t   i;
+    UINTMAX_T  ul;
+    const char *p;
+    int        ch;
+    int        llong;
+
+    for (;;) {
+        while ((ch = *fmt++) != '%')
+            if (ch == '\0')
+                goto done;
+        llong = 0;
+        for (;;) {
+            ch = *fmt++;
+            if (ch == '*' || (ch == '.' && *fmt == '*')) {
+                if (ch == '.')
+                    fmt++;
+                if (nargs < RAMLOG_MAXARGS)
+                    rec[2 + nargs++] = va_arg(ap, int);
+                continue;
+            }
+            if (ch == 'l' && *fmt == 'l') {
+                fmt++;
+                llong = 1;
+                continue;
+            }
+            if (ch == '#' || ch == ' ' || ch == '-' || ch == '+' ||
+                ch == '.' || ch == 'l' || ch == 't' || ch == 'z' ||
+                ((unsigned)ch - '0' <= 9))
+                continue;
+            break;
+        }
+        if (ch == '\0')
+            break;
+        if (nargs + llong >= RAMLOG_MAXARGS)
+            break;
+        switch (ch) {
+            case 'c':
+            case 'd':
+            case 'o':
+            case 'u':
+            case 'p':
+            case 'X':
+            case 'x':
+                if (llong) {
+                    ul = va_arg(ap, uint64_t);
+                    rec[2 + nargs++] = ul >> 32;
+                } else {
+                    ul = va_arg(ap, unsigned int);
+                }
+                rec[2 + nargs++] = (uint32_t) ul;
+                break;
+            case 's':
+                p = va_arg(ap, const char *);
+                if (p == NULL || slen >= sizeof (str)) {
+                    rec[2 + nargs++] = RAMLOG_NULLSTR;
+                    break;
+                }
+                rec[2 + nargs++] = slen;
+                while (*p != '\0' && slen < sizeof (str) - 1)
+                    str[slen++] = *p++;
+                str[slen++] = '\0';
+                break;
+            default:
+                break;
+        }
+    }
+done:
+    nwords = 2 + nargs + (slen + 3) / 4;
+    rec[0] = RAMLOG_TAG | (nargs << 16) | nwords;
+    rec[1] = (uint32_t) start;
+
+    pos = ramlog_reserve(nwords);
+    if (ramlog.rl_magic != RAMLOG_MAGIC) {
+        ramlog.rl_words = RAMLOG_WORDS;
+        ramlog.rl_magic = RAMLOG_MAGIC;
+    }
+    for (i = 1; i < 2 + nargs; i++)
+        ramlog.rl_ring[pos + i] = rec[i];
+    memcpy(&ramlog.rl_ring[pos + 2 + nargs], str, slen);
+    ramlog.rl_ring[pos] = rec[0];
+    return (0);
+}
+
+__attribute__((format(__printf__, 1, 2)))
+static int
+ramlog_printf(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    ramlog_vprintf(fmt, ap);
+    va_end(ap);
+    return (0);
+}
+#endif /* USE_SERIAL_OUTPUT */
+#endif /* DEBUG_RAMLOG */
+
 #ifdef USE_SERIAL_OUTPUT
 static int KPutChar(int ch)
 {
@@ -173,6 +337,7 @@ static int KPutChar(int ch)
     return ch;
 }
 
+#ifndef DEBUG_RAMLOG
 /**
  * KPutS() outputs a null-terminated string to the console by calling KPutChar
  * for each character. This function corresponds to the KPutS/KPutStr
@@ -187,19 +352,28 @@ static void KPutS(const char *str)
         str++;
     }
 }
+#endif
 
 int
 putchar(int ch)
 {
+#ifdef DEBUG_RAMLOG
+    ramlog_printf("%c", ch);
+#else
     KPutChar(ch);
+#endif
     return (ch);
 }
 
 int
 puts(const char *str)
 {
+#ifdef DEBUG_RAMLOG
+    ramlog_printf("%s\n", str);
+#else
     KPutS(str);
     KPutChar('\n');
+#endif
     return (0);
 }
 #endif
@@ -650,7 +824,11 @@ int sprintf(char *buf, const char *fmt, ...)
 __attribute__((format(__printf__, 1, 0)))
 int vprintf(const char *fmt, va_list ap)
 {
+#ifdef DEBUG_RAMLOG
+    return (ramlog_vprintf(fmt, ap));
+#else
     return (kdoprnt(NULL, fmt, ap));
+#endif
 }
 
 /**
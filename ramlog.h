@@ -0,0 +1,64 @@
+//
+// Copyright 2022-2025 Stefan Reinauer & Chris Hooper
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+
+#ifndef _RAMLOG_H
+#define _RAMLOG_H
+
+#include <stdint.h>
+
+/*
+ * RAM log ring (DEBUG_RAMLOG)
+ *
+ * printf() in a debug build stores the format pointer and its raw
+ * arguments here instead of formatting them to the serial port. The
+ * text is produced later by "a4091d -l", which finds the ring through
+ * as_ramlog in the driver globals.
+ *
+ * Each record starts on a longword of rl_ring[] and never wraps around
+ * the end of the ring:
+ *
+ *   word 0     RAMLOG_TAG | nargs << 16 | record length in longwords
+ *   word 1     format string, or NULL for padding up to the ring end
+ *   word 2..   nargs arguments, one longword each (two for %ll)
+ *   ...        strings of %s arguments, NUL terminated; the argument
+ *              holds the byte offset of its string from the end of the
+ *              arguments, or RAMLOG_NULLSTR
+ *
+ * Word 0 is written last, so a reader only ever sees a tag on a record
+ * which is complete.
+ */
+#define RAMLOG_MAGIC    0x524c4f47      /* "RLOG" */
+#define RAMLOG_WORDS    2048            /* 8 KB, must be a power of two */
+#define RAMLOG_TAG      0xa5000000
+#define RAMLOG_TAGMASK  0xff000000
+#define RAMLOG_NULLSTR  0xffffffff
+
+#define RAMLOG_MAXARGS  16              /* Arguments kept per record */
+#define RAMLOG_MAXSTR   128             /* String bytes kept per record */
+
+#define RAMLOG_REC_NARGS(w)  (((w) >> 16) & 0xff)
+#define RAMLOG_REC_LEN(w)    ((w) & 0xffff)
+
+struct ramlog {
+    uint32_t          rl_magic;         /* RAMLOG_MAGIC once written */
+    uint32_t          rl_words;         /* RAMLOG_WORDS */
+    volatile uint32_t rl_head;          /* Longwords ever reserved */
+    uint32_t          rl_reserved;
+    uint32_t          rl_ring[RAMLOG_WORDS];
+};
+
+#ifdef DEBUG_RAMLOG
+extern struct ramlog ramlog;
+#endif
+
+#endif /* _RAMLOG_H */
@@ -15,6 +15,8 @@
 #define __RELOC_H 1
 
 uint32_t relocate(ULONG offset asm("d0"), uint32_t program asm("a0"));
+uint32_t relocate_codec(ULONG offset asm("d0"), ULONG codec asm("d1"),
+                        uint32_t program asm("a0"));
 extern uint32_t rErrno;
 extern uint32_t ReadHandle[2];
 
@@ -0,0 +1,134 @@
+//
+// Copyright 2026 Stefan Reinauer
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+
+/*
+ * Benchmark for the ROM loader in reloc.S
+ *
+ * Times the ROM init stage of the boot, i.e. getting the driver from the
+ * ROM into a relocated seglist, the way DiagEntry does it. The ROM is
+ * simulated by a nibble-mapped copy of the image in RAM, laid out like
+ * the A4091 ROM as seen during AutoConfig. Runs under vamos, so the
+ * numbers compare loader versions against each other rather than
+ * predicting real hardware.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <proto/exec.h>
+#include <proto/dos.h>
+
+#include <clib/exec_protos.h>
+uint32_t relocate(ULONG offset asm("d0"), uint8_t *program asm("a0"));
+extern uint8_t device[], device_end[];
+extern uint8_t device_zx0[], device_zx0_end[];
+
+/* relocate() takes offset 0 to mean RAM, so keep the image off it */
+#define ROM_OFFSET  0x100
+#define MIN_TICKS   (2 * TICKS_PER_SECOND)
+
+static void free_seglist(uint32_t ret)
+{
+	uint32_t *seg = (uint32_t *)ret;
+
+	do {
+		uint32_t len = *(seg - 1);
+		unsigned char *fptr = (unsigned char *)(seg - 1);
+		seg = BADDR(*seg);
+		FreeMem(fptr, len << 2);
+	} while (seg);
+}
+
+/*
+ * Spread each byte over four ROM bytes, high nibble in the upper half
+ * of the first and low nibble in the upper half of the third.
+ */
+static uint8_t *nibble_map(const uint8_t *src, ULONG len, ULONG *size)
+{
+	ULONG i, pos;
+	uint8_t *rom;
+
+	*size = ((ROM_OFFSET + len + 3) & ~3UL) * 4;
+	rom = AllocMem(*size, MEMF_PUBLIC | MEMF_CLEAR);
+	if (rom == NULL)
+		return NULL;
+	for (i = 0; i < len; i++) {
+		pos = (ROM_OFFSET + i) * 4;
+		rom[pos] = src[i] & 0xf0;
+		rom[pos + 2] = src[i] << 4;
+	}
+	return rom;
+}
+
+static ULONG ticks(void)
+{
+	struct DateStamp ds;
+
+	DateStamp(&ds);
+	return (ds.ds_Days * 24 * 60 + ds.ds_Minute) * 60 * TICKS_PER_SECOND +
+		ds.ds_Tick;
+}
+
+static int bench(const char *name, ULONG offset, uint8_t *image)
+{
+	ULONG start, elapsed, runs = 0;
+	uint32_t ret;
+
+	start = ticks();
+	do {
+		ret = relocate(offset, image);
+		if (ret == 0) {
+			printf("%-24s relocate failed\n", name);
+			return 1;
+		}
+		free_seglist(ret);
+		runs++;
+		elapsed = ticks() - start;
+	} while (elapsed < MIN_TICKS);
+
+	printf("%-24s %6lu runs %8lu us/run\n", name, runs,
+	       elapsed * (1000000 / TICKS_PER_SECOND) / runs);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	ULONG plain_len = device_end - device;
+	ULONG zx0_len = device_zx0_end - device_zx0;
+	ULONG plain_size, zx0_size;
+	uint8_t *plain_rom, *zx0_rom;
+	int ret = 0;
+
+	if (plain_len == 0 || zx0_len == 0) {
+		printf("No driver image linked in.\n");
+		return 1;
+	}
+
+	plain_rom = nibble_map(device, plain_len, &plain_size);
+	zx0_rom = nibble_map(device_zx0, zx0_len, &zx0_size);
+	if (plain_rom == NULL || zx0_rom == NULL) {
+		printf("Out of memory.\n");
+		return 1;
+	}
+
+	printf("Driver: %lu bytes, %lu bytes zx0 compressed\n\n",
+	       plain_len, zx0_len);
+	ret |= bench("ROM, zx0", ROM_OFFSET, zx0_rom);
+	ret |= bench("ROM, uncompressed", ROM_OFFSET, plain_rom);
+	ret |= bench("RAM, zx0", 0, device_zx0);
+	ret |= bench("RAM, uncompressed", 0, device);
+
+	FreeMem(zx0_rom, zx0_size);
+	FreeMem(plain_rom, plain_size);
+	return ret;
+}
@@ -0,0 +1,343 @@
+/* A4091 ROM payload codecs
+ *
+ * Copyright 2026 Stefan Reinauer
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "romcodec.h"
+#include "romtoc.h"
+#include "zx0pack.h"
+
+#define LZ4_MIN_MATCH   4
+#define LZ4_MAX_OFFSET  65535
+#define LZ4_LAST_LITS   5       /* A block ends in at least 5 literals */
+#define LZ4_MF_LIMIT    12      /* and no match starts in its last 12 bytes */
+#define LZ4_HASH_BITS   16
+#define LZ4_CHAIN_DEPTH 256     /* Candidates per position */
+
+/*
+ * Cycle model. The numbers are 68000 clock cycles without wait states,
+ * taken from the instruction timing tables for the loops in reloc.S
+ * (lz4_decompress, zx0_decompress and the Zorro III branch of RomCopy).
+ * They only have to rank the codecs correctly, so faster CPUs are not
+ * modelled separately.
+ */
+#ifndef ROM_BYTE_CYCLES
+#define ROM_BYTE_CYCLES 136     /* RomCopy: 2 nibble reads and merge */
+#endif
+#define COPY_CYCLES     22      /* move.b (ax)+,(a1)+ / dbf */
+
+#define LZ4_SEQ         40      /* Fetch and split the token */
+#define LZ4_LITRUN      62      /* Set up and finish a literal copy */
+#define LZ4_MATCH       156     /* Offset, length and match copy setup */
+#define LZ4_EXT         38      /* Each length extension byte */
+
+#define ZX0_BIT         14      /* add.b / bne */
+#define ZX0_REFILL      10      /* Fetch the next byte of bits */
+#define ZX0_GAMMA       48      /* bsr, setup and rts per Elias value */
+#define ZX0_GAMMA_BIT   26      /* Shift one value bit in */
+#define ZX0_LITRUN      36
+#define ZX0_REPEAT      48
+#define ZX0_NEWOFF      138     /* LSB fetch and offset assembly, copy setup */
+
+struct lz4 {
+	const uint8_t *in;
+	size_t len, inserted;
+	int32_t *head, *chain;
+};
+
+static uint32_t hash4(const uint8_t *p)
+{
+	uint32_t v = p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+
+	return (v * 2654435761U) >> (32 - LZ4_HASH_BITS);
+}
+
+/* Longest match for pos, or 0 if there is none of at least 4 bytes */
+static size_t find_match(struct lz4 *z, size_t pos, size_t *offset)
+{
+	const uint8_t *in = z->in;
+	size_t limit = z->len - LZ4_LAST_LITS, best = 0, n;
+	int depth = LZ4_CHAIN_DEPTH;
+	int32_t c;
+
+	if (pos + LZ4_MF_LIMIT > z->len)
+		return 0;
+	for (; z->inserted < pos; z->inserted++) {
+		uint32_t h = hash4(in + z->inserted);
+
+		z->chain[z->inserted] = z->head[h];
+		z->head[h] = z->inserted;
+	}
+	for (c = z->head[hash4(in + pos)]; c >= 0 && depth--;
+	     c = z->chain[c]) {
+		if (pos - c > LZ4_MAX_OFFSET)
+			break;
+		if (in[c + best] != in[pos + best])
+			continue;
+		for (n = 0; pos + n < limit && in[c + n] == in[pos + n]; n++)
+			;
+		if (n > best) {
+			best = n;
+			*offset = pos - c;
+			if (pos + n == limit)
+				break;
+		}
+	}
+	return best >= LZ4_MIN_MATCH ? best : 0;
+}
+
+static uint8_t *put_len(uint8_t *o, size_t n)
+{
+	for (; n >= 255; n -= 255)
+		*o++ = 255;
+	*o++ = n;
+	return o;
+}
+
+/* One sequence: literals, then a match unless mlen is 0 */
+static uint8_t *sequence(uint8_t *o, const uint8_t *lit, size_t nlit,
+		size_t offset, size_t mlen)
+{
+	uint8_t *token = o++;
+
+	*token = (nlit < 15 ? nlit : 15) << 4;
+	if (nlit >= 15)
+		o = put_len(o, nlit - 15);
+	memcpy(o, lit, nlit);
+	o += nlit;
+	if (!mlen)
+		return o;
+	*o++ = offset;
+	*o++ = offset >> 8;
+	mlen -= LZ4_MIN_MATCH;
+	*token |= mlen < 15 ? mlen : 15;
+	if (mlen >= 15)
+		o = put_len(o, mlen - 15);
+	return o;
+}
+
+/* Greedy parse with one step of lazy matching, like lz4hc's fast modes */
+static size_t compress(const uint8_t *in, size_t len, uint8_t *out)
+{
+	struct lz4 z = { in, len, 0, NULL, NULL };
+	size_t pos = 0, anchor = 0, n, n2, offset = 0, offset2 = 0;
+	uint8_t *o = out;
+
+	z.head = malloc((1 << LZ4_HASH_BITS) * sizeof(*z.head));
+	z.chain = malloc(len * sizeof(*z.chain));
+	if (!z.head || !z.chain) {
+		free(z.head);
+		free(z.chain);
+		return 0;
+	}
+	memset(z.head, 0xff, (1 << LZ4_HASH_BITS) * sizeof(*z.head));
+
+	while (pos < len) {
+		if (!(n = find_match(&z, pos, &offset))) {
+			pos++;
+			continue;
+		}
+		/* Take a literal if the next position matches longer */
+		while ((n2 = find_match(&z, pos + 1, &offset2)) > n) {
+			pos++;
+			n = n2;
+			offset = offset2;
+		}
+		o = sequence(o, in + anchor, pos - anchor, offset, n);
+		pos += n;
+		anchor = pos;
+	}
+	o = sequence(o, in + anchor, len - anchor, 0, 0);
+
+	free(z.head);
+	free(z.chain);
+	return o - out;
+}
+
+static long get_len(const uint8_t *in, size_t inlen, size_t *pos,
+		struct lz4pack_stats *st)
+{
+	long len = 0;
+	uint8_t b;
+
+	do {
+		if (*pos >= inlen || len > 0x1000000)
+			return -1;
+		b = in[(*pos)++];
+		len += b;
+		if (st)
+			st->ext_bytes++;
+	} while (b == 255);
+	return len;
+}
+
+long lz4pack_unpack(const uint8_t *in, size_t inlen, uint8_t *out,
+		size_t outlen, struct lz4pack_stats *st)
+{
+	size_t ip = 0, op = 0, offset;
+	long lit, mlen, ext;
+	uint8_t token;
+
+	while (ip < inlen) {
+		token = in[ip++];
+		lit = token >> 4;
+		if (lit == 15) {
+			if ((ext = get_len(in, inlen, &ip, st)) < 0)
+				return -1;
+			lit += ext;
+		}
+		if (ip + lit > inlen || op + lit > outlen)
+			return -1;
+		memcpy(out + op, in + ip, lit);
+		ip += lit;
+		op += lit;
+		if (st) {
+			st->sequences++;
+			st->literal_runs += lit != 0;
+			st->literals += lit;
+		}
+		/* The last sequence has no match */
+		if (ip == inlen)
+			break;
+
+		if (ip + 2 > inlen)
+			return -1;
+		offset = in[ip] | in[ip + 1] << 8;
+		ip += 2;
+		mlen = token & 15;
+		if (mlen == 15) {
+			if ((ext = get_len(in, inlen, &ip, st)) < 0)
+				return -1;
+			mlen += ext;
+		}
+		mlen += LZ4_MIN_MATCH;
+		if (offset == 0 || offset > op || op + mlen > outlen)
+			return -1;
+		if (st) {
+			st->matches++;
+			st->matched += mlen;
+		}
+		for (; mlen; mlen--, op++)
+			out[op] = out[op - offset];
+	}
+	return op;
+}
+
+static void put_be32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static uint32_t get_be32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+uint8_t *lz4pack_buffer(const uint8_t *in, size_t len, size_t *outlen)
+{
+	/* Worst case: all literals, one length byte per 255 */
+	uint8_t *out = calloc(LZ4PACK_HDR_SIZE + len + len / 255 + 16, 1);
+	uint8_t *check = malloc(len + 1);
+	size_t clen;
+
+	if (!out || !check || !len)
+		goto fail;
+	clen = compress(in, len, out + LZ4PACK_HDR_SIZE);
+	if (!clen || lz4pack_unpack(out + LZ4PACK_HDR_SIZE, clen, check,
+				len, NULL) != (long)len ||
+	    memcmp(check, in, len))
+		goto fail;
+	free(check);
+	memcpy(out, "LZ4\001", 4);
+	put_be32(out + 4, len);
+	put_be32(out + 8, clen);
+	*outlen = LZ4PACK_HDR_SIZE + clen;
+	return out;
+fail:
+	free(check);
+	free(out);
+	return NULL;
+}
+
+static uint64_t zx0_cycles(const struct zx0pack_stats *st)
+{
+	uint64_t blocks = st->literal_runs + st->repeats + st->new_offsets;
+	uint64_t value_bits = 0;
+
+	/* A value with n bits after the leading 1 takes 2n + 1 bits */
+	if (st->bits > blocks + st->gammas)
+		value_bits = (st->bits - blocks - st->gammas) / 2;
+	return ZX0_BIT * st->bits + ZX0_REFILL * st->bytes_refilled +
+		ZX0_GAMMA * st->gammas + ZX0_GAMMA_BIT * value_bits +
+		ZX0_LITRUN * st->literal_runs + ZX0_REPEAT * st->repeats +
+		ZX0_NEWOFF * st->new_offsets +
+		COPY_CYCLES * (st->literals + st->matched);
+}
+
+static uint64_t lz4_cycles(const struct lz4pack_stats *st)
+{
+	return LZ4_SEQ * st->sequences + LZ4_LITRUN * st->literal_runs +
+		LZ4_MATCH * st->matches + LZ4_EXT * st->ext_bytes +
+		COPY_CYCLES * (st->literals + st->matched);
+}
+
+uint64_t romcodec_cycles(const uint8_t *data, size_t len)
+{
+	uint32_t magic = len >= 12 ? get_be32(data) : 0;
+	uint64_t cycles = (uint64_t)len * ROM_BYTE_CYCLES;
+	size_t usize, csize;
+	uint8_t *out;
+	long got;
+
+	if (magic != ROMTOC_ZX0_MAGIC && magic != ROMTOC_LZ4_MAGIC)
+		return cycles;
+
+	usize = get_be32(data + 4);
+	csize = get_be32(data + 8);
+	if (csize > len - 12 || !(out = malloc(usize + 1)))
+		return 0;
+	if (magic == ROMTOC_ZX0_MAGIC) {
+		struct zx0pack_stats st;
+
+		memset(&st, 0, sizeof(st));
+		got = zx0pack_unpack_stats(data + 12, csize, out, usize, &st);
+		cycles += zx0_cycles(&st);
+	} else {
+		struct lz4pack_stats st;
+
+		memset(&st, 0, sizeof(st));
+		got = lz4pack_unpack(data + 12, csize, out, usize, &st);
+		cycles += lz4_cycles(&st);
+	}
+	free(out);
+	return got == (long)usize ? cycles : 0;
+}
@@ -0,0 +1,73 @@
+/* A4091 ROM payload codecs
+ *
+ * Copyright 2026 Stefan Reinauer
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef ROMCODEC_H
+#define ROMCODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * LZ4 packer and the 68k decode time model romtool uses to pick a codec
+ * for each ROM payload.
+ *
+ * LZ4 payloads are a raw LZ4 block behind the same 12 byte header as
+ * zx0 ones:
+ *
+ *   00 "LZ4" magic, 01 version
+ *   04 uncompressed size (big endian)
+ *   08 compressed size (big endian)
+ *   0C LZ4 block
+ */
+
+#define LZ4PACK_HDR_SIZE   12
+
+/* What a block made the depacker do */
+struct lz4pack_stats {
+	uint64_t sequences, literal_runs, literals;
+	uint64_t matches, matched, ext_bytes;
+};
+
+/*
+ * Pack one buffer. Returns a malloc'ed header and block and its length
+ * in *outlen, or NULL if out of memory.
+ */
+uint8_t *lz4pack_buffer(const uint8_t *in, size_t len, size_t *outlen);
+
+/* Decode a block (without header). Returns the output size, or -1. */
+long lz4pack_unpack(const uint8_t *in, size_t inlen, uint8_t *out,
+		size_t outlen, struct lz4pack_stats *st);
+
+/*
+ * Estimated 68000 clock cycles for _relocate to get a payload (plain,
+ * zx0 or lz4, with header) out of the ROM into RAM, not counting the
+ * relocation itself. Returns 0 if the payload does not decode.
+ */
+uint64_t romcodec_cycles(const uint8_t *data, size_t len);
+
+#endif
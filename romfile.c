@@ -29,6 +29,7 @@
 #include <dos/dosextens.h>
 #include <exec/execbase.h>
 #include <exec/lists.h>
+#include <exec/semaphores.h>
 #include <libraries/expansion.h>
 #include <libraries/expansionbase.h>
 #include <proto/dos.h>
@@ -36,6 +37,7 @@
 #endif
 #include "version.h"
 #include "romfile.h"
+#include "romtoc.h"
 
 #define DOSTYPE_CD01 0x43443031
 #define DOSTYPE_CDVD 0x43445644
@@ -91,9 +93,12 @@ static struct FileSysEntry *find_registered_filesystem(ULONG id1, ULONG id2)
 
 #if HAVE_ROM
 typedef struct {
-	uint32_t romfile[3], romfile_len[3], romfile_dostype[3];
+	int count;
+	struct romtoc_entry file[ROMTOC_MAX_ENTRIES];
 } romfiles_t;
 
+static const char *codec_name[] = { "plain", "zx0", "rnc", "lz4" };
+
 static uint32_t RomFetch32(uint32_t offset)
 {
     uint8_t *rombase = (uint8_t *)asave->as_addr;
@@ -106,77 +111,148 @@ static uint32_t RomFetch32(uint32_t offset)
     return ret;
 }
 
-static void parse_romfiles(romfiles_t *rom)
+/*
+ * Read the table of contents of a ROM ending at top. Returns 0 if there
+ * is none, or if it does not check out.
+ */
+static int parse_toc(romfiles_t *rom, uint32_t top)
 {
-    int i;
+    uint32_t hdr = top - ROMTOC_LEGACY_SIZE - ROMTOC_HDR_SIZE;
+    uint32_t total, count, esize, sum, pos, i, j;
 
-    /* If no end-of-rom signature is found below, all slots stay empty */
-    memset(rom, 0, sizeof(*rom));
+    if (RomFetch32(hdr) != ROMTOC_MAGIC)
+        return 0;
+    total = count = RomFetch32(hdr + 4) & 0xffff;
+    esize = RomFetch32(hdr + 8) >> 16;
 
-    for (i=1; i<=2; i++) {
-        /* Look for end-of-rom signature */
-        if (RomFetch32((i*32*1024)-8) == 0xffff5352 &&
-                RomFetch32((i*32*1024)-4) == 0x2f434448) {
+    /* Newer versions may append fields to an entry; skip them */
+    if (esize < ROMTOC_ENTRY_SIZE || (esize & 3) || count * esize > hdr)
+        return 0;
+    if (count > ROMTOC_MAX_ENTRIES)
+        count = ROMTOC_MAX_ENTRIES;
+
+    sum = RomFetch32(hdr) + RomFetch32(hdr + 4) + RomFetch32(hdr + 8);
+    for (i = 0; i < total; i++) {
+        pos = hdr - (i + 1) * esize;
+        for (j = 0; j < esize; j += 4) {
+            uint32_t val = RomFetch32(pos + j);
+            if (i < count && j < ROMTOC_ENTRY_SIZE)
+                ((uint32_t *)&rom->file[i])[j / 4] = val;
+            sum += val;
+        }
+    }
+    if (sum != RomFetch32(hdr + 12)) {
+        printf("ROM TOC checksum mismatch.\n");
+        memset(rom, 0, sizeof(*rom));
+        return 0;
+    }
+    rom->count = count;
+    return 1;
+}
 
-            rom->romfile_len[0]=RomFetch32((i*32*1024) - 12);
-            if (rom->romfile_len[0])
-                rom->romfile[0]=RomFetch32((i*32*1024) - 16);
+/*
+ * Make an entry from a slot of the old inventory, which knows neither
+ * the codec nor the uncompressed size. Arguments are the ROM offsets of
+ * the slot's fields; dostype_at is 0 for the driver.
+ */
+static void legacy_entry(romfiles_t *rom, uint32_t type, uint32_t dostype_at,
+                         uint32_t offset_at, uint32_t len_at)
+{
+    struct romtoc_entry *e = &rom->file[rom->count];
+    uint32_t magic;
+
+    memset(e, 0, sizeof(*e));
+    e->te_length = RomFetch32(len_at);
+    if (e->te_length == 0)
+        return;
+    e->te_type = type;
+    e->te_offset = RomFetch32(offset_at);
+    if (dostype_at)
+        e->te_dostype = RomFetch32(dostype_at);
+    e->te_size = e->te_length;
+
+    magic = RomFetch32(e->te_offset);
+    if (magic == ROMTOC_ZX0_MAGIC)
+        e->te_codec = ROMTOC_CODEC_ZX0;
+    else if (magic == ROMTOC_RNC_MAGIC)
+        e->te_codec = ROMTOC_CODEC_RNC;
+    else if (magic == ROMTOC_LZ4_MAGIC)
+        e->te_codec = ROMTOC_CODEC_LZ4;
+    if (e->te_codec != ROMTOC_CODEC_NONE)
+        e->te_size = RomFetch32(e->te_offset + 4);
+    rom->count++;
+}
 
-            rom->romfile_len[1]=RomFetch32((i*32*1024) - 20);
-            if (rom->romfile_len[1]) {
-                rom->romfile[1]=RomFetch32((i*32*1024) - 24);
-                rom->romfile_dostype[1]=RomFetch32((i*32*1024) - 28);
-            }
+static void parse_romfiles(romfiles_t *rom)
+{
+    uint32_t top;
+    int i, fs = 0, toc = 0;
 
-            rom->romfile_len[2]=RomFetch32((i*32*1024) - 32);
-            if (rom->romfile_len[2]) {
-                rom->romfile[2]=RomFetch32((i*32*1024) - 36);
-                rom->romfile_dostype[2]=RomFetch32((i*32*1024) - 40);
-            }
+    /* If no end-of-rom signature is found below, there are no entries */
+    memset(rom, 0, sizeof(*rom));
 
+    for (top = ROMTOC_MIN_ROM; top <= ROMTOC_MAX_ROM; top <<= 1) {
+        /* Look for end-of-rom signature */
+        if (RomFetch32(top - 8) == ROMTOC_SIG1 &&
+                RomFetch32(top - 4) == ROMTOC_SIG2) {
+            toc = parse_toc(rom, top);
+            if (!toc) {
+                legacy_entry(rom, ROMTOC_TYPE_DRIVER, 0,
+                             top - 16, top - 12);
+                legacy_entry(rom, ROMTOC_TYPE_FILESYSTEM, top - 28,
+                             top - 24, top - 20);
+                legacy_entry(rom, ROMTOC_TYPE_FILESYSTEM, top - 40,
+                             top - 36, top - 32);
+            }
             break;
         }
     }
 
-    printf("Detected %dkB ROM.\n", i*32);
-    if(rom->romfile_len[0]) {
-        printf("  Driver @ 0x%05x (%d bytes)\n", rom->romfile[0], rom->romfile_len[0]);
-
-        for (i=1; i<3; i++) {
-            if(rom->romfile_len[i]) {
-                printf("  FS %d   @ 0x%05x (%d bytes): %08x\n", i, rom->romfile[i],
-                            rom->romfile_len[i], rom->romfile_dostype[i]);
-                if (rom->romfile_dostype[i] == 0)
-                    printf("            no DosType: FS can not be "
-                           "demand-loaded (romtool -T missing?)\n");
-                if (RomFetch32(rom->romfile[i]) == 0x524e4301) {
-                    rom->romfile_len[i] = RomFetch32(rom->romfile[i] + 4);
-                    printf("            compressed (%d bytes)\n",
-                                    rom->romfile_len[i]);
-                }
-            } else
-                printf("  FS %d not found.\n", i);
+    if (top > ROMTOC_MAX_ROM) {
+        printf("No ROM inventory found.\n");
+        return;
+    }
+    printf("Detected %dkB ROM%s.\n", (int)(top / 1024), toc ? " with TOC" : "");
+    for (i = 0; i < rom->count; i++) {
+        struct romtoc_entry *e = &rom->file[i];
+
+        if (e->te_type == ROMTOC_TYPE_DRIVER) {
+            printf("  Driver @ 0x%05x (%d bytes)\n", e->te_offset,
+                        e->te_length);
+            continue;
         }
-    } else
-        printf("  Driver not found. Huh?\n");
+        if (e->te_type != ROMTOC_TYPE_FILESYSTEM)
+            continue;
+        printf("  FS %d   @ 0x%05x (%d bytes): %08x\n", ++fs, e->te_offset,
+                    e->te_length, e->te_dostype);
+        if (e->te_dostype == 0)
+            printf("            no DosType: FS can not be "
+                   "demand-loaded (romtool -T missing?)\n");
+        if (e->te_codec < ARRAY_SIZE(codec_name))
+            printf("            %s (%d bytes)\n", codec_name[e->te_codec],
+                        e->te_size);
+        else
+            printf("            unknown codec %d\n", e->te_codec);
+    }
+    if (fs == 0)
+        printf("  No FS found.\n");
 }
 
-static int add_romfilesystem(romfiles_t *rom, int slot,
-                             struct FileSysEntry **newEntry)
+/*
+ * Relocate a ROM filesystem and, if it has a romtag, initialize it.
+ * Returns the seglist as a pointer, or 0. Sets *romtag if InitResident()
+ * ran, in which case the filesystem registered its own FileSysEntry.
+ */
+static uint32_t relocate_romfilesystem(struct romtoc_entry *e, int *romtag)
 {
     uint32_t fs_seglist = 0;
     struct Resident *r = NULL;
-    struct FileSysResource *FileSysResBase;
-    struct FileSysEntry *fse = NULL;
-    struct FileSysEntry *created = NULL;
-
     unsigned int i;
-    if (newEntry)
-        *newEntry = NULL;
-    printf("Looking for FS in A4091 ROM slot %d... ", slot);
 
-    if (rom->romfile_len[slot])
-        fs_seglist = relocate(rom->romfile[slot], (uint32_t)asave->as_addr);
+    *romtag = 0;
+    if (e->te_length)
+        fs_seglist = relocate_codec(e->te_offset, e->te_codec,
+                                    (uint32_t)asave->as_addr);
 
     printf("%sfound.\n", fs_seglist?"":"not ");
 
@@ -184,7 +260,7 @@ static int add_romfilesystem(romfiles_t *rom, int slot,
         return 0;
 
     printf("Resident struct... ");
-    for (i=fs_seglist; i<fs_seglist + rom->romfile_len[slot]; i+=2) {
+    for (i=fs_seglist; i<fs_seglist + e->te_size; i+=2) {
         if(*(uint16_t *)i == 0x4afc) {
             r = (struct Resident *)i;
             break;
@@ -198,17 +274,22 @@ static int add_romfilesystem(romfiles_t *rom, int slot,
             printf("Initializing FS @%p... ", r);
             InitResident(r, fs_seglist >> 2);
             printf("done.\n");
-            created = find_registered_filesystem(
-                        rom->romfile_dostype[slot], 0);
-            if (created &&
-                created->fse_SegList != (BPTR)(fs_seglist >> 2))
-                created = NULL;
-            if (newEntry)
-                *newEntry = created;
-	    return 1;
+            *romtag = 1;
         } else
             printf("No rt_Init.\n");
     }
+    return fs_seglist;
+}
+
+/*
+ * Add a FileSysEntry for dostype with the given seglist, unless there
+ * is one already. Returns the new entry or NULL.
+ */
+static struct FileSysEntry *register_filesystem(ULONG dostype, BPTR seglist)
+{
+    struct FileSysResource *FileSysResBase;
+    struct FileSysEntry *fse = NULL;
+    struct FileSysEntry *created = NULL;
 
     Forbid();
     FileSysResBase = (struct FileSysResource *)OpenResource(FSRNAME);
@@ -216,7 +297,7 @@ static int add_romfilesystem(romfiles_t *rom, int slot,
     for (fse = (struct FileSysEntry *)FileSysResBase->fsr_FileSysEntries.lh_Head;
 	      fse->fse_Node.ln_Succ;
 	      fse = (struct FileSysEntry *)fse->fse_Node.ln_Succ) {
-	if (fse->fse_DosType == rom->romfile_dostype[slot]) {
+	if (fse->fse_DosType == dostype) {
 		printf("DosType already present. Skipping.\n");
 		FileSysResBase = NULL;
 	}
@@ -227,10 +308,10 @@ static int add_romfilesystem(romfiles_t *rom, int slot,
         fse = AllocMem(sizeof(struct FileSysEntry), MEMF_PUBLIC | MEMF_CLEAR);
         if (fse) {
             fse->fse_Node.ln_Name = (UBYTE*)device_id_string;
-            fse->fse_DosType = rom->romfile_dostype[slot];
+            fse->fse_DosType = dostype;
             fse->fse_Version = ((LONG)DEVICE_VERSION) << 16 | DEVICE_REVISION;
             fse->fse_PatchFlags = 0x190; // StackSize, SegList and GlobalVec
-            fse->fse_SegList = fs_seglist >> 2;
+            fse->fse_SegList = seglist;
             fse->fse_GlobalVec = -1;
             //fse->fse_StackSize = 5120;
             fse->fse_StackSize = 16384; // Is there a right answer here?
@@ -241,9 +322,191 @@ static int add_romfilesystem(romfiles_t *rom, int slot,
 	}
     }
     Permit();
+    return created;
+}
+
+#ifdef ENABLE_LAZY_FS
+/*
+ * A filesystem which is relocated when DOS first starts a handler for
+ * it. Its FileSysEntry points to a one-segment stub seglist, whose code
+ * calls lazy_fs_load() with all registers saved and then continues at
+ * lf_start, the relocated handler. DOS keeps using the stub for all
+ * later handler starts, so device nodes and the FileSysEntry never need
+ * to be patched. The handler is started like any C handler (GlobalVec
+ * -1), which all ROM filesystems are.
+ */
+#define LAZY_STUB_WORDS 15
+
+struct lazy_fs {
+    ULONG                lf_seglen;     /* Segment size, as LoadSeg() does */
+    BPTR                 lf_next;       /* The stub seglist points here */
+    UWORD                lf_code[LAZY_STUB_WORDS];
+    ULONG                lf_start;      /* Handler entry once loaded */
+    struct FileSysEntry *lf_fse;
+    struct romtoc_entry  lf_entry;
+    struct SignalSemaphore lf_lock;     /* Held while loading */
+};
+
+/*
+ * Handler entry if the filesystem could not be loaded: fail the startup
+ * packet, so DOS does not wait for the handler forever.
+ */
+static void lazy_fs_fail(void)
+{
+    struct DosLibrary *DOSBase;
+    struct DosPacket *pkt;
+
+    DOSBase = (struct DosLibrary *)OpenLibrary("dos.library", 36);
+    if (!DOSBase)
+        return;
+    pkt = WaitPkt();
+    ReplyPkt(pkt, DOSFALSE, ERROR_OBJECT_NOT_FOUND);
+    CloseLibrary(&DOSBase->dl_lib);
+}
+
+/*
+ * Drop the FileSysEntry a romtag registered for our DosType, keeping
+ * ours with the stub, so the CD cleanup and DOS only ever see one.
+ */
+static void adopt_romtag_fse(struct lazy_fs *lf, BPTR seglist)
+{
+    struct FileSysResource *FileSysResBase;
+    struct FileSysEntry *fse;
+    struct FileSysEntry *drop = NULL;
+
+    FileSysResBase = (struct FileSysResource *)OpenResource(FSRNAME);
+    if (!FileSysResBase)
+        return;
+    Forbid();
+    for (fse = (struct FileSysEntry *)
+                FileSysResBase->fsr_FileSysEntries.lh_Head;
+         fse->fse_Node.ln_Succ;
+         fse = (struct FileSysEntry *)fse->fse_Node.ln_Succ) {
+        if (fse != lf->lf_fse && fse->fse_SegList == seglist &&
+            fse->fse_DosType == lf->lf_entry.te_dostype) {
+            /* Only used by new device nodes, which get ours instead */
+            if (fse->fse_PatchFlags & 0x10)
+                lf->lf_fse->fse_StackSize = fse->fse_StackSize;
+            if (fse->fse_PatchFlags & 0x20)
+                lf->lf_fse->fse_Priority = fse->fse_Priority;
+            Remove(&fse->fse_Node);
+            drop = fse;
+            break;
+        }
+    }
+    Permit();
+
+    /* Allocated by the romtag init; nothing refers to it any more */
+    if (drop)
+        FreeMem(drop, sizeof (*drop));
+}
+
+/*
+ * Called from the stub in the context of the new handler process. Two
+ * handlers may be started at once; the first one loads while holding
+ * lf_lock, the second waits for it. Decompressing and relocating takes
+ * long enough that it must not run under Forbid().
+ */
+static void lazy_fs_load(struct lazy_fs *lf)
+{
+    uint32_t seglist;
+    int romtag;
+
+    ObtainSemaphore(&lf->lf_lock);
+    if (lf->lf_start == 0) {
+        printf("Starting handler for %08x, loading FS... ",
+               lf->lf_entry.te_dostype);
+        seglist = relocate_romfilesystem(&lf->lf_entry, &romtag);
+        if (seglist && romtag)
+            adopt_romtag_fse(lf, seglist >> 2);
+        lf->lf_start = seglist ? seglist + 4 : (ULONG)lazy_fs_fail;
+    }
+    ReleaseSemaphore(&lf->lf_lock);
+}
+
+static UWORD *stub_long(UWORD *c, ULONG value)
+{
+    *c++ = value >> 16;
+    *c++ = value;
+    return c;
+}
+
+static struct FileSysEntry *register_lazy_filesystem(struct romtoc_entry *e)
+{
+    struct lazy_fs *lf;
+    UWORD *c;
+
+    lf = AllocMem(sizeof (*lf), MEMF_PUBLIC | MEMF_CLEAR);
+    if (lf == NULL)
+        return NULL;
+    lf->lf_seglen = sizeof (*lf);
+    lf->lf_entry = *e;
+    InitSemaphore(&lf->lf_lock);
+
+    c = lf->lf_code;
+    *c++ = 0x48e7;                      /* movem.l d0-d7/a0-a6,-(sp) */
+    *c++ = 0xfffe;
+    *c++ = 0x4879;                      /* pea     lf */
+    c = stub_long(c, (ULONG)lf);
+    *c++ = 0x4eb9;                      /* jsr     lazy_fs_load */
+    c = stub_long(c, (ULONG)lazy_fs_load);
+    *c++ = 0x588f;                      /* addq.l  #4,sp */
+    *c++ = 0x4cdf;                      /* movem.l (sp)+,d0-d7/a0-a6 */
+    *c++ = 0x7fff;
+    *c++ = 0x2f39;                      /* move.l  lf_start,-(sp) */
+    c = stub_long(c, (ULONG)&lf->lf_start);
+    *c++ = 0x4e75;                      /* rts */
+    CacheClearU();
+
+    lf->lf_fse = register_filesystem(e->te_dostype, MKBADDR(&lf->lf_next));
+    if (lf->lf_fse == NULL) {
+        FreeMem(lf, sizeof (*lf));
+        return NULL;
+    }
+    printf("registered, loads on first use.\n");
+    return lf->lf_fse;
+}
+#endif
+
+static int add_romfilesystem(romfiles_t *rom, int slot,
+                             struct FileSysEntry **newEntry)
+{
+    struct romtoc_entry *e = &rom->file[slot];
+    struct FileSysEntry *created = NULL;
+    int loaded;
+
+    if (newEntry)
+        *newEntry = NULL;
+    printf("Looking for FS in A4091 ROM entry %d... ", slot);
+
+#ifdef ENABLE_LAZY_FS
+    /* An entry the loader can not unpack would only fail at handler start */
+    if (e->te_length == 0 || (e->te_codec != ROMTOC_CODEC_NONE &&
+                              e->te_codec != ROMTOC_CODEC_ZX0 &&
+                              e->te_codec != ROMTOC_CODEC_LZ4)) {
+        printf("not found.\n");
+        return 0;
+    }
+    created = register_lazy_filesystem(e);
+    loaded = (created != NULL);
+#else
+    uint32_t fs_seglist;
+    int romtag;
+
+    fs_seglist = relocate_romfilesystem(e, &romtag);
+    loaded = (fs_seglist != 0);
+    if (fs_seglist && romtag) {
+        created = find_registered_filesystem(e->te_dostype, 0);
+        if (created &&
+            created->fse_SegList != (BPTR)(fs_seglist >> 2))
+            created = NULL;
+    } else if (fs_seglist) {
+        created = register_filesystem(e->te_dostype, fs_seglist >> 2);
+    }
+#endif
     if (newEntry)
         *newEntry = created;
-    return (fse!=NULL);
+    return loaded;
 }
 #endif
 
@@ -259,7 +522,9 @@ static int add_romfilesystem(romfiles_t *rom, int slot,
  * nonzero if a filesystem was initialized; the caller scans
  * FileSystem.resource for the result, since a filesystem with a
  * romtag (e.g. ODFileSystem) registers its own FileSysEntry inside
- * InitResident().
+ * InitResident(). With ENABLE_LAZY_FS, ROM filesystems are only
+ * registered here and relocated when DOS first starts a handler for
+ * them, so a partition which is never used costs no RAM.
  */
 LONG LoadFileSys(ULONG id1, ULONG id2)
 {
@@ -284,7 +549,7 @@ LONG LoadFileSys(ULONG id1, ULONG id2)
 #if HAVE_ROM
 	static romfiles_t rom;
 	static int rom_parsed;
-	static int slot_tried[3];
+	static int slot_tried[ROMTOC_MAX_ENTRIES];
 	int slot;
 
 	if (!rom_parsed) {
@@ -292,15 +557,16 @@ LONG LoadFileSys(ULONG id1, ULONG id2)
 		rom_parsed = 1;
 	}
 
-	for (slot = 1; slot < 3; slot++) {
+	for (slot = 0; slot < rom.count; slot++) {
+		struct romtoc_entry *e = &rom.file[slot];
 		struct FileSysEntry *created = NULL;
 
 		if (slot_tried[slot] ||
-		    rom.romfile_len[slot] == 0 ||
-		    rom.romfile_dostype[slot] == 0)
+		    e->te_type != ROMTOC_TYPE_FILESYSTEM ||
+		    e->te_length == 0 ||
+		    e->te_dostype == 0)
 			continue;
-		if (rom.romfile_dostype[slot] == id1 ||
-		    rom.romfile_dostype[slot] == id2) {
+		if (e->te_dostype == id1 || e->te_dostype == id2) {
 			slot_tried[slot] = 1;
 			loaded |= add_romfilesystem(&rom, slot, &created);
 			if (created)
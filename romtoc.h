@@ -0,0 +1,82 @@
+//
+// Copyright 2026 Stefan Reinauer
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+
+#ifndef ROMTOC_H
+#define ROMTOC_H 1
+
+#include <stdint.h>
+
+/*
+ * ROM table of contents
+ *
+ * The end of a ROM image holds the old fixed inventory (driver and two
+ * filesystem slots, ROMTOC_LEGACY_SIZE bytes) ending in the signature
+ * FFFF5352 2F434448. romtool keeps filling it in for older drivers and
+ * tools. Directly below it is the TOC header, and below that the TOC
+ * entries, entry 0 closest to the header:
+ *
+ *   ROM end - ROMTOC_LEGACY_SIZE - ROMTOC_HDR_SIZE
+ *       - (i + 1) * ROMTOC_ENTRY_SIZE          entry i
+ *   ROM end - ROMTOC_LEGACY_SIZE - ROMTOC_HDR_SIZE  header
+ *   ROM end - ROMTOC_LEGACY_SIZE                    old inventory
+ *
+ * All values are big endian. Offsets are relative to the ROM start.
+ * ROM sizes are powers of two from ROMTOC_MIN_ROM to ROMTOC_MAX_ROM.
+ */
+
+#define ROMTOC_SIG1          0xFFFF5352
+#define ROMTOC_SIG2          0x2F434448
+#define ROMTOC_MAGIC         0x524F4D54      /* "ROMT" */
+#define ROMTOC_VERSION       1
+#define ROMTOC_LEGACY_SIZE   40
+#define ROMTOC_HDR_SIZE      16
+#define ROMTOC_ENTRY_SIZE    32
+#define ROMTOC_MAX_ENTRIES   16
+#define ROMTOC_MIN_ROM       (32 * 1024)
+#define ROMTOC_MAX_ROM       (512 * 1024)
+
+/* te_type */
+#define ROMTOC_TYPE_DRIVER      1
+#define ROMTOC_TYPE_FILESYSTEM  2
+
+/* te_codec */
+#define ROMTOC_CODEC_NONE    0       /* Plain hunk file */
+#define ROMTOC_CODEC_ZX0     1       /* "ZX0\1", size, packed size, data */
+#define ROMTOC_CODEC_RNC     2       /* "RNC\1", size, ... */
+#define ROMTOC_CODEC_LZ4     3       /* "LZ4\1", size, packed size, block */
+
+#define ROMTOC_ZX0_MAGIC     0x5A583001
+#define ROMTOC_RNC_MAGIC     0x524E4301
+#define ROMTOC_LZ4_MAGIC     0x4C5A3401
+
+struct romtoc_hdr {
+    uint32_t th_magic;          /* ROMTOC_MAGIC */
+    uint16_t th_version;        /* ROMTOC_VERSION */
+    uint16_t th_count;          /* Number of entries */
+    uint16_t th_entry_size;     /* ROMTOC_ENTRY_SIZE, newer versions may grow */
+    uint16_t th_reserved;
+    uint32_t th_check;          /* Sum of the longwords above and of all entries */
+};
+
+struct romtoc_entry {
+    uint32_t te_type;           /* ROMTOC_TYPE_* */
+    uint32_t te_dostype;        /* Filesystems only, else 0 */
+    uint32_t te_offset;         /* Start in the ROM */
+    uint32_t te_length;         /* Bytes stored in the ROM */
+    uint32_t te_size;           /* Bytes after decompression */
+    uint32_t te_codec;          /* ROMTOC_CODEC_* */
+    uint32_t te_checksum;       /* Sum of the stored data as longwords */
+    uint32_t te_reserved;
+};
+
+#endif
@@ -29,6 +29,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
 #include <getopt.h>
 #include <fcntl.h>
@@ -36,17 +37,17 @@
 #include <sys/stat.h>
 #include <arpa/inet.h>
 
-#define ROMTOOL_VERSION "v0.4 (2025-11-28)"
+#include "romtoc.h"
+#include "romcodec.h"
+#include "zx0pack.h"
+
+#define ROMTOOL_VERSION "v0.5 (2026-10-19)"
 
 #ifndef O_BINARY
 #define O_BINARY 0
 #endif
 
-enum {
-	DEVICE,
-	FILESYSTEM1,
-	FILESYSTEM2
-};
+#define MAX_FILESYSTEMS (ROMTOC_MAX_ENTRIES - 1)
 
 struct file {
 	char *addr;
@@ -60,122 +61,357 @@ struct rom_inventory {
 	uint32_t signature[2];
 };
 
-int is_compressed(char *image)
+/*
+ * One payload of the ROM. While editing, data points either into the
+ * loaded image or into a file given on the command line.
+ */
+struct entry {
+	uint32_t type, dostype, codec, size, checksum;
+	uint32_t offset, length;
+	char *data;
+};
+
+struct rom {
+	struct file image;
+	uint32_t header_len;	/* Bytes before the first payload */
+	int valid;		/* Image has an inventory */
+	int has_toc;		/* Image carried a valid TOC */
+	int count;
+	struct entry entry[ROMTOC_MAX_ENTRIES];
+};
+
+static const char *codec_name[] = { "uncompressed", "zx0", "rnc", "lz4" };
+
+static uint32_t get32(const char *p)
 {
-	uint32_t *file = (uint32_t *)image;
-	if (ntohl(file[0]) == 0x524e4301)
-		printf("rnc compressed (%x uncompressed)", ntohl(file[1]));
-	if (ntohl(file[0]) == 0x5a583001)
-		printf("zx0 compressed (%x uncompressed)", ntohl(file[1]));
-	return (ntohl(file[0]) == 0x524e4301 || ntohl(file[0]) == 0x5a583001);
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return ntohl(v);
 }
 
-void inventory(char *filename, struct file *rom)
+static void put32(char *p, uint32_t v)
 {
-	struct rom_inventory *inv = (struct rom_inventory *)(rom->addr + rom->len -
-			sizeof(struct rom_inventory));
+	v = htonl(v);
+	memcpy(p, &v, 4);
+}
 
-	if (ntohl(inv->signature[0]) != 0xFFFF5352 ||
-		ntohl(inv->signature[1]) != 0x2F434448) {
-		printf("%s: %dkB SCSI ROM image. Signature: %08x%08x (INVALID)\n\n",
-			filename, (rom->len==32768) ? 32:64,
-			ntohl(inv->signature[0]), ntohl(inv->signature[1]));
-		return;
+static uint32_t checksum(const char *data, uint32_t len)
+{
+	uint32_t sum = 0, i;
+	char tail[4] = { 0, 0, 0, 0 };
+
+	for (i = 0; i + 4 <= len; i += 4)
+		sum += get32(data + i);
+	if (i < len) {
+		memcpy(tail, data + i, len - i);
+		sum += get32(tail);
 	}
-	printf("%s: %dkB SCSI ROM image. Signature: OK\n\n",
-			filename, (rom->len==32768) ? 32:64);
+	return sum;
+}
 
-	printf(" ROM header:   offset = 0x000000 length = 0x%06x\n",
-			ntohl(inv->device_offset));
-	printf(" Driver:       offset = 0x%06x length = 0x%06x ",
-			ntohl(inv->device_offset), ntohl(inv->device_len));
-	is_compressed(rom->addr + ntohl(inv->device_offset));
-
-	if (ntohl(inv->filesystem1_len)) {
-		printf("\n FileSystem 1: offset = 0x%06x length = 0x%06x ",
-				ntohl(inv->filesystem1_offset), ntohl(inv->filesystem1_len));
-		is_compressed(rom->addr + ntohl(inv->filesystem1_offset));
-		printf("\n               DosType = 0x%08x", ntohl(inv->filesystem1_dostype));
-	} else
-		printf("\n FileSystem 1: <empty>");
-
-	if (ntohl(inv->filesystem2_len)) {
-		printf("\n FileSystem 2: offset = 0x%06x length = 0x%06x ",
-			ntohl(inv->filesystem2_offset), ntohl(inv->filesystem2_len));
-		is_compressed(rom->addr + ntohl(inv->filesystem2_offset));
-		printf("\n               DosType = 0x%08x", ntohl(inv->filesystem2_dostype));
-	} else
-		printf("\n FileSystem 2: <empty>");
-	printf("\n\n");
-
-	int freebytes = rom->len - sizeof(struct rom_inventory) - ntohl(inv->device_offset);
-	if (inv->filesystem1_len)
-		freebytes -= ntohl(inv->filesystem1_len);
-	if (inv->filesystem2_len)
-		freebytes -= ntohl(inv->filesystem2_len);
-	if (inv->device_len)
-		freebytes -= ntohl(inv->device_len);
-
-	printf(" %d bytes free (%2.2f%%)\n\n", freebytes, (float)freebytes/(float)rom->len * 100 );
+static int rom_size_ok(size_t len)
+{
+	return len >= ROMTOC_MIN_ROM && len <= ROMTOC_MAX_ROM &&
+		(len & (len - 1)) == 0;
+}
+
+/* Fill in codec and uncompressed size from the stream header */
+static void detect_codec(struct entry *e)
+{
+	uint32_t magic = e->length >= 8 ? get32(e->data) : 0;
+
+	e->codec = ROMTOC_CODEC_NONE;
+	e->size = e->length;
+	if (magic == ROMTOC_ZX0_MAGIC)
+		e->codec = ROMTOC_CODEC_ZX0;
+	else if (magic == ROMTOC_RNC_MAGIC)
+		e->codec = ROMTOC_CODEC_RNC;
+	else if (magic == ROMTOC_LZ4_MAGIC)
+		e->codec = ROMTOC_CODEC_LZ4;
+	if (e->codec != ROMTOC_CODEC_NONE)
+		e->size = get32(e->data + 4);
 }
 
-char *file_backup(char *addr, size_t len)
+static int legacy_entry(struct rom *rom, uint32_t type, uint32_t dostype,
+		uint32_t offset, uint32_t len)
 {
-	char *backup;
+	struct entry *e = &rom->entry[rom->count];
+
 	if (len == 0)
-		return NULL;
-	backup = malloc(len);
-	if (!backup) {
-		printf("Out of memory.\n");
-		exit(EXIT_FAILURE);
+		return 0;
+	if (offset + len > rom->image.len) {
+		printf("Inventory entry at 0x%06x is outside the image\n", offset);
+		return -1;
 	}
-	memcpy(backup, addr, len);
-	return backup;
+	memset(e, 0, sizeof(*e));
+	e->type = type;
+	e->dostype = type == ROMTOC_TYPE_FILESYSTEM ? dostype : 0;
+	e->offset = offset;
+	e->length = len;
+	e->data = rom->image.addr + offset;
+	detect_codec(e);
+	e->checksum = checksum(e->data, len);
+	rom->count++;
+	return 0;
 }
 
-int resize(struct file *rom, int newsize)
+/*
+ * parse_toc
+ * ---------
+ * Read the table of contents below the old inventory. Returns 0 if
+ * there is none or it does not add up, in which case the caller falls
+ * back to the old inventory.
+ */
+static int parse_toc(struct rom *rom)
 {
-	if ((newsize * 1024) == rom->len) {
-		printf("Skip resize, ROM is already %dkb\n", newsize);
+	char *hdr = rom->image.addr + rom->image.len -
+		ROMTOC_LEGACY_SIZE - ROMTOC_HDR_SIZE;
+	uint32_t count, esize, sum, i, j;
+
+	if (get32(hdr) != ROMTOC_MAGIC)
+		return 0;
+	count = get32(hdr + 4) & 0xffff;
+	esize = get32(hdr + 8) >> 16;
+	if (esize < ROMTOC_ENTRY_SIZE || (esize & 3) ||
+	    count > ROMTOC_MAX_ENTRIES ||
+	    count * esize > hdr - rom->image.addr) {
+		printf("Ignoring ROM TOC with %u entries of %u bytes\n",
+				count, esize);
+		return 0;
+	}
+	sum = get32(hdr) + get32(hdr + 4) + get32(hdr + 8);
+	for (i = 0; i < count; i++)
+		for (j = 0; j < esize; j += 4)
+			sum += get32(hdr - (i + 1) * esize + j);
+	if (sum != get32(hdr + 12)) {
+		printf("Ignoring ROM TOC with bad checksum\n");
 		return 0;
 	}
 
-	struct rom_inventory *inv = (struct rom_inventory *)(rom->addr + rom->len -
-			sizeof(struct rom_inventory));
-	struct rom_inventory backup = *inv;
-
-	int freebytes = rom->len - sizeof(struct rom_inventory) - ntohl(inv->device_offset);
-	if (inv->filesystem1_len)
-		freebytes -= ntohl(inv->filesystem1_len);
-	if (inv->filesystem2_len)
-		freebytes -= ntohl(inv->filesystem2_len);
-	if (inv->device_len)
-		freebytes -= ntohl(inv->device_len);
-
-	if (newsize == 32 && freebytes < 32768) {
-			printf("Not enough free space to resize. Missing %d bytes.\n",
-					32768 - freebytes);
-			return -1;
+	for (i = 0; i < count; i++) {
+		char *p = hdr - (i + 1) * esize;
+		struct entry *e = &rom->entry[i];
+
+		memset(e, 0, sizeof(*e));
+		e->type     = get32(p + 0);
+		e->dostype  = get32(p + 4);
+		e->offset   = get32(p + 8);
+		e->length   = get32(p + 12);
+		e->size     = get32(p + 16);
+		e->codec    = get32(p + 20);
+		e->checksum = get32(p + 24);
+		if (e->offset + e->length > rom->image.len) {
+			printf("ROM TOC entry %u is outside the image\n", i);
+			return 0;
+		}
+		e->data = rom->image.addr + e->offset;
+	}
+	rom->count = count;
+	rom->has_toc = 1;
+	return 1;
+}
+
+/*
+ * parse_rom
+ * ---------
+ * Build the entry list for an image, from the TOC if it has a valid
+ * one, else from the old driver + two filesystem inventory.
+ */
+int parse_rom(struct rom *rom)
+{
+	struct rom_inventory *inv = (struct rom_inventory *)(rom->image.addr +
+			rom->image.len - sizeof(struct rom_inventory));
+
+	rom->count = 0;
+	rom->valid = 0;
+	rom->has_toc = 0;
+	if (ntohl(inv->signature[0]) != ROMTOC_SIG1 ||
+	    ntohl(inv->signature[1]) != ROMTOC_SIG2)
+		return -1;
+
+	rom->header_len = ntohl(inv->device_offset);
+	if (rom->header_len >= rom->image.len)
+		return -1;
+
+	rom->valid = 1;
+	if (parse_toc(rom))
+		return 0;
+
+	if (legacy_entry(rom, ROMTOC_TYPE_DRIVER, 0,
+			ntohl(inv->device_offset), ntohl(inv->device_len)) ||
+	    legacy_entry(rom, ROMTOC_TYPE_FILESYSTEM,
+			ntohl(inv->filesystem1_dostype),
+			ntohl(inv->filesystem1_offset),
+			ntohl(inv->filesystem1_len)) ||
+	    legacy_entry(rom, ROMTOC_TYPE_FILESYSTEM,
+			ntohl(inv->filesystem2_dostype),
+			ntohl(inv->filesystem2_offset),
+			ntohl(inv->filesystem2_len))) {
+		rom->valid = 0;
+		return -1;
+	}
+	return 0;
+}
+
+static uint32_t used_bytes(struct rom *rom)
+{
+	uint32_t used = rom->header_len + ROMTOC_LEGACY_SIZE +
+		ROMTOC_HDR_SIZE + rom->count * ROMTOC_ENTRY_SIZE;
+	int i;
+
+	for (i = 0; i < rom->count; i++)
+		used += rom->entry[i].length;
+	return used;
+}
+
+void inventory(char *filename, struct rom *rom)
+{
+	int i, fs = 0, freebytes;
+	uint32_t sig1 = get32(rom->image.addr + rom->image.len - 8);
+	uint32_t sig2 = get32(rom->image.addr + rom->image.len - 4);
+
+	if (!rom->valid) {
+		printf("%s: %zukB SCSI ROM image. Signature: %08x%08x (INVALID)\n\n",
+			filename, rom->image.len / 1024, sig1, sig2);
+		return;
+	}
+	printf("%s: %zukB SCSI ROM image. Signature: OK, ", filename,
+			rom->image.len / 1024);
+	if (rom->has_toc)
+		printf("TOC v%d (%d entries)\n\n", ROMTOC_VERSION, rom->count);
+	else
+		printf("no TOC\n\n");
+
+	printf(" ROM header:   offset = 0x000000 length = 0x%06x\n",
+			rom->header_len);
+	for (i = 0; i < rom->count; i++) {
+		struct entry *e = &rom->entry[i];
+
+		if (e->type == ROMTOC_TYPE_DRIVER)
+			printf(" Driver:       ");
+		else if (e->type == ROMTOC_TYPE_FILESYSTEM)
+			printf(" FileSystem %d: ", ++fs);
+		else
+			printf(" Type %-7u: ", e->type);
+		printf("offset = 0x%06x length = 0x%06x ", e->offset, e->length);
+		if (e->codec < sizeof(codec_name) / sizeof(codec_name[0]))
+			printf("%s", codec_name[e->codec]);
+		else
+			printf("codec %u", e->codec);
+		if (e->codec != ROMTOC_CODEC_NONE)
+			printf(" (%x uncompressed)", e->size);
+		printf("\n");
+		if (e->type == ROMTOC_TYPE_FILESYSTEM)
+			printf("               DosType = 0x%08x\n", e->dostype);
+		if (rom->has_toc)
+			printf("               Checksum = 0x%08x (%s)\n", e->checksum,
+				checksum(e->data, e->length) == e->checksum ?
+				"OK" : "BAD");
+	}
+	for (; fs < 2; fs++)
+		printf(" FileSystem %d: <empty>\n", fs + 1);
+	printf("\n");
+
+	freebytes = rom->image.len - used_bytes(rom);
+	printf(" %d bytes free (%2.2f%%)\n\n", freebytes,
+			(float)freebytes/(float)rom->image.len * 100 );
+}
+
+/*
+ * build_rom
+ * ---------
+ * Lay out the header and all entries into a new image of the given
+ * size, then write the TOC and, for older drivers and tools, the old
+ * inventory with the driver and the first two filesystems.
+ */
+int build_rom(struct rom *rom, size_t newlen)
+{
+	struct rom_inventory *inv;
+	uint32_t used = used_bytes(rom), offset, sum;
+	char *image, *hdr;
+	int i, j, fs = 0;
+
+	if (used > newlen) {
+		printf("Files can not fit into image (%d bytes too big)\n",
+				(int)(used - newlen));
+		return -1;
 	}
 
-	char *new_addr = malloc(newsize * 1024);
-	if (!new_addr) {
+	image = malloc(newlen);
+	if (!image) {
 		printf("Out of memory.\n");
 		exit(EXIT_FAILURE);
 	}
+	memset(image, 0xff, newlen);
+	memcpy(image, rom->image.addr, rom->header_len);
 
-	if (newsize == 64)
-		memset(new_addr + 32*1024, 0xff, 32*1024);
+	offset = rom->header_len;
+	for (i = 0; i < rom->count; i++) {
+		struct entry *e = &rom->entry[i];
 
-	memcpy(new_addr, rom->addr, 32 * 1024);
-	free(rom->addr);
-	rom->addr = new_addr;
-	rom->len = newsize * 1024;
+		memcpy(image + offset, e->data, e->length);
+		e->offset = offset;
+		e->checksum = checksum(e->data, e->length);
+		offset += e->length;
+	}
 
-	inv = (struct rom_inventory *)(rom->addr + rom->len -
-		sizeof(struct rom_inventory));
-	*inv=backup;
+	hdr = image + newlen - ROMTOC_LEGACY_SIZE - ROMTOC_HDR_SIZE;
+	put32(hdr + 0, ROMTOC_MAGIC);
+	put32(hdr + 4, ROMTOC_VERSION << 16 | rom->count);
+	put32(hdr + 8, ROMTOC_ENTRY_SIZE << 16);
+	sum = get32(hdr) + get32(hdr + 4) + get32(hdr + 8);
+	for (i = 0; i < rom->count; i++) {
+		struct entry *e = &rom->entry[i];
+		char *p = hdr - (i + 1) * ROMTOC_ENTRY_SIZE;
+
+		put32(p + 0, e->type);
+		put32(p + 4, e->dostype);
+		put32(p + 8, e->offset);
+		put32(p + 12, e->length);
+		put32(p + 16, e->size);
+		put32(p + 20, e->codec);
+		put32(p + 24, e->checksum);
+		put32(p + 28, 0);
+		for (j = 0; j < ROMTOC_ENTRY_SIZE; j += 4)
+			sum += get32(p + j);
+	}
+	put32(hdr + 12, sum);
 
+	inv = (struct rom_inventory *)(image + newlen -
+			sizeof(struct rom_inventory));
+	inv->filesystem1_dostype = inv->filesystem2_dostype = 0xffffffff;
+	inv->filesystem1_offset = inv->filesystem1_len = 0;
+	inv->filesystem2_offset = inv->filesystem2_len = 0;
+	inv->device_offset = htonl(rom->header_len);
+	inv->device_len = 0;
+	for (i = 0; i < rom->count; i++) {
+		struct entry *e = &rom->entry[i];
+
+		if (e->type == ROMTOC_TYPE_DRIVER && !inv->device_len) {
+			/* Old drivers expect it right behind the header */
+			if (e->offset == rom->header_len)
+				inv->device_len = htonl(e->length);
+		} else if (e->type == ROMTOC_TYPE_FILESYSTEM && fs == 0) {
+			inv->filesystem1_dostype = htonl(e->dostype);
+			inv->filesystem1_offset = htonl(e->offset);
+			inv->filesystem1_len = htonl(e->length);
+			fs++;
+		} else if (e->type == ROMTOC_TYPE_FILESYSTEM && fs == 1) {
+			inv->filesystem2_dostype = htonl(e->dostype);
+			inv->filesystem2_offset = htonl(e->offset);
+			inv->filesystem2_len = htonl(e->length);
+			fs++;
+		}
+	}
+	inv->signature[0] = htonl(ROMTOC_SIG1);
+	inv->signature[1] = htonl(ROMTOC_SIG2);
+
+	for (i = 0; i < rom->count; i++)
+		rom->entry[i].data = image + rom->entry[i].offset;
+	free(rom->image.addr);
+	rom->image.addr = image;
+	rom->image.len = newlen;
+	rom->has_toc = 1;
 	return 0;
 }
 
@@ -217,134 +453,270 @@ struct file memorize_file(char *filename)
 	return ret;
 }
 
-int write_file(char *filename, struct file rom)
+/* Pick the codec per payload by estimated decode time (-c fast) */
+#define CODEC_FAST  -1
+#define MAX_CANDIDATES  3
+
+struct payload {
+	const char *name;
+	int count, chosen;
+	struct file cand[MAX_CANDIDATES];
+	uint64_t cycles[MAX_CANDIDATES];
+};
+
+/* Same padding as memorize_file() */
+static struct file padded_copy(const uint8_t *data, size_t len)
 {
-	int fd = open(filename, O_CREAT | O_WRONLY | O_TRUNC | O_BINARY,
-			S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
-	if (fd == -1) {
-		fprintf(stderr, "%s: ",filename);
-		perror("Could not open file");
-		exit(EXIT_FAILURE);
-	}
+	struct file f;
 
-	if (write(fd, rom.addr, rom.len) != rom.len) {
-		perror("Could not write file");
+	f.len = (len + 15) & ~15;
+	f.addr = calloc(f.len, 1);
+	if (!f.addr) {
+		printf("Out of memory.\n");
 		exit(EXIT_FAILURE);
 	}
-
-	close(fd);
-
-	return 0;
+	memcpy(f.addr, data, len);
+	return f;
 }
 
-int replace_file(struct file *rom, int num, struct file *file_to_insert, int dostype)
+static void add_candidate(struct payload *p, struct file f)
 {
-	struct rom_inventory *inv = (struct rom_inventory *)(rom->addr + rom->len -
-			sizeof(struct rom_inventory));
-
-	int new_space = 0;
-	struct file local_filesystem1 = {NULL,0},
-		    local_filesystem2 = {NULL,0},
-		    device_content    = {NULL,0};
-
-	// Flags to track which local struct file's .addr was allocated by file_backup
-	int device_content_is_backup = 0;
-	int filesystem1_is_backup = 0;
-	int filesystem2_is_backup = 0;
-
-	switch (num) {
-	case DEVICE:
-		new_space = ntohl(inv->device_offset) + file_to_insert->len + ntohl(inv->filesystem1_len) + ntohl(inv->filesystem2_len) + sizeof(struct rom_inventory);
-
-		device_content = *file_to_insert;
-
-		local_filesystem1.addr = file_backup(rom->addr+ntohl(inv->filesystem1_offset), ntohl(inv->filesystem1_len));
-		local_filesystem1.len = ntohl(inv->filesystem1_len);
-		if (local_filesystem1.addr) filesystem1_is_backup = 1;
-
-		local_filesystem2.addr = file_backup(rom->addr+ntohl(inv->filesystem2_offset), ntohl(inv->filesystem2_len));
-		local_filesystem2.len = ntohl(inv->filesystem2_len);
-		if (local_filesystem2.addr) filesystem2_is_backup = 1;
-		break;
-	case FILESYSTEM1:
-		new_space = ntohl(inv->device_offset) + ntohl(inv->device_len) + file_to_insert->len + ntohl(inv->filesystem2_len) + sizeof(struct rom_inventory);
+	p->cycles[p->count] = romcodec_cycles((uint8_t *)f.addr, f.len);
+	p->cand[p->count++] = f;
+}
 
-		device_content.addr = file_backup(rom->addr+ntohl(inv->device_offset), ntohl(inv->device_len));
-		device_content.len = ntohl(inv->device_len);
-		if (device_content.addr) device_content_is_backup = 1;
+/*
+ * pack_payloads
+ * -------------
+ * Load the given files and pack those which are not compressed yet
+ * with codec, or with every codec for CODEC_FAST. Files which are
+ * packed already are taken as they are. Each payload starts out with
+ * its smallest candidate, choose_codecs() trades up from there. zx0
+ * packing runs on all CPUs and reuses results from $ZX0PACK_CACHE.
+ */
+static void pack_payloads(char **names, struct payload *payloads, int count,
+		int codec)
+{
+	struct zx0pack_job jobs[ROMTOC_MAX_ENTRIES];
+	struct file raw[ROMTOC_MAX_ENTRIES];
+	int map[ROMTOC_MAX_ENTRIES], n = 0, i, j;
+
+	for (i = 0; i < count; i++) {
+		struct payload *p = &payloads[i];
+		struct entry e;
+
+		memset(p, 0, sizeof(*p));
+		if (!names[i])
+			continue;
+		p->name = names[i];
+		raw[i] = memorize_file(names[i]);
+		e.data = raw[i].addr;
+		e.length = raw[i].len;
+		detect_codec(&e);
+		if (e.codec != ROMTOC_CODEC_NONE) {
+			add_candidate(p, raw[i]);
+			continue;
+		}
+		if (codec == ROMTOC_CODEC_LZ4 || codec == CODEC_FAST) {
+			struct stat st;
+			struct file f;
+			uint8_t *data = NULL;
+			size_t len;
+
+			/* The padding is not part of the payload */
+			if (stat(names[i], &st) == 0)
+				data = lz4pack_buffer((uint8_t *)raw[i].addr,
+						st.st_size, &len);
+			if (!data) {
+				printf("Could not lz4 pack %s\n", names[i]);
+				exit(EXIT_FAILURE);
+			}
+			f = padded_copy(data, len);
+			free(data);
+			add_candidate(p, f);
+		}
+		if (codec == ROMTOC_CODEC_ZX0 || codec == CODEC_FAST) {
+			memset(&jobs[n], 0, sizeof(jobs[n]));
+			jobs[n].input = names[i];
+			map[n++] = i;
+		}
+		if (codec == CODEC_FAST)
+			add_candidate(p, raw[i]);
+		else
+			free(raw[i].addr);
+	}
 
-		local_filesystem1 = *file_to_insert;
+	if (n && zx0pack_run(jobs, n, 0, NULL))
+		exit(EXIT_FAILURE);
+	for (i = 0; i < n; i++) {
+		add_candidate(&payloads[map[i]],
+				padded_copy(jobs[i].data, jobs[i].len));
+		if (jobs[i].cached)
+			printf("%s: zx0 result from cache\n", jobs[i].input);
+		free(jobs[i].data);
+	}
 
-		local_filesystem2.addr = file_backup(rom->addr+ntohl(inv->filesystem2_offset), ntohl(inv->filesystem2_len));
-		local_filesystem2.len = ntohl(inv->filesystem2_len);
-		if (local_filesystem2.addr) filesystem2_is_backup = 1;
+	for (i = 0; i < count; i++) {
+		struct payload *p = &payloads[i];
+
+		if (!p->count)
+			continue;
+		for (j = 1; j < p->count; j++)
+			if (p->cand[j].len < p->cand[p->chosen].len)
+				p->chosen = j;
+		if (p->count == 1 && codec != CODEC_FAST)
+			continue;
+		printf("%s:\n", p->name);
+		for (j = 0; j < p->count; j++) {
+			struct entry e;
+
+			e.data = p->cand[j].addr;
+			e.length = p->cand[j].len;
+			detect_codec(&e);
+			printf("   %-12s %7zu bytes  %8.2f Mcycles\n",
+				codec_name[e.codec], p->cand[j].len,
+				p->cycles[j] / 1e6);
+		}
+	}
+}
 
-		inv->filesystem1_dostype = htonl(dostype);
+static struct entry *payload_entry(struct rom *rom, struct payload *p)
+{
+	int i;
 
-		break;
-	case FILESYSTEM2:
-		new_space = ntohl(inv->device_offset) + ntohl(inv->device_len) + ntohl(inv->filesystem1_len) + file_to_insert->len + sizeof(struct rom_inventory);
+	for (i = 0; i < rom->count; i++)
+		if (rom->entry[i].data == p->cand[p->chosen].addr)
+			return &rom->entry[i];
+	return NULL;
+}
 
-		device_content.addr = file_backup(rom->addr+ntohl(inv->device_offset), ntohl(inv->device_len));
-		device_content.len = ntohl(inv->device_len);
-		if (device_content.addr) device_content_is_backup = 1;
+/*
+ * choose_codecs
+ * -------------
+ * Starting from the smallest candidates, spend the free space of a
+ * romlen bytes image on faster ones. Each step takes the switch which
+ * saves the most decode cycles per extra ROM byte, so the space goes
+ * where it buys the most boot time.
+ */
+static void choose_codecs(struct rom *rom, struct payload *payloads,
+		int count, uint32_t romlen)
+{
+	uint32_t used = used_bytes(rom);
+	int64_t room = (int64_t)romlen - used;
+	int i, j;
+
+	for (;;) {
+		struct payload *best = NULL;
+		double best_gain = 0;
+		int best_cand = 0;
+
+		for (i = 0; i < count; i++) {
+			struct payload *p = &payloads[i];
+
+			for (j = 0; j < p->count; j++) {
+				int64_t extra = (int64_t)p->cand[j].len -
+					p->cand[p->chosen].len;
+				double gain;
+
+				if (!p->cycles[j] ||
+				    p->cycles[j] >= p->cycles[p->chosen] ||
+				    extra > room)
+					continue;
+				gain = (double)(p->cycles[p->chosen] -
+						p->cycles[j]) /
+					(extra > 0 ? extra : 1);
+				if (gain > best_gain) {
+					best = p;
+					best_gain = gain;
+					best_cand = j;
+				}
+			}
+		}
+		if (!best)
+			break;
 
-		local_filesystem1.addr = file_backup(rom->addr+ntohl(inv->filesystem1_offset), ntohl(inv->filesystem1_len));
-		local_filesystem1.len = ntohl(inv->filesystem1_len);
-		if (local_filesystem1.addr) filesystem1_is_backup = 1;
+		struct entry *e = payload_entry(rom, best);
 
-		local_filesystem2 = *file_to_insert;
+		room -= (int64_t)best->cand[best_cand].len -
+			best->cand[best->chosen].len;
+		best->chosen = best_cand;
+		if (e) {
+			e->data = best->cand[best_cand].addr;
+			e->length = best->cand[best_cand].len;
+			detect_codec(e);
+		}
+	}
 
-		inv->filesystem2_dostype = htonl(dostype);
+	for (i = 0; i < count; i++) {
+		struct payload *p = &payloads[i];
+		struct entry *e;
 
-		break;
+		if (p->count < 2 || !(e = payload_entry(rom, p)))
+			continue;
+		printf("%s: using %s\n", p->name, codec_name[e->codec]);
 	}
+}
 
-	if (new_space > rom->len) {
-		printf("File can not fit into image (%zd bytes too big)\n",
-				new_space - rom->len);
-		// Free any allocated backups before returning
-		if (device_content_is_backup && device_content.addr) free(device_content.addr);
-		if (filesystem1_is_backup && local_filesystem1.addr) free(local_filesystem1.addr);
-		if (filesystem2_is_backup && local_filesystem2.addr) free(local_filesystem2.addr);
-		return -1;
+int write_file(char *filename, struct file rom)
+{
+	int fd = open(filename, O_CREAT | O_WRONLY | O_TRUNC | O_BINARY,
+			S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+	if (fd == -1) {
+		fprintf(stderr, "%s: ",filename);
+		perror("Could not open file");
+		exit(EXIT_FAILURE);
 	}
 
-	/* Write device driver back */
-	// First, clear the area where content will be placed (or the free space after the last item)
-	memset(rom->addr + ntohl(inv->device_offset), 0xff, rom->len - ntohl(inv->device_offset) - sizeof(struct rom_inventory));
-	if (device_content.addr && device_content.len > 0) { // Ensure there's content to copy
-		memcpy(rom->addr + ntohl(inv->device_offset), device_content.addr, device_content.len);
+	if (write(fd, rom.addr, rom.len) != rom.len) {
+		perror("Could not write file");
+		exit(EXIT_FAILURE);
 	}
-	inv->device_len = htonl(device_content.len); // This correctly reflects the new device length or existing if not replaced
 
-	uint32_t current_offset = ntohl(inv->device_offset) + device_content.len;
+	close(fd);
 
-	if (local_filesystem1.len > 0 && local_filesystem1.addr) { // Ensure there's content to copy
-		inv->filesystem1_offset = htonl(current_offset);
-		inv->filesystem1_len = htonl(local_filesystem1.len);
-		memcpy(rom->addr + current_offset, local_filesystem1.addr, local_filesystem1.len);
-		current_offset += local_filesystem1.len;
-	} else {
-		inv->filesystem1_offset = 0; // Or an offset indicating no file, e.g., current_offset if it's 0 length
-		inv->filesystem1_len = 0;
-	}
+	return 0;
+}
 
-	if (local_filesystem2.len > 0 && local_filesystem2.addr) { // Ensure there's content to copy
-		inv->filesystem2_offset = htonl(current_offset);
-		inv->filesystem2_len = htonl(local_filesystem2.len);
-		memcpy(rom->addr + current_offset, local_filesystem2.addr, local_filesystem2.len);
-		// current_offset += local_filesystem2.len; // Not needed after this
-	} else {
-		inv->filesystem2_offset = 0;
-		inv->filesystem2_len = 0;
+/*
+ * replace_file
+ * ------------
+ * Put a file in place of the driver (slot < 0) or of filesystem number
+ * slot, counting from 0. A slot past the last filesystem appends one.
+ */
+int replace_file(struct rom *rom, int slot, struct file *file, uint32_t dostype)
+{
+	struct entry *e = NULL;
+	int i, fs = 0;
+
+	for (i = 0; i < rom->count && !e; i++) {
+		if (slot < 0 && rom->entry[i].type == ROMTOC_TYPE_DRIVER)
+			e = &rom->entry[i];
+		else if (slot >= 0 && rom->entry[i].type == ROMTOC_TYPE_FILESYSTEM &&
+			 fs++ == slot)
+			e = &rom->entry[i];
 	}
 
-	// Free any allocated backups
-	if (device_content_is_backup && device_content.addr) free(device_content.addr);
-	if (filesystem1_is_backup && local_filesystem1.addr) free(local_filesystem1.addr);
-	if (filesystem2_is_backup && local_filesystem2.addr) free(local_filesystem2.addr);
+	if (!e) {
+		if (rom->count == ROMTOC_MAX_ENTRIES) {
+			printf("ROM TOC is full (%d entries)\n", ROMTOC_MAX_ENTRIES);
+			return -1;
+		}
+		if (slot < 0) {
+			/* The driver goes first, right behind the ROM header */
+			memmove(&rom->entry[1], &rom->entry[0],
+					rom->count * sizeof(struct entry));
+			e = &rom->entry[0];
+		} else
+			e = &rom->entry[rom->count];
+		rom->count++;
+	}
 
+	memset(e, 0, sizeof(*e));
+	e->type = slot < 0 ? ROMTOC_TYPE_DRIVER : ROMTOC_TYPE_FILESYSTEM;
+	e->dostype = slot < 0 ? 0 : dostype;
+	e->data = file->addr;
+	e->length = file->len;
+	detect_codec(e);
 	return 0;
 }
 
@@ -360,27 +732,32 @@ static void print_usage(const char *name)
 	printf("\n"
 	       "   -o | --output <filename>              output filename\n"
 	       "   -D | --device <filename>              path to driver image\n"
-	       "   -F | --filesystem <filename>          path to CDFileSystem\n"
+	       "   -F | --filesystem <filename>          path to a filesystem, may be given\n"
+	       "                                         up to %d times\n"
 	       "   -T | --dostype <val>                  DosType (eg. 0x43443031), required with -F\n"
-	       "   -s | --skip                           skip first filesystem slot\n"
-	       "   -r | --resize [32|64}                 resize rom image to 32kB or 64kB\n"
+	       "   -s | --skip                           keep the next filesystem entry\n"
+	       "   -r | --resize <kB>                    resize rom image (32, 64, ... 512kB)\n"
+	       "   -c | --codec <zx0|lz4|fast>           pack uncompressed -D/-F files; fast\n"
+	       "                                         picks the codec per file that unpacks\n"
+	       "                                         quickest and still fits the ROM\n"
+	       "   -z | --compress                       same as --codec zx0\n"
 	       "   -v | --version:                       print the version\n"
-	       "   -h | --help:                          print this help\n\n");
+	       "   -h | --help:                          print this help\n\n",
+	       MAX_FILESYSTEMS);
 }
 
 int main(int argc, char *argv[])
 {
 	char *output_filename = NULL,
 	     *device_filename = NULL,
-	     *filesystem1_filename = NULL,
-	     *filesystem2_filename = NULL;
+	     *fs_filename[MAX_FILESYSTEMS] = { NULL };
 
-	int fs_slot = 0, changed = 0;
-	uint32_t newsize=0, filesystem1_dostype=0, filesystem2_dostype=0;
-	struct file rom = {NULL,0},
-		    device = {NULL,0},
-		    filesystem1 = {NULL,0},
-		    filesystem2 = {NULL,0};
+	int i, fs_slot = 0, changed = 0, codec = ROMTOC_CODEC_NONE;
+	uint32_t newsize = 0, fs_dostype[MAX_FILESYSTEMS] = { 0 };
+	struct rom rom;
+	struct file device = {NULL,0},
+		    filesystem[MAX_FILESYSTEMS];
+	struct payload payloads[1 + MAX_FILESYSTEMS];
 
 	int opt, option_index = 0;
 	static const struct option long_options[] = {
@@ -390,12 +767,17 @@ int main(int argc, char *argv[])
 		{"dostype", 1, NULL, 'T'},
 		{"skip", 0, NULL, 's'},
 		{"resize", 1, NULL, 'r'},
+		{"codec", 1, NULL, 'c'},
+		{"compress", 0, NULL, 'z'},
 		{"version", 0, NULL, 'v'},
 		{"help", 0, NULL, 'h'},
 		{0, 0, 0, 0}
 	};
 
-	while ((opt = getopt_long(argc, argv, "o:D:F:T:sr:vh?",
+	memset(&rom, 0, sizeof(rom));
+	memset(filesystem, 0, sizeof(filesystem));
+
+	while ((opt = getopt_long(argc, argv, "o:D:F:T:sr:c:zvh?",
 					long_options, &option_index)) != EOF) {
 		switch (opt) {
 		case 'o':
@@ -405,40 +787,52 @@ int main(int argc, char *argv[])
 			device_filename = strdup(optarg);
 			break;
 		case 'F':
-			if (fs_slot == 0)
-				filesystem1_filename = strdup(optarg);
-			else if (fs_slot ==1)
-				filesystem2_filename = strdup(optarg);
-			else {
-				printf("Only two filesystems supported\n");
+			if (fs_slot >= MAX_FILESYSTEMS) {
+				printf("Only %d filesystems supported\n",
+						MAX_FILESYSTEMS);
 				exit(1);
 			}
-			fs_slot++;
+			fs_filename[fs_slot++] = strdup(optarg);
 			break;
 		case 'T':
-			if (fs_slot == 0) {
+			if (fs_slot == 0 || !fs_filename[fs_slot - 1]) {
 				printf("Specify filesystem before DosType.\n");
 				exit(1);
-			} else if (fs_slot == 1) {
-				filesystem1_dostype = strtol(optarg, NULL, 16);
-			} else if (fs_slot == 2) {
-				filesystem2_dostype = strtol(optarg, NULL, 16);
 			}
+			fs_dostype[fs_slot - 1] = strtoul(optarg, NULL, 16);
 			break;
 		case 's':
-			fs_slot++;
-			if (fs_slot > 1) {
-				printf("Only two filesystems supported\n");
+			if (fs_slot >= MAX_FILESYSTEMS) {
+				printf("Only %d filesystems supported\n",
+						MAX_FILESYSTEMS);
 				exit(1);
 			}
+			fs_slot++;
 			break;
 		case 'r':
 			newsize = strtoul(optarg, NULL, 0);
-			if (newsize != 32 && newsize != 64) {
-				printf("Option --resize only supports 32 and 64.\n");
+			if (!rom_size_ok(newsize * 1024)) {
+				printf("Option --resize supports 32, 64, 128, 256"
+				       " and 512.\n");
 				exit(EXIT_FAILURE);
 			}
 			break;
+		case 'c':
+			if (!strcmp(optarg, "zx0"))
+				codec = ROMTOC_CODEC_ZX0;
+			else if (!strcmp(optarg, "lz4"))
+				codec = ROMTOC_CODEC_LZ4;
+			else if (!strcmp(optarg, "fast"))
+				codec = CODEC_FAST;
+			else {
+				printf("Option --codec supports zx0, lz4 and"
+				       " fast.\n");
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'z':
+			codec = ROMTOC_CODEC_ZX0;
+			break;
 		case 'v':
 			print_version();
 			exit(EXIT_SUCCESS);
@@ -459,72 +853,100 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
-	if ((filesystem1_filename && filesystem1_dostype == 0) ||
-	    (filesystem2_filename && filesystem2_dostype == 0)) {
-		fprintf(stderr, "Error: no DosType (-T) given for %s.\n"
-			"The driver loads filesystems on demand, keyed by"
-			" DosType; a slot\nwithout one would never be"
-			" loaded.\n",
-			(filesystem1_filename && filesystem1_dostype == 0) ?
-			filesystem1_filename : filesystem2_filename);
-		exit(EXIT_FAILURE);
+	for (i = 0; i < fs_slot; i++) {
+		if (fs_filename[i] && fs_dostype[i] == 0) {
+			fprintf(stderr, "Error: no DosType (-T) given for %s.\n"
+				"The driver loads filesystems on demand, keyed by"
+				" DosType; a slot\nwithout one would never be"
+				" loaded.\n", fs_filename[i]);
+			exit(EXIT_FAILURE);
+		}
 	}
 
 	char *filename = argv[optind];
 	if (!output_filename)
 		output_filename = filename;
 
-	rom = memorize_file(filename);
-
-	//int size = rom.len;
-	//char *image = rom.addr;
+	rom.image = memorize_file(filename);
 
-	if (rom.len != (32*1024) && rom.len != (64*1024)) {
-		printf("ROM file needs to be 32k or 64k in size\n");
+	if (!rom_size_ok(rom.image.len)) {
+		printf("ROM file needs to be 32k, 64k, ... or 512k in size\n");
 		exit(EXIT_FAILURE);
 	}
 
-	if (newsize) {
-		if (resize(&rom, newsize))
+	if (parse_rom(&rom)) {
+		if (device_filename || fs_slot || newsize) {
+			printf("%s has no valid ROM inventory.\n", filename);
 			exit(EXIT_FAILURE);
-		if (newsize * 1024 != rom.len)
-			changed = 1;
+		}
+		inventory(filename, &rom);
+		free(rom.image.addr);
+		return 0;
 	}
 
 	// TODO implement file removal
 
+	if (codec != ROMTOC_CODEC_NONE) {
+		char *names[1 + MAX_FILESYSTEMS];
+
+		names[0] = device_filename;
+		memcpy(&names[1], fs_filename, sizeof(fs_filename));
+		pack_payloads(names, payloads, 1 + MAX_FILESYSTEMS, codec);
+		for (i = 0; i < 1 + MAX_FILESYSTEMS; i++) {
+			struct payload *p = &payloads[i];
+
+			if (!p->count)
+				continue;
+			if (i == 0)
+				device = p->cand[p->chosen];
+			else
+				filesystem[i - 1] = p->cand[p->chosen];
+		}
+	}
+
 	if (device_filename) {
-		device = memorize_file(device_filename);
-		replace_file(&rom, DEVICE, &device, 0L);
+		if (!device.addr)
+			device = memorize_file(device_filename);
+		if (replace_file(&rom, -1, &device, 0))
+			exit(EXIT_FAILURE);
 		changed = 1;
 	}
 
-	if (filesystem1_filename) {
-		filesystem1 = memorize_file(filesystem1_filename);
-		replace_file(&rom, FILESYSTEM1, &filesystem1,
-				filesystem1_dostype);
+	for (i = 0; i < fs_slot; i++) {
+		if (!fs_filename[i])
+			continue;
+		if (!filesystem[i].addr)
+			filesystem[i] = memorize_file(fs_filename[i]);
+		if (replace_file(&rom, i, &filesystem[i], fs_dostype[i]))
+			exit(EXIT_FAILURE);
 		changed = 1;
 	}
 
-	if (filesystem2_filename) {
-		filesystem2 = memorize_file(filesystem2_filename);
-		replace_file(&rom, FILESYSTEM2, &filesystem2,
-				filesystem2_dostype);
+	if (codec == CODEC_FAST)
+		choose_codecs(&rom, payloads, 1 + MAX_FILESYSTEMS,
+				newsize ? newsize * 1024 : rom.image.len);
+
+	if (newsize && newsize * 1024 == rom.image.len)
+		printf("Skip resize, ROM is already %dkb\n", newsize);
+	else if (newsize)
 		changed = 1;
-	}
+
+	/* Rewriting also upgrades an image with the old inventory only */
+	if (changed && build_rom(&rom, newsize ? newsize * 1024 :
+				rom.image.len))
+		exit(EXIT_FAILURE);
 
 	inventory(output_filename, &rom);
 
 	if (changed)
-		write_file(output_filename, rom);
+		write_file(output_filename, rom.image);
 
-	if (filesystem1.addr)
-		free(filesystem1.addr);
-	if (filesystem2.addr)
-		free(filesystem2.addr);
+	for (i = 0; i < MAX_FILESYSTEMS; i++)
+		if (filesystem[i].addr)
+			free(filesystem[i].addr);
 	if (device.addr)
 		free(device.addr);
-	free(rom.addr);
+	free(rom.image.addr);
 
 	return 0;
 }
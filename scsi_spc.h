@@ -404,6 +404,33 @@ struct scsi_reserve_release_10_idparam {
 /*
  * REPORT LUNS
  */
+#define SCSI_REPORT_LUNS		0xA0
+
+struct scsi_report_luns {
+	u_int8_t opcode;
+	u_int8_t _res0;
+	u_int8_t selectreport;
+#define SELECTREPORT_NORMAL		0x00
+#define SELECTREPORT_WELLKNOWN		0x01
+#define SELECTREPORT_ALL		0x02
+	u_int8_t _res1[3];
+	u_int8_t alloclen[4];
+	u_int8_t _res2;
+	u_int8_t control;
+};
+
+struct scsi_report_luns_header {
+	u_int8_t length[4];		/* in bytes, not including header */
+	u_int8_t _res0[4];
+					/* followed by array of: */
+};
+
+struct scsi_report_luns_lun {
+	u_int8_t lun[8];
+#define REPORTLUNS_ADDR_MASK		0xc0	/* addressing method */
+#define REPORTLUNS_ADDR_PERIPH		0x00	/* peripheral device */
+#define REPORTLUNS_ADDR_FLAT		0x40	/* flat space */
+};
 
 /*
  * MAINTENANCE_IN[REPORT SUPPORTED OPERATION CODES]
@@ -1191,6 +1191,9 @@ scsi_probe_device(struct scsibus_softc *sc, int target, int lun)
 #endif  /* !PORT_AMIGA */
 
 #ifdef PORT_AMIGA
+#ifdef ENABLE_TOPOCACHE
+	topo_note_inquiry(periph, inqbuf);
+#endif
 	FreeMem(inqbuf, sizeof(*inqbuf));
 #endif
 	return (docontinue);
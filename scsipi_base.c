@@ -53,6 +53,8 @@
 #include "scsi_all.h"
 #include "scsi_message.h"
 #include "sd.h"
+#include "device.h"
+#include "bootlog.h"
 
 #undef SCSIPI_DEBUG
 #undef QUEUE_DEBUG
@@ -598,6 +600,8 @@ scsipi_get_xs(struct scsipi_periph *periph, int flags)
     xs->xs_done_callback = NULL;
     xs->xs_callback_arg = NULL;
     xs->amiga_ior = NULL;
+    xs->xs_iov = NULL;
+    xs->xs_iovcnt = 0;
 
     chan->chan_active++;
 
@@ -1036,6 +1040,36 @@ scsipi_kill_pending(struct scsipi_periph *periph)
 	}
 }
 
+#ifdef PORT_AMIGA
+/*
+ * scsipi_abort_queued
+ * -------------------
+ * Take the xfers of requests which were marked by AbortIO() off the
+ * channel queue before they reach the adapter. Like the commands
+ * flushed by a bus reset, they finish through the completion queue,
+ * where the periph callback replies the request with IOERR_ABORTED.
+ */
+void
+scsipi_abort_queued(struct scsipi_channel *chan)
+{
+	struct scsipi_xfer *xs, *xs_next;
+	struct IORequest *ior;
+
+	for (xs = TAILQ_FIRST(&chan->chan_queue); xs != NULL; xs = xs_next) {
+		xs_next = TAILQ_NEXT(xs, channel_q);
+		ior = xs->amiga_ior;
+		if (ior == NULL || (ior->io_Flags & IOF_ABORTREQ) == 0 ||
+		    (xs->xs_control & (XS_CTL_ASYNC | XS_CTL_REQSENSE)) !=
+		    XS_CTL_ASYNC)
+			continue;
+		TAILQ_REMOVE(&chan->chan_queue, xs, channel_q);
+		xs->error = XS_RESET;
+		xs->xs_retries = 0;
+		TAILQ_INSERT_TAIL(&chan->chan_complete, xs, channel_q);
+	}
+}
+#endif
+
 /*
  * scsipi_print_cdb:
  * prints a command descriptor block (for debug purpose, error messages,
@@ -1272,6 +1306,10 @@ scsipi_interpret_sense(struct scsipi_xfer *xs)
 			error = EINVAL;
 			break;
 		case SKEY_UNIT_ATTENTION:
+#ifdef PORT_AMIGA
+			/* Geometry or mode parameters may have changed */
+			sd_geom_invalidate(periph);
+#endif
 			if (sense->asc == 0x29 &&
 			    sense->ascq == 0x00) {
 				/* device or bus reset */
@@ -2075,6 +2113,10 @@ scsipi_complete(struct scsipi_xfer *xs)
 	} else
 		mutex_exit(chan_mtx(chan));
 
+#ifdef ENABLE_BOOTLOG
+	bootlog_xfer(xs);
+#endif
+
 #ifndef PORT_AMIGA
 /*
  * cdh disabled for now -- not sure, but might need this if
@@ -344,6 +344,8 @@ struct scsipi_channel {
 	struct Task *chan_task;
 	uint32_t chan_sig_mask;
 	uint64_t chan_current_blkno;
+	uint32_t chan_reset_count;       /* bus resets, invalidates idle units */
+	volatile uint8_t chan_abort_pending; /* AbortIO() marked a request */
 #endif
 #ifndef PORT_AMIGA
 	/* callback we may have to call from completion thread */
@@ -444,6 +446,7 @@ struct scsipi_periph {
 	void *drv_state;        /* pointer to Amiga driver's device state */
         struct MinList periph_changeintlist;  /* Notify list for media change */
         struct Interrupt *periph_changeint;   /* Old notify for media change */
+        struct DriveGeometry *periph_geom;    /* Cached TD_GETGEOMETRY result */
 #else
 	device_t periph_dev;	/* pointer to peripheral's device */
 #endif
@@ -554,6 +557,8 @@ struct scsipi_periph {
 #define PERIPH_KEEP_LABEL	0x0200	/* retain label after 'full' close */
 #define	PERIPH_SENSE		0x0400	/* periph has sense pending */
 #define PERIPH_UNTAG		0x0800	/* untagged command running */
+#define PERIPH_WP_VALID		0x1000	/* PERIPH_WP is valid */
+#define PERIPH_WP		0x2000	/* media is write protected */
 
 /* periph_quirks */
 #define	PQUIRK_AUTOSAVE		0x00000001	/* do implicit SAVE POINTERS */
@@ -630,6 +635,8 @@ struct scsipi_xfer {
 
         void    *xs_callback_arg;       /* AmigaOS callback data */
         void    *amiga_ior;             /* AmigaOS IO request for transfer */
+        const struct NSIOVec *xs_iov;   /* Vectored data buffers, or NULL */
+        int     xs_iovcnt;              /* Number of xs_iov entries */
 	int	xs_control;		/* control flags */
 	volatile int xs_status;		/* status flags */
 	struct scsipi_periph *xs_periph;/* peripheral doing the xfer */
@@ -790,6 +797,9 @@ void	scsipi_user_done(struct scsipi_xfer *);
 int	scsipi_interpret_sense(struct scsipi_xfer *);
 void	scsipi_wait_drain(struct scsipi_periph *);
 void	scsipi_kill_pending(struct scsipi_periph *);
+#ifdef PORT_AMIGA
+void	scsipi_abort_queued(struct scsipi_channel *);
+#endif
 void    scsipi_get_opcodeinfo(struct scsipi_periph *periph);
 void    scsipi_free_opcodeinfo(struct scsipi_periph *periph);
 struct scsipi_periph *scsipi_alloc_periph(int);
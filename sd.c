@@ -37,6 +37,7 @@
 #include "attach.h"
 #include "cmdhandler.h"
 #include "ndkcompat.h"
+#include "nsd.h"
 
 #ifndef SDRETRIES
 #define SDRETRIES 2
@@ -61,6 +62,7 @@ static void sd_complete(struct scsipi_xfer *xs);
 static void sd_startstop_complete(struct scsipi_xfer *xs);
 static void sd_tur_complete(struct scsipi_xfer *xs);
 static void scsidirect_complete(struct scsipi_xfer *xs);
+static void scsidirect_batch_complete(struct scsipi_xfer *xs);
 static void geom_done_inquiry(struct scsipi_xfer *xs);
 
 #if defined(SCRIPTS_IN_MAINBOARD_RAM)
@@ -207,6 +209,10 @@ translate_xs_error(struct scsipi_xfer *xs)
 {
     scsipi_xfer_result_t res = xs->error;
 
+    if ((res != XS_NOERROR) && (xs->amiga_ior != NULL) &&
+        (((struct IORequest *) xs->amiga_ior)->io_Flags & IOF_ABORTREQ))
+        return (IOERR_ABORTED);  // Cancelled by AbortIO()
+
     if (res == XS_SENSE) {
         if ((xs->sense.scsi_sense.asc == 0x3a) ||
             ((xs->sense.scsi_sense.asc == 0x04) &&
@@ -249,12 +255,46 @@ call_changeintlist(struct scsipi_periph *periph)
     Permit();
 }
 
+/*
+ * sd_geom_invalidate
+ * ------------------
+ * Drop the cached geometry and write protect status of a unit, so the
+ * next TD_GETGEOMETRY or TD_PROTSTATUS goes back to the drive. Called
+ * on media change, unit attention, and after MODE SELECT or FORMAT UNIT
+ * was sent through HD_SCSICMD.
+ */
+void
+sd_geom_invalidate(struct scsipi_periph *periph)
+{
+    periph->periph_flags &= ~(PERIPH_WP_VALID | PERIPH_WP);
+    if (periph->periph_geom != NULL) {
+        FreeMem(periph->periph_geom, sizeof (*periph->periph_geom));
+        periph->periph_geom = NULL;
+    }
+}
+
+/*
+ * geom_cache_store
+ * ----------------
+ * Remember a successfully computed geometry, so that repeat
+ * TD_GETGEOMETRY requests can be answered without bus traffic.
+ */
+static void
+geom_cache_store(struct scsipi_periph *periph, const struct DriveGeometry *geom)
+{
+    if (periph->periph_geom == NULL)
+        periph->periph_geom = AllocMem(sizeof (*geom), MEMF_PUBLIC);
+    if (periph->periph_geom != NULL)
+        CopyMem((APTR) geom, periph->periph_geom, sizeof (*geom));
+}
+
 void
 sd_media_unloaded(struct scsipi_periph *periph)
 {
     if (periph->periph_flags & PERIPH_MEDIA_LOADED) {
         periph->periph_flags &= ~PERIPH_MEDIA_LOADED;
         periph->periph_changenum++;
+        sd_geom_invalidate(periph);
         call_changeintlist(periph);
         printf("Media unloaded\n");
     }
@@ -266,6 +306,7 @@ sd_media_loaded(struct scsipi_periph *periph)
     if ((periph->periph_flags & PERIPH_MEDIA_LOADED) == 0) {
         periph->periph_flags |= PERIPH_MEDIA_LOADED;
         periph->periph_changenum++;
+        sd_geom_invalidate(periph);
         call_changeintlist(periph);
         printf("Media loaded\n");
     }
@@ -385,6 +426,7 @@ sd_blocksize(void *periph_p)
     struct scsipi_periph *periph = periph_p;
     int      flags;
     int blksize = 0;
+    uint64_t capacity;
     scsi_mode_sense_t modepage;
 
     if (periph->periph_blkshift != 0)
@@ -395,7 +437,7 @@ sd_blocksize(void *periph_p)
     /*
      * SCSI Read Capacity can provide block size.
      */
-    (void) sd_read_capacity(periph, &blksize, flags);
+    capacity = sd_read_capacity(periph, &blksize, flags);
     if (is_valid_blksize(blksize))
         goto got_blocksize;
 
@@ -435,6 +477,9 @@ sd_blocksize(void *periph_p)
 
 got_blocksize:
     periph->periph_blkshift = calc_blkshift(blksize);
+#ifdef ENABLE_TOPOCACHE
+    topo_note_capacity(periph, capacity);
+#endif
     return (blksize);
 }
 
@@ -499,7 +544,9 @@ IsMinListEmpty(const struct MinList *list)
  * sd_testunitready_walk
  * ---------------------
  * Walks all peripherals of the channel which have client applications
- * waiting for change interrupts (TD_REMOVE or TD_ADDCHANGEINT).
+ * waiting for change interrupts (TD_REMOVE or TD_ADDCHANGEINT), and
+ * closed removable media units which are kept attached, so that a media
+ * change invalidates them.
  */
 void
 sd_testunitready_walk(struct scsipi_channel *chan)
@@ -515,7 +562,9 @@ sd_testunitready_walk(struct scsipi_channel *chan)
         LIST_FOREACH(periph, &chan->chan_periphtab[i], periph_hash) {
             if ((periph->periph_tur_active == 0) &&
                 ((periph->periph_changeint != NULL) ||
-                 !IsMinListEmpty(&periph->periph_changeintlist))) {
+                 !IsMinListEmpty(&periph->periph_changeintlist) ||
+                 ((periph->periph_flags & (PERIPH_OPEN | PERIPH_REMOVABLE)) ==
+                  PERIPH_REMOVABLE))) {
                 /* Need to poll this device to detect load/eject */
                 sd_testunitready(periph, NULL);
             }
@@ -524,17 +573,16 @@ sd_testunitready_walk(struct scsipi_channel *chan)
 }
 
 /*
- * sd_readwrite
- * ------------
- * Initiate a read or write operation on the specified SCSI device.
- * b_flags includes B_READ when the operation is a read from the SCSI
- * device to computer RAM.
+ * sd_rw
+ * -----
+ * Build and issue the READ or WRITE command for sd_readwrite() and
+ * sd_readwritev(). If iov is not NULL, the data phase is spread over
+ * the iovcnt buffers it describes, and buf is the first of them.
  */
-int
-sd_readwrite(void *periph_p, uint64_t blkno, uint b_flags, void *buf,
-             uint buflen, void *ior)
+static int
+sd_rw(struct scsipi_periph *periph, uint64_t blkno, uint b_flags, void *buf,
+      uint buflen, const struct NSIOVec *iov, int iovcnt, void *ior)
 {
-    struct scsipi_periph *periph = periph_p;
     struct scsipi_generic cmdbuf;
     struct scsipi_xfer *xs;
     uint32_t blkshift = periph->periph_blkshift;
@@ -600,8 +648,11 @@ sd_readwrite(void *periph_p, uint64_t blkno, uint b_flags, void *buf,
 
     xs->amiga_ior = ior;
     xs->xs_done_callback = sd_complete;
+    xs->xs_iov = iov;
+    xs->xs_iovcnt = iovcnt;
 
-    if (__predict_false(is_zorro_ii_address(xs->data, xs->datalen))) {
+    if (__predict_false(iov == NULL &&
+                        is_zorro_ii_address(xs->data, xs->datalen))) {
         struct scsipi_channel *chan = periph->periph_channel;
         void *bounce_buf;
 
@@ -669,6 +720,66 @@ sd_readwrite(void *periph_p, uint64_t blkno, uint b_flags, void *buf,
     return (scsipi_execute_xs(xs));
 }
 
+/*
+ * sd_readwrite
+ * ------------
+ * Initiate a read or write operation on the specified SCSI device.
+ * b_flags includes B_READ when the operation is a read from the SCSI
+ * device to computer RAM.
+ */
+int
+sd_readwrite(void *periph_p, uint64_t blkno, uint b_flags, void *buf,
+             uint buflen, void *ior)
+{
+    return (sd_rw(periph_p, blkno, b_flags, buf, buflen, NULL, 0, ior));
+}
+
+/*
+ * sd_readwritev
+ * -------------
+ * Initiate a vectored read or write of buflen bytes at blkno, using
+ * the buffers described by iov in order. The whole range is moved by
+ * a single SCSI command, with the adapter's scatter/gather list
+ * covering the individual buffers.
+ */
+int
+sd_readwritev(void *periph_p, uint64_t blkno, uint b_flags,
+              const struct NSIOVec *iov, uint buflen, void *ior)
+{
+    struct scsipi_periph *periph = periph_p;
+    uint32_t blkmask = (1 << periph->periph_blkshift) - 1;
+    uint32_t total = 0;
+    uint     chain = 0;
+    int      iovcnt;
+
+    if (buflen & blkmask)
+        return (IOERR_BADLENGTH);
+
+    for (iovcnt = 0; total < buflen; iovcnt++) {
+        if (iovcnt >= NSIOV_MAX)
+            return (IOERR_BADLENGTH);
+        if (iov[iovcnt].iov_Len > buflen - total)
+            return (IOERR_BADLENGTH);
+        if (iov[iovcnt].iov_Len == 0)
+            continue;
+        /*
+         * Buffers in Zorro II memory would need the bounce buffer,
+         * which can only hold a single linear transfer.
+         */
+        if (is_zorro_ii_address(iov[iovcnt].iov_Base, iov[iovcnt].iov_Len))
+            return (IOERR_BADADDRESS);
+        total += iov[iovcnt].iov_Len;
+
+        /* Worst case DMA chain entries: alignment split plus 1 MB pieces */
+        chain += iov[iovcnt].iov_Len / AMIGA_MAX_TRANSFER + 2;
+    }
+    if (chain > DMAMAXIO)
+        return (IOERR_BADLENGTH);
+
+    return (sd_rw(periph, blkno, b_flags, iov[0].iov_Base, buflen,
+                  iov, iovcnt, ior));
+}
+
 #ifdef ENABLE_SEEK
 /* Seek is implemented but untested code */
 int
@@ -735,6 +846,13 @@ sd_getgeometry(void *periph_p, void *geom_p, void *ior)
     struct scsipi_inquiry cmd;
     int flags = XS_CTL_ASYNC | XS_CTL_SIMPLE_TAG | XS_CTL_DATA_IN;
 
+    if (periph->periph_geom != NULL) {
+        /* Answer from the cache, without going to the drive */
+        CopyMem(periph->periph_geom, geom, sizeof (*geom));
+        cmd_complete(ior, 0);
+        return (0);
+    }
+
     memset(&cmd, 0, sizeof(cmd));
     cmd.opcode = INQUIRY;
     cmd.byte2 = periph->periph_lun << 5;
@@ -785,11 +903,17 @@ sd_get_protstatus(void *periph_p, ULONG *status)
     int                   rc;
     scsi_mode_sense_t     modepage;
 
+    if (periph->periph_flags & PERIPH_WP_VALID) {
+        *status = !!(periph->periph_flags & PERIPH_WP);
+        return (0);
+    }
+
     if ((rc = scsipi_mode_sense(periph, SMS_DBD, 3, &modepage.hdr,
                           sizeof (modepage.hdr) +
                           sizeof (modepage.pg.control_params),
                           flags, 0, 2000)) == 0) {
         *status = !!(modepage.pg.control_params.ctl_flags3 & CTL3_SWP);
+        periph->periph_flags |= PERIPH_WP_VALID | (*status ? PERIPH_WP : 0);
         return (0);
     } else {
         /* Failure */
@@ -947,6 +1071,7 @@ geom_done_mode_page_5(struct scsipi_xfer *xs)
         printf("final bs=%"PRIu32" C=%"PRIu32" H=%"PRIu32" S=%"PRIu32" Capacity=%"PRIu32"\n",
                geom->dg_SectorSize, geom->dg_Cylinders, geom->dg_Heads,
                geom->dg_TrackSectors, geom->dg_TotalSectors);
+        geom_cache_store(xs->xs_periph, geom);
     } else if (xs->cmdstore.bytes[0] == SMS_DBD) {
         /* Failed to get page. If DBD was on, try again with DBD off */
         queue_get_mode_page(xs, 5, 0, modepage, geom_done_mode_page_5);
@@ -980,6 +1105,7 @@ geom_done_mode_page_4(struct scsipi_xfer *xs)
         printf("mode4 bs=%"PRIu32" C=%"PRIu32" H=%"PRIu32" S=%"PRIu32" Capacity=%"PRIu32"\n",
                geom->dg_SectorSize, geom->dg_Cylinders, geom->dg_Heads,
                geom->dg_TrackSectors, geom->dg_TotalSectors);
+        geom_cache_store(xs->xs_periph, geom);
     } else if (xs->cmdstore.bytes[0] == SMS_DBD) {
         /* Failed to get page. If DBD was on, try again with DBD off */
         queue_get_mode_page(xs, 4, 0, modepage, geom_done_mode_page_4);
@@ -1069,6 +1195,7 @@ geom_done_get_capacity(struct scsipi_xfer *xs)
         printf("TotalSectors=%"PRIu32" C=%"PRIu32" H=%"PRIu32" S=%"PRIu32" %p\n", geom->dg_TotalSectors,
                geom->dg_Cylinders, geom->dg_Heads, geom->dg_TrackSectors, xs);
 #endif
+        geom_cache_store(xs->xs_periph, geom);
         cmd_complete(xs->amiga_ior, 0);
         return;
     }
@@ -1133,17 +1260,22 @@ geom_done_inquiry(struct scsipi_xfer *oxs)
         cmd_complete(oxs->amiga_ior, rc);
 }
 
-int
-sd_scsidirect(void *periph_p, void *scmd_p, void *ior)
+/*
+ * scsidirect_issue
+ * ----------------
+ * Queue a single SCSICmd for sd_scsidirect() or sd_scsidirect_batch().
+ * done_cb is called when the command has completed.
+ */
+static int
+scsidirect_issue(struct scsipi_periph *periph, struct SCSICmd *scmd,
+                 void *ior, void (*done_cb)(struct scsipi_xfer *))
 {
     int cmdlen;
     int flags;
     void *buf;
     uint buflen;
-    struct scsipi_periph *periph = periph_p;
     struct scsipi_xfer *xs;
     struct scsipi_generic *cmdp;
-    struct SCSICmd *scmd = scmd_p;
 #if 0
     printf("scsidirect dlen=%"PRIu32" clen=%u slen=%u flags=%x [",
            scmd->scsi_Length, scmd->scsi_CmdLength, scmd->scsi_SenseLength,
@@ -1232,7 +1364,7 @@ sd_scsidirect(void *periph_p, void *scmd_p, void *ior)
 
     xs->amiga_ior = ior;
     xs->xs_callback_arg = scmd;
-    xs->xs_done_callback = scsidirect_complete;
+    xs->xs_done_callback = done_cb;
 #if 0
     printf("sdirect%d.%d %p issue\n",
            xs->xs_periph->periph_target, xs->xs_periph->periph_lun, xs);
@@ -1240,6 +1372,37 @@ sd_scsidirect(void *periph_p, void *scmd_p, void *ior)
     return (scsipi_execute_xs(xs));
 }
 
+int
+sd_scsidirect(void *periph_p, void *scmd_p, void *ior)
+{
+    return (scsidirect_issue(periph_p, scmd_p, ior, scsidirect_complete));
+}
+
+/*
+ * sd_scsidirect_batch
+ * -------------------
+ * Run an array of SCSICmd structures with a single IORequest. io_Data
+ * points to the array and io_Length is its size in bytes. The commands
+ * are issued back to back, each one from the completion of the one
+ * before, and the request is replied once at the end. io_Actual
+ * returns how many entries were run. If SCSICMDVF_STOPONERROR is set
+ * in io_Offset, the batch ends at the first failing entry.
+ */
+int
+sd_scsidirect_batch(void *periph_p, void *ior)
+{
+    struct IOStdReq *io = ior;
+    ULONG count = io->io_Length / sizeof (struct SCSICmd);
+
+    if ((count == 0) || (count > SCSICMDV_MAX) ||
+        (io->io_Length != count * sizeof (struct SCSICmd)))
+        return (IOERR_BADLENGTH);
+
+    io->io_Actual = 0;
+    return (scsidirect_issue(periph_p, io->io_Data, ior,
+                             scsidirect_batch_complete));
+}
+
 
 /* Called when disk read/write transfer is complete */
 static void
@@ -1400,8 +1563,14 @@ sd_tur_complete(struct scsipi_xfer *xs)
 }
 
 
-static void
-scsidirect_complete(struct scsipi_xfer *xs)
+/*
+ * scsidirect_finish
+ * -----------------
+ * Release the bounce buffer of a completed SCSI direct command and fill
+ * in the results of its SCSICmd. Returns the AmigaOS error code.
+ */
+static int
+scsidirect_finish(struct scsipi_xfer *xs)
 {
     int             rc   = translate_xs_error(xs);
     struct SCSICmd *scmd = xs->xs_callback_arg;
@@ -1427,6 +1596,15 @@ scsidirect_complete(struct scsipi_xfer *xs)
     scmd->scsi_Actual    = scmd->scsi_Length;
     scmd->scsi_CmdActual = scmd->scsi_CmdLength;
 
+    /* The application may have changed what the cached geometry says */
+    switch (xs->cmd->opcode) {
+        case SCSI_MODE_SELECT_6:
+        case SCSI_MODE_SELECT_10:
+        case SCSI_FORMAT_UNIT:
+            sd_geom_invalidate(xs->xs_periph);
+            break;
+    }
+
     if (rc != 0) {
         printf("sdirect%d.%d fail %d (%d)\n",
                xs->xs_periph->periph_target, xs->xs_periph->periph_lun, rc,
@@ -1439,5 +1617,53 @@ scsidirect_complete(struct scsipi_xfer *xs)
             scmd->scsi_SenseActual = len;
         }
     }
-    cmd_complete(xs->amiga_ior, rc);
+    return (rc);
+}
+
+static void
+scsidirect_complete(struct scsipi_xfer *xs)
+{
+    cmd_complete(xs->amiga_ior, scsidirect_finish(xs));
+}
+
+static void
+scsidirect_batch_complete(struct scsipi_xfer *xs)
+{
+    struct IOStdReq      *io     = xs->amiga_ior;
+    struct scsipi_periph *periph = xs->xs_periph;
+    struct SCSICmd       *scmd   = io->io_Data;
+    ULONG                 count  = io->io_Length / sizeof (*scmd);
+    int                   rc     = scsidirect_finish(xs);
+
+    io->io_Actual++;
+    if (io->io_Flags & IOF_ABORTREQ) {
+        /* AbortIO() - don't start any more entries */
+        cmd_complete(io, IOERR_ABORTED);
+        return;
+    }
+    if (rc != 0) {
+        if (io->io_Offset & SCSICMDVF_STOPONERROR) {
+            cmd_complete(io, rc);
+            return;
+        }
+        /* Report the first failure once the whole batch has run */
+        if (io->io_Error == 0)
+            io->io_Error = rc;
+    }
+
+    while (io->io_Actual < count) {
+        rc = scsidirect_issue(periph, &scmd[io->io_Actual], io,
+                              scsidirect_batch_complete);
+        if (rc == 0)
+            return;  // Next entry is on its way
+
+        /* Could not even queue this entry */
+        scmd[io->io_Actual].scsi_Status = rc;
+        io->io_Actual++;
+        if (io->io_Error == 0)
+            io->io_Error = rc;
+        if (io->io_Offset & SCSICMDVF_STOPONERROR)
+            break;
+    }
+    cmd_complete(io, io->io_Error);
 }
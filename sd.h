@@ -16,6 +16,8 @@
 
 #define MAX_BOUNCE_SIZE (256 * 1024)
 
+struct NSIOVec;
+
 uint32_t get_scripts_dma_addr(const void *scripts, uint32_t size);
 #if defined(SCRIPTS_IN_MAINBOARD_RAM)
 uint32_t get_scripts_mainboard_addr(const void *scripts, uint32_t size,
@@ -25,8 +27,11 @@ void free_scripts_copy(void);
 
 int sd_readwrite(void *periph, uint64_t blkno, uint b_flags,
                  void *buf, uint buflen, void *ior);
+int sd_readwritev(void *periph_p, uint64_t blkno, uint b_flags,
+                  const struct NSIOVec *iov, uint buflen, void *ior);
 int sd_seek(void *periph_p, uint64_t blkno, void *ior);
 int sd_scsidirect(void *periph, void *cmd_p, void *ior);
+int sd_scsidirect_batch(void *periph_p, void *ior);
 int sd_getgeometry(void *periph, void *buf, void *ior);
 int sd_get_protstatus(void *periph_p, ULONG *status);
 int sd_startstop(void *periph_p, void *ior, int start, int load_eject,
@@ -38,5 +43,6 @@ uint32_t sd_blocksize(void *periph_p);
 
 void sd_media_unloaded(struct scsipi_periph *periph);
 void sd_media_loaded(struct scsipi_periph *periph);
+void sd_geom_invalidate(struct scsipi_periph *periph);
 
 #endif /* _SD_H */
@@ -109,7 +109,11 @@ __KERNEL_RCSID(0, "$NetBSD: siop.c,v 1.71 2022/04/07 19:33:37 andvar Exp $");
 #include "sys_queue.h"
 #include "siopreg.h"
 #include "siopvar.h"
+#include "siopbounce.h"
 #include "sd.h"
+#include "nsd.h"
+#include "dmacal.h"
+#include "loopback.h"
 #include <stdio.h>
 
 /*
@@ -120,6 +124,9 @@ __KERNEL_RCSID(0, "$NetBSD: siop.c,v 1.71 2022/04/07 19:33:37 andvar Exp $");
 #define SCSI_DATA_WAIT  500000  /* wait per data in/out step */
 #define SCSI_INIT_WAIT  500000  /* wait per step (both) during init */
 
+/* Time allowed for a target to go bus free after ABORT or BUS DEVICE RESET */
+#define SIOP_RECOVER_TIMEOUT 2000   /* ms */
+
 void siop_select(struct siop_softc *);
 void siopabort(struct siop_softc *, siop_regmap_p, const char *);
 void sioperror(struct siop_softc *, siop_regmap_p, u_char);
@@ -134,6 +141,19 @@ void siop_poll(struct siop_softc *, struct siop_acb *);
 void siopintr(struct siop_softc *);
 void scsi_period_to_siop(struct siop_softc *, int);
 void siop_start(struct siop_softc *, int, int, u_char *, int, u_char *, int);
+static void siop_build_chain(struct siop_acb *, u_char *, int);
+#ifdef PORT_AMIGA
+static int siop_recover(struct siop_softc *, struct siop_acb *);
+static int siop_recover_done(struct siop_softc *, struct siop_acb *);
+static void siop_recover_cancel(struct siop_softc *, struct siop_acb *);
+#endif
+#ifdef ENABLE_AUTOSENSE
+static int siop_autosense(struct siop_softc *, struct siop_acb *, int *);
+#endif
+#ifdef ENABLE_QUICK_COMPLETION
+static void siop_quick_start(struct siop_softc *);
+static void siop_quick_finish(struct siop_softc *);
+#endif
 #ifdef DEBUG_SIOP
 void siop_dump_acb(struct siop_acb *);
 #endif
@@ -266,6 +286,10 @@ siop_scsipi_request(struct scsipi_channel *chan, scsipi_adapter_req_t req,
     switch (req) {
     case ADAPTER_REQ_RUN_XFER:
         xs = arg;
+#ifdef ENABLE_LOOPBACK
+        if (loopback_request(xs))
+            return;
+#endif
 #ifdef DIAGNOSTIC
         periph = xs->xs_periph;
 #endif
@@ -310,6 +334,12 @@ siop_scsipi_request(struct scsipi_channel *chan, scsipi_adapter_req_t req,
         acb->clen = xs->cmdlen;
         acb->daddr = xs->data;
         acb->dleft = xs->datalen;
+#ifdef PORT_AMIGA
+        acb->bounce_hlen = acb->bounce_tlen = 0;
+#endif
+#ifdef ENABLE_QUICK_COMPLETION
+        siop_build_chain(acb, acb->daddr, acb->dleft);
+#endif
 
         s = bsd_splbio();
         TAILQ_INSERT_TAIL(&sc->ready_list, acb, chain);
@@ -435,7 +465,9 @@ siop_sched(struct siop_softc *sc)
     for (acb = sc->ready_list.tqh_first; acb; acb = acb->chain.tqe_next) {
         periph = acb->xs->xs_periph;
         i = periph->periph_target;
-        if(!(sc->sc_tinfo[i].lubusy & (1 << periph->periph_lun))) {
+        /* Recovery and sense ACBs still own the LUN of their command */
+        if ((acb->flags & (ACB_RECOVER | ACB_SENSE)) ||
+            !(sc->sc_tinfo[i].lubusy & (1 << periph->periph_lun))) {
             struct siop_tinfo *ti = &sc->sc_tinfo[i];
 
             TAILQ_REMOVE(&sc->ready_list, acb, chain);
@@ -471,7 +503,8 @@ siop_sched(struct siop_softc *sc)
      * active command.
      */
     callout_reset(&acb->xs->xs_callout,
-        mstohz(acb->xs->timeout) + 1, siop_timeout, acb);
+        mstohz((acb->flags & ACB_RECOVER) ? SIOP_RECOVER_TIMEOUT :
+        acb->xs->timeout) + 1, siop_timeout, acb);
 #endif
 #if 0
     acb->cmd.bytes[0] |= slp->scsipi_scsi.lun << 5; /* XXXX */
@@ -504,6 +537,16 @@ siop_scsidone(struct siop_acb *acb, int stat)
     periph = xs->xs_periph;
     sc = device_private(periph->periph_channel->chan_adapter->adapt_dev);
 
+#ifdef PORT_AMIGA
+    if ((acb->flags & ACB_RECOVER) && acb == sc->sc_nexus &&
+        siop_recover_done(sc, acb))
+        return;     /* requeued for the next recovery step */
+#endif
+#ifdef ENABLE_AUTOSENSE
+    if (acb == sc->sc_nexus && siop_autosense(sc, acb, &stat))
+        return;     /* requeued for REQUEST SENSE */
+#endif
+
     xs->status = stat;
     xs->resid = 0;      /* XXXX */
 
@@ -519,6 +562,14 @@ siop_scsidone(struct siop_acb *acb, int stat)
      * nexus queue and see if it's there, so we can mark the unit as no
      * longer busy.  This code is sickening, but it works.
      */
+#ifdef ENABLE_QUICK_COMPLETION
+    if (acb->flags & ACB_QDONE) {
+        /* siop_quick_complete() already released the nexus */
+        if (sc->ready_list.tqh_first)
+            dosched = 1;
+        SIOP_TRACE('d','q',stat,0)
+    } else
+#endif
     if (acb == sc->sc_nexus) {
         sc->sc_nexus = NULL;
         sc->sc_tinfo[periph->periph_target].lubusy &=
@@ -564,8 +615,32 @@ siop_scsidone(struct siop_acb *acb, int stat)
      * http://aminet.net/package/docs/misc/MuManual
      *
      */
-    if (acb->iob_buf != NULL && acb->iob_len != 0) {
-        CachePostDMA(&acb->iob_buf, (LONG *)&acb->iob_len, 0);
+    if (xs->xs_iov != NULL) {
+        const struct NSIOVec *iov = xs->xs_iov;
+        int iovcnt;
+
+        for (iovcnt = xs->xs_iovcnt; iovcnt > 0; iov++, iovcnt--) {
+            APTR  addr = iov->iov_Base;
+            LONG  len = iov->iov_Len;
+            CachePostDMA(addr, &len, 0);
+        }
+    } else if (acb->iob_buf != NULL && acb->iob_len != 0) {
+        LONG len = acb->iob_len;
+        CachePostDMA(acb->iob_buf, &len, 0);
+    }
+
+    /*
+     * Hand the bounced head and tail bytes of a read to the caller. This
+     * has to happen before scsipi_done() interprets any sense data, as a
+     * recovered error completes the request as a success.
+     */
+    if ((acb->bounce_hlen | acb->bounce_tlen) != 0 &&
+        (xs->xs_control & XS_CTL_DATA_IN) && siop_bounce_wanted(xs->error)) {
+        u_char *bounce = SIOP_BOUNCE(acb);
+
+        dma_cachectl(bounce, 8);
+        siop_bounce_finish(bounce, acb->bounce_head, acb->bounce_hlen,
+                           acb->bounce_tail, acb->bounce_tlen);
     }
 #endif
 
@@ -705,6 +780,15 @@ siopinitialize(struct siop_softc *sc)
         sc->sc_tcp[0] = 3000 / sc->sc_clock_freq;
     }
 
+#ifdef PORT_AMIGA
+    sc->sc_dmode = 0xe0;    /* burst length = 8, drive FC2 */
+#else
+    sc->sc_dmode = 0x80;    /* burst length = 4 */
+#endif
+#ifdef ENABLE_DMA_CALIBRATION
+    dma_burst_load(sc);
+#endif
+
     if (sc->sc_nosync) {
 #ifdef PORT_AMIGA
         inhibit_sync = sc->sc_nosync & 0xff;
@@ -723,6 +807,10 @@ siopinitialize(struct siop_softc *sc)
     }
 
     siopreset(sc);
+#ifdef ENABLE_DMA_CALIBRATION
+    if (dma_burst_calibrate(sc))
+        siopreset(sc);
+#endif
 }
 
 #ifdef PORT_AMIGA
@@ -735,6 +823,9 @@ siopshutdown(struct scsipi_channel *chan)
     scsipi_free_all_xs(chan);
     FreeMem(sc->sc_acb, sizeof(struct siop_acb) * SIOP_NACB);
     free_scripts_copy();
+#ifdef ENABLE_LOOPBACK
+    loopback_free();
+#endif
 }
 #endif
 
@@ -755,6 +846,17 @@ siop_timeout(void *arg)
     s = bsd_splbio();
 
 #ifdef PORT_AMIGA
+    sc->sc_tinfo[periph->periph_target].touts++;
+
+    /*
+     * A disconnected command is first aborted on its own target, which
+     * leaves the commands of all other targets alone.
+     */
+    if (siop_recover(sc, acb)) {
+        bsd_splx(s);
+        return;
+    }
+
     /*
      * To prevent clobbering transactions on this channel to other targets
      * which have not timed out, we will:
@@ -763,6 +865,7 @@ siop_timeout(void *arg)
      * 3) siop_scsidone() will take care of resetting the channel when
      *    there are no more transactions pending for the channel,
      */
+    acb->flags &= ~ACB_RECOVER;
     sc->sc_channel.chan_flags |= SCSIPI_CHAN_RESET_PEND;
 
     printf("XS_TIMEOUT %p %p\n", acb, acb->xs);
@@ -776,6 +879,131 @@ siop_timeout(void *arg)
     bsd_splx(s);
 }
 
+#ifdef PORT_AMIGA
+/*
+ * Start targeted recovery of a timed out command
+ *
+ * A disconnected command is taken off nexus_list and queued at the head
+ * of ready_list as a recovery ACB. siop_sched() selects its target with
+ * ATN and sends IDENTIFY and ABORT in place of the command; if that
+ * fails, siop_recover_done() follows up with BUS DEVICE RESET. Commands
+ * of other targets keep their places on both lists.
+ *
+ * Returns 0 if the command is connected to the bus, or is itself a
+ * recovery which got stuck; the caller then resets the bus.
+ */
+static int
+siop_recover(struct siop_softc *sc, struct siop_acb *acb)
+{
+    struct siop_acb *acb2;
+
+    if (acb->flags & ACB_RECOVER)
+        return (0);
+
+    for (acb2 = sc->nexus_list.tqh_first; acb2; acb2 = acb2->chain.tqe_next)
+        if (acb2 == acb)
+            break;
+    if (acb2 == NULL)
+        return (0);
+
+    TAILQ_REMOVE(&sc->nexus_list, acb, chain);
+    --sc->sc_active;
+    acb->flags |= ACB_ABORT;
+    TAILQ_INSERT_HEAD(&sc->ready_list, acb, chain);
+    scsipi_printaddr(acb->xs->xs_periph);
+    printf("sending ABORT\n");
+
+    if (sc->sc_nexus == NULL) {
+        /* SCRIPTS keeps waiting for the reselection until signalled */
+        if (sc->nexus_list.tqh_first == NULL)
+            sc->sc_flags |= SIOP_RESELWAIT;
+        siop_sched(sc);
+    }
+    return (1);
+}
+
+/*
+ * Evaluate a recovery ACB which finished as the nexus
+ *
+ * If the target went bus free after the message, the command is gone
+ * and completes as XS_TIMEOUT. A BUS DEVICE RESET also drops every other
+ * command of the target and its transfer agreement. If the ABORT did
+ * not get through, the ACB is queued again for BUS DEVICE RESET and 1
+ * is returned; if that failed too, the bus is reset once the other
+ * targets are idle.
+ */
+static int
+siop_recover_done(struct siop_softc *sc, struct siop_acb *acb)
+{
+    struct scsipi_xfer *xs = acb->xs;
+    struct scsipi_periph *periph = xs->xs_periph;
+    int target = periph->periph_target;
+    struct siop_acb *acb2, *next;
+
+    if (xs->error == XS_NOERROR) {
+        scsipi_printaddr(periph);
+        if (acb->flags & ACB_BDR) {
+            printf("bus device reset\n");
+            sc->sc_sync[target].state = NEG_WIDE;
+            sc->sc_sync[target].sxfer = 0;
+            sc->sc_sync[target].sbcl = 0;
+            for (acb2 = sc->nexus_list.tqh_first; acb2; acb2 = next) {
+                next = acb2->chain.tqe_next;
+                if (acb2->xs->xs_periph->periph_target == target) {
+                    acb2->xs->error = XS_RESET;
+                    siop_scsidone(acb2, acb2->stat[0]);
+                }
+            }
+        } else {
+            printf("aborted\n");
+        }
+        xs->error = XS_TIMEOUT;
+        return (0);
+    }
+
+    if (xs->error == XS_RESET)
+        return (0);     /* overtaken by a bus reset */
+
+    scsipi_printaddr(periph);
+    if (acb->flags & ACB_BDR) {
+        printf("bus device reset failed\n");
+        sc->sc_channel.chan_flags |= SCSIPI_CHAN_RESET_PEND;
+        xs->error = XS_TIMEOUT;
+        return (0);
+    }
+
+    printf("abort failed\n");
+    acb->flags = (acb->flags & ~ACB_ABORT) | ACB_BDR;
+    xs->error = XS_NOERROR;
+    sc->sc_nexus = NULL;
+    --sc->sc_active;
+    TAILQ_INSERT_HEAD(&sc->ready_list, acb, chain);
+    siop_sched(sc);
+    return (1);
+}
+
+/*
+ * Withdraw a recovery or sense ACB which is still waiting on ready_list
+ *
+ * The command goes back to nexus_list as a disconnected command, either
+ * because its target reselected after all or because a bus reset is
+ * about to complete it.
+ */
+static void
+siop_recover_cancel(struct siop_softc *sc, struct siop_acb *acb)
+{
+    struct scsipi_periph *periph = acb->xs->xs_periph;
+
+    TAILQ_REMOVE(&sc->ready_list, acb, chain);
+    acb->flags &= ~ACB_RECOVER;
+    TAILQ_INSERT_TAIL(&sc->nexus_list, acb, chain);
+    sc->sc_tinfo[periph->periph_target].lubusy |= 1 << periph->periph_lun;
+    ++sc->sc_active;
+    callout_reset(&acb->xs->xs_callout,
+        mstohz(acb->xs->timeout) + 1, siop_timeout, acb);
+}
+#endif
+
 void
 siopreset(struct siop_softc *sc)
 {
@@ -814,11 +1042,7 @@ siopreset(struct siop_softc *sc)
     rp->siop_scntl0 = SIOP_ARB_FULL | SIOP_SCNTL0_EPC | SIOP_SCNTL0_EPG;
     rp->siop_scntl1 = SIOP_SCNTL1_ESR;
     rp->siop_dcntl = sc->sc_dcntl;
-#ifdef PORT_AMIGA
-    rp->siop_dmode = 0xe0;  /* burst length = 8, drive FC2 */
-#else
-    rp->siop_dmode = 0x80;  /* burst length = 4 */
-#endif
+    rp->siop_dmode = sc->sc_dmode;
     rp->siop_sien = 0x00;   /* don't enable interrupts yet */
     rp->siop_dien = 0x00;   /* don't enable interrupts yet */
     rp->siop_scid = 1 << sc->sc_channel.chan_id;
@@ -872,8 +1096,28 @@ siopreset(struct siop_softc *sc)
             TAILQ_INSERT_TAIL(&sc->free_list, acb, chain);
             acb++;
         }
+#ifdef ENABLE_QUICK_COMPLETION
+        TAILQ_INIT(&sc->sc_qdone_list);
+#endif
         memset(sc->sc_tinfo, 0, sizeof(sc->sc_tinfo));
     } else {
+#ifdef PORT_AMIGA
+        /*
+         * The bus reset overtakes any ABORT, BUS DEVICE RESET or REQUEST
+         * SENSE not sent yet; complete those commands with the
+         * disconnected ones.
+         * RESET_PEND is dropped first so siop_scsidone() does not come
+         * back here for the last of them.
+         */
+        sc->sc_flags &= ~SIOP_RESELWAIT;
+        sc->sc_channel.chan_flags &= ~SCSIPI_CHAN_RESET_PEND;
+        for (acb = sc->ready_list.tqh_first; acb != NULL; ) {
+            struct siop_acb *next = acb->chain.tqe_next;
+            if (acb->flags & (ACB_RECOVER | ACB_SENSE))
+                siop_recover_cancel(sc, acb);
+            acb = next;
+        }
+#endif
         if (sc->sc_nexus != NULL) {
             sc->sc_nexus->xs->error = XS_RESET;
             siop_scsidone(sc->sc_nexus, sc->sc_nexus->stat[0]);
@@ -886,6 +1130,7 @@ siopreset(struct siop_softc *sc)
 
 #ifdef PORT_AMIGA
     sc->sc_channel.chan_flags &= ~SCSIPI_CHAN_RESET_PEND;
+    sc->sc_channel.chan_reset_count++;
 #endif
 
     sc->sc_flags |= SIOP_ALIVE;
@@ -899,27 +1144,245 @@ siopreset(struct siop_softc *sc)
     rp->siop_dien = sc->sc_dien;
 }
 
+#ifdef ENABLE_AUTOSENSE
 /*
- * Setup Data Storage for 53C710 and start SCRIPTS processing
+ * Automatic REQUEST SENSE
+ *
+ * Called from siop_scsidone() while the ACB is still the nexus. On CHECK
+ * CONDITION the ACB is turned into a REQUEST SENSE for the same LUN and
+ * queued at the head of ready_list, so it is selected as soon as the
+ * target has gone bus free and before any other command reaches the
+ * LUN. The xfer then completes once, as XS_SENSE with the sense data,
+ * instead of going through scsipi_request_sense() on the completion
+ * thread.
+ *
+ * When the REQUEST SENSE itself finishes, *stat is set back to CHECK
+ * CONDITION. If it failed, the xfer completes as before and scsipi asks
+ * for the sense data itself.
  */
+static int
+siop_autosense(struct siop_softc *sc, struct siop_acb *acb, int *stat)
+{
+    struct scsipi_xfer *xs = acb->xs;
+    struct scsi_request_sense *cmd;
+    u_char *sense = SIOP_SENSE(acb);
+
+    if (acb->flags & ACB_SENSE) {
+        acb->flags &= ~ACB_SENSE;
+        if (xs->error == XS_NOERROR && *stat == SCSI_OK) {
+            dma_cachectl(sense, SIOP_SENSE_LEN);
+            memcpy(&xs->sense.scsi_sense, sense, SIOP_SENSE_LEN);
+            xs->error = XS_SENSE;
+        }
+        *stat = SCSI_CHECK;
+        return (0);
+    }
 
-void
-siop_start(struct siop_softc *sc, int target, int lun, u_char *cbuf, int clen,
-           u_char *buf, int len)
+    if (*stat != SCSI_CHECK || xs->error != XS_NOERROR ||
+        (xs->xs_control & XS_CTL_REQSENSE))
+        return (0);
+
+    acb->flags |= ACB_SENSE;
+    cmd = (struct scsi_request_sense *) &acb->cmd;
+    memset(cmd, 0, sizeof (*cmd));
+    cmd->opcode = SCSI_REQUEST_SENSE;
+    cmd->length = SIOP_SENSE_LEN;
+    acb->clen = sizeof (*cmd);
+    acb->daddr = (char *) sense;
+    acb->dleft = SIOP_SENSE_LEN;
+
+    /* The data buffer stays set up for CachePostDMA() in siop_scsidone() */
+    memset(&acb->ds.chain, 0, sizeof (acb->ds.chain));
+    acb->ds.chain[0].databuf = (char *) kvtop(sense);
+    acb->ds.chain[0].datalen = SIOP_SENSE_LEN;
+    acb->iob_curbuf = acb->iob_curlen = 0;
+
+    SIOP_TRACE('d','s',*stat,0)
+    sc->sc_nexus = NULL;
+    --sc->sc_active;
+    TAILQ_INSERT_HEAD(&sc->ready_list, acb, chain);
+    siop_sched(sc);
+    return (1);
+}
+#endif /* ENABLE_AUTOSENSE */
+
+/*
+ * Build physical DMA addresses for scatter/gather I/O
+ *
+ * With ENABLE_QUICK_COMPLETION this is done when the command is queued,
+ * so siop_start() has no CachePreDMA() work left when it is called from
+ * the interrupt handler.
+ */
+static void
+siop_build_chain(struct siop_acb *acb, u_char *buf, int len)
 {
-    siop_regmap_p rp = sc->sc_siopp;
     int nchain;
 #ifdef PORT_AMIGA
     int count;
     ULONG tcount;
+    const struct NSIOVec *iov;
+    int iovcnt;
 #else
     int count, tcount;
 #endif
     char *addr, *dmaend;
-    struct siop_acb *acb = sc->sc_nexus;
 #ifdef DEBUG
     int i;
 #endif
+
+    memset(&acb->ds.chain, 0, sizeof (acb->ds.chain));
+    acb->iob_buf = buf;
+    acb->iob_len = len;
+    acb->iob_curbuf = acb->iob_curlen = 0;
+    nchain = 0;
+    count = len;
+    addr = buf;
+    dmaend = NULL;
+#ifdef PORT_AMIGA
+    /*
+     * ReadFromRAM should only be set when writing to the device
+     * When this flag is set, CachePreDMA doesn't turn off copyback mode
+     * Maybe there's some way to know here what the direction of the transfer is?
+     * We also need to match this flag at the other side
+     */
+    //ULONG flags = DMA_ReadFromRAM;
+    ULONG flags = 0;
+
+    /*
+     * Vectored transfers describe one SCSI data phase with several
+     * buffers. Each one is a separate CachePreDMA() range.
+     */
+    iov = acb->xs->xs_iov;
+    iovcnt = acb->xs->xs_iovcnt;
+    if (iov != NULL) {
+        addr = iov->iov_Base;
+        count = iov->iov_Len;
+    }
+
+    /*
+     * Unaligned leading bytes and trailing bytes past the last longword
+     * go through the ACB bounce area, so the 53C710 bursts directly to
+     * a longword aligned middle and CachePreDMA() never sees a partial
+     * longword. Small transfers are not worth it (SIOP_BOUNCE_MIN).
+     */
+    acb->bounce_hlen = acb->bounce_tlen = 0;
+    if (iov == NULL &&
+        siop_bounce_split(buf, len, &acb->bounce_hlen, &acb->bounce_tlen)) {
+        u_char *bounce = SIOP_BOUNCE(acb);
+
+        acb->bounce_head = buf;
+        acb->bounce_tail = buf + len - acb->bounce_tlen;
+        if (acb->xs->xs_control & XS_CTL_DATA_OUT) {
+            memcpy(bounce, acb->bounce_head, acb->bounce_hlen);
+            memcpy(bounce + 4, acb->bounce_tail, acb->bounce_tlen);
+        }
+        if (acb->bounce_hlen != 0) {
+            acb->ds.chain[0].databuf = (char *) kvtop(bounce);
+            acb->ds.chain[0].datalen = acb->bounce_hlen;
+            dmaend = acb->ds.chain[0].databuf + acb->bounce_hlen;
+            nchain = 1;
+        }
+        addr += acb->bounce_hlen;
+        count -= acb->bounce_hlen + acb->bounce_tlen;
+        acb->iob_buf = addr;
+        acb->iob_len = count;
+    }
+next_iov:
+#endif
+
+    while (count > 0) {
+        acb->ds.chain[nchain].databuf = (char *) kvtop (addr);
+#ifdef PORT_AMIGA
+        tcount = count;
+        if (tcount > AMIGA_MAX_TRANSFER)
+            tcount = AMIGA_MAX_TRANSFER;
+        if ((((ULONG) addr) & 3) && (tcount > 30)) {
+            /*
+             * First sg should align transfer, unless it's a small transfer.
+             *
+             * XXX: The 30 above is subject to tuning. The tradeoff is that
+             *      one more sg entry takes CPU time and some bus bandwidth
+             *      to process.
+             */
+            tcount = 4 - (((ULONG) addr) & 3);
+        }
+        acb->ds.chain[nchain].databuf = (char *)
+                CachePreDMA((APTR) addr, &tcount, flags);
+        flags |= DMA_Continue;
+#else
+        /* original PAGESIZE scatter gather */
+        acb->ds.chain[nchain].databuf = (char *) kvtop (addr);
+        if (count < (tcount = PAGE_SIZE - ((int) addr & PGOFSET)))
+            tcount = count;
+#endif
+        acb->ds.chain[nchain].datalen = tcount;
+        addr += tcount;
+        count -= tcount;
+        if (acb->ds.chain[nchain].databuf == dmaend) {
+            dmaend += acb->ds.chain[nchain].datalen;
+            acb->ds.chain[nchain].datalen = 0;
+            acb->ds.chain[--nchain].datalen += tcount;
+#ifdef DEBUG
+            ++siopdma_hits;
+#endif
+        }
+        else {
+            dmaend = acb->ds.chain[nchain].databuf +
+                acb->ds.chain[nchain].datalen;
+            acb->ds.chain[nchain].datalen = tcount;
+#ifdef DEBUG
+            if (nchain) /* Don't count miss on first one */
+                ++siopdma_misses;
+#endif
+        }
+        ++nchain;
+    }
+#ifdef PORT_AMIGA
+    if (iov != NULL && --iovcnt > 0) {
+        iov++;
+        addr = iov->iov_Base;
+        count = iov->iov_Len;
+        flags = 0;
+        goto next_iov;
+    }
+    if (acb->bounce_tlen != 0) {
+        acb->ds.chain[nchain].databuf = (char *) kvtop(SIOP_BOUNCE(acb) + 4);
+        acb->ds.chain[nchain].datalen = acb->bounce_tlen;
+        ++nchain;
+    }
+#endif
+#ifdef DEBUG
+    if (nchain != 1 && len != 0 && siop_debug & 3) {
+        printf ("DMA chaining set: %d\n", nchain);
+        for (i = 0; i < nchain; ++i) {
+            printf ("  [%d] %8p %lx\n", i, acb->ds.chain[i].databuf,
+                acb->ds.chain[i].datalen);
+        }
+    }
+#endif
+
+    /* push data cache for the data buffers the 53c710 will access */
+#ifdef PORT_AMIGA
+    if (acb->xs->xs_iov != NULL) {
+        for (iov = acb->xs->xs_iov, iovcnt = acb->xs->xs_iovcnt;
+             iovcnt > 0; iov++, iovcnt--)
+            dma_cachectl (iov->iov_Base, iov->iov_Len);
+    } else
+#endif
+    if (buf != NULL && len != 0)
+        dma_cachectl (buf, len);
+}
+
+/*
+ * Setup Data Storage for 53C710 and start SCRIPTS processing
+ */
+
+void
+siop_start(struct siop_softc *sc, int target, int lun, u_char *cbuf, int clen,
+           u_char *buf, int len)
+{
+    siop_regmap_p rp = sc->sc_siopp;
+    struct siop_acb *acb = sc->sc_nexus;
     if (acb == NULL) {
         printf("siop_start: NULL acb!\n");
         return;
@@ -963,8 +1426,18 @@ siop_start(struct siop_softc *sc, int target, int lun, u_char *cbuf, int clen,
     acb->ds.msginbuf = (char *) kvtop(&acb->msg[1]);
     acb->ds.extmsgbuf = (char *) kvtop(&acb->msg[2]);
     acb->ds.synmsgbuf = (char *) kvtop(&acb->msg[3]);
-    memset(&acb->ds.chain, 0, sizeof (acb->ds.chain));
 
+#ifdef PORT_AMIGA
+    if (acb->flags & ACB_RECOVER) {
+        /* IDENTIFY without disconnect privilege, then the recovery message */
+        acb->msgout[0] = MSG_IDENTIFY | lun;
+        acb->msgout[1] = (acb->flags & ACB_BDR) ? MSG_BUS_DEVICE_RESET :
+                                                  MSG_ABORT;
+        acb->ds.idlen = 2;
+        acb->ds.cmdlen = 0;
+        clen = 0;
+    } else
+#endif
     /*
      * Negotiate wide is the initial negotiation state;  since the 53c710
      * doesn't do wide transfers, just begin the synchronous transfer
@@ -1000,89 +1473,16 @@ siop_start(struct siop_softc *sc, int target, int lun, u_char *cbuf, int clen,
         }
     }
 
-/*
- * Build physical DMA addresses for scatter/gather I/O
- */
-    acb->iob_buf = buf;
-    acb->iob_len = len;
-    acb->iob_curbuf = acb->iob_curlen = 0;
-    nchain = 0;
-    count = len;
-    addr = buf;
-    dmaend = NULL;
-#ifdef PORT_AMIGA
-    /*
-     * ReadFromRAM should only be set when writing to the device
-     * When this flag is set, CachePreDMA doesn't turn off copyback mode
-     * Maybe there's some way to know here what the direction of the transfer is?
-     * We also need to match this flag at the other side
-     */
-    //ULONG flags = DMA_ReadFromRAM;
-    ULONG flags = 0;
-#endif
-
-    while (count > 0) {
-        acb->ds.chain[nchain].databuf = (char *) kvtop (addr);
-#ifdef PORT_AMIGA
-        tcount = count;
-        if (tcount > AMIGA_MAX_TRANSFER)
-            tcount = AMIGA_MAX_TRANSFER;
-        if ((((ULONG) addr) & 3) && (tcount > 30)) {
-            /*
-             * First sg should align transfer, unless it's a small transfer.
-             *
-             * XXX: The 30 above is subject to tuning. The tradeoff is that
-             *      one more sg entry takes CPU time and some bus bandwidth
-             *      to process.
-             */
-            tcount = 4 - (((ULONG) addr) & 3);
-        }
-        acb->ds.chain[nchain].databuf = (char *)
-                CachePreDMA((APTR) addr, &tcount, flags);
-        flags |= DMA_Continue;
+#ifdef ENABLE_QUICK_COMPLETION
+    (void)buf;      /* chain was built by siop_scsipi_request() */
 #else
-        /* original PAGESIZE scatter gather */
-        acb->ds.chain[nchain].databuf = (char *) kvtop (addr);
-        if (count < (tcount = PAGE_SIZE - ((int) addr & PGOFSET)))
-            tcount = count;
-#endif
-        acb->ds.chain[nchain].datalen = tcount;
-        addr += tcount;
-        count -= tcount;
-        if (acb->ds.chain[nchain].databuf == dmaend) {
-            dmaend += acb->ds.chain[nchain].datalen;
-            acb->ds.chain[nchain].datalen = 0;
-            acb->ds.chain[--nchain].datalen += tcount;
-#ifdef DEBUG
-            ++siopdma_hits;
-#endif
-        }
-        else {
-            dmaend = acb->ds.chain[nchain].databuf +
-                acb->ds.chain[nchain].datalen;
-            acb->ds.chain[nchain].datalen = tcount;
-#ifdef DEBUG
-            if (nchain) /* Don't count miss on first one */
-                ++siopdma_misses;
-#endif
-        }
-        ++nchain;
-    }
-#ifdef DEBUG
-    if (nchain != 1 && len != 0 && siop_debug & 3) {
-        printf ("DMA chaining set: %d\n", nchain);
-        for (i = 0; i < nchain; ++i) {
-            printf ("  [%d] %8p %lx\n", i, acb->ds.chain[i].databuf,
-                acb->ds.chain[i].datalen);
-        }
-    }
+    if ((acb->flags & (ACB_RECOVER | ACB_SENSE)) == 0)
+        siop_build_chain(acb, buf, len);
 #endif
 
     /* push data cache for all data the 53c710 needs to access */
     dma_cachectl ((void *)acb, sizeof (struct siop_acb));
     dma_cachectl (cbuf, clen);
-    if (buf != NULL && len != 0)
-        dma_cachectl (buf, len);
 
 #ifndef PORT_AMIGA
 #ifdef DEBUG
@@ -1096,7 +1496,8 @@ siop_start(struct siop_softc *sc, int target, int lun, u_char *cbuf, int clen,
     }
 #endif
 #endif
-    if (sc->nexus_list.tqh_first == NULL) {
+    if (sc->nexus_list.tqh_first == NULL &&
+        (sc->sc_flags & SIOP_RESELWAIT) == 0) {
 #ifndef PORT_AMIGA
         /* Callout is now configured for every transaction in siop_sched() */
         callout_reset(&acb->xs->xs_callout,
@@ -1719,6 +2120,7 @@ siop_checkintr(struct siop_softc *sc, u_char istat, u_char dstat,
         int reselid = rp->siop_scratch & 0x7f;
         int reselun = rp->siop_sfbr & 0x07;
 
+        sc->sc_flags &= ~SIOP_RESELWAIT;
 #ifdef DEBUG
         if (siop_debug & 0x100)
             printf ("%s: target ID %02x reselected dsps %lx\n",
@@ -1739,6 +2141,21 @@ siop_checkintr(struct siop_softc *sc, u_char istat, u_char dstat,
                 &= ~(1 << sc->sc_nexus->xs->xs_periph->periph_lun);
             --sc->sc_active;
         }
+#ifdef PORT_AMIGA
+        /*
+         * A command waiting to be aborted may come back by itself;
+         * let it carry on instead.
+         */
+        for (acb = sc->ready_list.tqh_first; acb;
+            acb = acb->chain.tqe_next) {
+            if ((acb->flags & ACB_RECOVER) &&
+                reselid == (acb->ds.scsi_addr >> 16) &&
+                reselun == (acb->msgout[0] & 0x07)) {
+                siop_recover_cancel(sc, acb);
+                break;
+            }
+        }
+#endif
         /*
          * locate acb of reselecting device
          * set sc->sc_nexus to acb
@@ -1791,6 +2208,7 @@ siop_checkintr(struct siop_softc *sc, u_char istat, u_char dstat,
                 device_xname(sc->sc_dev), rp->siop_scntl1,
                 ctest2, rp->siop_sfbr, istat, rp->siop_istat);
 #endif
+        sc->sc_flags &= ~SIOP_RESELWAIT;
         /* XXX assumes it was not select */
         if (sc->sc_nexus == NULL) {
 #ifdef DEBUG
@@ -1972,6 +2390,12 @@ siopintr(register struct siop_softc *sc)
     int status;
     int s = bsd_splbio();
 
+#ifdef ENABLE_LOOPBACK
+    loopback_finish();
+#endif
+#ifdef ENABLE_QUICK_COMPLETION
+    siop_quick_finish(sc);
+#endif
     istat = sc->sc_istat;
     if ((istat & (SIOP_ISTAT_SIP | SIOP_ISTAT_DIP)) == 0) {
         bsd_splx(s);
@@ -2042,6 +2466,147 @@ siopintr(register struct siop_softc *sc)
 #endif
 }
 
+#ifdef ENABLE_QUICK_COMPLETION
+/*
+ * Interrupt-time completion of the common case
+ *
+ * Called from the interrupt handler after ISTAT and DSTAT were latched.
+ * If the interrupt is the SCRIPTS "command complete" interrupt with GOOD
+ * status and a COMMAND COMPLETE message, the nexus is released, the ACB
+ * is parked on sc_qdone_list and the next ready command is started right
+ * away. Anything else (errors, check condition, negotiation, reselection)
+ * returns 0 so the interrupt is handed to siopintr() as before.
+ *
+ * Must not touch callouts or reply messages; siop_quick_finish() does
+ * that from the service task.
+ *
+ * Cache maintenance is only partly kept out of here. The data buffers
+ * see CachePreDMA() when the command is queued and CachePostDMA() in
+ * siop_scsidone() on the service task, but the status and message bytes
+ * are still invalidated below, and siop_start() still pushes the ACB,
+ * with CacheClearE() at interrupt time. Both only cover a few bytes of
+ * the ACB and have to happen right before the chip or CPU reads them.
+ */
+int
+siop_quick_complete(struct siop_softc *sc, u_char istat, u_char dstat)
+{
+    siop_regmap_p rp = sc->sc_siopp;
+    struct siop_acb *acb = sc->sc_nexus;
+    struct scsipi_periph *periph;
+    int timeout;
+
+    if ((istat & SIOP_ISTAT_SIP) ||
+        (dstat & ~SIOP_DSTAT_DFE) != SIOP_DSTAT_SIR)
+        return (0);
+    if (acb == NULL || sc->sc_istat != 0 ||
+        (sc->sc_flags & (SIOP_INTSOFF | SIOP_INTDEFER)) ||
+        (sc->sc_channel.chan_flags & SCSIPI_CHAN_RESET_PEND) ||
+        (acb->flags & (ACB_RECOVER | ACB_SENSE)) ||
+        rp->siop_dsps != 0xff00)
+        return (0);
+
+    periph = acb->xs->xs_periph;
+    if (sc->sc_sync[periph->periph_target].state == NEG_WAITS)
+        return (0);     /* siop_checkintr() reports the negotiation */
+
+    dma_cachectl(&acb->stat[0], 1);
+    dma_cachectl(&acb->msg[0], 1);
+    if (acb->stat[0] != SCSI_OK || acb->msg[0] != MSG_CMD_COMPLETE)
+        return (0);
+
+    /* Clear the DMA FIFO, as siop_checkintr() does */
+    rp->siop_ctest8 |= SIOP_CTEST8_CLF;
+    timeout = 10000;
+    while ((rp->siop_ctest1 & SIOP_CTEST1_FMT) != SIOP_CTEST1_FMT)
+        if (timeout-- == 0)
+            break;
+    rp->siop_ctest8 &= ~SIOP_CTEST8_CLF;
+
+    sc->sc_nexus = NULL;
+    sc->sc_tinfo[periph->periph_target].lubusy &= ~(1 << periph->periph_lun);
+    --sc->sc_active;
+    acb->flags |= ACB_QDONE;
+    TAILQ_INSERT_TAIL(&sc->sc_qdone_list, acb, chain);
+    SIOP_TRACE('q','d',0,0)
+
+    if (sc->nexus_list.tqh_first)
+        rp->siop_dcntl |= SIOP_DCNTL_STD;
+
+    siop_quick_start(sc);
+    return (1);
+}
+
+/*
+ * Start the next ready command from interrupt context.
+ *
+ * Only plain DMA transfers to targets which have finished negotiation
+ * are started here. Everything else is left on ready_list for
+ * siop_sched(), which runs when the service task finishes the ACB.
+ */
+static void
+siop_quick_start(struct siop_softc *sc)
+{
+    struct scsipi_periph *periph = NULL;
+    struct siop_acb *acb;
+    int target;
+
+    for (acb = sc->ready_list.tqh_first; acb; acb = acb->chain.tqe_next) {
+        if (acb->flags & (ACB_RECOVER | ACB_SENSE))
+            return;     /* siop_sched() sends it first */
+        periph = acb->xs->xs_periph;
+        if (!(sc->sc_tinfo[periph->periph_target].lubusy &
+              (1 << periph->periph_lun)))
+            break;
+    }
+    if (acb == NULL || siop_no_dma ||
+        (acb->xs->xs_control & (XS_CTL_POLL | XS_CTL_RESET)))
+        return;
+
+    target = periph->periph_target;
+    if (sc->sc_sync[target].state != NEG_DONE)
+        return;
+
+    TAILQ_REMOVE(&sc->ready_list, acb, chain);
+    sc->sc_nexus = acb;
+    sc->sc_tinfo[target].lubusy |= (1 << periph->periph_lun);
+    acb->flags |= ACB_QSTART;
+    ++sc->sc_active;
+    SIOP_TRACE('q','s',target,0)
+    siop_select(sc);
+}
+
+/*
+ * Service task side of siop_quick_complete(); called with splbio held.
+ *
+ * Arms the timeout of commands which were started from the interrupt
+ * handler and finishes the ACBs which completed there.
+ */
+static void
+siop_quick_finish(struct siop_softc *sc)
+{
+    struct siop_acb *acb;
+
+    acb = sc->sc_nexus;
+    if (acb != NULL && (acb->flags & ACB_QSTART)) {
+        acb->flags &= ~ACB_QSTART;
+        callout_reset(&acb->xs->xs_callout,
+            mstohz(acb->xs->timeout) + 1, siop_timeout, acb);
+    }
+    for (acb = sc->nexus_list.tqh_first; acb; acb = acb->chain.tqe_next) {
+        if (acb->flags & ACB_QSTART) {
+            acb->flags &= ~ACB_QSTART;
+            callout_reset(&acb->xs->xs_callout,
+                mstohz(acb->xs->timeout) + 1, siop_timeout, acb);
+        }
+    }
+
+    while ((acb = sc->sc_qdone_list.tqh_first) != NULL) {
+        TAILQ_REMOVE(&sc->sc_qdone_list, acb, chain);
+        siop_scsidone(acb, SCSI_OK);
+    }
+}
+#endif /* ENABLE_QUICK_COMPLETION */
+
 void
 scsi_period_to_siop(struct siop_softc *sc, int target)
 {
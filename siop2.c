@@ -119,6 +119,9 @@ __KERNEL_RCSID(0, "$NetBSD: siop2.c,v 1.44 2019/11/10 21:16:22 chs Exp $");
 #include "siopreg.h"
 #include "siopvar.h"
 #include "sd.h"
+#include "nsd.h"
+#include "dmacal.h"
+#include "loopback.h"
 #include <stdio.h>
 #endif
 
@@ -447,6 +450,10 @@ siopng_scsipi_request(struct scsipi_channel *chan, scsipi_adapter_req_t req,
 	switch (req) {
 	case ADAPTER_REQ_RUN_XFER:
 		xs = arg;
+#ifdef ENABLE_LOOPBACK
+		if (loopback_request(xs))
+			return;
+#endif
 #ifdef DIAGNOSTIC
 		periph = xs->xs_periph;
 #endif
@@ -852,6 +859,15 @@ siopnginitialize(struct siop_softc *sc)
 	if (!siopng_ultra_enabled(sc) && sc->sc_minsync < 25)
 		sc->sc_minsync = 25;
 
+#if defined(DRIVER_A4770)
+	sc->sc_dmode = 0x80;		/* 53C770 burst length 8 */
+#else
+	sc->sc_dmode = 0xc0;		/* XXX burst length */
+#endif
+#ifdef ENABLE_DMA_CALIBRATION
+	dma_burst_load(sc);
+#endif
+
 #ifndef PORT_AMIGA
 	if (scsi_nosync) {
 		inhibit_sync = (scsi_nosync >> shift_nosync) & 0xffff;
@@ -872,6 +888,10 @@ siopnginitialize(struct siop_softc *sc)
 	}
 
 	siopngreset (sc);
+#ifdef ENABLE_DMA_CALIBRATION
+	if (dma_burst_calibrate(sc))
+		siopngreset(sc);
+#endif
 }
 
 #ifdef PORT_AMIGA
@@ -884,6 +904,9 @@ siopngshutdown(struct scsipi_channel *chan)
     scsipi_free_all_xs(chan);
     FreeMem(sc->sc_acb, sizeof(struct siop_acb) * SIOP_NACB);
     free_scripts_copy();
+#ifdef ENABLE_LOOPBACK
+    loopback_free();
+#endif
 }
 #endif
 
@@ -975,11 +998,7 @@ siopngreset(struct siop_softc *sc)
 	rp->siop_stest3 |= SIOP_STEST3_TE;	/* TolerANT enable */
 	rp->siop_scntl0 = SIOP_ARB_FULL | /*SIOP_SCNTL0_EPC |*/ SIOP_SCNTL0_EPG;
 	rp->siop_dcntl = sc->sc_dcntl;
-#if defined(DRIVER_A4770)
-	rp->siop_dmode = 0x80;		/* 53C770 burst length 8 */
-#else
-	rp->siop_dmode = 0xc0;		/* XXX burst length */
-#endif
+	rp->siop_dmode = sc->sc_dmode;
 	rp->siop_ctest0 = sc->sc_ctest0;
 	rp->siop_ctest3 = (rp->siop_ctest3 & SIOP_CTEST3_V) | sc->sc_ctest3;
 	rp->siop_sien = 0x00;	/* don't enable interrupts yet */
@@ -1072,6 +1091,7 @@ siopngreset(struct siop_softc *sc)
 
 #ifdef PORT_AMIGA
 	sc->sc_channel.chan_flags &= ~SCSIPI_CHAN_RESET_PEND;
+	sc->sc_channel.chan_reset_count++;
 #endif
 
 	sc->sc_flags |= SIOP_ALIVE;
@@ -1100,6 +1120,10 @@ siopng_start(struct siop_softc *sc, int target, int lun, u_char *cbuf,
 	int count, tcount;
 	char *addr, *dmaend;
 	struct siop_acb *acb = sc->sc_nexus;
+#ifdef PORT_AMIGA
+	const struct NSIOVec *iov;
+	int iovcnt;
+#endif
 #ifdef DEBUG
 	int i;
 #endif
@@ -1214,6 +1238,16 @@ siopng_start(struct siop_softc *sc, int target, int lun, u_char *cbuf,
 	count = len;
 	addr = buf;
 	dmaend = NULL;
+#ifdef PORT_AMIGA
+	/* Vectored transfers describe one SCSI data phase with several buffers */
+	iov = acb->xs->xs_iov;
+	iovcnt = acb->xs->xs_iovcnt;
+	if (iov != NULL) {
+		addr = iov->iov_Base;
+		count = iov->iov_Len;
+	}
+next_iov:
+#endif
 	while (count > 0) {
 		acb->ds.chain[nchain].databuf = (char *) kvtop (addr);
 		if (count < (tcount = PAGE_SIZE - ((int) addr & PGOFSET)))
@@ -1246,6 +1280,14 @@ siopng_start(struct siop_softc *sc, int target, int lun, u_char *cbuf,
 		}
 		++nchain;
 	}
+#ifdef PORT_AMIGA
+	if (iov != NULL && --iovcnt > 0) {
+		iov++;
+		addr = iov->iov_Base;
+		count = iov->iov_Len;
+		goto next_iov;
+	}
+#endif
 #ifdef DEBUG
 	if (nchain != 1 && len != 0 && siopng_debug & 3) {
 		printf ("DMA chaining set: %d\n", nchain);
@@ -1259,6 +1301,13 @@ siopng_start(struct siop_softc *sc, int target, int lun, u_char *cbuf,
 	/* push data cache for all data the 53c720/770 needs to access */
 	dma_cachectl ((void *)acb, sizeof (struct siop_acb));
 	dma_cachectl (cbuf, clen);
+#ifdef PORT_AMIGA
+	if (acb->xs->xs_iov != NULL) {
+		for (iov = acb->xs->xs_iov, iovcnt = acb->xs->xs_iovcnt;
+		     iovcnt > 0; iov++, iovcnt--)
+			dma_cachectl (iov->iov_Base, iov->iov_Len);
+	} else
+#endif
 	if (buf != NULL && len != 0)
 		dma_cachectl (buf, len);
 
@@ -1994,6 +2043,9 @@ siopngintr(register struct siop_softc *sc)
 	int status;
 	int s = bsd_splbio();
 
+#ifdef ENABLE_LOOPBACK
+	loopback_finish();
+#endif
 	istat = sc->sc_istat;
 	if ((istat & (SIOP_ISTAT_SIP | SIOP_ISTAT_DIP)) == 0) {
 		bsd_splx(s);
@@ -0,0 +1,68 @@
+//
+// Copyright 2026 Stefan Reinauer
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+
+#ifndef _SIOPBOUNCE_H
+#define _SIOPBOUNCE_H
+
+#include <string.h>
+
+/*
+ * Head and tail bounce bytes of a 53C710 transfer, see siop_build_chain().
+ * The unaligned leading bytes of a buffer DMA to offset 0 of the bounce
+ * cache line and the bytes past its last longword to offset 4. Kept out
+ * of siop.c so bouncetest can check it on the host.
+ */
+#define SIOP_BOUNCE_MIN  30     /* Smaller transfers are not split */
+
+/*
+ * siop_bounce_split
+ * -----------------
+ * Returns nonzero if buf/len needs bouncing, with the number of head
+ * and tail bytes in *hlen and *tlen.
+ */
+static inline int
+siop_bounce_split(const void *buf, int len, unsigned char *hlen,
+                  unsigned char *tlen)
+{
+    *hlen = *tlen = 0;
+    if (len <= SIOP_BOUNCE_MIN || ((((unsigned long) buf) | len) & 3) == 0)
+        return (0);
+    *hlen = (4 - (((unsigned long) buf) & 3)) & 3;
+    *tlen = (len - *hlen) & 3;
+    return (1);
+}
+
+/*
+ * siop_bounce_wanted
+ * ------------------
+ * A read which reached the data phase has its head and tail bytes in
+ * the bounce line, whatever status it ended with. CHECK CONDITION with
+ * a RECOVERED ERROR sense completes as XS_BUSY or XS_SENSE here and is
+ * turned into success by scsipi_interpret_sense() later, so only the
+ * errors which mean the target never got that far are skipped.
+ */
+static inline int
+siop_bounce_wanted(int error)
+{
+    return (error != XS_SELTIMEOUT && error != XS_RESET);
+}
+
+static inline void
+siop_bounce_finish(const unsigned char *bounce, unsigned char *head,
+                   unsigned hlen, unsigned char *tail, unsigned tlen)
+{
+    memcpy(head, bounce, hlen);
+    memcpy(tail, bounce + 4, tlen);
+}
+
+#endif /* _SIOPBOUNCE_H */
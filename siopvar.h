@@ -36,6 +36,16 @@
 #ifndef _SIOPVAR_H_
 #define _SIOPVAR_H_
 
+/* Interrupt-time completion is only implemented for the 53C710 (siop.c) */
+#if defined(ENABLE_QUICK_COMPLETION) && !defined(ARCH_710)
+#undef ENABLE_QUICK_COMPLETION
+#endif
+
+/* So is automatic REQUEST SENSE */
+#if defined(ENABLE_AUTOSENSE) && !defined(ARCH_710)
+#undef ENABLE_AUTOSENSE
+#endif
+
 /*
  * The largest single request will be MAXPHYS bytes which will require
  * at most MAXPHYS/PAGE_SIZE+1 chain elements to describe, i.e. if none of
@@ -90,6 +100,12 @@ struct siop_acb {
 #define ACB_FREE	0x00
 #define ACB_ACTIVE	0x01
 #define ACB_DONE	0x04
+#define ACB_QDONE	0x08	/* Completed by siop_quick_complete() */
+#define ACB_QSTART	0x10	/* Started from interrupt, no timeout yet */
+#define ACB_ABORT	0x20	/* Timed out, sends ABORT to its target */
+#define ACB_BDR		0x40	/* ABORT failed, sends BUS DEVICE RESET */
+#define ACB_RECOVER	(ACB_ABORT | ACB_BDR)
+#define ACB_SENSE	0x80	/* Runs REQUEST SENSE after CHECK CONDITION */
 	struct scsipi_generic cmd;  /* SCSI command block */
 	struct siop_ds ds;
 	void	*iob_buf;
@@ -103,8 +119,37 @@ struct siop_acb {
 	int	 clen;
 	char	*daddr;		/* Saved data pointer */
 	int	 dleft;		/* Residue */
+#if defined(PORT_AMIGA) && defined(ARCH_710)
+	u_char	*bounce_head;	/* Leading unaligned bytes of the buffer */
+	u_char	*bounce_tail;	/* Trailing bytes past the last longword */
+	u_char	bounce_hlen;
+	u_char	bounce_tlen;
+	u_char	bounce_pad[2];
+	u_char	bounce[32];	/* Holds one cache line, see SIOP_BOUNCE() */
+#endif
+#ifdef ENABLE_AUTOSENSE
+	u_char	sense[32 + 16];	/* REQUEST SENSE data, see SIOP_SENSE() */
+#endif
 };
 
+#if defined(PORT_AMIGA) && defined(ARCH_710)
+/*
+ * The head bytes live at offset 0 and the tail bytes at offset 4 of a
+ * 16-byte cache line which nothing else shares, so the CPU never has a
+ * dirty copy of it while the 53C710 writes there.
+ */
+#define SIOP_BOUNCE(acb) ((u_char *)(((u_long)(acb)->bounce + 15) & ~15))
+#endif
+
+#ifdef ENABLE_AUTOSENSE
+/*
+ * Sense data is received into two cache lines of the ACB for the same
+ * reason, and copied to the xfer when REQUEST SENSE completes.
+ */
+#define SIOP_SENSE_LEN	32	/* sizeof (struct scsi_sense_data) */
+#define SIOP_SENSE(acb) ((u_char *)(((u_long)(acb)->sense + 15) & ~15))
+#endif
+
 #ifdef PORT_AMIGA
 /*
  * The NCR SCRIPTS programs use fixed byte offsets into siop_ds, and DSA
@@ -179,6 +224,9 @@ struct	siop_softc {
 	TAILQ_HEAD(acb_list, siop_acb) free_list,
 				       ready_list,
 				       nexus_list;
+#ifdef ENABLE_QUICK_COMPLETION
+	struct acb_list sc_qdone_list;	/* completed at interrupt time */
+#endif
 
 	struct siop_acb *sc_nexus;	/* current command */
 #define SIOP_NACB 16
@@ -226,14 +274,26 @@ struct	siop_softc {
 		u_char scntl3;
 #endif
 	} sc_sync[MAX_TARGETS];
+	u_char	sc_dmode;		/* DMODE value set by reset */
+	u_char	sc_pad[3];
+	u_long	sc_burst_kbs[4];	/* DMA calibration, KB/s per BL code */
 };
 
+/* DMA burst length selected by the DMODE BL field */
+#if defined(ARCH_710)
+#define SIOP_BURST_LEN(bl)	(1 << (bl))	/* 0->1 1->2 2->4 3->8 */
+#else
+#define SIOP_BURST_LEN(bl)	(2 << (bl))	/* 0->2 1->4 2->8 3->16 */
+#endif
+
 /* sc_flags */
 #define	SIOP_INTSOFF	0x80	/* Interrupts turned off */
 #define	SIOP_INTDEFER	0x40	/* Level 6 interrupt has been deferred */
 #define SIOP_FORCE_NARROW 0x20	/* board policy disables wide SCSI */
 #define SIOP_FORCE_NON_ULTRA 0x10 /* board policy disables ultra timings */
 #define SIOP_INTERNAL_SCRIPTS 0x02 /* 53C770 internal SCRIPTS RAM active */
+#define SIOP_RESELWAIT	0x08	/* SCRIPTS waits for a reselection which
+				   nobody on nexus_list will make */
 #define	SIOP_ALIVE	0x01	/* controller initialized */
 #define SIOP_SELECTED	0x04	/* bus is in selected state. Needed for
 				   correct abort procedure. */
@@ -285,6 +345,9 @@ void siop_scsipi_request(struct scsipi_channel *,
 			scsipi_adapter_req_t, void *);
 void siopinitialize(struct siop_softc *);
 void siopintr(struct siop_softc *);
+#ifdef ENABLE_QUICK_COMPLETION
+int  siop_quick_complete(struct siop_softc *, u_char, u_char);
+#endif
 void siop_dump_registers(struct siop_softc *);
 #ifdef DEBUG
 void siop_dump(struct siop_softc *);
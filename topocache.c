@@ -0,0 +1,450 @@
+//
+// Copyright 2026 Stefan Reinauer
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+
+#ifdef DEBUG_ATTACH
+#define USE_SERIAL_OUTPUT
+#endif
+#include "port.h"
+#include "printf.h"
+#include <string.h>
+#include <sys/param.h>
+#include <exec/memory.h>
+
+#include "device.h"
+#include "scsi_all.h"
+#include "scsipi_all.h"
+#include "scsipiconf.h"
+#include "scsipi_base.h"
+#include "sys_queue.h"
+#include "siopreg.h"
+#include "siopvar.h"
+#include "attach.h"
+#include "topocache.h"
+#include "util/a4092flash/flash.h"
+#include "util/a4092flash/oem_flash.h"
+
+#ifdef ENABLE_TOPOCACHE
+
+#if defined(ARCH_710)
+#define topo_allow_disc   siop_allow_disc
+#elif defined(ARCH_720) || defined(ARCH_770)
+#define topo_allow_disc   siopng_allow_disc
+#endif
+
+#define TOPO_INQ_EVPD       0x01        /* INQUIRY byte 1: vital product data */
+#define TOPO_VPD_SERIAL     0x80        /* Unit serial number VPD page */
+#define TOPO_VPD_LEN        (4 + sizeof (((struct topo_entry *)0)->te_serial))
+#define TOPO_INQ_LEN        SCSIPI_INQUIRY_LENGTH_SCSI2
+
+/*
+ * topo_checksum
+ * -------------
+ * XOR32 over the entry table, matching the mfg and OEM flash records.
+ */
+static uint32_t
+topo_checksum(const struct topo_entry *te, uint count)
+{
+    const uint32_t *words = (const uint32_t *) te;
+    uint32_t xor = 0;
+    uint i;
+
+    for (i = 0; i < count * sizeof (*te) / sizeof (uint32_t); i++)
+        xor ^= words[i];
+    return (xor);
+}
+
+static struct topo_entry *
+topo_find(int target, int lun)
+{
+    struct topo_entry *te = asave->topo.ent;
+    uint i;
+
+    for (i = 0; i < TOPO_MAX_ENTRIES; i++, te++)
+        if ((te->te_flags & TOPO_F_VALID) &&
+            te->te_target == target && te->te_lun == lun)
+            return (te);
+    return (NULL);
+}
+
+static struct topo_entry *
+topo_alloc(int target, int lun)
+{
+    struct topo_entry *te = topo_find(target, lun);
+    uint i;
+
+    if (te != NULL)
+        return (te);
+
+    te = asave->topo.ent;
+    for (i = 0; i < TOPO_MAX_ENTRIES; i++, te++)
+        if ((te->te_flags & TOPO_F_VALID) == 0)
+            return (te);
+    return (NULL);
+}
+
+/*
+ * topo_forget
+ * -----------
+ * Drop a cache entry which no longer matches the device on the bus.
+ */
+static void
+topo_forget(struct topo_entry *te)
+{
+    printf("Topology: target %d.%d changed\n", te->te_target, te->te_lun);
+    memset(te, 0, sizeof (*te));
+    asave->topo.dirty = 1;
+}
+
+/*
+ * topo_sector_free
+ * ----------------
+ * The topology sector used to be the last sector of the OEM region.
+ * Returns 0 if the programmed OEM blob still reaches into it.
+ */
+static int
+topo_sector_free(void)
+{
+    struct oem_header oem;
+
+    if (!flash_readBuf(OEM_FLASH_OFFSET, (UBYTE *) &oem, sizeof (oem)))
+        return (0);
+    if (oem.magic == OEM_MAGIC &&
+        OEM_FLASH_OFFSET + oem.total_size > TOPO_FLASH_OFFSET) {
+        printf("Topology: OEM data uses the cache sector\n");
+        return (0);
+    }
+    return (1);
+}
+
+/*
+ * topo_load
+ * ---------
+ * Read the topology cache from flash into asave. An absent or corrupt
+ * cache just leaves the table empty, so every unit is fully probed.
+ */
+void
+topo_load(void)
+{
+    struct topo_header *hdr = &asave->topo.hdr;
+
+    memset(&asave->topo, 0, sizeof (asave->topo));
+
+    if (!topo_sector_free()) {
+        asave->topo.blocked = 1;
+        return;
+    }
+    if (!flash_readBuf(TOPO_FLASH_OFFSET, (UBYTE *) hdr, sizeof (*hdr)) ||
+        !TOPO_IS_VALID(hdr))
+        goto empty;
+
+    if (!flash_readBuf(TOPO_FLASH_OFFSET + sizeof (*hdr),
+                       (UBYTE *) asave->topo.ent,
+                       hdr->count * sizeof (struct topo_entry)))
+        goto empty;
+
+    if (topo_checksum(asave->topo.ent, hdr->count) != hdr->checksum) {
+        printf("Topology: checksum mismatch\n");
+        goto empty;
+    }
+    printf("Topology: %u cached units\n", hdr->count);
+    return;
+
+empty:
+    memset(&asave->topo, 0, sizeof (asave->topo));
+}
+
+/*
+ * topo_attach
+ * -----------
+ * Attempt to attach a peripheral from its cache entry. One INQUIRY is
+ * issued to validate the entry: the unit serial number VPD page when
+ * the device provided one, otherwise standard INQUIRY data. Returns 0
+ * if the periph was set up from the cache, non-zero if the caller has
+ * to probe the device. The block size is not taken from the cache;
+ * sd_blocksize() issues READ CAPACITY, which topo_note_capacity() then
+ * checks against the entry.
+ */
+int
+topo_attach(struct scsipi_periph *periph)
+{
+    struct scsipi_inquiry cmd;
+    struct topo_entry *te;
+    uint8_t *buf;
+    int target = periph->periph_target;
+    int len;
+    int match;
+
+    asave->topo.pend.te_flags = 0;
+
+    te = topo_find(target, periph->periph_lun);
+    if (te == NULL)
+        return (1);
+
+    /* Disconnect support was not checked when this entry was recorded */
+    if (asave->allow_disc && ((te->te_flags & TOPO_F_DISC_PROBED) == 0))
+        return (1);
+
+    if (scsipi_lookup_periph(periph->periph_channel, target,
+                             periph->periph_lun) != NULL)
+        return (1);
+
+    len = (te->te_flags & TOPO_F_SERIAL) ? TOPO_VPD_LEN : TOPO_INQ_LEN;
+    buf = AllocMem(len, (asave->need_chip_ram_dma ? MEMF_CHIP : 0) |
+                   MEMF_PUBLIC | MEMF_CLEAR);
+    if (buf == NULL)
+        return (1);
+
+    memset(&cmd, 0, sizeof (cmd));
+    cmd.opcode = INQUIRY;
+    cmd.length = len;
+    if (te->te_flags & TOPO_F_SERIAL) {
+        cmd.byte2 = TOPO_INQ_EVPD;
+        cmd.unused[0] = TOPO_VPD_SERIAL;
+    }
+
+    match = 0;
+    if (scsipi_command(periph, (void *) &cmd, sizeof (cmd), buf, len, 0,
+                       3000, NULL, XS_CTL_DISCOVERY | XS_CTL_SILENT |
+                       XS_CTL_DATA_IN) == 0 && buf[0] == te->te_device) {
+        if (te->te_flags & TOPO_F_SERIAL) {
+            char serial[sizeof (te->te_serial)];
+            uint slen = MIN(buf[3], sizeof (serial));
+
+            memset(serial, 0, sizeof (serial));
+            memcpy(serial, buf + 4, slen);
+            match = (buf[1] == TOPO_VPD_SERIAL) &&
+                    (memcmp(serial, te->te_serial, sizeof (serial)) == 0);
+        } else {
+            struct scsipi_inquiry_data *inq = (void *) buf;
+            match = (memcmp(inq->vendor, te->te_vendor,
+                            sizeof (te->te_vendor)) == 0) &&
+                    (memcmp(inq->product, te->te_product,
+                            sizeof (te->te_product)) == 0) &&
+                    (memcmp(inq->revision, te->te_revision,
+                            sizeof (te->te_revision)) == 0);
+        }
+    }
+    FreeMem(buf, len);
+
+    if (!match) {
+        topo_forget(te);
+        return (1);
+    }
+
+    periph->periph_type    = te->te_device & SID_TYPE;
+    periph->periph_version = te->te_version;
+    periph->periph_cap     = te->te_cap;
+    periph->periph_quirks  = te->te_quirks;
+    periph->periph_flags  |= PERIPH_MEDIA_LOADED;
+    if (te->te_flags & TOPO_F_REMOVABLE)
+        periph->periph_flags |= PERIPH_REMOVABLE;
+
+    /*
+     * Sync and wide are negotiated again after every bus reset. The
+     * outcome is not cached: a target which once fell back to
+     * asynchronous transfers because of a marginal cable or a glitch
+     * would otherwise never be offered sync or wide again.
+     */
+    if (asave->allow_disc && (te->te_flags & TOPO_F_DISC))
+        topo_allow_disc[target] = 3;
+
+    printf("Topology: target %d.%d from cache\n", target, periph->periph_lun);
+    return (0);
+}
+
+/*
+ * topo_note_inquiry
+ * -----------------
+ * Stage the identity of a freshly probed peripheral.
+ */
+void
+topo_note_inquiry(struct scsipi_periph *periph,
+                  const struct scsipi_inquiry_data *inqbuf)
+{
+    struct topo_entry *pend = &asave->topo.pend;
+
+    memset(pend, 0, sizeof (*pend));
+    pend->te_target = periph->periph_target;
+    pend->te_lun    = periph->periph_lun;
+    pend->te_flags  = TOPO_F_VALID;
+    pend->te_device = inqbuf->device;
+    if (inqbuf->dev_qual2 & SID_REMOVABLE)
+        pend->te_flags |= TOPO_F_REMOVABLE;
+    memcpy(pend->te_vendor, inqbuf->vendor, sizeof (pend->te_vendor));
+    memcpy(pend->te_product, inqbuf->product, sizeof (pend->te_product));
+    memcpy(pend->te_revision, inqbuf->revision, sizeof (pend->te_revision));
+}
+
+/*
+ * topo_note_capacity
+ * ------------------
+ * Called by sd_blocksize() with the READ CAPACITY result, 0 if the
+ * command failed. A probed unit records it in the staged entry. For a
+ * unit attached from the cache, a capacity or block size other than
+ * the recorded one drops the entry, so the next boot probes it again.
+ */
+void
+topo_note_capacity(struct scsipi_periph *periph, uint64_t capacity)
+{
+    struct topo_entry *pend = &asave->topo.pend;
+    struct topo_entry *te;
+
+    if ((pend->te_flags & TOPO_F_VALID) &&
+        pend->te_target == periph->periph_target &&
+        pend->te_lun == periph->periph_lun) {
+        if ((pend->te_flags & TOPO_F_REMOVABLE) == 0)
+            pend->te_capacity = capacity;
+        return;
+    }
+
+    te = topo_find(periph->periph_target, periph->periph_lun);
+    if (te == NULL || (te->te_flags & TOPO_F_REMOVABLE) || capacity == 0)
+        return;  // Removable, or READ CAPACITY failed
+    if (te->te_capacity != capacity ||
+        te->te_blkshift != periph->periph_blkshift)
+        topo_forget(te);
+}
+
+/*
+ * topo_read_serial
+ * ----------------
+ * Fetch the unit serial number VPD page into the staged entry.
+ * This is only done for devices which were not found in the cache.
+ */
+static void
+topo_read_serial(struct scsipi_periph *periph, struct topo_entry *pend)
+{
+    struct scsipi_inquiry cmd;
+    uint8_t *buf;
+    uint slen;
+
+    if (periph->periph_version < 2)
+        return;  // VPD pages were introduced with SCSI-2
+
+    buf = AllocMem(TOPO_VPD_LEN, (asave->need_chip_ram_dma ? MEMF_CHIP : 0) |
+                   MEMF_PUBLIC | MEMF_CLEAR);
+    if (buf == NULL)
+        return;
+
+    memset(&cmd, 0, sizeof (cmd));
+    cmd.opcode = INQUIRY;
+    cmd.byte2 = TOPO_INQ_EVPD;
+    cmd.unused[0] = TOPO_VPD_SERIAL;
+    cmd.length = TOPO_VPD_LEN;
+
+    if (scsipi_command(periph, (void *) &cmd, sizeof (cmd), buf, TOPO_VPD_LEN,
+                       0, 3000, NULL, XS_CTL_DISCOVERY | XS_CTL_SILENT |
+                       XS_CTL_DATA_IN) == 0 &&
+        buf[0] == pend->te_device && buf[1] == TOPO_VPD_SERIAL &&
+        buf[3] != 0) {
+        slen = MIN(buf[3], sizeof (pend->te_serial));
+        memcpy(pend->te_serial, buf + 4, slen);
+        pend->te_flags |= TOPO_F_SERIAL;
+    }
+    FreeMem(buf, TOPO_VPD_LEN);
+}
+
+/*
+ * topo_update
+ * -----------
+ * Complete the staged entry of a probed peripheral and store it in the
+ * cache if anything differs from what was recorded before.
+ */
+void
+topo_update(struct scsipi_periph *periph)
+{
+    struct topo_entry *pend = &asave->topo.pend;
+    struct topo_entry *te;
+    int target = periph->periph_target;
+
+    if (((pend->te_flags & TOPO_F_VALID) == 0) ||
+        pend->te_target != target || pend->te_lun != periph->periph_lun)
+        return;
+
+    pend->te_version = periph->periph_version;
+    pend->te_cap     = periph->periph_cap;
+    pend->te_quirks  = periph->periph_quirks;
+    if ((pend->te_flags & TOPO_F_REMOVABLE) == 0)
+        pend->te_blkshift = periph->periph_blkshift;
+
+    if (asave->allow_disc) {
+        pend->te_flags |= TOPO_F_DISC_PROBED;
+        if (topo_allow_disc[target] == 3)
+            pend->te_flags |= TOPO_F_DISC;
+    }
+
+    topo_read_serial(periph, pend);
+
+    te = topo_alloc(target, periph->periph_lun);
+    if (te == NULL) {
+        printf("Topology: cache full\n");
+    } else if (memcmp(te, pend, sizeof (*te)) != 0) {
+        memcpy(te, pend, sizeof (*te));
+        asave->topo.dirty = 1;
+    }
+    pend->te_flags = 0;
+}
+
+/*
+ * topo_commit
+ * -----------
+ * Write the topology cache back to flash if it changed. Returns 1 if
+ * the cache was written, 0 if there was nothing to do, <0 on error.
+ */
+int
+topo_commit(void)
+{
+    struct topo_header *hdr = &asave->topo.hdr;
+    struct topo_entry *te = asave->topo.ent;
+    uint count = 0;
+    uint i;
+
+    if (!asave->topo.dirty || asave->topo.blocked)
+        return (0);
+
+    /* Pack valid entries to the front of the table */
+    for (i = 0; i < TOPO_MAX_ENTRIES; i++) {
+        if (te[i].te_flags & TOPO_F_VALID) {
+            if (i != count)
+                memcpy(&te[count], &te[i], sizeof (*te));
+            count++;
+        }
+    }
+    if (count < TOPO_MAX_ENTRIES)
+        memset(&te[count], 0, (TOPO_MAX_ENTRIES - count) * sizeof (*te));
+
+    hdr->magic    = TOPO_MAGIC;
+    hdr->version  = TOPO_VERSION;
+    hdr->count    = count;
+    hdr->checksum = topo_checksum(te, count);
+    hdr->reserved = 0;
+
+    printf("Topology: saving %u units\n", count);
+    if (!flash_erase_sector(TOPO_FLASH_OFFSET, TOPO_FLASH_SIZE)) {
+        printf("Topology: erase failed\n");
+        return (-1);
+    }
+
+    if (!flash_writeBuf(TOPO_FLASH_OFFSET, (const UBYTE *) hdr,
+                        sizeof (*hdr)) ||
+        !flash_writeBuf(TOPO_FLASH_OFFSET + sizeof (*hdr),
+                        (const UBYTE *) te, count * sizeof (*te))) {
+        printf("Topology: write failed\n");
+        return (-1);
+    }
+
+    asave->topo.dirty = 0;
+    return (1);
+}
+
+#endif /* ENABLE_TOPOCACHE */
@@ -0,0 +1,25 @@
+#ifndef TOPOCACHE_H
+#define TOPOCACHE_H
+
+/* The topology cache is kept in the flash of the A4092 and A4770 only */
+#if defined(ENABLE_TOPOCACHE) && \
+    !defined(FLASH_PARALLEL) && !defined(FLASH_SPI)
+#undef ENABLE_TOPOCACHE
+#endif
+
+#ifdef ENABLE_TOPOCACHE
+#include "util/a4092flash/topo_flash.h"
+
+struct scsipi_periph;
+struct scsipi_inquiry_data;
+
+void topo_load(void);
+int  topo_attach(struct scsipi_periph *periph);
+void topo_note_inquiry(struct scsipi_periph *periph,
+                       const struct scsipi_inquiry_data *inqbuf);
+void topo_note_capacity(struct scsipi_periph *periph, uint64_t capacity);
+void topo_update(struct scsipi_periph *periph);
+int  topo_commit(void);
+#endif
+
+#endif /* TOPOCACHE_H */
@@ -42,6 +42,7 @@ struct Config* configure(int argc, char *argv[]) {
   if (config == NULL) return NULL;
 
   config->eraseFlash       = false;
+  config->deltaFlash       = false;
   config->rebootRequired   = false;
   config->assumeYes        = false;
   config->nvramFlash       = false;
@@ -70,6 +71,10 @@ struct Config* configure(int argc, char *argv[]) {
           config->eraseFlash = true;
           break;
 
+        case 'D':
+          config->deltaFlash = true;
+          break;
+
         case 'B':
           config->rebootRequired = true;
           break;
@@ -118,11 +123,12 @@ struct Config* configure(int argc, char *argv[]) {
 */
 void usage(void) {
     printf("\nUsage: a4092flash [--gui|-G]\n");
-    printf("       a4092flash [-Y] { -R <a4092.rom> | -W <a4092.rom> | -E | -P | -F <nvram_cmd> }\n\n");
+    printf("       a4092flash [-Y] { -R <a4092.rom> | -W <a4092.rom> [-D] | -E | -P | -F <nvram_cmd> }\n\n");
     printf("       --gui | -G - Start the Workbench GUI from CLI.\n");
     printf("       -Y assume YES as answer to all questions\n");
     printf("       -R <a4092.rom> - Read A4092 ROM to file\n");
     printf("       -W <a4092.rom> - Flash A4092 ROM from file\n");
+    printf("       -D Only erase and program sectors that changed (with -W)\n");
     printf("       -E Erase flash.\n");
     printf("       -P Probe flash.\n");
     printf("       -B Reboot.\n");
@@ -24,6 +24,7 @@ struct Config {
   bool writeFlash;
   bool probeFlash;
   bool eraseFlash;
+  bool deltaFlash;
   bool rebootRequired;
   bool assumeYes;
   bool nvramFlash;
@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <exec/types.h>
+
+#include "flash_delta.c"
+
+// --- Stub Flash Implementation ---
+#define FLASH_SECTOR_SIZE (4 * 1024)
+#define FLASH_SECTORS     16
+#define FLASH_TOTAL_SIZE  (FLASH_SECTORS * FLASH_SECTOR_SIZE)
+
+static UBYTE flash_memory_stub[FLASH_TOTAL_SIZE];
+static ULONG stub_erases;
+static ULONG stub_written;
+
+bool flash_erase_sector(ULONG offset, ULONG sectorSize)
+{
+    ULONG sector_start_offset = (offset / FLASH_SECTOR_SIZE) * FLASH_SECTOR_SIZE;
+    memset(flash_memory_stub + sector_start_offset, 0xFF, sectorSize);
+    stub_erases++;
+    return true;
+}
+
+// NOR semantics: programming can only clear bits
+bool flash_writeBuf(ULONG offset, const UBYTE *buf, ULONG len)
+{
+    for (ULONG i = 0; i < len; i++)
+        flash_memory_stub[offset + i] &= buf[i];
+    stub_written += len;
+    return true;
+}
+
+bool flash_readBuf(ULONG offset, UBYTE *buf, ULONG len)
+{
+    memcpy(buf, flash_memory_stub + offset, len);
+    return true;
+}
+
+// --- Unit Test ---
+void print_test_result(const char* test_name, bool pass)
+{
+    printf("TEST: %-44s [%s%s%s]\n", test_name,
+           pass ? "\033[32m" : "\033[31m",  // Green for PASS, Red for FAIL
+           pass ? "PASS" : "FAIL",
+           "\033[0m");  // Reset color
+    if (!pass) exit(1);
+}
+
+static void reset_counters(void)
+{
+    stub_erases = 0;
+    stub_written = 0;
+}
+
+static bool flash_matches(const UBYTE *image, ULONG len)
+{
+    return memcmp(flash_memory_stub, image, len) == 0;
+}
+
+int main(void)
+{
+    static UBYTE image[FLASH_TOTAL_SIZE];
+    static UBYTE tail[FLASH_SECTOR_SIZE];
+    struct flash_delta_stats stats;
+    int res;
+
+    printf("Delta Reflash Unit Tests\n");
+    printf("--------------------------------\n");
+
+    for (ULONG i = 0; i < sizeof(image); i++)
+        image[i] = (UBYTE)(i * 7 + (i >> 8));
+    // Leave an erased tail in the last sector, as a ROM image would
+    memset(image + FLASH_TOTAL_SIZE - 1024, 0xFF, 1024);
+
+    // Test 1: Blank flash, nothing to erase
+    memset(flash_memory_stub, 0xFF, sizeof(flash_memory_stub));
+    reset_counters();
+    res = flash_write_delta(0, image, sizeof(image), FLASH_SECTOR_SIZE,
+                            &stats, NULL, NULL);
+    print_test_result("Write to blank flash", res == FLASH_DELTA_OK &&
+                      flash_matches(image, sizeof(image)));
+    print_test_result("Blank flash: no erases", stub_erases == 0);
+    print_test_result("Blank flash: 0xFF tail skipped",
+                      stub_written < sizeof(image) &&
+                      stats.programmed == stub_written);
+
+    // Test 2: Same image again
+    reset_counters();
+    res = flash_write_delta(0, image, sizeof(image), FLASH_SECTOR_SIZE,
+                            &stats, NULL, NULL);
+    print_test_result("Rewrite identical image", res == FLASH_DELTA_OK &&
+                      stub_erases == 0 && stub_written == 0 &&
+                      stats.sectors == FLASH_SECTORS);
+
+    // Test 3: One byte which needs a bit set again
+    image[3 * FLASH_SECTOR_SIZE + 100] = 0xFF;
+    reset_counters();
+    res = flash_write_delta(0, image, sizeof(image), FLASH_SECTOR_SIZE,
+                            &stats, NULL, NULL);
+    print_test_result("Changed byte erases one sector",
+                      res == FLASH_DELTA_OK && stub_erases == 1 &&
+                      stats.erased == 1 && flash_matches(image, sizeof(image)));
+    print_test_result("Erased sector skips 0xFF bytes",
+                      stub_written < FLASH_SECTOR_SIZE);
+
+    // Test 4: Only clears bits, programmed in place
+    image[5 * FLASH_SECTOR_SIZE + 10] &= 0x0F;
+    image[5 * FLASH_SECTOR_SIZE + 11] &= 0xF0;
+    reset_counters();
+    res = flash_write_delta(0, image, sizeof(image), FLASH_SECTOR_SIZE,
+                            &stats, NULL, NULL);
+    print_test_result("Cleared bits need no erase",
+                      res == FLASH_DELTA_OK && stub_erases == 0 &&
+                      stats.rewritten == 1 && flash_matches(image, sizeof(image)));
+    print_test_result("Only changed bytes programmed", stub_written <= 2);
+
+    // Test 5: Image shorter than a sector multiple
+    for (ULONG i = 0; i < sizeof(flash_memory_stub); i++)
+        flash_memory_stub[i] = (UBYTE)(i * 3) & 0x7F;
+    memcpy(tail, flash_memory_stub + 2 * FLASH_SECTOR_SIZE + 300,
+           FLASH_SECTOR_SIZE - 300);
+    reset_counters();
+    res = flash_write_delta(0, image, 2 * FLASH_SECTOR_SIZE + 300,
+                            FLASH_SECTOR_SIZE, &stats, NULL, NULL);
+    print_test_result("Partial last sector", res == FLASH_DELTA_OK &&
+                      stats.sectors == 3 && stub_erases == 3 &&
+                      flash_matches(image, 2 * FLASH_SECTOR_SIZE + 300));
+    print_test_result("Partial last sector: rest kept",
+                      memcmp(flash_memory_stub + 2 * FLASH_SECTOR_SIZE + 300,
+                             tail, FLASH_SECTOR_SIZE - 300) == 0);
+
+    // Test 6: Unaligned start is rejected
+    res = flash_write_delta(100, image, FLASH_SECTOR_SIZE,
+                            FLASH_SECTOR_SIZE, &stats, NULL, NULL);
+    print_test_result("Reject unaligned address", res == FLASH_DELTA_ERR_ARG);
+
+    printf("\n--------------------------------\n");
+    printf("All tests passed successfully! ✅\n");
+
+    return 0;
+}
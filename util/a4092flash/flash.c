@@ -49,6 +49,7 @@ static flashStatusSinkFn flash_status_sink = NULL;
 static void *flash_status_sink_ctx = NULL;
 
 #define FLASH_VERIFY_PROGRESS_CHUNK 1024UL
+#define FLASH_VERIFY_READ_CHUNK     256UL   /* Small enough for the driver stack */
 
 void flash_set_status_sink(flashStatusSinkFn sink, void *ctx)
 {
@@ -541,6 +542,33 @@ void flash_writeByte(ULONG address, UBYTE data)
 #endif
 }
 
+/**
+ * flash_writeBuf
+ *
+ * @brief Write a buffer to flash (dispatches to SPI or parallel). SPI flash
+ *        is programmed a whole page at a time.
+ * @param address Starting address
+ * @param buf Data to write
+ * @param len Number of bytes to write
+ * @return true on success
+ */
+bool flash_writeBuf(ULONG address, const UBYTE *buf, ULONG len)
+{
+#ifdef FLASH_SPI
+  if (current_flash_type == FLASH_TYPE_SPI) {
+    return spi_flash_writeBuf(address, buf, len);
+  }
+#endif
+#ifdef FLASH_PARALLEL
+  if (current_flash_type == FLASH_TYPE_PARALLEL) {
+    for (ULONG i = 0; i < len; i++)
+      parallel_flash_writeByte(address + i, buf[i]);
+    return true;
+  }
+#endif
+  return false;
+}
+
 /**
  * flash_verify_erased
  *
@@ -593,21 +621,29 @@ static bool flash_verify_erased(ULONG address, ULONG size,
                                 ULONG total)
 {
   bool failed = false;
-  UBYTE d;
+  UBYTE chunk[FLASH_VERIFY_READ_CHUNK];
   ULONG verified = 0;
 
   flash_printf("Verifying erase from 0x%08lX (%lu bytes)...\n",
                       (unsigned long)address, (unsigned long)size);
 
-  for (ULONG i = address; i < address + size; i++) {
-    d = flash_readByte(i);
-    if (d != 0xFF) {
-      failed = true;
-      flash_printf("Erase verify failed at 0x%08lX: expected 0xFF, got 0x%02X\n",
-                          (unsigned long)i, d);
+  while (verified < size) {
+    ULONG len = size - verified;
+
+    if (len > sizeof(chunk))
+      len = sizeof(chunk);
+    if (!flash_readBuf(address + verified, chunk, len))
+      return false;
+
+    for (ULONG i = 0; i < len; i++) {
+      if (chunk[i] != 0xFF) {
+        failed = true;
+        flash_printf("Erase verify failed at 0x%08lX: expected 0xFF, got 0x%02X\n",
+                            (unsigned long)(address + verified + i), chunk[i]);
+      }
     }
 
-    verified++;
+    verified += len;
     if (progressFn &&
         ((verified % FLASH_VERIFY_PROGRESS_CHUNK) == 0 || verified == size)) {
       flash_emit_erase_progress(progressFn, progressCtx,
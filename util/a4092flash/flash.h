@@ -45,6 +45,7 @@ bool flash_init(UBYTE *manuf, UBYTE *devid, volatile UBYTE *base, ULONG *size, U
 UBYTE flash_readByte(ULONG address);
 bool flash_readBuf(ULONG address, UBYTE *buf, ULONG len);
 void flash_writeByte(ULONG address, UBYTE data);
+bool flash_writeBuf(ULONG address, const UBYTE *buf, ULONG len);
 bool flash_erase_chip(void);
 bool flash_erase_sector(ULONG address, ULONG sectorSize);
 bool flash_erase_sector_with_progress(ULONG address, ULONG sectorSize,
@@ -0,0 +1,205 @@
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include <exec/types.h>
+#include "flash.h"
+#include "flash_delta.h"
+#include <stdlib.h>
+#include <string.h>
+
+// --- Internal Helper Functions ---
+
+/*
+ * NOR flash can only clear bits. A sector which differs from the image
+ * can be programmed in place unless some byte of the image has a bit set
+ * which is already clear in flash.
+ */
+static int delta_scan(ULONG address, const UBYTE *image, ULONG len,
+                      bool *differs, bool *needsErase)
+{
+  UBYTE cur[FLASH_DELTA_CHUNK];
+
+  *differs = false;
+  *needsErase = false;
+  for (ULONG off = 0; off < len; off += FLASH_DELTA_CHUNK) {
+    ULONG n = (len - off < FLASH_DELTA_CHUNK) ? len - off : FLASH_DELTA_CHUNK;
+
+    if (!flash_readBuf(address + off, cur, n))
+      return FLASH_DELTA_ERR_READ;
+    for (ULONG i = 0; i < n; i++) {
+      UBYTE want = image[off + i];
+
+      if (cur[i] == want)
+        continue;
+      *differs = true;
+      if ((cur[i] & want) != want) {
+        *needsErase = true;
+        return FLASH_DELTA_OK;
+      }
+    }
+  }
+  return FLASH_DELTA_OK;
+}
+
+/*
+ * Program only the runs of bytes which differ from the flash contents.
+ * After an erase the flash is known to be all 0xFF, so 0xFF runs in the
+ * image are skipped without reading the sector back first.
+ */
+static int delta_program(ULONG address, const UBYTE *image, ULONG len,
+                         bool erased, ULONG *programmed)
+{
+  UBYTE cur[FLASH_DELTA_CHUNK];
+
+  for (ULONG off = 0; off < len; off += FLASH_DELTA_CHUNK) {
+    ULONG n = (len - off < FLASH_DELTA_CHUNK) ? len - off : FLASH_DELTA_CHUNK;
+    const UBYTE *want = image + off;
+    ULONG i = 0;
+
+    if (erased)
+      memset(cur, 0xFF, n);
+    else if (!flash_readBuf(address + off, cur, n))
+      return FLASH_DELTA_ERR_READ;
+
+    while (i < n) {
+      ULONG start;
+
+      if (cur[i] == want[i]) {
+        i++;
+        continue;
+      }
+      start = i;
+      while (i < n && cur[i] != want[i])
+        i++;
+      if (!flash_writeBuf(address + off + start, want + start, i - start))
+        return FLASH_DELTA_ERR_WRITE;
+      *programmed += i - start;
+    }
+  }
+  return FLASH_DELTA_OK;
+}
+
+static int delta_verify(ULONG address, const UBYTE *image, ULONG len,
+                        ULONG *failAddress)
+{
+  UBYTE cur[FLASH_DELTA_CHUNK];
+
+  for (ULONG off = 0; off < len; off += FLASH_DELTA_CHUNK) {
+    ULONG n = (len - off < FLASH_DELTA_CHUNK) ? len - off : FLASH_DELTA_CHUNK;
+
+    if (!flash_readBuf(address + off, cur, n))
+      return FLASH_DELTA_ERR_READ;
+    for (ULONG i = 0; i < n; i++) {
+      if (cur[i] != image[off + i]) {
+        *failAddress = address + off + i;
+        return FLASH_DELTA_ERR_VERIFY;
+      }
+    }
+  }
+  return FLASH_DELTA_OK;
+}
+
+/*
+ * Erase a sector of which the image only covers the first len bytes.
+ * Whatever follows the image in that sector is read back first and
+ * programmed again after the erase.
+ */
+static int delta_erase(ULONG sector, ULONG sectorSize, ULONG len,
+                       ULONG *programmed, ULONG *failAddress)
+{
+  ULONG tailLen = sectorSize - len;
+  UBYTE *tail = NULL;
+  int res = FLASH_DELTA_OK;
+
+  if (tailLen != 0) {
+    tail = malloc(tailLen);
+    if (tail == NULL)
+      return FLASH_DELTA_ERR_NOMEM;
+    if (!flash_readBuf(sector + len, tail, tailLen)) {
+      free(tail);
+      return FLASH_DELTA_ERR_READ;
+    }
+  }
+
+  if (!flash_erase_sector(sector, sectorSize))
+    res = FLASH_DELTA_ERR_ERASE;
+  else if (tail != NULL)
+    res = delta_program(sector + len, tail, tailLen, true, programmed);
+  if (res == FLASH_DELTA_OK && tail != NULL)
+    res = delta_verify(sector + len, tail, tailLen, failAddress);
+
+  free(tail);
+  return res;
+}
+
+// --- API Implementation ---
+
+/**
+ * flash_write_delta
+ *
+ * @brief Bring the flash at address in line with image, sector by sector
+ * @param address Sector aligned flash address of the image
+ * @param image Image to write
+ * @param len Length of the image in bytes
+ * @param sectorSize Erase sector size
+ * @param stats Filled in with what was done, may be NULL
+ * @param progressFn Called after each sector, may be NULL
+ * @param progressCtx Passed to progressFn
+ * @return FLASH_DELTA_OK or a FLASH_DELTA_ERR_* code
+ *
+ * Sectors which already match are not touched. If the image ends within
+ * a sector which has to be erased, the rest of that sector keeps its
+ * contents.
+ */
+int flash_write_delta(ULONG address, const UBYTE *image, ULONG len,
+                      ULONG sectorSize, struct flash_delta_stats *stats,
+                      flashDeltaProgressFn progressFn, void *progressCtx)
+{
+  struct flash_delta_stats local;
+  int res = FLASH_DELTA_OK;
+
+  if (stats == NULL)
+    stats = &local;
+  memset(stats, 0, sizeof(*stats));
+
+  if (image == NULL || sectorSize == 0 || (address % sectorSize) != 0)
+    return FLASH_DELTA_ERR_ARG;
+
+  for (ULONG done = 0; done < len; done += sectorSize) {
+    ULONG sector = address + done;
+    ULONG n = (len - done < sectorSize) ? len - done : sectorSize;
+    bool differs;
+    bool needsErase;
+
+    stats->sectors++;
+    stats->failAddress = sector;
+    res = delta_scan(sector, image + done, n, &differs, &needsErase);
+    if (res != FLASH_DELTA_OK)
+      break;
+
+    if (differs) {
+      if (needsErase) {
+        res = delta_erase(sector, sectorSize, n, &stats->programmed,
+                          &stats->failAddress);
+        if (res != FLASH_DELTA_OK)
+          break;
+        stats->erased++;
+      } else {
+        stats->rewritten++;
+      }
+
+      res = delta_program(sector, image + done, n, needsErase,
+                          &stats->programmed);
+      if (res == FLASH_DELTA_OK)
+        res = delta_verify(sector, image + done, n, &stats->failAddress);
+      if (res != FLASH_DELTA_OK)
+        break;
+    }
+
+    if (progressFn)
+      progressFn(progressCtx, done + n, len);
+  }
+
+  if (res == FLASH_DELTA_OK)
+    stats->failAddress = 0;
+  return res;
+}
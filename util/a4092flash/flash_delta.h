@@ -0,0 +1,38 @@
+// SPDX-License-Identifier: BSD-2-Clause
+
+#ifndef FLASH_DELTA_H
+#define FLASH_DELTA_H
+
+#include <stdbool.h>
+
+/*
+ * Differential reflashing: only erase and program the sectors of an
+ * image which differ from what is already in flash. Works on top of the
+ * unified flash API, so it covers SPI and parallel flash alike.
+ */
+
+#define FLASH_DELTA_CHUNK 256   /* Read and compare granularity */
+
+#define FLASH_DELTA_OK           (0)
+#define FLASH_DELTA_ERR_ARG      (-1)
+#define FLASH_DELTA_ERR_READ     (-2)
+#define FLASH_DELTA_ERR_ERASE    (-3)
+#define FLASH_DELTA_ERR_WRITE    (-4)
+#define FLASH_DELTA_ERR_VERIFY   (-5)
+#define FLASH_DELTA_ERR_NOMEM    (-6)
+
+struct flash_delta_stats {
+  ULONG sectors;        /* Sectors covered by the image */
+  ULONG erased;         /* Sectors which had to be erased */
+  ULONG rewritten;      /* Sectors programmed without an erase */
+  ULONG programmed;     /* Bytes sent to the flash */
+  ULONG failAddress;    /* Failing sector or byte on an error */
+};
+
+typedef void (*flashDeltaProgressFn)(void *ctx, ULONG done, ULONG total);
+
+int flash_write_delta(ULONG address, const UBYTE *image, ULONG len,
+                      ULONG sectorSize, struct flash_delta_stats *stats,
+                      flashDeltaProgressFn progressFn, void *progressCtx);
+
+#endif
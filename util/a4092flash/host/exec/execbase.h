@@ -0,0 +1,11 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/* Minimal exec/execbase.h for host builds of the flash code (spi_bench) */
+
+#ifndef EXEC_EXECBASE_H
+#define EXEC_EXECBASE_H
+
+#include <exec/types.h>
+
+struct ExecBase;
+
+#endif
@@ -0,0 +1,22 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/* Minimal exec/types.h for host builds of the flash code (spi_bench) */
+
+#ifndef EXEC_TYPES_H
+#define EXEC_TYPES_H
+
+#include <stdint.h>
+
+typedef int8_t   BYTE;
+typedef uint8_t  UBYTE;
+typedef int16_t  WORD;
+typedef uint16_t UWORD;
+typedef int32_t  LONG;
+typedef uint32_t ULONG;
+typedef int16_t  BOOL;
+typedef void    *APTR;
+typedef char    *STRPTR;
+
+#define TRUE  1
+#define FALSE 0
+
+#endif
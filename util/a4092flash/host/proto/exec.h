@@ -0,0 +1,4 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/* Empty proto/exec.h for host builds of the flash code (spi_bench) */
+
+#include <exec/types.h>
@@ -34,6 +34,7 @@
 #include "main.h"
 #include "config.h"
 #include "nvram_flash.h"
+#include "flash_delta.h"
 
 #define A4091_ROM_MAGIC1 0xFFFF5352
 #define A4091_ROM_MAGIC2 0x2F434448
@@ -398,11 +399,13 @@ int main(int argc, char *argv[])
             char *flash_buf = AllocMem(inspect_size, 0);
 
             if (flash_buf) {
-              flash_readBuf(0, (UBYTE *)flash_buf, inspect_size);
-              summarize_rom_buffer((UBYTE *)flash_buf, inspect_size, &flash_info);
-
-              printf("  Installed: ");
-              printf("%s\n", flash_info.summary);
+              if (flash_readBuf(0, (UBYTE *)flash_buf, inspect_size)) {
+                summarize_rom_buffer((UBYTE *)flash_buf, inspect_size, &flash_info);
+                printf("  Installed: ");
+                printf("%s\n", flash_info.summary);
+              } else {
+                printf("  Installed: unreadable\n");
+              }
               FreeMem(flash_buf, inspect_size);
             }
 
@@ -423,7 +426,20 @@ int main(int argc, char *argv[])
             }
           }
 
-          if (config->writeFlash && config->scsi_rom_filename) {
+          if (config->writeFlash && config->scsi_rom_filename &&
+              config->deltaFlash && config->eraseFlash == false) {
+            if (sectorSize == 0) {
+              printf("Flash has no erase sectors, -D not supported.\n");
+              rc = 5;
+              goto exit;
+            }
+            printf("Updating changed sectors of %s ROM.\n", board_name);
+            if (!writeBufToFlashDelta(driver_buffer, romSize, sectorSize)) {
+              fprintf(stderr, "ERROR: Flash update failed!\n");
+              rc = 5;
+              goto exit;
+            }
+          } else if (config->writeFlash && config->scsi_rom_filename) {
             if (config->eraseFlash == false) {
               if (sectorSize > 0) {
                 printf("Erasing flash bank.\n");
@@ -596,9 +612,10 @@ BOOL writeFlashToFile(char *filename, ULONG romSize)
 
   if (buffer) {
     fprintf(stdout, "Reading Flash...\n");
-    int i;
-    for (i=0; i<romSize; i++) {
-      buffer[i] = flash_readByte(i);
+    if (!flash_readBuf(0, (UBYTE *)buffer, romSize)) {
+      printf("Error reading flash\n");
+      FreeMem(buffer, romSize);
+      return false;
     }
     fprintf(stdout, "Writing File %s...\n", filename);
     fh = Open(filename,MODE_NEWFILE);
@@ -649,15 +666,35 @@ static void emit_write_progress(flashWriteProgressFn progressFn, void *progressC
   }
 }
 
+static void show_console_progress(ULONG done, ULONG size, int *lastProgress)
+{
+  int progress = (size > 0) ? (int)((done * 100UL) / size) : 100;
+
+  if (*lastProgress != progress) {
+    fprintf(stdout,"\b\b\b\b%3d%%",progress);
+    fflush(stdout);
+    *lastProgress = progress;
+  }
+}
+
+/*
+ * Flash is programmed one SPI page at a time and read back in larger
+ * chunks, instead of a command sequence per byte.
+ */
+#define FLASH_WRITE_CHUNK   256UL
+#define FLASH_VERIFY_CHUNK  4096UL
+
+static UBYTE verifyBuf[FLASH_VERIFY_CHUNK];
+
 BOOL writeBufToFlashWithProgress(struct scsiBoard *board, UBYTE *source,
                                  volatile UBYTE *dest, ULONG size,
                                  flashWriteProgressFn progressFn,
                                  void *progressCtx)
 {
-  UBYTE destVal   = 0;
   bool showConsole = (progressFn == NULL) && !flash_status_sink_active();
   int lastWriteProgress = -1;
   int lastVerifyProgress = -1;
+  ULONG len;
 
   (void)board;
   (void)dest;
@@ -669,24 +706,23 @@ BOOL writeBufToFlashWithProgress(struct scsiBoard *board, UBYTE *source,
     flash_printf("Writing flash...\n");
   }
 
-  for (ULONG i = 0; i < size; i++) {
-    if (showConsole) {
-      int progress = (size > 1) ? (int)((i * 100UL) / (size - 1)) : 100;
+  if (showConsole)
+    show_console_progress(0, size, &lastWriteProgress);
 
-      if (lastWriteProgress != progress) {
-        fprintf(stdout,"\b\b\b\b%3d%%",progress);
-        fflush(stdout);
-        lastWriteProgress = progress;
-      }
-    }
+  for (ULONG i = 0; i < size; i += len) {
+    len = FLASH_WRITE_CHUNK - (i & (FLASH_WRITE_CHUNK - 1));
+    if (len > size - i)
+      len = size - i;
 
-    flash_writeByte(i, source[i]);
+    if (!flash_writeBuf(i, source + i, len))
+      return false;
 
-    if (!showConsole) {
+    if (showConsole) {
+      show_console_progress(i + len, size, &lastWriteProgress);
+    } else {
       emit_write_progress(progressFn, progressCtx, FLASH_WRITE_PHASE_PROGRAM,
-                          i + 1, size, &lastWriteProgress);
+                          i + len, size, &lastWriteProgress);
     }
-
   }
 
   if (showConsole) {
@@ -698,27 +734,33 @@ BOOL writeBufToFlashWithProgress(struct scsiBoard *board, UBYTE *source,
     flash_printf("Verifying flash...\n");
   }
 
-  for (ULONG i = 0; i < size; i++) {
-    if (showConsole) {
-      int progress = (size > 1) ? (int)((i * 100UL) / (size - 1)) : 100;
+  if (showConsole)
+    show_console_progress(0, size, &lastVerifyProgress);
 
-      if (lastVerifyProgress != progress) {
-        fprintf(stdout,"\b\b\b\b%3d%%",progress);
-        fflush(stdout);
-        lastVerifyProgress = progress;
-      }
+  for (ULONG i = 0; i < size; i += len) {
+    len = size - i;
+    if (len > FLASH_VERIFY_CHUNK)
+      len = FLASH_VERIFY_CHUNK;
+
+    if (!flash_readBuf(i, verifyBuf, len)) {
+      flash_printf("Read back failed at offset %06lx\n", (unsigned long)i);
+      return false;
     }
+    if (memcmp(source + i, verifyBuf, len) != 0) {
+      ULONG j = 0;
 
-    destVal = flash_readByte(i);
-    if (source[i] != destVal) {
-          flash_printf("Verification failed at offset %06lx - Expected %02X but read %02X\n",
-                              (unsigned long)i, source[i], destVal);
-          return false;
+      while (source[i + j] == verifyBuf[j])
+        j++;
+      flash_printf("Verification failed at offset %06lx - Expected %02X but read %02X\n",
+                          (unsigned long)(i + j), source[i + j], verifyBuf[j]);
+      return false;
     }
 
-    if (!showConsole) {
+    if (showConsole) {
+      show_console_progress(i + len, size, &lastVerifyProgress);
+    } else {
       emit_write_progress(progressFn, progressCtx, FLASH_WRITE_PHASE_VERIFY,
-                          i + 1, size, &lastVerifyProgress);
+                          i + len, size, &lastVerifyProgress);
     }
   }
 
@@ -736,6 +778,49 @@ BOOL writeBufToFlash(struct scsiBoard *board, UBYTE *source, volatile UBYTE *des
   return writeBufToFlashWithProgress(board, source, dest, size, NULL, NULL);
 }
 
+static void delta_progress(void *ctx, ULONG done, ULONG total)
+{
+  show_console_progress(done, total, (int *)ctx);
+}
+
+/**
+ * writeBufToFlashDelta()
+ *
+ * Compare the image against the flash sector by sector, and only erase
+ * and program the sectors which differ.
+ *
+ * @param source image to write
+ * @param size image size in bytes
+ * @param sectorSize flash erase sector size
+ * @returns true on success
+*/
+BOOL writeBufToFlashDelta(UBYTE *source, ULONG size, ULONG sectorSize)
+{
+  struct flash_delta_stats stats;
+  int lastProgress = -1;
+  int res;
+
+  fprintf(stdout,"Updating:     ");
+  fflush(stdout);
+  show_console_progress(0, size, &lastProgress);
+
+  res = flash_write_delta(0, source, size, sectorSize, &stats,
+                          delta_progress, &lastProgress);
+  printf("\n");
+
+  if (res != FLASH_DELTA_OK) {
+    printf("Update failed at offset %06lx (error %d)\n",
+           (unsigned long)stats.failAddress, res);
+    return false;
+  }
+
+  printf("%lu of %lu sectors changed (%lu erased), %lu bytes programmed.\n",
+         (unsigned long)(stats.erased + stats.rewritten),
+         (unsigned long)stats.sectors, (unsigned long)stats.erased,
+         (unsigned long)stats.programmed);
+  return true;
+}
+
 /**
  * probeFlash()
  *
@@ -783,14 +868,15 @@ static BOOL probeFlash(ULONG romSize)
   ULONG search_size = (romSize < SEARCH_SIZE) ? romSize : SEARCH_SIZE;
   char *buffer = AllocMem(search_size, 0);
   if (buffer) {
-    for (int i = 0; i < search_size; i++) {
-      buffer[i] = flash_readByte(i);
+    if (flash_readBuf(0, (UBYTE *)buffer, search_size)) {
+      struct romInfo info;
+      summarize_rom_buffer((UBYTE *)buffer, search_size, &info);
+      printf("Version: %s\n", info.summary);
+    } else {
+      printf("Error reading flash\n");
+      ret = false;
     }
 
-    struct romInfo info;
-    summarize_rom_buffer((UBYTE *)buffer, search_size, &info);
-    printf("Version: %s\n", info.summary);
-
     FreeMem(buffer, search_size);
   } else {
     ret = false;
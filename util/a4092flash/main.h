@@ -78,6 +78,7 @@ ULONG getFileSize(char *);
 BOOL readFileToBuf(char *, void *);
 BOOL writeFlashToFile(char *filename, ULONG romSize);
 BOOL writeBufToFlash(struct scsiBoard *board, UBYTE *source, volatile UBYTE *dest, ULONG size);
+BOOL writeBufToFlashDelta(UBYTE *source, ULONG size, ULONG sectorSize);
 BOOL writeBufToFlashWithProgress(struct scsiBoard *board, UBYTE *source,
                                  volatile UBYTE *dest, ULONG size,
                                  flashWriteProgressFn progressFn,
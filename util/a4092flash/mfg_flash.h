@@ -7,7 +7,8 @@
  *
  * Flash layout (512 KB W25X40):
  *   0x00000 - 0x5FFFF  (384 KB)  Firmware/ROM Image
- *   0x60000 - 0x7CFFF  (116 KB)  OEM Data (boot image)
+ *   0x60000 - 0x7BFFF  (112 KB)  OEM Data (boot image)
+ *   0x7C000 - 0x7CFFF  (4 KB)    Topology cache
  *   0x7D000 - 0x7EFFF  (8 KB)    NVRAM/Settings
  *   0x7F000 - 0x7FFFF  (4 KB)    Manufacturing Data
  *
@@ -21,7 +21,7 @@ import tempfile
 OEM_MAGIC = 0x4F454D00  # "OEM\0"
 OEM_VERSION = 2
 OEM_MAX_COLORS = 32
-OEM_FLASH_SIZE = 0x1D000  # 116 KB
+OEM_FLASH_SIZE = 0x1C000  # 112 KB
 OEM_VARIANT_SLOTS = 3
 OEM_COORD_CENTER = 0xFFFF
 DEPTHS = (5, 4, 3)
@@ -2,6 +2,22 @@
 #include "nvram_flash.h"
 #include <string.h> // For memcpy
 
+/*
+ * The partition is split into two banks, each of which must be a whole
+ * erase sector. Entries are appended to the active bank. Once it is full,
+ * the newest entries are copied to the other bank, and that bank's header
+ * is written last with a higher sequence number. If power fails during a
+ * rotation, the new bank has no valid header and the old one still wins.
+ *
+ * Partitions written by older versions (a single nvram_partition_hdr and
+ * one log over the whole partition) are still read, and are converted on
+ * the next write. The new bank goes where the old log has no entries yet,
+ * or into bank 0 once the log has grown into bank 1. Either way the
+ * newest old entries stay on flash until the new bank is verified.
+ */
+
+#define ENTRY_ERASED 0xFFFFFFFF
+
 // --- Internal Helper Functions ---
 
 static uint32_t calculate_checksum(const uint8_t *data, size_t len)
@@ -15,18 +31,12 @@ static uint32_t calculate_checksum(const uint8_t *data, size_t len)
 
 static void internal_flash_write(ULONG base_addr, const void* src, size_t size)
 {
-    const uint8_t* s = (const uint8_t*)src;
-    for (size_t i = 0; i < size; ++i) {
-        flash_writeByte(base_addr + i, s[i]);
-    }
+    flash_writeBuf(base_addr, (const UBYTE *)src, size);
 }
 
 static void internal_flash_read(void* dest, ULONG base_addr, size_t size)
 {
-    uint8_t* d = (uint8_t*)dest;
-    for (size_t i = 0; i < size; ++i) {
-        d[i] = flash_readByte(base_addr + i);
-    }
+    flash_readBuf(base_addr, (UBYTE *)dest, size);
 }
 
 static bool validate_entry(const struct nvram_t *entry)
@@ -34,141 +44,305 @@ static bool validate_entry(const struct nvram_t *entry)
     return calculate_checksum(entry->data, sizeof(entry->data)) == entry->checksum;
 }
 
-static void find_entries(ULONG partition_address, const struct nvram_partition_hdr *hdr, 
-                        ULONG *last_offset, ULONG *second_last_offset, ULONG *free_slot_offset)
+static ULONG bank_address(ULONG partition_address, ULONG partition_size, int bank)
+{
+    return partition_address + bank * (partition_size / NVRAM_BANKS);
+}
+
+static ULONG bank_slots(ULONG partition_size)
+{
+    return (partition_size / NVRAM_BANKS - sizeof(struct nvram_bank_hdr)) /
+           sizeof(struct nvram_t);
+}
+
+static ULONG slot_address(ULONG bank_addr, ULONG slot)
+{
+    return bank_addr + sizeof(struct nvram_bank_hdr) + slot * sizeof(struct nvram_t);
+}
+
+static bool read_bank_hdr(ULONG bank_addr, struct nvram_bank_hdr *hdr)
+{
+    internal_flash_read(hdr, bank_addr, sizeof(*hdr));
+    return hdr->magic == NVRAM_LOG_MAGIC && hdr->seq == (uint32_t)~hdr->seq_inv;
+}
+
+/*
+ * Entries are appended and the checksum word is programmed first, so the
+ * used slots of a bank are always a prefix. Binary search for the first
+ * slot whose checksum word is still erased.
+ */
+static ULONG find_frontier(ULONG bank_addr, ULONG slots)
 {
-    const ULONG data_area_start = sizeof(struct nvram_partition_hdr);
-    ULONG current_offset = data_area_start;
-    *last_offset = 0;
-    *second_last_offset = 0;
-    if (free_slot_offset) *free_slot_offset = 0;
+    ULONG lo = 0, hi = slots;
 
-    while (current_offset + sizeof(struct nvram_t) <= hdr->partition_size) {
+    while (lo < hi) {
+        ULONG mid = lo + (hi - lo) / 2;
         uint32_t chk;
-        internal_flash_read(&chk, partition_address + current_offset, sizeof(uint32_t));
-        if (chk == 0xFFFFFFFF) {
-            if (free_slot_offset && *free_slot_offset == 0) {
-                *free_slot_offset = current_offset;
-            }
-            break;
-        }
-        *second_last_offset = *last_offset;
-        *last_offset = current_offset;
-        current_offset += sizeof(struct nvram_t);
+
+        internal_flash_read(&chk, slot_address(bank_addr, mid), sizeof(chk));
+        if (chk == ENTRY_ERASED)
+            hi = mid;
+        else
+            lo = mid + 1;
     }
+    return lo;
 }
 
-// --- API Implementation ---
-
-int flash_format_nvram_partition(ULONG partition_address, ULONG size)
+/* Newest valid entries before slot 'end', newest first. Returns the count. */
+static int read_newest(ULONG bank_addr, ULONG end, struct nvram_t *entries, int max)
 {
-    if (size < sizeof(struct nvram_partition_hdr)) {
-        return NVRAM_ERR_INVALID_ARG;
+    int found = 0;
+
+    while (end > 0 && found < max) {
+        end--;
+        internal_flash_read(&entries[found], slot_address(bank_addr, end),
+                            sizeof(struct nvram_t));
+        if (validate_entry(&entries[found]))
+            found++;
     }
+    return found;
+}
 
-    if (!flash_erase_sector(partition_address, size)) {
-        return NVRAM_ERR_VERIFY_ERASE_FAIL;
+/*
+ * Pick the bank with a valid header and the higher sequence number
+ * (compared modulo 2^32). Returns -1 if neither bank has a valid header.
+ */
+static int find_active_bank(ULONG partition_address, ULONG partition_size,
+                            struct nvram_bank_hdr *active)
+{
+    struct nvram_bank_hdr hdr[NVRAM_BANKS];
+    bool valid[NVRAM_BANKS];
+    int best = -1;
+
+    for (int i = 0; i < NVRAM_BANKS; i++) {
+        valid[i] = read_bank_hdr(bank_address(partition_address, partition_size, i), &hdr[i]) &&
+                   hdr[i].partition_size == partition_size;
+        if (valid[i] && (best < 0 || (int32_t)(hdr[i].seq - hdr[best].seq) > 0))
+            best = i;
     }
+    if (best >= 0)
+        *active = hdr[best];
+    return best;
+}
 
-    struct nvram_partition_hdr hdr = { .magic = NVRAM_MAGIC, .partition_size = size };
-    internal_flash_write(partition_address, &hdr, sizeof(hdr));
+/* Old format: one log after a nvram_partition_hdr, scanned linearly */
+static ULONG legacy_log_end(ULONG partition_address, ULONG partition_size, ULONG start)
+{
+    ULONG end = start;
 
-    struct nvram_partition_hdr read_hdr;
-    internal_flash_read(&read_hdr, partition_address, sizeof(read_hdr));
-    if (read_hdr.magic != hdr.magic || read_hdr.partition_size != hdr.partition_size) {
-        return NVRAM_ERR_WRITE_FAIL;
+    while (end + sizeof(struct nvram_t) <= partition_size) {
+        uint32_t chk;
+        internal_flash_read(&chk, partition_address + end, sizeof(chk));
+        if (chk == ENTRY_ERASED)
+            break;
+        end += sizeof(struct nvram_t);
     }
+    return end;
+}
 
-    return NVRAM_OK;
+static int legacy_read_newest(ULONG partition_address, ULONG partition_size,
+                              ULONG start, struct nvram_t *entries, int max)
+{
+    ULONG end = legacy_log_end(partition_address, partition_size, start);
+    int found = 0;
+
+    while (end > start && found < max) {
+        end -= sizeof(struct nvram_t);
+        internal_flash_read(&entries[found], partition_address + end, sizeof(struct nvram_t));
+        if (validate_entry(&entries[found]))
+            found++;
+    }
+    return found;
 }
 
-int flash_read_nvram(ULONG partition_address, struct nvram_t* last_entry)
+/* Offset of the first old format slot which lies wholly in bank 1 */
+static ULONG legacy_tail_start(ULONG partition_size)
 {
-    if (last_entry == NULL) return NVRAM_ERR_INVALID_ARG;
+    ULONG first = sizeof(struct nvram_partition_hdr);
+    ULONG half = partition_size / NVRAM_BANKS;
+
+    return first + (half - first + sizeof(struct nvram_t) - 1) /
+                   sizeof(struct nvram_t) * sizeof(struct nvram_t);
+}
+
+/*
+ * Read the partition size from whichever header is at the start. For an
+ * old format log, *legacy is the offset its readable entries start at,
+ * otherwise 0.
+ */
+static int read_partition_size(ULONG partition_address, ULONG *size, ULONG *legacy)
+{
+    struct nvram_bank_hdr bank_hdr;
+    struct nvram_bank_hdr hdr;
+    struct nvram_t newest;
+    ULONG psize;
 
-    struct nvram_partition_hdr hdr;
+    *legacy = 0;
     internal_flash_read(&hdr, partition_address, sizeof(hdr));
+    if (hdr.magic == NVRAM_LOG_MAGIC || hdr.magic == NVRAM_MAGIC) {
+        psize = hdr.partition_size;
+    } else {
+        /*
+         * Bank 0 may have been erased for a rotation that never finished.
+         * Its size is then only known from bank 1, which sits half the
+         * partition further on; try the standard partition size.
+         */
+        psize = NVRAM_SIZE;
+        if (!read_bank_hdr(partition_address + psize / NVRAM_BANKS, &bank_hdr) ||
+            bank_hdr.partition_size != psize) {
+            /*
+             * Or for the conversion of an old log which had grown into
+             * bank 1. Its newest entries are still there.
+             */
+            if (hdr.magic != ENTRY_ERASED ||
+                legacy_read_newest(partition_address, psize,
+                                   legacy_tail_start(psize), &newest, 1) == 0)
+                return NVRAM_ERR_BAD_MAGIC;
+            *size = psize;
+            *legacy = legacy_tail_start(psize);
+            return NVRAM_OK;
+        }
+    }
 
-    if (hdr.magic != NVRAM_MAGIC) return NVRAM_ERR_BAD_MAGIC;
-    if (hdr.partition_size < sizeof(struct nvram_partition_hdr) + MIN_ENTRIES * sizeof(struct nvram_t)) {
+    if (psize / NVRAM_BANKS < sizeof(struct nvram_bank_hdr) + MIN_ENTRIES * sizeof(struct nvram_t))
         return NVRAM_ERR_INVALID_ARG;
+
+    *size = psize;
+    if (find_active_bank(partition_address, psize, &bank_hdr) < 0) {
+        if (hdr.magic != NVRAM_MAGIC)
+            return NVRAM_ERR_BAD_MAGIC;
+        *legacy = sizeof(struct nvram_partition_hdr);
     }
+    return NVRAM_OK;
+}
 
-    ULONG last_offset, second_last_offset;
-    find_entries(partition_address, &hdr, &last_offset, &second_last_offset, NULL);
+/*
+ * Erase 'bank', write the given entries (oldest first) and then the
+ * header which makes the bank active. The entries are read back before
+ * the header goes in, so a bank never becomes active with bad data.
+ */
+static int write_bank(ULONG partition_address, ULONG partition_size, int bank,
+                      uint32_t seq, const struct nvram_t *entries, int count)
+{
+    ULONG addr = bank_address(partition_address, partition_size, bank);
+    struct nvram_bank_hdr hdr = {
+        .magic = NVRAM_LOG_MAGIC,
+        .partition_size = partition_size,
+        .seq = seq,
+        .seq_inv = ~seq,
+    };
+    struct nvram_bank_hdr read_hdr;
+    struct nvram_t read_entry;
+
+    if (!flash_erase_sector(addr, partition_size / NVRAM_BANKS))
+        return NVRAM_ERR_VERIFY_ERASE_FAIL;
 
-    if (last_offset == 0) return NVRAM_ERR_NO_ENTRIES;
+    for (int i = 0; i < count; i++) {
+        internal_flash_write(slot_address(addr, i), &entries[i], sizeof(struct nvram_t));
+        internal_flash_read(&read_entry, slot_address(addr, i), sizeof(read_entry));
+        if (memcmp(&read_entry, &entries[i], sizeof(read_entry)))
+            return NVRAM_ERR_WRITE_FAIL;
+    }
+    internal_flash_write(addr, &hdr, sizeof(hdr));
 
-    const ULONG data_area_start = sizeof(struct nvram_partition_hdr);
-    ULONG current_offset = last_offset;
-    
-    while (current_offset >= data_area_start) {
-        struct nvram_t entry;
-        internal_flash_read(&entry, partition_address + current_offset, sizeof(entry));
+    if (!read_bank_hdr(addr, &read_hdr) || read_hdr.seq != seq)
+        return NVRAM_ERR_WRITE_FAIL;
+    return NVRAM_OK;
+}
 
-        if (validate_entry(&entry)) {
-            *last_entry = entry;
-            return NVRAM_OK;
-        }
+// --- API Implementation ---
 
-        if (current_offset < data_area_start + sizeof(struct nvram_t)) break;
-        current_offset -= sizeof(struct nvram_t);
+int flash_format_nvram_partition(ULONG partition_address, ULONG size)
+{
+    if (size / NVRAM_BANKS < sizeof(struct nvram_bank_hdr) + MIN_ENTRIES * sizeof(struct nvram_t)) {
+        return NVRAM_ERR_INVALID_ARG;
     }
 
-    return NVRAM_ERR_NO_VALID_ENTRY;
+    if (!flash_erase_sector(partition_address, size)) {
+        return NVRAM_ERR_VERIFY_ERASE_FAIL;
+    }
+
+    return write_bank(partition_address, size, 0, 1, NULL, 0);
 }
 
-int flash_write_nvram(ULONG partition_address, struct nvram_t* new_entry)
+int flash_read_nvram(ULONG partition_address, struct nvram_t* last_entry)
 {
-    if (new_entry == NULL) return NVRAM_ERR_INVALID_ARG;
-
-    struct nvram_partition_hdr hdr;
-    internal_flash_read(&hdr, partition_address, sizeof(hdr));
+    if (last_entry == NULL) return NVRAM_ERR_INVALID_ARG;
 
-    if (hdr.magic != NVRAM_MAGIC) return NVRAM_ERR_BAD_MAGIC;
-    if (hdr.partition_size < sizeof(struct nvram_partition_hdr) + MIN_ENTRIES * sizeof(struct nvram_t)) {
-        return NVRAM_ERR_INVALID_ARG;
+    ULONG partition_size;
+    ULONG legacy;
+    int res = read_partition_size(partition_address, &partition_size, &legacy);
+    if (res != NVRAM_OK) return res;
+
+    int found;
+    if (legacy) {
+        found = legacy_read_newest(partition_address, partition_size, legacy, last_entry, 1);
+    } else {
+        struct nvram_bank_hdr hdr;
+        int bank = find_active_bank(partition_address, partition_size, &hdr);
+        ULONG addr = bank_address(partition_address, partition_size, bank);
+        ULONG frontier = find_frontier(addr, bank_slots(partition_size));
+
+        if (frontier == 0) return NVRAM_ERR_NO_ENTRIES;
+        found = read_newest(addr, frontier, last_entry, 1);
     }
 
-    const ULONG data_area_start = sizeof(struct nvram_partition_hdr);
-    ULONG last_offset, second_last_offset, free_slot_offset;
-    find_entries(partition_address, &hdr, &last_offset, &second_last_offset, &free_slot_offset);
+    return found ? NVRAM_OK : NVRAM_ERR_NO_VALID_ENTRY;
+}
 
-    if (free_slot_offset == 0) {
+int flash_write_nvram(ULONG partition_address, struct nvram_t* new_entry)
+{
+    if (new_entry == NULL) return NVRAM_ERR_INVALID_ARG;
 
-        struct nvram_t last = {0}, second_last = {0};
-        bool last_found = false, second_last_found = false;
+    ULONG partition_size;
+    ULONG legacy;
+    int res = read_partition_size(partition_address, &partition_size, &legacy);
+    if (res != NVRAM_OK) return res;
 
-        if (last_offset != 0) {
-            internal_flash_read(&last, partition_address + last_offset, sizeof(last));
-            if (validate_entry(&last)) last_found = true;
-        }
+    struct nvram_t entry_to_write;
+    memcpy(entry_to_write.data, new_entry->data, sizeof(entry_to_write.data));
+    entry_to_write.checksum = calculate_checksum(entry_to_write.data, sizeof(entry_to_write.data));
 
-        if (second_last_offset != 0) {
-            internal_flash_read(&second_last, partition_address + second_last_offset, sizeof(second_last));
-            if (validate_entry(&second_last)) second_last_found = true;
-        }
-        
-        int format_res = flash_format_nvram_partition(partition_address, hdr.partition_size);
-        if (format_res != NVRAM_OK) return format_res;
-
-        ULONG write_offset = data_area_start;
-        if (second_last_found) {
-            internal_flash_write(partition_address + write_offset, &second_last, sizeof(struct nvram_t));
-            write_offset += sizeof(struct nvram_t);
-        }
-        if (last_found) {
-            internal_flash_write(partition_address + write_offset, &last, sizeof(struct nvram_t));
-            write_offset += sizeof(struct nvram_t);
+    /* Carried over on a rotation: the two newest entries plus the new one */
+    struct nvram_t newest[2];
+    struct nvram_t carry[3];
+    int found, count = 0;
+    int target;
+    uint32_t seq;
+
+    if (legacy) {
+        found = legacy_read_newest(partition_address, partition_size, legacy, newest, 2);
+        /*
+         * Never erase the bank holding the newest old entries before the
+         * new bank is verified. Once the old log reaches into bank 1,
+         * bank 0 only has older entries and the old header; losing those
+         * leaves the tail in bank 1 for read_partition_size() to find.
+         */
+        if (legacy_log_end(partition_address, partition_size, legacy) >
+            partition_size / NVRAM_BANKS)
+            target = 0;
+        else
+            target = 1;
+        seq = 1;
+    } else {
+        struct nvram_bank_hdr hdr;
+        int bank = find_active_bank(partition_address, partition_size, &hdr);
+        ULONG addr = bank_address(partition_address, partition_size, bank);
+        ULONG frontier = find_frontier(addr, bank_slots(partition_size));
+
+        if (frontier < bank_slots(partition_size)) {
+            internal_flash_write(slot_address(addr, frontier), &entry_to_write, sizeof(entry_to_write));
+            return NVRAM_OK;
         }
-        free_slot_offset = write_offset;
+
+        found = read_newest(addr, frontier, newest, 2);
+        target = (bank + 1) % NVRAM_BANKS;
+        seq = hdr.seq + 1;
     }
 
-    struct nvram_t entry_to_write;
-    memcpy(entry_to_write.data, new_entry->data, sizeof(entry_to_write.data));
-    entry_to_write.checksum = calculate_checksum(entry_to_write.data, sizeof(entry_to_write.data));
-    
-    internal_flash_write(partition_address + free_slot_offset, &entry_to_write, sizeof(entry_to_write));
+    while (found > 0)
+        carry[count++] = newest[--found];
+    carry[count++] = entry_to_write;
 
-    return NVRAM_OK;
+    return write_bank(partition_address, partition_size, target, seq, carry, count);
 }
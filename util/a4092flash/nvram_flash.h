@@ -13,7 +13,9 @@ typedef uint16_t UWORD;
 typedef uint32_t ULONG;
 
 // --- NVRAM Configuration ---
-#define NVRAM_MAGIC 0x4E56524D // 'NVRM' in ASCII
+#define NVRAM_MAGIC 0x4E56524D // 'NVRM' in ASCII, single log (old format)
+#define NVRAM_LOG_MAGIC 0x4E564C47 // 'NVLG' in ASCII, bank header
+#define NVRAM_BANKS 2          // Each bank must be a whole erase sector
 #define MIN_ENTRIES 16
 #define NVRAM_OFFSET 512000  // 500KB (0x7D000)
 #define NVRAM_SIZE   8192    // 8KB  (0x2000)
@@ -30,7 +32,7 @@ typedef uint32_t ULONG;
 
 // --- Data Structures ---
 
-// NVRAM Partition Header (8 bytes)
+// NVRAM Partition Header (8 bytes), old single log format
 #pragma pack(push, 1)
 struct nvram_partition_hdr {
     uint32_t magic;
@@ -38,6 +40,16 @@ struct nvram_partition_hdr {
 };
 #pragma pack(pop)
 
+// NVRAM Bank Header (16 bytes), at the start of each bank
+#pragma pack(push, 1)
+struct nvram_bank_hdr {
+    uint32_t magic;          // NVRAM_LOG_MAGIC
+    uint32_t partition_size; // Both banks together
+    uint32_t seq;            // Higher is newer, bumped on each rotation
+    uint32_t seq_inv;        // ~seq, so a torn header never validates
+};
+#pragma pack(pop)
+
 // NVRAM Entry (Length MUST be 32bit aligned)
 #pragma pack(push, 1)
 struct nvram_t {
@@ -59,6 +71,8 @@ struct nvram_t {
 /**
  * @brief Formats a flash region for use as an NVRAM partition.
  *
+ * The region is split into NVRAM_BANKS banks, bank 0 becomes active.
+ *
  * @param partition_address The absolute starting address of the partition.
  * @param size The total size of the partition to create.
  * @return NVRAM_OK on success, or a negative error code.
@@ -83,6 +97,9 @@ int flash_read_nvram(
 /**
  * @brief Writes a new entry to the NVRAM partition.
  *
+ * Appends to the active bank. When it is full, the newest entries move
+ * to the other bank, which is erased first and activated last.
+ *
  * @param partition_address The absolute starting address of the partition.
  * @param new_entry Pointer to the entry data to be written.
  * @return NVRAM_OK on success, or a negative error code.
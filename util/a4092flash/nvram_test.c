@@ -8,13 +8,18 @@
 // --- Flash API ---
 UBYTE flash_readByte(ULONG address);
 void flash_writeByte(ULONG address, UBYTE data);
+bool flash_readBuf(ULONG address, UBYTE *buf, ULONG len);
+bool flash_writeBuf(ULONG address, const UBYTE *buf, ULONG len);
 bool flash_erase_sector(ULONG address, ULONG sectorSize);
 
 // --- Stub Flash Implementation ---
 #define FLASH_SECTOR_SIZE (4 * 1024)
-#define FLASH_TOTAL_SIZE  (2 * FLASH_SECTOR_SIZE)
+#define FLASH_SECTORS     3
+#define FLASH_TOTAL_SIZE  (FLASH_SECTORS * FLASH_SECTOR_SIZE)
 
 static UBYTE flash_memory_stub[FLASH_TOTAL_SIZE];
+static ULONG stub_reads;
+static ULONG stub_erases[FLASH_SECTORS];
 
 // Stubs now convert absolute address to an offset in the memory array
 bool flash_erase_sector(ULONG offset, ULONG sectorSize)
@@ -22,6 +27,8 @@ bool flash_erase_sector(ULONG offset, ULONG sectorSize)
     ULONG sector_start_offset = (offset / FLASH_SECTOR_SIZE) * FLASH_SECTOR_SIZE;
     printf("STUB: Erasing sector at offset 0x%X (size: 0x%X)\n", sector_start_offset, sectorSize);
     memset(flash_memory_stub + sector_start_offset, 0xFF, sectorSize);
+    for (ULONG s = 0; s < sectorSize / FLASH_SECTOR_SIZE; s++)
+        stub_erases[sector_start_offset / FLASH_SECTOR_SIZE + s]++;
     return true;
 }
 
@@ -35,6 +42,20 @@ UBYTE flash_readByte(ULONG offset)
     return flash_memory_stub[offset];
 }
 
+bool flash_writeBuf(ULONG offset, const UBYTE *buf, ULONG len)
+{
+    for (ULONG i = 0; i < len; i++)
+        flash_writeByte(offset + i, buf[i]);
+    return true;
+}
+
+bool flash_readBuf(ULONG offset, UBYTE *buf, ULONG len)
+{
+    memcpy(buf, flash_memory_stub + offset, len);
+    stub_reads++;
+    return true;
+}
+
 // --- Unit Test ---
 void print_test_result(const char* test_name, bool pass)
 {
@@ -45,6 +66,28 @@ void print_test_result(const char* test_name, bool pass)
     if (!pass) exit(1);
 }
 
+static struct nvram_t make_entry(int value)
+{
+    struct nvram_t entry = {0};
+    entry.data[0] = (uint8_t)(value & 0xFF);
+    entry.data[1] = (uint8_t)((value >> 8) & 0xFF);
+    return entry;
+}
+
+static bool entry_is(const struct nvram_t *entry, int value)
+{
+    return entry->data[0] == (uint8_t)(value & 0xFF) &&
+           entry->data[1] == (uint8_t)((value >> 8) & 0xFF);
+}
+
+static bool bank_hdr_at(ULONG address, uint32_t *seq)
+{
+    struct nvram_bank_hdr hdr;
+    memcpy(&hdr, flash_memory_stub + address, sizeof(hdr));
+    if (seq) *seq = hdr.seq;
+    return hdr.magic == NVRAM_LOG_MAGIC && hdr.seq == (uint32_t)~hdr.seq_inv;
+}
+
 int main(void)
 {
     printf("NVRAM Flash Library Unit Tests\n");
@@ -52,13 +95,21 @@ int main(void)
 
     // The partition address is now an absolute address
     const ULONG partition_offset = FLASH_SECTOR_SIZE;
-    const ULONG partition_size = FLASH_SECTOR_SIZE;
-    
+    const ULONG partition_size = 2 * FLASH_SECTOR_SIZE;
+    const ULONG bank0 = partition_offset;
+    const ULONG bank1 = partition_offset + FLASH_SECTOR_SIZE;
+    const int slots = (FLASH_SECTOR_SIZE - sizeof(struct nvram_bank_hdr)) / sizeof(struct nvram_t);
+    struct nvram_t last_entry;
+    struct nvram_t entry;
+    uint32_t seq;
+    int res;
+
     // Test 1: Format and Initial State
-    int res = flash_format_nvram_partition(partition_offset, partition_size);
+    res = flash_format_nvram_partition(partition_offset, partition_size);
     print_test_result("Format partition", res == NVRAM_OK);
+    print_test_result("Bank 0 active after format", bank_hdr_at(bank0, &seq) && seq == 1 &&
+                      !bank_hdr_at(bank1, NULL));
 
-    struct nvram_t last_entry;
     res = flash_read_nvram(partition_offset, &last_entry);
     print_test_result("Read from empty partition", res == NVRAM_ERR_NO_ENTRIES);
 
@@ -84,65 +135,135 @@ int main(void)
 
     // Test 4: Corrupt last entry and read again
     printf("\n--- Inducing corruption ---\n");
-    // Find the current last entry location in flash to corrupt it
-    ULONG current_offset = sizeof(struct nvram_partition_hdr);
-    ULONG last_written_offset = 0;
-    while (current_offset + sizeof(struct nvram_t) <= partition_size) {
-        uint32_t chk = flash_readByte(partition_offset + current_offset) |
-                      (flash_readByte(partition_offset + current_offset + 1) << 8) |
-                      (flash_readByte(partition_offset + current_offset + 2) << 16) |
-                      (flash_readByte(partition_offset + current_offset + 3) << 24);
-        if (chk == 0xFFFFFFFF) break;
-        last_written_offset = current_offset;
-        current_offset += sizeof(struct nvram_t);
-    }
-    flash_writeByte(partition_offset + last_written_offset + sizeof(uint32_t), 'X'); // Corrupt 'S'
+    flash_writeByte(bank0 + sizeof(struct nvram_bank_hdr) + sizeof(struct nvram_t) + sizeof(uint32_t), 'X');
     
     res = flash_read_nvram(partition_offset, &last_entry);
     print_test_result("Read after corruption (should find previous)", res == NVRAM_OK && last_entry.data[0] == 0xAA && last_entry.data[1] == 0xBB);
     printf("--- Corruption test passed ---\n\n");
-    
-    // Test 5: Fill partition to trigger compaction
+
+    // Test 5: Fill bank 0 and check the lookup cost
     flash_format_nvram_partition(partition_offset, partition_size);
-    
-    int num_entries_to_fill = (partition_size - sizeof(struct nvram_partition_hdr)) / sizeof(struct nvram_t);
-    printf("Filling partition with %d entries...\n", num_entries_to_fill);
-    
-    struct nvram_t temp_entry;
-    for (int i = 0; i < num_entries_to_fill; ++i) {
-        temp_entry.data[0] = (uint8_t)(i & 0xFF);
-        temp_entry.data[1] = (uint8_t)((i >> 8) & 0xFF);
-        res = flash_write_nvram(partition_offset, &temp_entry);
+    printf("Filling bank 0 with %d entries...\n", slots);
+    for (int i = 0; i < slots; ++i) {
+        entry = make_entry(i);
+        res = flash_write_nvram(partition_offset, &entry);
         if (res != NVRAM_OK) print_test_result("Fill loop failed", false);
     }
-    print_test_result("Fill partition to capacity", true);
+    print_test_result("Fill bank to capacity", !bank_hdr_at(bank1, NULL));
+
+    stub_reads = 0;
+    res = flash_read_nvram(partition_offset, &last_entry);
+    print_test_result("Read from full bank", res == NVRAM_OK && entry_is(&last_entry, slots - 1));
+    printf("Lookup took %u flash reads for %d slots\n", stub_reads, slots);
+    print_test_result("Lookup is logarithmic", stub_reads <= 16);
+
+    // Test 6: Rotation to bank 1
+    printf("\nWriting one more entry to trigger rotation...\n");
+    entry = make_entry(0xEEFF);
+    res = flash_write_nvram(partition_offset, &entry);
+    print_test_result("Trigger rotation", res == NVRAM_OK);
+    print_test_result("Bank 1 active with higher sequence", bank_hdr_at(bank1, &seq) && seq == 2);
+
+    res = flash_read_nvram(partition_offset, &last_entry);
+    print_test_result("Read after rotation returns newest", res == NVRAM_OK && entry_is(&last_entry, 0xEEFF));
+
+    internal_flash_read(&entry, slot_address(bank1, 0), sizeof(entry));
+    print_test_result("Rotation: carried second-to-last", entry_is(&entry, slots - 2));
+    internal_flash_read(&entry, slot_address(bank1, 1), sizeof(entry));
+    print_test_result("Rotation: carried last", entry_is(&entry, slots - 1));
+    internal_flash_read(&entry, slot_address(bank1, 2), sizeof(entry));
+    print_test_result("Rotation: wrote new entry", entry_is(&entry, 0xEEFF));
+
+    // Test 7: Power failure during a rotation
+    printf("\n--- Interrupted rotation ---\n");
+    for (int i = 3; i < slots; ++i) {
+        entry = make_entry(0x100 + i);
+        flash_write_nvram(partition_offset, &entry);
+    }
+    // Bank 1 is full. Start a rotation into bank 0, but stop before its header.
+    flash_erase_sector(bank0, FLASH_SECTOR_SIZE);
+    entry = make_entry(0x1234);
+    entry.checksum = calculate_checksum(entry.data, sizeof(entry.data));
+    internal_flash_write(slot_address(bank0, 0), &entry, sizeof(entry));
+    res = flash_read_nvram(partition_offset, &last_entry);
+    print_test_result("Unfinished rotation keeps old bank", res == NVRAM_OK && entry_is(&last_entry, 0x100 + slots - 1));
 
-    struct nvram_t overflow_entry;
-    overflow_entry.data[0] = 0xFF;
-    overflow_entry.data[1] = 0xEE;
-    printf("\nWriting one more entry to trigger compaction...\n");
-    res = flash_write_nvram(partition_offset, &overflow_entry);
-    print_test_result("Trigger compaction cycle", res == NVRAM_OK);
+    // A torn header, with seq_inv not yet programmed, must not win either
+    struct nvram_bank_hdr torn = { .magic = NVRAM_LOG_MAGIC, .partition_size = partition_size, .seq = 3, .seq_inv = 0xFFFFFFFF };
+    internal_flash_write(bank0, &torn, sizeof(torn));
+    res = flash_read_nvram(partition_offset, &last_entry);
+    print_test_result("Torn header is ignored", res == NVRAM_OK && entry_is(&last_entry, 0x100 + slots - 1));
+
+    entry = make_entry(0x4321);
+    res = flash_write_nvram(partition_offset, &entry);
+    res |= flash_read_nvram(partition_offset, &last_entry);
+    print_test_result("Next write completes the rotation", res == NVRAM_OK && entry_is(&last_entry, 0x4321) &&
+                      bank_hdr_at(bank0, &seq) && seq == 3);
+    printf("--- Interrupted rotation test passed ---\n\n");
 
-    // Verify state after compaction
+    // Test 8: Wear leveling
+    flash_format_nvram_partition(partition_offset, partition_size);
+    memset(stub_erases, 0, sizeof(stub_erases));
+    for (int i = 0; i < 10 * slots; ++i) {
+        entry = make_entry(i);
+        if (flash_write_nvram(partition_offset, &entry) != NVRAM_OK)
+            print_test_result("Wear leveling write failed", false);
+    }
     res = flash_read_nvram(partition_offset, &last_entry);
-    print_test_result("Read after compaction returns newest", res == NVRAM_OK && last_entry.data[0] == 0xFF && last_entry.data[1] == 0xEE);
-    
-    struct nvram_t entry_in_mem;
-    
-    internal_flash_read(&entry_in_mem, partition_offset + sizeof(struct nvram_partition_hdr), sizeof(struct nvram_t));
-    uint8_t expected_val = (num_entries_to_fill - 2) & 0xFF;
-    uint8_t expected_val_hi = ((num_entries_to_fill - 2) >> 8) & 0xFF;
-    print_test_result("Compaction: restored second-to-last", entry_in_mem.data[0] == expected_val && entry_in_mem.data[1] == expected_val_hi);
-    
-    internal_flash_read(&entry_in_mem, partition_offset + sizeof(struct nvram_partition_hdr) + sizeof(struct nvram_t), sizeof(struct nvram_t));
-    expected_val = (num_entries_to_fill - 1) & 0xFF;
-    expected_val_hi = ((num_entries_to_fill - 1) >> 8) & 0xFF;
-    print_test_result("Compaction: restored last", entry_in_mem.data[0] == expected_val && entry_in_mem.data[1] == expected_val_hi);
-    
-    internal_flash_read(&entry_in_mem, partition_offset + sizeof(struct nvram_partition_hdr) + 2 * sizeof(struct nvram_t), sizeof(struct nvram_t));
-    print_test_result("Compaction: wrote new entry", entry_in_mem.data[0] == 0xFF && entry_in_mem.data[1] == 0xEE);
-    
+    printf("Erases: bank 0 %u, bank 1 %u\n", stub_erases[1], stub_erases[2]);
+    print_test_result("Both banks wear evenly", res == NVRAM_OK && entry_is(&last_entry, 10 * slots - 1) &&
+                      stub_erases[1] > 1 &&
+                      (stub_erases[1] > stub_erases[2] ? stub_erases[1] - stub_erases[2] : stub_erases[2] - stub_erases[1]) <= 1);
+
+    // Test 9: Partition in the old single log format
+    printf("\n--- Old partition format ---\n");
+    struct nvram_partition_hdr old_hdr = { .magic = NVRAM_MAGIC, .partition_size = partition_size };
+    flash_erase_sector(partition_offset, partition_size);
+    internal_flash_write(partition_offset, &old_hdr, sizeof(old_hdr));
+    for (int i = 0; i < 100; ++i) {  // Stays in the first sector
+        entry = make_entry(0x300 + i);
+        entry.checksum = calculate_checksum(entry.data, sizeof(entry.data));
+        internal_flash_write(partition_offset + sizeof(old_hdr) + i * sizeof(entry), &entry, sizeof(entry));
+    }
+    memset(stub_erases, 0, sizeof(stub_erases));
+    entry = make_entry(0x5454);
+    res = flash_write_nvram(partition_offset, &entry);
+    print_test_result("Short old log converts into bank 1", res == NVRAM_OK && bank_hdr_at(bank1, NULL) &&
+                      stub_erases[1] == 0);
+    res = flash_read_nvram(partition_offset, &last_entry);
+    print_test_result("Read after short conversion", res == NVRAM_OK && entry_is(&last_entry, 0x5454));
+
+    flash_erase_sector(partition_offset, partition_size);
+    internal_flash_write(partition_offset, &old_hdr, sizeof(old_hdr));
+    for (int i = 0; i < 600; ++i) {  // Reaches into the second sector
+        entry = make_entry(0x200 + i);
+        entry.checksum = calculate_checksum(entry.data, sizeof(entry.data));
+        internal_flash_write(partition_offset + sizeof(old_hdr) + i * sizeof(entry), &entry, sizeof(entry));
+    }
+    res = flash_read_nvram(partition_offset, &last_entry);
+    print_test_result("Read old format", res == NVRAM_OK && entry_is(&last_entry, 0x200 + 599));
+
+    // Power fails right after bank 0 was erased for the conversion
+    flash_erase_sector(bank0, FLASH_SECTOR_SIZE);
+    res = flash_read_nvram(partition_offset, &last_entry);
+    print_test_result("Interrupted conversion keeps newest entry", res == NVRAM_OK && entry_is(&last_entry, 0x200 + 599));
+
+    memset(stub_erases, 0, sizeof(stub_erases));
+    entry = make_entry(0x5555);
+    res = flash_write_nvram(partition_offset, &entry);
+    print_test_result("Write converts old format", res == NVRAM_OK && bank_hdr_at(bank0, NULL) &&
+                      stub_erases[2] == 0);
+    res = flash_read_nvram(partition_offset, &last_entry);
+    print_test_result("Read after conversion", res == NVRAM_OK && entry_is(&last_entry, 0x5555));
+    internal_flash_read(&entry, slot_address(bank0, 1), sizeof(entry));
+    print_test_result("Conversion kept newest old entry", entry_is(&entry, 0x200 + 599));
+
+    entry = make_entry(0x6666);
+    res = flash_write_nvram(partition_offset, &entry);
+    res |= flash_read_nvram(partition_offset, &last_entry);
+    print_test_result("Append after conversion", res == NVRAM_OK && entry_is(&last_entry, 0x6666));
+    printf("--- Old partition format test passed ---\n");
+
     printf("\n--------------------------------\n");
     printf("All tests passed successfully! ✅\n");
     
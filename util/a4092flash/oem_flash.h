@@ -15,7 +15,7 @@
 #include <stdint.h>
 
 #define OEM_FLASH_OFFSET    0x60000
-#define OEM_FLASH_SIZE      0x1D000     /* 116 KB (29 x 4KB sectors) */
+#define OEM_FLASH_SIZE      0x1C000     /* 112 KB (28 x 4KB sectors) */
 
 #define OEM_MAGIC           0x4F454D00  /* "OEM\0" */
 #define OEM_VERSION         2
@@ -29,27 +29,35 @@ extern struct ExecBase *SysBase;
 #define SPI_PORT_READ_HOLD_OFFS  0x7FFFE0
 #define SPI_PORT_READ_END_OFFS   0x7FFFF0
 
+/* Host builds (SPI_SIM) route the port to the flash model in spi_sim.c */
+#ifdef SPI_SIM
+#include "spi_sim.h"
+#define SPI_PORT_WRITE(base, offs, w) spisim_write32((base) + (offs), (w))
+#define SPI_PORT_READ(base, offs)     spisim_read32((base) + (offs))
+#else
+#define SPI_PORT_WRITE(base, offs, w) \
+    (*(volatile uint32_t *)(uintptr_t)((base) + (offs)) = (w))
+#define SPI_PORT_READ(base, offs) \
+    (*(volatile uint32_t *)(uintptr_t)((base) + (offs)))
+#endif
+
 /* MMIO access helpers using shared nibble_word functions */
 static inline void mmio_write_hold(uint32_t base, uint8_t v)
 {
-    volatile uint32_t *p = (volatile uint32_t *)(uintptr_t)(base + SPI_PORT_WRITE_HOLD_OFFS);
-    *p = pack_nibble_word(v);
+    SPI_PORT_WRITE(base, SPI_PORT_WRITE_HOLD_OFFS, pack_nibble_word(v));
 }
 static inline void mmio_write_end(uint32_t base, uint8_t v)
 {
-    volatile uint32_t *p = (volatile uint32_t *)(uintptr_t)(base + SPI_PORT_WRITE_END_OFFS);
-    *p = pack_nibble_word(v);
+    SPI_PORT_WRITE(base, SPI_PORT_WRITE_END_OFFS, pack_nibble_word(v));
 }
 static inline uint8_t mmio_read_hold(uint32_t base)
 {
-    volatile uint32_t *p = (volatile uint32_t *)(uintptr_t)(base + SPI_PORT_READ_HOLD_OFFS);
-    uint32_t w = *p;
+    uint32_t w = SPI_PORT_READ(base, SPI_PORT_READ_HOLD_OFFS);
     return unpack_nibble_word(w);
 }
 static inline uint8_t mmio_read_end(uint32_t base)
 {
-    volatile uint32_t *p = (volatile uint32_t *)(uintptr_t)(base + SPI_PORT_READ_END_OFFS);
-    uint32_t w = *p;
+    uint32_t w = SPI_PORT_READ(base, SPI_PORT_READ_END_OFFS);
     return unpack_nibble_word(w);
 }
 
@@ -398,6 +406,26 @@ void spi_flash_writeByte(ULONG address, UBYTE data)
     }
 }
 
+/**
+ * spi_flash_writeBuf
+ *
+ * @brief Program a buffer into SPI flash, one PAGE PROGRAM per 256-byte page
+ * @param address Starting byte address
+ * @param buf Data to write
+ * @param len Number of bytes to write
+ * @return true on success
+ */
+bool spi_flash_writeBuf(ULONG address, const UBYTE *buf, ULONG len)
+{
+    if (!spi_write_buf_pagewise(spi_base_address, address, buf, len, NULL)) {
+        flash_printf("Write failed in 0x%08lX-0x%08lX\n",
+                     (unsigned long)address,
+                     (unsigned long)(address + len - 1));
+        return false;
+    }
+    return true;
+}
+
 /**
  * spi_flash_erase_sector
  *
@@ -0,0 +1,216 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/* spi_bench - run the a4092flash SPI code against the flash model
+ *
+ * Builds spi.c, flash.c and flash_delta.c for the host with the port
+ * routed to spi_sim.c, then erases, programs and verifies a ROM image
+ * and reports SPI transactions and modeled time for each step.
+ *
+ * Usage: spi_bench [-v] [-k <spi kHz>] [-a <access ns>] [rom file]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <exec/types.h>
+
+#include "flash.h"
+#include "flash_delta.h"
+#include "spi_sim.h"
+
+#define BENCH_BASE      0x40000000UL    /* Board address handed to flash_init */
+#define BENCH_ROM_SIZE  (64 * 1024)     /* Default image, one flash bank */
+#define BENCH_READ_SIZE 4096
+
+static bool verbose;
+
+static void quiet_sink(void *ctx, const char *message)
+{
+    (void)ctx;
+    if (verbose)
+        fputs(message, stdout);
+}
+
+static void print_header(void)
+{
+    printf("%-22s %8s %9s %8s %6s %6s %10s\n", "Step", "Txns", "Accesses",
+           "Polls", "Progs", "Erases", "Time (ms)");
+}
+
+static void print_phase(const char *name)
+{
+    struct spisim_stats s;
+
+    spisim_get_stats(&s);
+    printf("%-22s %8lu %9lu %8lu %6lu %6lu %10.1f\n", name,
+           (unsigned long)s.transactions, (unsigned long)s.accesses,
+           (unsigned long)s.status_polls, (unsigned long)s.page_programs,
+           (unsigned long)(s.erases_4k + s.erases_32k + s.erases_64k +
+                           s.chip_erases),
+           (double)s.time_ns / 1e6);
+    if (s.rejected)
+        printf("  %lu commands rejected by the flash\n",
+               (unsigned long)s.rejected);
+    spisim_reset_stats();
+}
+
+static bool check_flash(const UBYTE *image, ULONG len, const char *what)
+{
+    if (memcmp(spisim_memory(), image, len) != 0) {
+        printf("FAIL: flash contents differ after %s\n", what);
+        return false;
+    }
+    return true;
+}
+
+static UBYTE *load_image(const char *name, ULONG *len)
+{
+    UBYTE *image;
+    FILE *fp;
+    long size;
+
+    if (name == NULL) {
+        image = malloc(BENCH_ROM_SIZE);
+        if (image == NULL)
+            return NULL;
+        for (ULONG i = 0; i < BENCH_ROM_SIZE; i++)
+            image[i] = (UBYTE)(i * 13 + (i >> 9));
+        /* Most ROM images end in an erased tail */
+        memset(image + BENCH_ROM_SIZE * 3 / 4, 0xFF, BENCH_ROM_SIZE / 4);
+        *len = BENCH_ROM_SIZE;
+        return image;
+    }
+
+    fp = fopen(name, "rb");
+    if (fp == NULL) {
+        perror(name);
+        return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    image = (size > 0) ? malloc(size) : NULL;
+    if (image == NULL || fread(image, 1, size, fp) != (size_t)size) {
+        printf("Can't read %s\n", name);
+        free(image);
+        fclose(fp);
+        return NULL;
+    }
+    fclose(fp);
+    *len = size;
+    return image;
+}
+
+int main(int argc, char *argv[])
+{
+    struct spisim_config cfg = {
+        .mfg = 0xEF, .type = 0x40, .cap = 0x13,    /* W25Q40, 512KB */
+        .sr1 = 0x1C,                               /* Fully protected */
+        .spi_hz = SPISIM_DEFAULT_SPI_HZ,
+        .access_ns = SPISIM_DEFAULT_ACCESS_NS,
+    };
+    const char *romfile = NULL;
+    UBYTE buf[BENCH_READ_SIZE];
+    UBYTE manuf, devid;
+    ULONG flashSize, sectorSize;
+    ULONG len, eraseSize;
+    UBYTE *image;
+    int res;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-v") == 0)
+            verbose = true;
+        else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc)
+            cfg.spi_hz = strtoul(argv[++i], NULL, 0) * 1000;
+        else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc)
+            cfg.access_ns = strtoul(argv[++i], NULL, 0);
+        else if (argv[i][0] != '-')
+            romfile = argv[i];
+        else {
+            printf("Usage: %s [-v] [-k <spi kHz>] [-a <access ns>] [rom file]\n",
+                   argv[0]);
+            return 1;
+        }
+    }
+
+    image = load_image(romfile, &len);
+    if (image == NULL)
+        return 1;
+    if (!spisim_init(&cfg) || len > spisim_size()) {
+        printf("Image does not fit the modeled flash\n");
+        return 1;
+    }
+    flash_set_status_sink(quiet_sink, NULL);
+
+    printf("SPI flash model: %lu KB, %lu kHz SPI clock, %lu ns per access\n",
+           (unsigned long)(spisim_size() / 1024),
+           (unsigned long)(cfg.spi_hz / 1000), (unsigned long)cfg.access_ns);
+    printf("Image: %lu bytes\n\n", (unsigned long)len);
+    print_header();
+
+    if (!flash_init(&manuf, &devid, (volatile UBYTE *)(uintptr_t)BENCH_BASE,
+                    &flashSize, &sectorSize)) {
+        printf("FAIL: flash_init did not detect the modeled flash\n");
+        return 1;
+    }
+    print_phase("Detect, unprotect");
+
+    eraseSize = (len + sectorSize - 1) / sectorSize * sectorSize;
+    if (!flash_erase_bank(0, sectorSize, eraseSize)) {
+        printf("FAIL: erase\n");
+        return 1;
+    }
+    print_phase("Erase and blank check");
+
+    for (ULONG i = 0; i < len; i++)
+        flash_writeByte(i, image[i]);
+    print_phase("Program, per byte");
+    if (!check_flash(image, len, "per byte programming"))
+        return 1;
+
+    spisim_fill(0xFF);
+    spisim_reset_stats();
+    if (!flash_writeBuf(0, image, len)) {
+        printf("FAIL: program\n");
+        return 1;
+    }
+    print_phase("Program, per page");
+    if (!check_flash(image, len, "page programming"))
+        return 1;
+
+    for (ULONG i = 0; i < len; i += BENCH_READ_SIZE) {
+        ULONG n = (len - i < BENCH_READ_SIZE) ? len - i : BENCH_READ_SIZE;
+
+        if (!flash_readBuf(i, buf, n) || memcmp(buf, image + i, n) != 0) {
+            printf("FAIL: verify at 0x%06lx\n", (unsigned long)i);
+            return 1;
+        }
+    }
+    print_phase("Verify, 4KB reads");
+
+    for (ULONG i = 0; i < len; i++) {
+        if (flash_readByte(i) != image[i]) {
+            printf("FAIL: verify at 0x%06lx\n", (unsigned long)i);
+            return 1;
+        }
+    }
+    print_phase("Verify, per byte");
+
+    res = flash_write_delta(0, image, len, sectorSize, NULL, NULL, NULL);
+    print_phase("Delta, unchanged");
+    if (res != FLASH_DELTA_OK)
+        return 1;
+
+    image[len / 2] = ~image[len / 2];
+    image[len / 2 + 1] |= 0x01;
+    res = flash_write_delta(0, image, len, sectorSize, NULL, NULL, NULL);
+    print_phase("Delta, two bytes");
+    if (res != FLASH_DELTA_OK || !check_flash(image, len, "delta update"))
+        return 1;
+
+    printf("\nAll steps completed, flash contents verified.\n");
+    spisim_free();
+    free(image);
+    return 0;
+}
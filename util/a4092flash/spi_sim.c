@@ -0,0 +1,366 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/* Host-side SPI NOR flash model for spi.c, see spi_sim.h */
+
+#include <stdlib.h>
+#include <string.h>
+#include <exec/types.h>
+#include "nibble_word.h"
+#include "spi_sim.h"
+
+/* Port register offsets, as decoded by the board (see spi.c) */
+#define PORT_MASK        0xFFFFF0
+#define PORT_WRITE_HOLD  0x7FFFC0
+#define PORT_WRITE_END   0x7FFFD0
+#define PORT_READ_HOLD   0x7FFFE0
+#define PORT_READ_END    0x7FFFF0
+
+#define SR1_WIP      0x01
+#define SR1_WEL      0x02
+#define SR1_BP_SHIFT 2
+#define SR1_TB       0x20
+#define SR1_WRITABLE 0xFC
+
+#define PAGE_SIZE 256
+
+enum {
+    CMD_WRSR   = 0x01,
+    CMD_PP     = 0x02,
+    CMD_READ   = 0x03,
+    CMD_WRDI   = 0x04,
+    CMD_RDSR1  = 0x05,
+    CMD_WREN   = 0x06,
+    CMD_SE_4K  = 0x20,
+    CMD_RDSR2  = 0x35,
+    CMD_RUID   = 0x4B,
+    CMD_BE_32K = 0x52,
+    CMD_CE     = 0x60,
+    CMD_RDID   = 0x9F,
+    CMD_CE2    = 0xC7,
+    CMD_BE_64K = 0xD8,
+};
+
+static struct {
+    struct spisim_config cfg;
+    struct spisim_stats  stats;
+    uint8_t  *mem;
+    uint32_t  size;
+    uint64_t  byte_ns;
+    uint64_t  now;              /* Modeled clock in ns */
+
+    /* Chip state */
+    uint8_t   sr1;              /* Non-volatile bits only */
+    uint8_t   sr2;
+    bool      wel;
+    bool      op_pending;       /* WEL clears when the operation ends */
+    uint64_t  busy_until;
+
+    /* Current transaction */
+    bool      selected;
+    bool      ignored;
+    uint32_t  n;                /* Bytes since chip select */
+    uint8_t   cmd;
+    uint32_t  addr;
+    uint8_t   new_sr1;
+    uint8_t   new_sr2;
+    uint8_t   page[PAGE_SIZE];
+    bool      page_set[PAGE_SIZE];
+    uint32_t  page_bytes;
+} sim;
+
+static bool sim_busy(void)
+{
+    return sim.now < sim.busy_until;
+}
+
+static void sim_update(void)
+{
+    if (sim.op_pending && !sim_busy()) {
+        sim.op_pending = false;
+        sim.wel = false;
+    }
+}
+
+static void sim_start_op(uint64_t duration)
+{
+    sim.busy_until = sim.now + duration;
+    sim.op_pending = true;
+}
+
+/* Block protect: BP2..0 cover 64KB << (BP - 1) at the top (or bottom) */
+static bool sim_protected(uint32_t addr, uint32_t len)
+{
+    unsigned bp = (sim.sr1 >> SR1_BP_SHIFT) & 7;
+    uint32_t bytes, start;
+
+    if (bp == 0)
+        return false;
+    bytes = (bp >= 6) ? sim.size : (0x10000u << (bp - 1));
+    if (bytes > sim.size)
+        bytes = sim.size;
+    start = (sim.sr1 & SR1_TB) ? 0 : sim.size - bytes;
+    return addr < start + bytes && addr + len > start;
+}
+
+/* Check WEL and protection for a program or erase, count a rejection */
+static bool sim_may_modify(uint32_t addr, uint32_t len)
+{
+    if (!sim.wel || sim_protected(addr, len)) {
+        sim.stats.rejected++;
+        sim.wel = false;
+        return false;
+    }
+    return true;
+}
+
+static void sim_erase(uint32_t size, uint64_t duration, uint32_t *counter)
+{
+    uint32_t addr = (sim.addr & (sim.size - 1)) & ~(size - 1);
+
+    if (!sim_may_modify(addr, size))
+        return;
+    memset(sim.mem + addr, 0xFF, size);
+    (*counter)++;
+    sim_start_op(duration);
+}
+
+static void sim_begin(uint8_t cmd)
+{
+    sim.cmd = cmd;
+    sim.addr = 0;
+    sim.page_bytes = 0;
+    memset(sim.page_set, 0, sizeof(sim.page_set));
+    sim.ignored = false;
+
+    if (sim_busy()) {
+        if (cmd == CMD_RDSR1 || cmd == CMD_RDSR2) {
+            sim.stats.status_polls++;
+        } else {
+            sim.ignored = true;
+            sim.stats.rejected++;
+        }
+    }
+}
+
+static uint8_t sim_byte(uint8_t mosi)
+{
+    uint32_t n = sim.n;
+
+    if (sim.ignored)
+        return 0xFF;
+
+    switch (sim.cmd) {
+        case CMD_RDSR1:
+            return sim.sr1 | (sim.wel ? SR1_WEL : 0) | (sim_busy() ? SR1_WIP : 0);
+        case CMD_RDSR2:
+            return sim.sr2;
+        case CMD_RDID:
+            if (n == 1) return sim.cfg.mfg;
+            if (n == 2) return sim.cfg.type;
+            if (n == 3) return sim.cfg.cap;
+            return 0xFF;
+        case CMD_RUID:
+            if (n >= 5 && n < 13)
+                return (uint8_t)(0xA0 + n - 5);
+            return 0xFF;
+        case CMD_WRSR:
+            if (n == 1) sim.new_sr1 = mosi;
+            if (n == 2) sim.new_sr2 = mosi;
+            return 0xFF;
+        case CMD_READ:
+            if (n <= 3) {
+                sim.addr = (sim.addr << 8) | mosi;
+                return 0xFF;
+            }
+            return sim.mem[sim.addr++ & (sim.size - 1)];
+        case CMD_PP:
+            if (n <= 3) {
+                sim.addr = (sim.addr << 8) | mosi;
+                return 0xFF;
+            }
+            /* Data beyond the end of the page wraps to its start */
+            sim.page[(sim.addr + sim.page_bytes) & (PAGE_SIZE - 1)] = mosi;
+            sim.page_set[(sim.addr + sim.page_bytes) & (PAGE_SIZE - 1)] = true;
+            sim.page_bytes++;
+            return 0xFF;
+        case CMD_SE_4K:
+        case CMD_BE_32K:
+        case CMD_BE_64K:
+            if (n <= 3)
+                sim.addr = (sim.addr << 8) | mosi;
+            return 0xFF;
+    }
+    return 0xFF;
+}
+
+static void sim_end(void)
+{
+    uint32_t n = sim.n;
+
+    if (sim.ignored)
+        return;
+
+    switch (sim.cmd) {
+        case CMD_WREN:
+            sim.wel = true;
+            break;
+        case CMD_WRDI:
+            sim.wel = false;
+            break;
+        case CMD_WRSR:
+            if (n < 2)
+                break;
+            if (!sim.wel) {
+                sim.stats.rejected++;
+                break;
+            }
+            sim.sr1 = sim.new_sr1 & SR1_WRITABLE;
+            if (n >= 3)
+                sim.sr2 = sim.new_sr2;
+            sim_start_op(SPISIM_T_W);
+            break;
+        case CMD_PP: {
+            uint32_t base = sim.addr & (sim.size - 1) & ~(PAGE_SIZE - 1);
+            uint32_t count = sim.page_bytes < PAGE_SIZE ? sim.page_bytes : PAGE_SIZE;
+
+            if (count == 0 || !sim_may_modify(base, PAGE_SIZE))
+                break;
+            for (uint32_t i = 0; i < PAGE_SIZE; i++) {
+                if (sim.page_set[i])
+                    sim.mem[base + i] &= sim.page[i];
+            }
+            sim.stats.page_programs++;
+            sim_start_op(SPISIM_T_BP1 + SPISIM_T_BP2 * (count - 1));
+            break;
+        }
+        case CMD_SE_4K:
+            if (n == 4)
+                sim_erase(0x1000, SPISIM_T_SE, &sim.stats.erases_4k);
+            break;
+        case CMD_BE_32K:
+            if (n == 4)
+                sim_erase(0x8000, SPISIM_T_BE1, &sim.stats.erases_32k);
+            break;
+        case CMD_BE_64K:
+            if (n == 4)
+                sim_erase(0x10000, SPISIM_T_BE2, &sim.stats.erases_64k);
+            break;
+        case CMD_CE:
+        case CMD_CE2:
+            if (n != 1 || !sim_may_modify(0, sim.size))
+                break;
+            memset(sim.mem, 0xFF, sim.size);
+            sim.stats.chip_erases++;
+            sim_start_op(SPISIM_T_CE);
+            break;
+    }
+}
+
+/* One byte on the bus; end deasserts chip select afterwards */
+static uint8_t sim_xfer(uint8_t mosi, bool end)
+{
+    uint8_t miso;
+
+    sim.now += sim.byte_ns;
+    sim.stats.time_ns += sim.byte_ns;
+    sim.stats.spi_cycles += 8;
+    sim_update();
+
+    if (!sim.selected) {
+        sim.selected = true;
+        sim.n = 0;
+        sim.stats.transactions++;
+        sim_begin(mosi);
+        miso = 0xFF;
+    } else {
+        miso = sim_byte(mosi);
+    }
+    sim.n++;
+
+    if (end) {
+        sim_end();
+        sim.selected = false;
+    }
+    return miso;
+}
+
+void spisim_write32(uint32_t addr, uint32_t value)
+{
+    sim.stats.accesses++;
+    sim.now += sim.cfg.access_ns;
+    sim.stats.time_ns += sim.cfg.access_ns;
+
+    switch (addr & PORT_MASK) {
+        case PORT_WRITE_HOLD:
+            sim_xfer(unpack_nibble_word(value), false);
+            break;
+        case PORT_WRITE_END:
+            sim_xfer(unpack_nibble_word(value), true);
+            break;
+    }
+}
+
+uint32_t spisim_read32(uint32_t addr)
+{
+    sim.stats.accesses++;
+    sim.now += sim.cfg.access_ns;
+    sim.stats.time_ns += sim.cfg.access_ns;
+
+    switch (addr & PORT_MASK) {
+        case PORT_READ_HOLD:
+            return pack_nibble_word(sim_xfer(0xFF, false));
+        case PORT_READ_END:
+            return pack_nibble_word(sim_xfer(0xFF, true));
+    }
+    return 0xFFFFFFFF;
+}
+
+bool spisim_init(const struct spisim_config *cfg)
+{
+    spisim_free();
+    memset(&sim, 0, sizeof(sim));
+    sim.cfg = *cfg;
+    if (sim.cfg.spi_hz == 0)
+        sim.cfg.spi_hz = SPISIM_DEFAULT_SPI_HZ;
+    if (sim.cfg.access_ns == 0)
+        sim.cfg.access_ns = SPISIM_DEFAULT_ACCESS_NS;
+    sim.size = 1UL << cfg->cap;
+    sim.mem = malloc(sim.size);
+    if (sim.mem == NULL)
+        return false;
+    memset(sim.mem, 0xFF, sim.size);
+    sim.byte_ns = 8000000000ULL / sim.cfg.spi_hz;
+    sim.sr1 = cfg->sr1 & SR1_WRITABLE;
+    sim.sr2 = cfg->sr2;
+    return true;
+}
+
+void spisim_free(void)
+{
+    free(sim.mem);
+    sim.mem = NULL;
+}
+
+void spisim_fill(uint8_t value)
+{
+    memset(sim.mem, value, sim.size);
+}
+
+uint8_t *spisim_memory(void)
+{
+    return sim.mem;
+}
+
+uint32_t spisim_size(void)
+{
+    return sim.size;
+}
+
+void spisim_get_stats(struct spisim_stats *stats)
+{
+    *stats = sim.stats;
+}
+
+void spisim_reset_stats(void)
+{
+    memset(&sim.stats, 0, sizeof(sim.stats));
+}
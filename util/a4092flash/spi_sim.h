@@ -0,0 +1,67 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/* Host-side SPI NOR flash model for spi.c
+ *
+ * Stands in for the A4092 SPI port when spi.c is built with SPI_SIM.
+ * The four port registers are decoded from the access offset, bytes go
+ * through the same nibble word packing as on the board, and a W25Q-class
+ * chip behind them answers the command set spi.c uses. Time is modeled,
+ * not measured: each port access costs the bus time plus eight SPI
+ * clocks, and program/erase/status writes keep WIP set for their typical
+ * datasheet duration.
+ */
+
+#ifndef SPI_SIM_H
+#define SPI_SIM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Typical W25Q40 timings in ns */
+#define SPISIM_T_BP1     30000ULL       /* First byte of a page program */
+#define SPISIM_T_BP2      2500ULL       /* Each further byte */
+#define SPISIM_T_SE   45000000ULL       /* 4KB sector erase */
+#define SPISIM_T_BE1 120000000ULL       /* 32KB block erase */
+#define SPISIM_T_BE2 150000000ULL       /* 64KB block erase */
+#define SPISIM_T_CE 1000000000ULL       /* Chip erase */
+#define SPISIM_T_W    10000000ULL       /* Status register write */
+
+#define SPISIM_DEFAULT_SPI_HZ    10000000UL
+#define SPISIM_DEFAULT_ACCESS_NS 400UL  /* One Zorro III longword access */
+
+struct spisim_config {
+    uint8_t  mfg;               /* JEDEC ID */
+    uint8_t  type;
+    uint8_t  cap;               /* log2 of the size in bytes */
+    uint8_t  sr1;               /* Status registers at power on */
+    uint8_t  sr2;
+    uint32_t spi_hz;            /* SPI clock */
+    uint32_t access_ns;         /* Host bus time per port access */
+};
+
+struct spisim_stats {
+    uint64_t time_ns;           /* Modeled time */
+    uint64_t spi_cycles;        /* SPI clocks */
+    uint32_t accesses;          /* Port register accesses */
+    uint32_t transactions;      /* Chip select assertions */
+    uint32_t status_polls;      /* Status reads while WIP was set */
+    uint32_t page_programs;
+    uint32_t erases_4k;
+    uint32_t erases_32k;
+    uint32_t erases_64k;
+    uint32_t chip_erases;
+    uint32_t rejected;          /* Commands dropped: busy, no WEL, protected */
+};
+
+bool spisim_init(const struct spisim_config *cfg);
+void spisim_free(void);
+void spisim_fill(uint8_t value);
+uint8_t *spisim_memory(void);
+uint32_t spisim_size(void);
+void spisim_get_stats(struct spisim_stats *stats);
+void spisim_reset_stats(void);
+
+/* Port register access, used by spi.c in place of the MMIO pointers */
+void spisim_write32(uint32_t addr, uint32_t value);
+uint32_t spisim_read32(uint32_t addr);
+
+#endif
@@ -0,0 +1,83 @@
+/*
+ * topo_flash.h - SCSI bus topology cache for A4092/A4770 SCSI controllers
+ *
+ * Records what the driver found on each target/LUN during the last probe,
+ * so that a cold boot can reuse it after one cheap validation command
+ * instead of repeating the INQUIRY probe and mode sense per unit. READ
+ * CAPACITY is still issued and checked against the recorded capacity.
+ *
+ * The cache lives in the 4 KB sector directly below the NVRAM partition,
+ * taken from the top of the OEM data region:
+ *   0x7C000 - 0x7CFFF  (4 KB)    Topology cache
+ *
+ * Boards programmed before the cache existed may have an OEM blob of up
+ * to 116 KB reaching into this sector. The driver reads the OEM header
+ * and leaves the sector alone in that case.
+ *
+ * Copyright (C) 2026 Stefan Reinauer
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef TOPO_FLASH_H
+#define TOPO_FLASH_H
+
+#include <stdint.h>
+
+#define TOPO_FLASH_OFFSET   0x7C000
+#define TOPO_FLASH_SIZE     0x1000      /* 4 KB sector */
+
+#define TOPO_MAGIC          0x544F504F  /* "TOPO" */
+#define TOPO_VERSION        4
+#define TOPO_MAX_ENTRIES    32
+
+/* te_flags */
+#define TOPO_F_VALID        0x01        /* Entry in use */
+#define TOPO_F_REMOVABLE    0x02        /* Removable media, no capacity cached */
+#define TOPO_F_DISC         0x04        /* Disconnect/reconnect page present */
+                                        /* 0x08 unused since version 3 */
+#define TOPO_F_SERIAL       0x10        /* te_serial holds VPD page 0x80 data */
+#define TOPO_F_DISC_PROBED  0x20        /* TOPO_F_DISC is meaningful */
+                                        /* 0x40 unused since version 4 */
+
+/*
+ * Per target/LUN entry - 80 bytes
+ */
+struct topo_entry {
+    uint8_t  te_target;
+    uint8_t  te_lun;
+    uint8_t  te_flags;                  /* TOPO_F_* */
+    uint8_t  te_device;                 /* INQUIRY qualifier and device type */
+    uint8_t  te_version;                /* ANSI SCSI version */
+    uint8_t  te_blkshift;               /* log2 of block size */
+    uint8_t  te_reserved0[2];
+    uint32_t te_cap;                    /* PERIPH_CAP_* */
+    uint32_t te_quirks;                 /* PQUIRK_* */
+    uint64_t te_capacity;               /* READ CAPACITY blocks, 0 if unknown */
+    char     te_vendor[8];              /* INQUIRY vendor, space padded */
+    char     te_product[16];            /* INQUIRY product, space padded */
+    char     te_revision[4];            /* INQUIRY revision, space padded */
+    char     te_serial[20];             /* Unit serial number, zero padded */
+    uint8_t  te_reserved[8];
+} __attribute__((packed)) __attribute__((aligned(2)));
+
+struct topo_header {
+    uint32_t magic;                     /* TOPO_MAGIC */
+    uint16_t version;                   /* TOPO_VERSION */
+    uint16_t count;                     /* Number of entries which follow */
+    uint32_t checksum;                  /* XOR32 over all entries */
+    uint32_t reserved;
+} __attribute__((packed)) __attribute__((aligned(2)));
+
+_Static_assert(sizeof(struct topo_entry) == 80,
+               "topo_entry structure must be exactly 80 bytes");
+_Static_assert(sizeof(struct topo_header) +
+               TOPO_MAX_ENTRIES * sizeof(struct topo_entry) <= TOPO_FLASH_SIZE,
+               "topology cache must fit into its flash sector");
+
+#define TOPO_IS_VALID(h) \
+    ((h)->magic == TOPO_MAGIC && \
+     (h)->version == TOPO_VERSION && \
+     (h)->count <= TOPO_MAX_ENTRIES)
+
+#endif /* TOPO_FLASH_H */
@@ -0,0 +1,768 @@
+/* A4091 ROM payload packer
+ *
+ * Copyright 2026 Stefan Reinauer
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "zx0pack.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+/* Bump when the output for a given input changes, to retire cache files */
+#define ZX0PACK_FORMAT  "zx0pack-1"
+
+#define MAX_OFFSET      32640   /* Largest offset ZX0 can encode */
+#define MAX_LEN         65535   /* The 68k depacker counts with dbf */
+#define MAX_COMPARE     1024    /* Longest match looked for */
+#define MATCH_STEPS     256     /* Match lengths tried besides the longest */
+#define LIT_WINDOW      64      /* Literal runs tried per position */
+#define CHAIN_DEPTH     1024    /* Candidates per position */
+#define ARRIVALS        4       /* Paths kept per position and state */
+#define INFINITE        0xffffffffU
+
+/*
+ * The parser keeps, for each position, the cheapest ways of getting
+ * there ending in a literal run (LIT) or a match (MATCH), for up to
+ * ARRIVALS different repeat offsets. The repeat offset matters because
+ * only a literal run may be followed by a match from the last offset.
+ */
+enum { LIT, MATCH };
+enum { BLOCK_LITERAL, BLOCK_REPEAT, BLOCK_NEW };
+
+struct arrival {
+	uint32_t cost;          /* In bits */
+	uint32_t from;          /* Position the block starts at */
+	uint32_t offset;        /* Repeat offset after this block */
+	uint8_t prev_state;
+	uint8_t prev_index;
+	uint8_t block;
+	uint8_t count;          /* Number of valid entries, in slot 0 only */
+};
+
+struct parser {
+	const uint8_t *in;
+	size_t len;
+	struct arrival *arr[2];  /* [state][pos * ARRIVALS + n] */
+	int32_t *head, *chain;
+};
+
+static int elias_bits(uint32_t value)
+{
+	int bits = 1;
+
+	while (value > 1) {
+		value >>= 1;
+		bits += 2;
+	}
+	return bits;
+}
+
+static struct arrival *slot(struct parser *p, int state, size_t pos)
+{
+	return &p->arr[state][pos * ARRIVALS];
+}
+
+/* Add a way to reach pos, keeping the list sorted by cost */
+static void arrive(struct parser *p, int state, size_t pos, uint32_t cost,
+		uint32_t from, uint32_t offset, int prev_state, int prev_index,
+		int block)
+{
+	struct arrival *a = slot(p, state, pos);
+	int count = a[0].count, i, j;
+
+	for (i = 0; i < count; i++) {
+		if (a[i].offset != offset)
+			continue;
+		if (a[i].cost <= cost)
+			return;
+		/* Cheaper way to the same offset: drop the old one */
+		memmove(&a[i], &a[i + 1], (count - i - 1) * sizeof(*a));
+		count--;
+		break;
+	}
+	for (i = 0; i < count && a[i].cost <= cost; i++)
+		;
+	if (i == ARRIVALS)
+		return;
+	if (count == ARRIVALS)
+		count--;
+	for (j = count; j > i; j--)
+		a[j] = a[j - 1];
+	a[i].cost = cost;
+	a[i].from = from;
+	a[i].offset = offset;
+	a[i].prev_state = prev_state;
+	a[i].prev_index = prev_index;
+	a[i].block = block;
+	a[0].count = count + 1;
+}
+
+static size_t match_len(struct parser *p, size_t pos, uint32_t offset)
+{
+	const uint8_t *a = p->in + pos, *b = a - offset;
+	size_t max = p->len - pos, n = 0;
+
+	if (max > MAX_COMPARE)
+		max = MAX_COMPARE;
+	while (n < max && a[n] == b[n])
+		n++;
+	return n;
+}
+
+static void literals(struct parser *p, size_t pos)
+{
+	struct arrival *a;
+	size_t k;
+	int n;
+
+	/* Start a run after a match, or at the very beginning */
+	for (k = 1; k <= LIT_WINDOW && k <= pos; k++) {
+		size_t from = pos - k;
+
+		a = slot(p, MATCH, from);
+		for (n = 0; n < a[0].count; n++) {
+			/* The first block has no type bit */
+			uint32_t cost = a[n].cost + (from ? 1 : 0) +
+				elias_bits(k) + 8 * k;
+			arrive(p, LIT, pos, cost, from, a[n].offset, MATCH, n,
+					BLOCK_LITERAL);
+		}
+	}
+
+	/* Or make a run one longer */
+	a = slot(p, LIT, pos - 1);
+	for (n = 0; n < a[0].count; n++) {
+		uint32_t run = pos - 1 - a[n].from;
+
+		if (run + 1 > MAX_LEN)
+			continue;
+		arrive(p, LIT, pos, a[n].cost - elias_bits(run) +
+				elias_bits(run + 1) + 8, a[n].from, a[n].offset,
+				a[n].prev_state, a[n].prev_index, BLOCK_LITERAL);
+	}
+}
+
+static void try_lengths(struct parser *p, size_t pos, size_t shortest,
+		size_t longest, uint32_t base, uint32_t offset, int prev_state,
+		int prev_index, int block)
+{
+	size_t l;
+
+	for (l = shortest; l <= longest; l++) {
+		uint32_t cost;
+
+		if (l > shortest + MATCH_STEPS && l != longest)
+			l = longest;
+		if (block == BLOCK_REPEAT)
+			cost = base + 1 + elias_bits(l);
+		else	/* First length bit shares the offset byte */
+			cost = base + 1 + elias_bits((offset - 1) / 128 + 1) +
+				8 + elias_bits(l - 1) - 1;
+		arrive(p, MATCH, pos + l, cost, pos, offset, prev_state,
+				prev_index, block);
+	}
+}
+
+static void matches(struct parser *p, size_t pos)
+{
+	struct arrival *lit = slot(p, LIT, pos), *match = slot(p, MATCH, pos);
+	struct arrival *best = NULL;
+	int best_state = LIT, best_index = 0, n, depth;
+	size_t longest = 1, len;
+	int32_t cand;
+
+	/* Repeat the offset of a literal run's predecessor */
+	for (n = 0; n < lit[0].count; n++) {
+		if (lit[n].offset > pos)
+			continue;
+		len = match_len(p, pos, lit[n].offset);
+		if (len)
+			try_lengths(p, pos, 1, len, lit[n].cost, lit[n].offset,
+					LIT, n, BLOCK_REPEAT);
+	}
+
+	/* A new offset costs the same from any arrival, take the cheapest */
+	if (lit[0].count)
+		best = &lit[0];
+	if (match[0].count && (!best || match[0].cost < best->cost)) {
+		best = &match[0];
+		best_state = MATCH;
+	}
+	if (!best || pos + 2 > p->len)
+		return;
+
+	for (cand = p->chain[pos], depth = 0; cand >= 0 && depth < CHAIN_DEPTH;
+			cand = p->chain[cand], depth++) {
+		uint32_t offset = pos - cand;
+
+		if (offset > MAX_OFFSET)
+			break;
+		len = match_len(p, pos, offset);
+		if (len <= longest)
+			continue;
+		/* Shorter lengths are cheaper at a closer offset */
+		try_lengths(p, pos, longest + 1 > 2 ? longest + 1 : 2, len,
+				best->cost, offset, best_state, best_index,
+				BLOCK_NEW);
+		longest = len;
+		if (len == MAX_COMPARE || pos + len == p->len)
+			break;
+	}
+}
+
+/* Link every position to the previous one starting with the same pair */
+static void hash_chains(struct parser *p)
+{
+	size_t i;
+
+	for (i = 0; i < 65536; i++)
+		p->head[i] = -1;
+	for (i = 0; i + 1 < p->len; i++) {
+		unsigned h = p->in[i] << 8 | p->in[i + 1];
+
+		p->chain[i] = p->head[h];
+		p->head[h] = i;
+	}
+	if (p->len)
+		p->chain[p->len - 1] = -1;
+}
+
+struct bitwriter {
+	uint8_t *out;
+	size_t pos, bitpos;
+	int mask, backtrack;
+};
+
+static void put_byte(struct bitwriter *w, uint8_t value)
+{
+	w->out[w->pos++] = value;
+}
+
+static void put_bit(struct bitwriter *w, int bit)
+{
+	if (w->backtrack) {
+		/* Goes into bit 0 of the offset byte just written */
+		if (bit)
+			w->out[w->pos - 1] |= 1;
+		w->backtrack = 0;
+		return;
+	}
+	if (w->mask == 0) {
+		w->mask = 0x80;
+		w->bitpos = w->pos;
+		put_byte(w, 0);
+	}
+	if (bit)
+		w->out[w->bitpos] |= w->mask;
+	w->mask >>= 1;
+}
+
+/* Interlaced Elias gamma: a 0 before each data bit, then a closing 1 */
+static void put_elias(struct bitwriter *w, uint32_t value, int invert)
+{
+	uint32_t bit = 1;
+
+	while (bit <= value >> 1)
+		bit <<= 1;
+	while (bit >>= 1) {
+		put_bit(w, 0);
+		put_bit(w, invert ? !(value & bit) : !!(value & bit));
+	}
+	put_bit(w, 1);
+}
+
+struct block {
+	uint32_t from, len, offset;
+	int type;
+};
+
+static size_t emit(struct parser *p, struct block *blocks, size_t count,
+		uint8_t *out)
+{
+	struct bitwriter w = { out, 0, 0, 0, 0 };
+	size_t i, j;
+
+	for (i = 0; i < count; i++) {
+		struct block *b = &blocks[i];
+
+		switch (b->type) {
+		case BLOCK_LITERAL:
+			if (i)
+				put_bit(&w, 0);
+			put_elias(&w, b->len, 0);
+			for (j = 0; j < b->len; j++)
+				put_byte(&w, p->in[b->from + j]);
+			break;
+		case BLOCK_REPEAT:
+			put_bit(&w, 0);
+			put_elias(&w, b->len, 0);
+			break;
+		case BLOCK_NEW:
+			put_bit(&w, 1);
+			put_elias(&w, (b->offset - 1) / 128 + 1, 1);
+			put_byte(&w, (127 - (b->offset - 1) % 128) << 1);
+			w.backtrack = 1;
+			put_elias(&w, b->len - 1, 0);
+			break;
+		}
+	}
+	/* End marker: an offset MSB which does not fit a byte */
+	put_bit(&w, 1);
+	put_elias(&w, 256, 1);
+	return w.pos;
+}
+
+static size_t compress(const uint8_t *in, size_t len, uint8_t *out)
+{
+	struct parser p = { in, len, { NULL, NULL }, NULL, NULL };
+	struct block *blocks = NULL;
+	size_t pos, count = 0, outlen = 0;
+	int state = LIT, index = 0;
+	struct arrival *a;
+
+	p.arr[LIT] = calloc((len + 1) * ARRIVALS, sizeof(struct arrival));
+	p.arr[MATCH] = calloc((len + 1) * ARRIVALS, sizeof(struct arrival));
+	p.head = malloc(65536 * sizeof(int32_t));
+	p.chain = malloc((len + 1) * sizeof(int32_t));
+	blocks = malloc((len + 1) * sizeof(struct block));
+	if (!p.arr[LIT] || !p.arr[MATCH] || !p.head || !p.chain || !blocks)
+		goto out;
+
+	hash_chains(&p);
+
+	/* Start as if after a match with the initial offset of 1 */
+	arrive(&p, MATCH, 0, 0, 0, 1, MATCH, 0, BLOCK_NEW);
+	for (pos = 1; pos <= len; pos++) {
+		literals(&p, pos);
+		if (pos < len)
+			matches(&p, pos);
+	}
+
+	/* Cheapest arrival at the end, then walk back */
+	a = slot(&p, LIT, len);
+	if (slot(&p, MATCH, len)[0].count &&
+	    slot(&p, MATCH, len)[0].cost < a[0].cost) {
+		a = slot(&p, MATCH, len);
+		state = MATCH;
+	}
+	pos = len;
+	while (pos > 0) {
+		struct arrival *cur = &slot(&p, state, pos)[index];
+
+		blocks[count].from = cur->from;
+		blocks[count].len = pos - cur->from;
+		blocks[count].offset = cur->offset;
+		blocks[count].type = cur->block;
+		count++;
+		pos = cur->from;
+		state = cur->prev_state;
+		index = cur->prev_index;
+	}
+	for (pos = 0; pos < count / 2; pos++) {
+		struct block t = blocks[pos];
+		blocks[pos] = blocks[count - 1 - pos];
+		blocks[count - 1 - pos] = t;
+	}
+	outlen = emit(&p, blocks, count, out);
+out:
+	free(blocks);
+	free(p.chain);
+	free(p.head);
+	free(p.arr[MATCH]);
+	free(p.arr[LIT]);
+	return outlen;
+}
+
+struct bitreader {
+	const uint8_t *in;
+	size_t pos, len;
+	int mask, byte;
+	struct zx0pack_stats *st;
+};
+
+static int get_bit(struct bitreader *r)
+{
+	if (r->mask == 0) {
+		if (r->pos >= r->len)
+			return -1;
+		r->byte = r->in[r->pos++];
+		r->mask = 0x80;
+		if (r->st)
+			r->st->bytes_refilled++;
+	}
+	if (r->st)
+		r->st->bits++;
+	int bit = !!(r->byte & r->mask);
+	r->mask >>= 1;
+	return bit;
+}
+
+/* Read an Elias gamma value whose first stop bit has been read already */
+static long get_elias(struct bitreader *r, int stop, int invert)
+{
+	long value = 1;
+	int bit;
+
+	if (stop < 0)
+		return -1;
+	if (r->st)
+		r->st->gammas++;
+	while (!stop) {
+		if ((bit = get_bit(r)) < 0)
+			return -1;
+		value = value << 1 | (invert ? !bit : bit);
+		if (value > 0x1000000 || (stop = get_bit(r)) < 0)
+			return -1;
+	}
+	return value;
+}
+
+long zx0pack_unpack(const uint8_t *in, size_t inlen, uint8_t *out,
+		size_t outlen)
+{
+	return zx0pack_unpack_stats(in, inlen, out, outlen, NULL);
+}
+
+long zx0pack_unpack_stats(const uint8_t *in, size_t inlen, uint8_t *out,
+		size_t outlen, struct zx0pack_stats *st)
+{
+	struct bitreader r = { in, 0, inlen, 0, 0, st };
+	size_t pos = 0, offset = 1;
+	long len, msb;
+	int bit;
+
+	for (;;) {
+		/* Literal run */
+		if ((len = get_elias(&r, get_bit(&r), 0)) < 0 ||
+		    pos + len > outlen || r.pos + len > inlen)
+			return -1;
+		memcpy(out + pos, in + r.pos, len);
+		if (st) {
+			st->literal_runs++;
+			st->literals += len;
+		}
+		pos += len;
+		r.pos += len;
+
+		if ((bit = get_bit(&r)) < 0)
+			return -1;
+		if (!bit) {
+			/* Match from the last offset */
+			if ((len = get_elias(&r, get_bit(&r), 0)) < 0 ||
+			    offset > pos || pos + len > outlen)
+				return -1;
+			if (st) {
+				st->repeats++;
+				st->matched += len;
+			}
+			for (; len; len--, pos++)
+				out[pos] = out[pos - offset];
+			if ((bit = get_bit(&r)) < 0)
+				return -1;
+			if (!bit)
+				continue;
+		}
+		for (;;) {
+			/* Match from a new offset */
+			if ((msb = get_elias(&r, get_bit(&r), 1)) < 0)
+				return -1;
+			if (msb == 256)
+				return pos;
+			if (msb > 256 || r.pos >= inlen)
+				return -1;
+			offset = msb * 128 - (in[r.pos] >> 1);
+			len = get_elias(&r, in[r.pos++] & 1, 0);
+			if (len < 0 || offset > pos || pos + len + 1 > outlen)
+				return -1;
+			if (st) {
+				st->new_offsets++;
+				st->matched += len + 1;
+			}
+			for (len++; len; len--, pos++)
+				out[pos] = out[pos - offset];
+			if ((bit = get_bit(&r)) < 0)
+				return -1;
+			if (!bit)
+				break;
+		}
+	}
+}
+
+static void put_be32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static uint32_t get_be32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+/* Check that a header and stream unpack to exactly the input */
+static int verify(const uint8_t *packed, size_t plen, const uint8_t *in,
+		size_t len)
+{
+	uint8_t *check;
+	long got;
+
+	if (plen < ZX0PACK_HDR_SIZE || memcmp(packed, "ZX0\001", 4) ||
+	    get_be32(packed + 4) != len ||
+	    get_be32(packed + 8) != plen - ZX0PACK_HDR_SIZE)
+		return -1;
+	check = malloc(len + 1);
+	if (!check)
+		return -1;
+	got = zx0pack_unpack(packed + ZX0PACK_HDR_SIZE,
+			plen - ZX0PACK_HDR_SIZE, check, len);
+	got = (got == (long)len && !memcmp(check, in, len)) ? 0 : -1;
+	free(check);
+	return got;
+}
+
+uint8_t *zx0pack_buffer(const uint8_t *in, size_t len, size_t *outlen)
+{
+	/* Worst case: all literals, a few bits of length per 64K run */
+	uint8_t *out = calloc(ZX0PACK_HDR_SIZE + len + len / 8 + 64, 1);
+	size_t clen;
+
+	/* ZX0 has no way to say "nothing" */
+	if (!out || !len) {
+		free(out);
+		return NULL;
+	}
+	clen = compress(in, len, out + ZX0PACK_HDR_SIZE);
+	if (!clen) {
+		free(out);
+		return NULL;
+	}
+	memcpy(out, "ZX0\001", 4);
+	put_be32(out + 4, len);
+	put_be32(out + 8, clen);
+	*outlen = ZX0PACK_HDR_SIZE + clen;
+	return out;
+}
+
+static uint8_t *read_file(const char *name, size_t *len)
+{
+	struct stat st;
+	uint8_t *buf;
+	int fd = open(name, O_RDONLY | O_BINARY);
+
+	if (fd == -1)
+		return NULL;
+	if (fstat(fd, &st) == -1 || !(buf = malloc(st.st_size + 1))) {
+		close(fd);
+		return NULL;
+	}
+	if (read(fd, buf, st.st_size) != st.st_size) {
+		free(buf);
+		close(fd);
+		return NULL;
+	}
+	close(fd);
+	*len = st.st_size;
+	return buf;
+}
+
+static int write_file(const char *name, const uint8_t *data, size_t len)
+{
+	char tmp[4096];
+	int fd;
+
+	/* Write under a temporary name so readers never see half a file */
+	snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", name, (long)getpid());
+	fd = open(tmp, O_CREAT | O_WRONLY | O_TRUNC | O_BINARY, 0644);
+	if (fd == -1)
+		return -1;
+	if (write(fd, data, len) != (ssize_t)len) {
+		close(fd);
+		unlink(tmp);
+		return -1;
+	}
+	close(fd);
+	if (rename(tmp, name)) {
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+/* FNV-1a, 64 bit. Hits are verified by unpacking, so this only has to spread */
+static uint64_t hash(const uint8_t *data, size_t len, uint64_t h)
+{
+	while (len--) {
+		h ^= *data++;
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+static void cache_name(char *buf, size_t size, const char *dir,
+		const uint8_t *in, size_t len)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	h = hash((const uint8_t *)ZX0PACK_FORMAT, strlen(ZX0PACK_FORMAT), h);
+	h = hash(in, len, h);
+	snprintf(buf, size, "%s/%016llx-%zu.zx0", dir, (unsigned long long)h,
+			len);
+}
+
+struct runner {
+	struct zx0pack_job *jobs;
+	int count, next;
+	const char *cachedir;
+	pthread_mutex_t lock;
+};
+
+static void run_job(struct zx0pack_job *job, const char *cachedir)
+{
+	char cached[4096];
+	uint8_t *in;
+	size_t len;
+
+	job->status = -1;
+	in = read_file(job->input, &len);
+	if (!in) {
+		fprintf(stderr, "%s: %s\n", job->input, strerror(errno));
+		return;
+	}
+	job->usize = len;
+
+	if (cachedir) {
+		cache_name(cached, sizeof(cached), cachedir, in, len);
+		job->data = read_file(cached, &job->len);
+		if (job->data && verify(job->data, job->len, in, len) == 0)
+			job->cached = 1;
+		else {
+			free(job->data);
+			job->data = NULL;
+		}
+	}
+
+	if (!job->data) {
+		job->data = zx0pack_buffer(in, len, &job->len);
+		if (!job->data || verify(job->data, job->len, in, len)) {
+			fprintf(stderr, "%s: packing failed\n", job->input);
+			free(in);
+			return;
+		}
+		if (cachedir && write_file(cached, job->data, job->len))
+			fprintf(stderr, "%s: could not write cache file\n",
+					cached);
+	}
+	free(in);
+
+	/*
+	 * Leave an identical output alone. All payloads are packed in one
+	 * run, so its timestamp must not change when only another one did.
+	 */
+	if (job->output) {
+		size_t olen;
+		uint8_t *old = read_file(job->output, &olen);
+		int same = old && olen == job->len &&
+			!memcmp(old, job->data, olen);
+
+		free(old);
+		if (same) {
+			job->status = 0;
+			return;
+		}
+	}
+
+	if (job->output && write_file(job->output, job->data, job->len)) {
+		fprintf(stderr, "%s: %s\n", job->output, strerror(errno));
+		return;
+	}
+	job->status = 0;
+}
+
+static void *worker(void *arg)
+{
+	struct runner *r = arg;
+	int i;
+
+	for (;;) {
+		pthread_mutex_lock(&r->lock);
+		i = r->next++;
+		pthread_mutex_unlock(&r->lock);
+		if (i >= r->count)
+			return NULL;
+		run_job(&r->jobs[i], r->cachedir);
+	}
+}
+
+int zx0pack_run(struct zx0pack_job *jobs, int count, int threads,
+		const char *cachedir)
+{
+	struct runner r = { jobs, count, 0, cachedir, PTHREAD_MUTEX_INITIALIZER };
+	pthread_t tid[64];
+	int i, started = 0;
+
+	if (!cachedir)
+		r.cachedir = cachedir = getenv(ZX0PACK_CACHE_ENV);
+	if (cachedir && *cachedir && mkdir(cachedir, 0755) && errno != EEXIST) {
+		fprintf(stderr, "%s: %s, not caching\n", cachedir,
+				strerror(errno));
+		r.cachedir = NULL;
+	}
+	if (cachedir && !*cachedir)
+		r.cachedir = NULL;
+
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads > count)
+		threads = count;
+	if (threads > (int)(sizeof(tid) / sizeof(tid[0])))
+		threads = sizeof(tid) / sizeof(tid[0]);
+
+	/* The calling thread works too, so one job needs no thread at all */
+	for (i = 1; i < threads; i++)
+		if (pthread_create(&tid[started], NULL, worker, &r) == 0)
+			started++;
+	worker(&r);
+	for (i = 0; i < started; i++)
+		pthread_join(tid[i], NULL);
+
+	for (i = 0; i < count; i++)
+		if (jobs[i].status)
+			return -1;
+	return 0;
+}
@@ -0,0 +1,89 @@
+/* A4091 ROM payload packer
+ *
+ * Copyright 2026 Stefan Reinauer
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef ZX0PACK_H
+#define ZX0PACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Host side ZX0 packer for ROM payloads. Output is a ZX0 (v2) stream
+ * behind the 12 byte header reloc.S expects, the same as util/zx0wrap
+ * writes:
+ *
+ *   00 "ZX0" magic, 01 version
+ *   04 uncompressed size (big endian)
+ *   08 compressed size (big endian)
+ *   0C compressed data
+ *
+ * Results are cached by a hash of the input and packer settings, so
+ * unchanged payloads are not packed again.
+ */
+
+#define ZX0PACK_HDR_SIZE   12
+#define ZX0PACK_CACHE_ENV  "ZX0PACK_CACHE"
+
+struct zx0pack_job {
+	const char *input;      /* File to pack */
+	const char *output;     /* Where to write the result, or NULL */
+	uint8_t *data;          /* Header and stream, malloc'ed */
+	size_t len;             /* Size of data */
+	size_t usize;           /* Size of the input */
+	int cached;             /* Result came from the cache */
+	int status;             /* 0 on success */
+};
+
+/*
+ * Pack one buffer. Returns a malloc'ed header and stream and its length
+ * in *outlen, or NULL if out of memory.
+ */
+uint8_t *zx0pack_buffer(const uint8_t *in, size_t len, size_t *outlen);
+
+/* What a stream made the depacker do, for estimating its run time */
+struct zx0pack_stats {
+	uint64_t literal_runs, literals;
+	uint64_t repeats, new_offsets, matched;
+	uint64_t gammas, bits, bytes_refilled;
+};
+
+/* Decode a stream (without header). Returns the output size, or -1. */
+long zx0pack_unpack(const uint8_t *in, size_t inlen, uint8_t *out,
+		size_t outlen);
+long zx0pack_unpack_stats(const uint8_t *in, size_t inlen, uint8_t *out,
+		size_t outlen, struct zx0pack_stats *st);
+
+/*
+ * Run the jobs on up to threads threads (0: one per CPU), using the
+ * cache in cachedir (NULL: $ZX0PACK_CACHE, if set). Returns 0 if all
+ * jobs succeeded.
+ */
+int zx0pack_run(struct zx0pack_job *jobs, int count, int threads,
+		const char *cachedir);
+
+#endif
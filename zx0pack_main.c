@@ -0,0 +1,117 @@
+/* A4091 ROM payload packer
+ *
+ * Copyright 2026 Stefan Reinauer
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "zx0pack.h"
+
+#define ZX0PACK_VERSION "v1.0 (2026-10-19)"
+
+static void print_usage(const char *name)
+{
+	printf("Usage: %s [-jcqvh] <input> <output> [<input> <output> ...]\n",
+			name);
+	printf("\n"
+	       "   -j | --jobs <n>                       pack on n threads (default: one per CPU)\n"
+	       "   -c | --cache <dir>                    reuse results from dir (default: $%s)\n"
+	       "   -q | --quiet                          only report errors\n"
+	       "   -v | --version:                       print the version\n"
+	       "   -h | --help:                          print this help\n\n",
+	       ZX0PACK_CACHE_ENV);
+}
+
+int main(int argc, char *argv[])
+{
+	struct zx0pack_job *jobs;
+	const char *cachedir = NULL;
+	int opt, i, count, threads = 0, quiet = 0, ret;
+	static const struct option long_options[] = {
+		{"jobs", 1, NULL, 'j'},
+		{"cache", 1, NULL, 'c'},
+		{"quiet", 0, NULL, 'q'},
+		{"version", 0, NULL, 'v'},
+		{"help", 0, NULL, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	while ((opt = getopt_long(argc, argv, "j:c:qvh?", long_options,
+					NULL)) != EOF) {
+		switch (opt) {
+		case 'j':
+			threads = atoi(optarg);
+			break;
+		case 'c':
+			cachedir = optarg;
+			break;
+		case 'q':
+			quiet = 1;
+			break;
+		case 'v':
+			printf("zx0pack %s -- ", ZX0PACK_VERSION);
+			printf("Copyright (C) 2026 Stefan Reinauer.\n\n");
+			exit(EXIT_SUCCESS);
+		case 'h':
+		case '?':
+		default:
+			print_usage(argv[0]);
+			exit(EXIT_SUCCESS);
+		}
+	}
+
+	count = (argc - optind) / 2;
+	if (count == 0 || (argc - optind) % 2) {
+		fprintf(stderr, "Specify pairs of input and output files.\n\n");
+		fprintf(stderr, "run '%s -h' for usage\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	jobs = calloc(count, sizeof(*jobs));
+	if (!jobs) {
+		printf("Out of memory.\n");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < count; i++) {
+		jobs[i].input = argv[optind + 2 * i];
+		jobs[i].output = argv[optind + 2 * i + 1];
+	}
+
+	ret = zx0pack_run(jobs, count, threads, cachedir);
+
+	for (i = 0; i < count; i++) {
+		if (!quiet && jobs[i].status == 0)
+			printf("%s (%zu) -> %s (%zu)%s\n", jobs[i].input,
+				jobs[i].usize, jobs[i].output,
+				jobs[i].len - ZX0PACK_HDR_SIZE,
+				jobs[i].cached ? " cached" : "");
+		free(jobs[i].data);
+	}
+	free(jobs);
+	return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}